@@ -8,7 +8,8 @@
 //   CPU:    PC (8B) + FCSR (4B) + pad (4B) + int regs x0-x31 (256B) + FP regs f0-f31 (256B)
 //   Memory: mmap_address (8B) + brk_base (8B) + brk_current (8B)
 //   Exec:   exec_base..original_stack_top + heap_start + heap_size + brk_overridden + dynamic (112B)
-//   Sched:  g_sched raw bytes + g_next_pid (4B) + g_next_epoll_fd (4B)
+//   Sched:  [len:u32, ThreadScheduler::save() bytes] + g_next_pid (4B)
+//   Fds:    fd table [count:u32, kind:u8 x count]
 //   Arena:  sparse chunks [guest_addr:u64, len:u64, data...]
 //           terminated by sentinel [addr=0xFFFFFFFFFFFFFFFF, len=0]
 
@@ -25,7 +26,7 @@ namespace checkpoint {
 using Machine = riscv::Machine<riscv::RISCV64>;
 
 static constexpr char MAGIC[8] = {'F','R','I','S','C','Y','C','K'};
-static constexpr uint32_t VERSION = 2;
+static constexpr uint32_t VERSION = 12;
 static constexpr uint64_t CHUNK_SIZE = 65536;  // 64KB sparse scan
 static constexpr uint64_t SENTINEL_ADDR = 0xFFFFFFFFFFFFFFFFULL;
 
@@ -130,31 +131,102 @@ inline std::vector<uint8_t> save_checkpoint(Machine& machine) {
     // Pad to 8-byte boundary (2 bytes used, need 6 more)
     for (int i = 0; i < 6; i++) emit_val<uint8_t>(out, 0);
 
+    // --- Guest clock (timed waits and timers hold its deadlines) ---
+    emit_val<uint64_t>(out, syscalls::guest_clock_ns());
+    emit_val<uint64_t>(out, syscalls::g_clock_offset);
+
     // --- Thread scheduler ---
-    // Write g_sched as raw bytes (ThreadScheduler is POD-like)
-    emit(out, &syscalls::g_sched, sizeof(syscalls::g_sched));
+    {
+        std::vector<uint8_t> sched;
+        syscalls::g_sched.save(sched);
+        emit_val<uint32_t>(out, static_cast<uint32_t>(sched.size()));
+        emit(out, sched.data(), sched.size());
+    }
     emit_val<int32_t>(out, static_cast<int32_t>(syscalls::g_next_pid));
-    emit_val<int32_t>(out, syscalls::g_next_epoll_fd);
+
+    // --- fd table ---
+    const auto& fd_slots = syscalls::g_fds.slots();
+    emit_val<uint32_t>(out, static_cast<uint32_t>(fd_slots.size()));
+    emit(out, fd_slots.data(), fd_slots.size());
 
     // --- Epoll instances ---
     emit_val<uint32_t>(out, static_cast<uint32_t>(syscalls::g_epoll_instances.size()));
     for (const auto& [epfd, inst] : syscalls::g_epoll_instances) {
+        // Descriptors dup'ed from one epoll_create1 share an id
         emit_val<int32_t>(out, epfd);
-        emit_val<uint32_t>(out, static_cast<uint32_t>(inst.interests.size()));
-        for (const auto& [fd, interest] : inst.interests) {
+        emit_val<uint32_t>(out, inst->id);
+        emit_val<uint32_t>(out, static_cast<uint32_t>(inst->interests.size()));
+        for (const auto& [fd, interest] : inst->interests) {
             emit_val<int32_t>(out, fd);
             emit_val<uint32_t>(out, interest.events);
             emit_val<uint64_t>(out, interest.data);
         }
     }
 
-    // --- Eventfd counters ---
-    emit_val<uint32_t>(out, static_cast<uint32_t>(syscalls::g_eventfd_counters.size()));
-    for (const auto& [fd, counter] : syscalls::g_eventfd_counters) {
+    // --- Eventfds ---
+    emit_val<uint32_t>(out, static_cast<uint32_t>(syscalls::g_eventfds.size()));
+    for (const auto& [fd, e] : syscalls::g_eventfds) {
+        // Descriptors dup'ed from one eventfd2 share an id
+        emit_val<int32_t>(out, fd);
+        emit_val<uint32_t>(out, e->id);
+        emit_val<uint64_t>(out, e->counter);
+    }
+
+    // --- timerfds ---
+    emit_val<uint32_t>(out, static_cast<uint32_t>(syscalls::g_timerfds.size()));
+    for (const auto& [fd, t] : syscalls::g_timerfds) {
+        // Descriptors dup'ed from one timerfd_create share an id
+        emit_val<int32_t>(out, fd);
+        emit_val<uint32_t>(out, t->id);
+        emit_val<uint8_t>(out, t->nonblock ? 1 : 0);
+        emit_val<uint8_t>(out, t->realtime ? 1 : 0);
+        emit_val<uint64_t>(out, t->deadline);
+        emit_val<uint64_t>(out, t->interval);
+        emit_val<uint64_t>(out, t->expirations);
+    }
+
+    // --- Pipe writes parked part-way ---
+    emit_val<uint32_t>(out, static_cast<uint32_t>(syscalls::g_pipe_writes.size()));
+    for (const auto& [tid, w] : syscalls::g_pipe_writes) {
+        emit_val<int32_t>(out, tid);
+        emit_val<int32_t>(out, w.fd);
+        emit_val<uint64_t>(out, w.addr);
+        emit_val<uint64_t>(out, w.len);
+        emit_val<uint64_t>(out, w.done);
+    }
+
+    // --- io_uring instances ---
+    // The rings are guest memory and travel with the arena; this is the
+    // state the kernel would hold
+    emit_val<uint32_t>(out, static_cast<uint32_t>(syscalls::g_io_urings.size()));
+    for (const auto& [fd, ring] : syscalls::g_io_urings) {
         emit_val<int32_t>(out, fd);
-        emit_val<uint64_t>(out, counter);
+        emit_val<uint32_t>(out, ring->id);
+        emit_val<uint32_t>(out, ring->sq_entries);
+        emit_val<uint32_t>(out, ring->cq_entries);
+        emit_val<uint64_t>(out, ring->rings);
+        emit_val<uint64_t>(out, ring->sqes);
+        emit_val<uint64_t>(out, ring->completions);
+        emit_val<uint32_t>(out, ring->carried);
+        emit_val<uint32_t>(out, static_cast<uint32_t>(ring->pending.size()));
+        for (const auto& chain : ring->pending) {
+            emit_val<uint32_t>(out, static_cast<uint32_t>(chain.size()));
+            for (const auto& op : chain) {
+                emit(out, &op.sqe, sizeof(op.sqe));
+                emit_val<uint64_t>(out, op.deadline_ns);
+                emit_val<uint64_t>(out, op.target);
+            }
+        }
+        emit_val<uint32_t>(out, static_cast<uint32_t>(ring->overflow.size()));
+        for (const auto& [user_data, res] : ring->overflow) {
+            emit_val<uint64_t>(out, user_data);
+            emit_val<int32_t>(out, res);
+        }
     }
 
+    // --- vDSO data page (its contents travel with the arena) ---
+    emit_val<uint64_t>(out, vdso::g_vdso_base);
+
     // --- Executable page list ---
     // Save page numbers that have exec permission (for dynamic libraries loaded via mmap+mprotect)
     std::vector<uint64_t> exec_pages;
@@ -293,41 +365,184 @@ inline void load_checkpoint(Machine& machine, const uint8_t* data, size_t size)
     // Skip padding
     for (int i = 0; i < 6; i++) r.read<uint8_t>();
 
+    // --- Guest clock ---
+    // Carries on from the saved reading, whatever this host's steady clock
+    // says; the wall clock is taken from the host again
+    {
+        uint64_t clock = r.read<uint64_t>();
+        syscalls::g_clock_offset = r.read<uint64_t>();
+        syscalls::g_clock_base = static_cast<int64_t>(clock - syscalls::g_clock_offset -
+                                                      syscalls::host_steady_ns());
+        syscalls::g_clock_epoch = INT64_MIN;
+    }
+
     // --- Thread scheduler ---
-    r.read_into(&syscalls::g_sched, sizeof(syscalls::g_sched));
+    {
+        uint32_t len = r.read<uint32_t>();
+        if (len > r.remaining()) throw std::runtime_error("checkpoint: unexpected EOF");
+        std::vector<uint8_t> sched(len);
+        r.read_into(sched.data(), sched.size());
+        syscalls::g_sched.load(sched.data(), sched.size());
+    }
     syscalls::g_next_pid = static_cast<pid_t>(r.read<int32_t>());
-    syscalls::g_next_epoll_fd = r.read<int32_t>();
+
+    // --- fd table ---
+    {
+        uint32_t num_fds = r.read<uint32_t>();
+        std::vector<syscalls::FdKind> fd_slots(num_fds);
+        r.read_into(fd_slots.data(), num_fds);
+        syscalls::g_fds.restore(std::move(fd_slots));
+    }
 
     // --- Epoll instances ---
+    // Interests are re-added once the eventfd counters are back, so the
+    // ready lists start from the restored state
+    struct SavedInterest { int32_t fd; uint32_t events; uint64_t data; };
+    std::vector<std::pair<std::shared_ptr<syscalls::EpollInstance>,
+                          std::vector<SavedInterest>>> saved_epoll;
     {
         uint32_t num_epoll = r.read<uint32_t>();
         syscalls::g_epoll_instances.clear();
+        syscalls::g_epoll_watchers.clear();
+        std::unordered_map<uint32_t, std::shared_ptr<syscalls::EpollInstance>> by_id;
         for (uint32_t i = 0; i < num_epoll; i++) {
             int32_t epfd = r.read<int32_t>();
+            uint32_t id = r.read<uint32_t>();
             uint32_t num_interests = r.read<uint32_t>();
-            auto& inst = syscalls::g_epoll_instances[epfd];
-            for (uint32_t j = 0; j < num_interests; j++) {
-                int32_t fd = r.read<int32_t>();
-                uint32_t events = r.read<uint32_t>();
-                uint64_t data = r.read<uint64_t>();
-                inst.interests[fd] = {events, data};
+            std::vector<SavedInterest> interests(num_interests);
+            for (auto& in : interests) {
+                in.fd = r.read<int32_t>();
+                in.events = r.read<uint32_t>();
+                in.data = r.read<uint64_t>();
             }
+            auto& inst = by_id[id];
+            if (!inst) {
+                inst = std::make_shared<syscalls::EpollInstance>();
+                inst->id = id;
+                saved_epoll.emplace_back(inst, std::move(interests));
+            }
+            syscalls::g_epoll_instances[epfd] = inst;
+            syscalls::g_next_epoll_id = std::max(syscalls::g_next_epoll_id, id + 1);
         }
         fprintf(stderr, "[checkpoint] Restored %u epoll instances\n", num_epoll);
     }
 
-    // --- Eventfd counters ---
+    // --- Eventfds ---
     {
         uint32_t num_eventfd = r.read<uint32_t>();
-        syscalls::g_eventfd_counters.clear();
+        syscalls::g_eventfds.clear();
+        std::unordered_map<uint32_t, std::shared_ptr<syscalls::EventFd>> by_id;
         for (uint32_t i = 0; i < num_eventfd; i++) {
             int32_t fd = r.read<int32_t>();
+            uint32_t id = r.read<uint32_t>();
             uint64_t counter = r.read<uint64_t>();
-            syscalls::g_eventfd_counters[fd] = counter;
+            auto& shared = by_id[id];
+            if (!shared) {
+                shared = std::make_shared<syscalls::EventFd>();
+                shared->id = id;
+                shared->counter = counter;
+            }
+            syscalls::g_eventfds[fd] = shared;
+            syscalls::g_next_eventfd_id = std::max(syscalls::g_next_eventfd_id, id + 1);
+        }
+        fprintf(stderr, "[checkpoint] Restored %u eventfds\n", num_eventfd);
+    }
+
+    // --- timerfds ---
+    {
+        uint32_t num_timerfds = r.read<uint32_t>();
+        for (const auto& [fd, t] : syscalls::g_timerfds) {
+            // Once per timer: dup'ed descriptors share it
+            if (t->deadline) syscalls::g_timers.cancel(t->timer);
+            t->deadline = 0;
+        }
+        syscalls::g_timerfds.clear();
+        std::unordered_map<uint32_t, std::shared_ptr<syscalls::TimerFd>> by_id;
+        for (uint32_t i = 0; i < num_timerfds; i++) {
+            int32_t fd = r.read<int32_t>();
+            auto t = std::make_shared<syscalls::TimerFd>();
+            t->id = r.read<uint32_t>();
+            t->nonblock = r.read<uint8_t>() != 0;
+            t->realtime = r.read<uint8_t>() != 0;
+            t->deadline = r.read<uint64_t>();
+            t->interval = r.read<uint64_t>();
+            t->expirations = r.read<uint64_t>();
+            auto& shared = by_id[t->id];
+            if (!shared) {
+                shared = std::move(t);
+                if (shared->deadline)
+                    shared->timer = syscalls::g_timers.add(shared->deadline,
+                                                           syscalls::TIMERFD_OWNER | shared->id);
+            }
+            syscalls::g_timerfds[fd] = shared;
+            syscalls::g_next_timerfd_id = std::max(syscalls::g_next_timerfd_id, shared->id + 1);
+        }
+        fprintf(stderr, "[checkpoint] Restored %u timerfds\n", num_timerfds);
+    }
+
+    // --- Pipe writes parked part-way ---
+    {
+        uint32_t num_writes = r.read<uint32_t>();
+        syscalls::g_pipe_writes.clear();
+        for (uint32_t i = 0; i < num_writes; i++) {
+            int32_t tid = r.read<int32_t>();
+            syscalls::PipeWrite w;
+            w.fd = r.read<int32_t>();
+            w.addr = r.read<uint64_t>();
+            w.len = r.read<uint64_t>();
+            w.done = r.read<uint64_t>();
+            syscalls::g_pipe_writes[tid] = w;
+        }
+    }
+    for (auto& [inst, interests] : saved_epoll) {
+        for (const auto& in : interests) {
+            syscalls::epoll_add(machine, *inst, in.fd, in.events, in.data);
+        }
+    }
+
+    // --- io_uring instances ---
+    {
+        uint32_t num_rings = r.read<uint32_t>();
+        syscalls::g_io_urings.clear();
+        std::unordered_map<uint32_t, std::shared_ptr<syscalls::IoUring>> by_id;
+        for (uint32_t i = 0; i < num_rings; i++) {
+            int32_t fd = r.read<int32_t>();
+            auto ring = std::make_shared<syscalls::IoUring>();
+            ring->id = r.read<uint32_t>();
+            ring->sq_entries = r.read<uint32_t>();
+            ring->cq_entries = r.read<uint32_t>();
+            ring->rings = r.read<uint64_t>();
+            ring->sqes = r.read<uint64_t>();
+            ring->completions = r.read<uint64_t>();
+            ring->carried = r.read<uint32_t>();
+            uint32_t num_chains = r.read<uint32_t>();
+            for (uint32_t c = 0; c < num_chains; c++) {
+                syscalls::IoUringChain chain(r.read<uint32_t>());
+                for (auto& op : chain) {
+                    r.read_into(&op.sqe, sizeof(op.sqe));
+                    op.deadline_ns = r.read<uint64_t>();
+                    op.target = r.read<uint64_t>();
+                }
+                ring->pending.push_back(std::move(chain));
+            }
+            uint32_t num_overflow = r.read<uint32_t>();
+            for (uint32_t o = 0; o < num_overflow; o++) {
+                uint64_t user_data = r.read<uint64_t>();
+                int32_t res = r.read<int32_t>();
+                ring->overflow.emplace_back(user_data, res);
+            }
+            // Descriptors dup'ed from one io_uring_setup share an id
+            auto& shared = by_id[ring->id];
+            if (!shared) shared = std::move(ring);
+            syscalls::g_io_urings[fd] = shared;
+            syscalls::g_next_io_uring_id = std::max(syscalls::g_next_io_uring_id, shared->id + 1);
         }
-        fprintf(stderr, "[checkpoint] Restored %u eventfd counters\n", num_eventfd);
+        fprintf(stderr, "[checkpoint] Restored %u io_uring fds\n", num_rings);
     }
 
+    // --- vDSO data page ---
+    uint64_t vdso_base = r.read<uint64_t>();
+
     // --- Executable page list ---
     uint64_t num_exec_pages = r.read<uint64_t>();
     std::vector<uint64_t> exec_pages(num_exec_pages);
@@ -404,6 +619,12 @@ inline void load_checkpoint(Machine& machine, const uint8_t* data, size_t size)
     syscalls::g_exec_ctx.brk_overridden = brk_overridden != 0;
     syscalls::g_exec_ctx.dynamic = dynamic != 0;
 
+    // The saved clock base is from the old host's steady clock
+    vdso::attach(machine, vdso_base);
+    syscalls::vdso_refresh(machine);
+    // Copies restored from one checkpoint must not share a keystream
+    syscalls::g_entropy.reseed();
+
     // --- Set stdin-wait flag so the main loop knows we're restored ---
     syscalls::g_waiting_for_stdin = true;
 
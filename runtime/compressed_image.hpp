@@ -0,0 +1,424 @@
+// compressed_image.hpp - Streaming .tar.gz / .tar.zst rootfs images
+//
+// A compressed rootfs is decompressed exactly once at startup, front to back,
+// and only its tar headers are kept: VirtualFS::load_tar builds the tree while
+// this scanner records restart points every SPAN bytes of output. Regular
+// files are bound lazily (FileData::assign_lazy); the first time the guest
+// opens or mmaps one, its bytes are decompressed again from the nearest
+// restart point. Cold start memory is the compressed image plus the restart
+// index, not the uncompressed archive.
+//
+//   gzip: restart points are deflate block boundaries carrying the 32 KiB
+//         history window (the zran technique), so any gzip works.
+//   zstd: restart points are frame boundaries. Single-frame archives still
+//         load, but every fetch decompresses from the start of the frame;
+//         produce images with independent frames (zstd --seekable, pzstd,
+//         or zstd -T0 --block-size) for cheap random access.
+//
+// Both codecs keep a live decoding cursor, so files opened in archive order
+// (the common case for a directory walk) never restart.
+//
+// Availability is decided at build time: FRISCY_HAVE_ZLIB / FRISCY_HAVE_ZSTD
+// are set by CMakeLists.txt when the libraries are found.
+
+#pragma once
+
+#include "vfs.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef FRISCY_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef FRISCY_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace vfs {
+
+enum class ImageFormat { Tar, Gzip, Zstd };
+
+inline ImageFormat detect_image_format(const ImageBuffer& image) {
+    const uint8_t* p = image.data();
+    if (image.size() >= 2 && p[0] == 0x1f && p[1] == 0x8b) return ImageFormat::Gzip;
+    if (image.size() >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+        return ImageFormat::Zstd;
+    return ImageFormat::Tar;
+}
+
+// Distance (uncompressed bytes) between restart points
+static constexpr uint64_t COMPRESSED_IMAGE_SPAN = 1ULL << 20;
+
+// Shared pull logic for the decompressing scan pass: decoded bytes land in
+// buf_[rd_, wr_) and produce() refills the buffer once it is drained.
+class StreamScanner : public TarReader {
+public:
+    bool read(uint8_t* out, size_t len) override { return pull(out, len); }
+    bool skip(uint64_t len) override { return pull(nullptr, len); }
+    uint64_t tell() const override { return consumed_; }
+
+protected:
+    virtual bool produce() = 0;
+
+    bool pull(uint8_t* out, uint64_t len) {
+        while (len > 0) {
+            if (rd_ == wr_) {
+                if (!produce()) return false;
+                continue;
+            }
+            size_t n = (size_t)std::min<uint64_t>(len, wr_ - rd_);
+            if (out) {
+                memcpy(out, buf_ + rd_, n);
+                out += n;
+            }
+            rd_ += n;
+            len -= n;
+            consumed_ += n;
+        }
+        return true;
+    }
+
+    uint8_t* buf_ = nullptr;
+    size_t rd_ = 0;
+    size_t wr_ = 0;
+    uint64_t consumed_ = 0;
+};
+
+#ifdef FRISCY_HAVE_ZLIB
+
+class GzipImage : public ContentSource,
+                  public std::enable_shared_from_this<GzipImage> {
+public:
+    static constexpr size_t WINDOW = 32768;
+
+    explicit GzipImage(std::shared_ptr<const ImageBuffer> image)
+        : image_(std::move(image)) {}
+
+    ~GzipImage() override {
+        if (cursor_live_) inflateEnd(&cursor_);
+    }
+
+    // Scan pass: feeds load_tar and records restart points
+    class Scanner : public StreamScanner {
+    public:
+        explicit Scanner(std::shared_ptr<GzipImage> owner) : owner_(std::move(owner)) {
+            buf_ = window_;
+            ok_ = inflateInit2(&strm_, 47) == Z_OK;  // gzip or zlib header
+            strm_.next_out = window_;
+            strm_.avail_out = WINDOW;
+        }
+        ~Scanner() override { if (ok_) inflateEnd(&strm_); }
+
+        bool bind(FileData& content, uint64_t offset, uint64_t len) override {
+            content.assign_lazy(owner_, offset, len);
+            return true;
+        }
+
+    protected:
+        bool produce() override {
+            if (!ok_ || done_) return false;
+            const ImageBuffer& img = *owner_->image_;
+            if (strm_.avail_out == 0) {
+                strm_.next_out = window_;
+                strm_.avail_out = WINDOW;
+                rd_ = wr_ = 0;
+            }
+            if (strm_.avail_in == 0) {
+                size_t left = img.size() - in_pos_;
+                if (left == 0) { done_ = true; return false; }
+                strm_.next_in = const_cast<Bytef*>(img.data() + in_pos_);
+                strm_.avail_in = (uInt)std::min<size_t>(left, UINT_MAX);
+            }
+            uInt in_before = strm_.avail_in;
+            uInt out_before = strm_.avail_out;
+            int ret = inflate(&strm_, Z_BLOCK);
+            in_pos_ += in_before - strm_.avail_in;
+            total_out_ += out_before - strm_.avail_out;
+            wr_ = WINDOW - strm_.avail_out;
+
+            if (ret == Z_STREAM_END) {
+                // Concatenated gzip members continue with a fresh header
+                if (in_pos_ >= img.size()) done_ = true;
+                else inflateReset(&strm_);
+                return true;
+            }
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                fprintf(stderr, "[vfs] gzip rootfs: %s\n", strm_.msg ? strm_.msg : "inflate error");
+                done_ = true;
+                return wr_ > rd_;
+            }
+            if (in_before == strm_.avail_in && out_before == strm_.avail_out) {
+                done_ = true;  // no progress: truncated input
+                return false;
+            }
+            // At a block boundary (and not after the final block)?
+            if ((strm_.data_type & 128) && !(strm_.data_type & 64) &&
+                (owner_->points_.empty() || total_out_ - last_point_ >= COMPRESSED_IMAGE_SPAN)) {
+                add_point();
+            }
+            return true;
+        }
+
+    private:
+        void add_point() {
+            Point pt;
+            pt.out = total_out_;
+            pt.in = in_pos_;
+            pt.bits = strm_.data_type & 7;
+            pt.window.reset(new uint8_t[WINDOW]);
+            // The last WINDOW bytes of output, oldest first
+            size_t left = strm_.avail_out;
+            if (left) memcpy(pt.window.get(), window_ + WINDOW - left, left);
+            if (left < WINDOW) memcpy(pt.window.get() + left, window_, WINDOW - left);
+            owner_->points_.push_back(std::move(pt));
+            last_point_ = total_out_;
+        }
+
+        std::shared_ptr<GzipImage> owner_;
+        z_stream strm_{};
+        uint8_t window_[WINDOW] = {};
+        size_t in_pos_ = 0;
+        uint64_t total_out_ = 0;
+        uint64_t last_point_ = 0;
+        bool ok_ = false;
+        bool done_ = false;
+    };
+
+    bool fetch(uint64_t offset, uint8_t* out, size_t len) override {
+        if (points_.empty()) return false;
+        // Last restart point at or before offset
+        auto it = std::upper_bound(points_.begin(), points_.end(), offset,
+            [](uint64_t off, const Point& p) { return off < p.out; });
+        if (it == points_.begin()) return false;
+        const Point& pt = *std::prev(it);
+
+        // Reuse the live cursor when it is between the point and the target
+        if (!cursor_live_ || cursor_out_ > offset || cursor_out_ < pt.out) {
+            if (!restart(pt)) return false;
+        }
+        return advance(nullptr, offset - cursor_out_) && advance(out, len);
+    }
+
+private:
+    struct Point {
+        uint64_t out;    // uncompressed offset
+        size_t in;       // compressed offset of the first full byte
+        int bits;        // bits of the preceding byte still unconsumed
+        std::unique_ptr<uint8_t[]> window;
+    };
+
+    bool restart(const Point& pt) {
+        if (cursor_live_) inflateEnd(&cursor_);
+        cursor_ = z_stream{};
+        cursor_live_ = inflateInit2(&cursor_, -15) == Z_OK;  // raw deflate
+        if (!cursor_live_) return false;
+        cursor_in_ = pt.in;
+        if (pt.bits) {
+            int byte = image_->data()[pt.in - 1];
+            inflatePrime(&cursor_, pt.bits, byte >> (8 - pt.bits));
+        }
+        inflateSetDictionary(&cursor_, pt.window.get(), WINDOW);
+        cursor_out_ = pt.out;
+        return true;
+    }
+
+    // Decode len bytes into out (or discard them when out is null)
+    bool advance(uint8_t* out, uint64_t len) {
+        uint8_t scratch[16384];
+        while (len > 0) {
+            uInt want = (uInt)std::min<uint64_t>(len, out ? UINT_MAX : sizeof(scratch));
+            cursor_.next_out = out ? out : scratch;
+            cursor_.avail_out = want;
+            if (cursor_.avail_in == 0) {
+                size_t left = image_->size() - cursor_in_;
+                if (left == 0) return fail();
+                cursor_.next_in = const_cast<Bytef*>(image_->data() + cursor_in_);
+                cursor_.avail_in = (uInt)std::min<size_t>(left, UINT_MAX);
+            }
+            uInt in_before = cursor_.avail_in;
+            int ret = inflate(&cursor_, Z_NO_FLUSH);
+            cursor_in_ += in_before - cursor_.avail_in;
+            uInt got = want - cursor_.avail_out;
+            cursor_out_ += got;
+            len -= got;
+            if (out) out += got;
+
+            if (ret == Z_STREAM_END) {
+                // Skip the 8-byte gzip trailer and parse the next member
+                cursor_in_ += 8;
+                if (cursor_in_ >= image_->size()) return len == 0 ? true : fail();
+                cursor_.avail_in = 0;
+                if (inflateReset2(&cursor_, 31) != Z_OK) return fail();
+            } else if (ret != Z_OK && !(ret == Z_BUF_ERROR && got > 0)) {
+                return fail();
+            }
+        }
+        return true;
+    }
+
+    bool fail() {
+        if (cursor_live_) inflateEnd(&cursor_);
+        cursor_live_ = false;
+        return false;
+    }
+
+    std::shared_ptr<const ImageBuffer> image_;
+    std::vector<Point> points_;
+    z_stream cursor_{};
+    bool cursor_live_ = false;
+    size_t cursor_in_ = 0;
+    uint64_t cursor_out_ = 0;
+};
+
+#endif  // FRISCY_HAVE_ZLIB
+
+#ifdef FRISCY_HAVE_ZSTD
+
+class ZstdImage : public ContentSource,
+                  public std::enable_shared_from_this<ZstdImage> {
+public:
+    explicit ZstdImage(std::shared_ptr<const ImageBuffer> image)
+        : image_(std::move(image)) {}
+
+    ~ZstdImage() override {
+        if (cursor_) ZSTD_freeDStream(cursor_);
+    }
+
+    class Scanner : public StreamScanner {
+    public:
+        explicit Scanner(std::shared_ptr<ZstdImage> owner)
+            : owner_(std::move(owner)), out_(ZSTD_DStreamOutSize()) {
+            buf_ = out_.data();
+            ds_ = ZSTD_createDStream();
+            owner_->points_.push_back({0, 0});
+        }
+        ~Scanner() override { ZSTD_freeDStream(ds_); }
+
+        bool bind(FileData& content, uint64_t offset, uint64_t len) override {
+            content.assign_lazy(owner_, offset, len);
+            return true;
+        }
+
+    protected:
+        bool produce() override {
+            const ImageBuffer& img = *owner_->image_;
+            if (!ds_ || in_pos_ >= img.size()) return false;
+            ZSTD_inBuffer in{img.data(), img.size(), in_pos_};
+            ZSTD_outBuffer out{out_.data(), out_.size(), 0};
+            size_t ret = ZSTD_decompressStream(ds_, &out, &in);
+            if (ZSTD_isError(ret)) {
+                fprintf(stderr, "[vfs] zstd rootfs: %s\n", ZSTD_getErrorName(ret));
+                in_pos_ = img.size();
+                rd_ = 0;
+                wr_ = out.pos;
+                return out.pos > 0;
+            }
+            if (out.pos == 0 && in.pos == in_pos_) return false;  // truncated
+            in_pos_ = in.pos;
+            total_out_ += out.pos;
+            rd_ = 0;
+            wr_ = out.pos;
+            // A frame just ended: the next one is an independent restart point
+            if (ret == 0 && in_pos_ < img.size() &&
+                total_out_ - owner_->points_.back().out >= COMPRESSED_IMAGE_SPAN) {
+                owner_->points_.push_back({total_out_, in_pos_});
+            }
+            return true;
+        }
+
+    private:
+        std::shared_ptr<ZstdImage> owner_;
+        ZSTD_DStream* ds_ = nullptr;
+        std::vector<uint8_t> out_;
+        size_t in_pos_ = 0;
+        uint64_t total_out_ = 0;
+    };
+
+    bool fetch(uint64_t offset, uint8_t* out, size_t len) override {
+        auto it = std::upper_bound(points_.begin(), points_.end(), offset,
+            [](uint64_t off, const Point& p) { return off < p.out; });
+        if (it == points_.begin()) return false;
+        const Point& pt = *std::prev(it);
+
+        if (!cursor_ || cursor_out_ > offset || cursor_out_ < pt.out) {
+            if (!cursor_) cursor_ = ZSTD_createDStream();
+            if (!cursor_) return false;
+            ZSTD_DCtx_reset(cursor_, ZSTD_reset_session_only);
+            cursor_in_ = pt.in;
+            cursor_out_ = pt.out;
+        }
+        return advance(nullptr, offset - cursor_out_) && advance(out, len);
+    }
+
+private:
+    struct Point {
+        uint64_t out;
+        size_t in;
+    };
+
+    bool advance(uint8_t* out, uint64_t len) {
+        uint8_t scratch[16384];
+        while (len > 0) {
+            size_t want = (size_t)std::min<uint64_t>(len, out ? SIZE_MAX : sizeof(scratch));
+            ZSTD_inBuffer in{image_->data(), image_->size(), cursor_in_};
+            ZSTD_outBuffer ob{out ? out : scratch, want, 0};
+            size_t ret = ZSTD_decompressStream(cursor_, &ob, &in);
+            if (ZSTD_isError(ret) || (ob.pos == 0 && in.pos == cursor_in_)) {
+                ZSTD_DCtx_reset(cursor_, ZSTD_reset_session_only);
+                cursor_out_ = UINT64_MAX;  // force a restart next time
+                return false;
+            }
+            cursor_in_ = in.pos;
+            cursor_out_ += ob.pos;
+            len -= ob.pos;
+            if (out) out += ob.pos;
+        }
+        return true;
+    }
+
+    std::shared_ptr<const ImageBuffer> image_;
+    std::vector<Point> points_;
+    ZSTD_DStream* cursor_ = nullptr;
+    size_t cursor_in_ = 0;
+    uint64_t cursor_out_ = 0;
+};
+
+#endif  // FRISCY_HAVE_ZSTD
+
+// Load a rootfs image of any supported format into fs. Plain tars borrow
+// from the image; compressed ones are scanned once and fetched lazily.
+inline bool load_image(VirtualFS& fs, std::shared_ptr<const ImageBuffer> image,
+                       std::string* error = nullptr) {
+    if (!image) return false;
+    switch (detect_image_format(*image)) {
+    case ImageFormat::Tar:
+        return fs.load_tar(std::move(image));
+    case ImageFormat::Gzip: {
+#ifdef FRISCY_HAVE_ZLIB
+        auto gz = std::make_shared<GzipImage>(std::move(image));
+        GzipImage::Scanner scanner(gz);
+        return fs.load_tar(scanner);
+#else
+        if (error) *error = "gzip rootfs images need a build with zlib";
+        return false;
+#endif
+    }
+    case ImageFormat::Zstd: {
+#ifdef FRISCY_HAVE_ZSTD
+        auto zs = std::make_shared<ZstdImage>(std::move(image));
+        ZstdImage::Scanner scanner(zs);
+        return fs.load_tar(scanner);
+#else
+        if (error) *error = "zstd rootfs images need a build with libzstd";
+        return false;
+#endif
+    }
+    }
+    return false;
+}
+
+}  // namespace vfs
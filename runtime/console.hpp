@@ -0,0 +1,80 @@
+// console.hpp - Buffered sink for guest stdout/stderr
+//
+// Shells and Node issue a great many tiny writes to fds 1 and 2. Handing
+// each one to the host separately costs a JS call and a TextDecoder pass in
+// the browser (or a write(2) natively), so guest output is copied here
+// straight out of guest memory (see guest_span.hpp) and handed on in
+// batches: when the buffer fills, at a newline if the sink is line-buffered,
+// once pending output is older than FLUSH_NS (checked from the Wasm run
+// loop), and whenever the machine stops (stdin wait, exit, execve) or is
+// about to block on the host. Where the batch goes is set by main.cpp: the
+// terminal's stdout ring in the browser, the host's stdout natively.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace syscalls {
+
+class ConsoleSink {
+public:
+    static constexpr size_t CAPACITY = 16384;
+    static constexpr uint64_t FLUSH_NS = 10'000'000;  // 10ms
+
+    using Output = void (*)(const char* data, size_t len);
+
+    ConsoleSink() { buf_.reserve(CAPACITY); }
+    ~ConsoleSink() { flush(); }
+
+    void set_output(Output out) { out_ = out; }
+
+    // Flush at every newline (natively, when stdout is a terminal)
+    void set_line_buffered(bool on) { line_buffered_ = on; }
+
+    void write(const char* data, size_t len) {
+        if (len == 0) return;
+        if (buf_.size() + len > CAPACITY) flush();
+        if (len >= CAPACITY) {
+            out_(data, len);  // Too big to be worth buffering
+            return;
+        }
+        if (buf_.empty()) first_pending_ = now_ns();
+        buf_.insert(buf_.end(), data, data + len);
+        if (line_buffered_ && memchr(data, '\n', len)) flush();
+    }
+
+    void flush() {
+        if (buf_.empty()) return;
+        out_(buf_.data(), buf_.size());
+        buf_.clear();
+    }
+
+    // Periodic check from the run loop: flush output that has waited too long
+    void tick() {
+        if (!buf_.empty() && now_ns() - first_pending_ >= FLUSH_NS) flush();
+    }
+
+    bool empty() const { return buf_.empty(); }
+
+private:
+    std::vector<char> buf_;
+    uint64_t first_pending_ = 0;  // When the oldest buffered byte arrived
+    bool line_buffered_ = false;
+    Output out_ = [](const char* data, size_t len) {
+        fwrite(data, 1, len, stdout);
+        fflush(stdout);
+    };
+
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+inline ConsoleSink g_console;
+
+}  // namespace syscalls
@@ -91,6 +91,7 @@ constexpr uint64_t AT_BASE_PLATFORM = 24;
 constexpr uint64_t AT_RANDOM       = 25;
 constexpr uint64_t AT_HWCAP2       = 26;
 constexpr uint64_t AT_EXECFN       = 31;
+constexpr uint64_t AT_SYSINFO_EHDR = 33;
 
 // RISC-V hardware capabilities
 constexpr uint64_t RISCV_HWCAP_IMAFDC = 0x112D;  // I, M, A, F, D, C extensions
@@ -246,7 +247,8 @@ inline std::vector<std::pair<uint64_t, uint64_t>> build_auxv(
     const ElfInfo& interp_info,    // Interpreter info (if dynamic)
     uint64_t interp_base,          // Base address where interpreter was loaded
     uint64_t random_addr,          // Address of 16 random bytes
-    uint64_t execfn_addr           // Address of executable filename string
+    uint64_t execfn_addr,          // Address of executable filename string
+    uint64_t sysinfo_ehdr = 0      // Address of the vDSO image (0: none)
 ) {
     std::vector<std::pair<uint64_t, uint64_t>> auxv;
 
@@ -295,6 +297,9 @@ inline std::vector<std::pair<uint64_t, uint64_t>> build_auxv(
     // We'll need to allocate this on the stack too
     auxv.push_back({AT_PLATFORM, 0});  // Will be filled in by caller
 
+    // vDSO (see vdso.hpp)
+    if (sysinfo_ehdr) auxv.push_back({AT_SYSINFO_EHDR, sysinfo_ehdr});
+
     // Terminator
     auxv.push_back({AT_NULL, 0});
 
@@ -516,7 +521,8 @@ inline uint64_t setup_dynamic_stack(
     uint64_t interp_base,
     const std::vector<std::string>& args,
     const std::vector<std::string>& env,
-    uint64_t stack_top = 0x7fff0000
+    uint64_t stack_top = 0x7fff0000,
+    uint64_t sysinfo_ehdr = 0  // vDSO image from vdso::map(), 0 for none
 ) {
     uint64_t sp = stack_top;
 
@@ -613,6 +619,9 @@ inline uint64_t setup_dynamic_stack(
     // Platform string
     auxv.push_back({elf::AT_PLATFORM, platform_addr});
 
+    // vDSO (see vdso.hpp)
+    if (sysinfo_ehdr) auxv.push_back({elf::AT_SYSINFO_EHDR, sysinfo_ehdr});
+
     // Terminator
     auxv.push_back({elf::AT_NULL, 0});
 
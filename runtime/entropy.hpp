@@ -0,0 +1,129 @@
+// entropy.hpp - ChaCha20 keystream for getrandom and /dev/urandom
+//
+// TLS setup, UUID generation and V8's hash seeds pull a lot of randomness
+// during guest startup. getrandom, reads of /dev/urandom and /dev/random,
+// and the VectorHeart getrandom hypercall (705) all draw from this one
+// generator, filling the guest buffer in place (see guest_span.hpp).
+//
+// The generator is ChaCha20 (20 rounds, 64-bit block counter) keyed from the
+// host's entropy source (std::random_device: getrandom natively,
+// crypto.getRandomValues under Emscripten) on first use and again after a
+// checkpoint restore. LANES blocks are computed side by side in GCC/Clang
+// vector types, which lower to AVX2/NEON natively (-march=native) and to
+// simd128 in the Wasm build (-msimd128).
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+namespace syscalls {
+
+class ChaChaRng {
+public:
+    static constexpr size_t LANES = 8;
+    static constexpr size_t BLOCK = 64;
+    static constexpr size_t BATCH = BLOCK * LANES;
+
+    using Key = std::array<uint32_t, 8>;
+
+    // Fill dst with len bytes of keystream
+    void fill(void* dst, size_t len) {
+        if (!seeded_) reseed();
+        auto* out = static_cast<uint8_t*>(dst);
+        size_t take = std::min(len, avail_);
+        memcpy(out, buf_.data() + BATCH - avail_, take);
+        avail_ -= take;
+        out += take;
+        len -= take;
+        while (len >= BATCH) {
+            generate(out);
+            out += BATCH;
+            len -= BATCH;
+        }
+        if (len > 0) {
+            generate(buf_.data());
+            memcpy(out, buf_.data(), len);
+            avail_ = BATCH - len;
+        }
+    }
+
+    // Draw a fresh key from the host
+    void reseed() {
+        std::random_device rd;
+        Key key;
+        for (auto& word : key) word = rd();
+        seed(key);
+    }
+
+    void seed(const Key& key) {
+        key_ = key;
+        counter_ = 0;
+        avail_ = 0;
+        seeded_ = true;
+    }
+
+private:
+    using Vec = uint32_t __attribute__((vector_size(4 * LANES)));
+
+    // In place, so no vector crosses a call boundary (that would tie the
+    // ABI to the target's vector width)
+    static void rotl(Vec& v, int n) { v = (v << n) | (v >> (32 - n)); }
+
+    static void quarter(Vec& a, Vec& b, Vec& c, Vec& d) {
+        a += b; d ^= a; rotl(d, 16);
+        c += d; b ^= c; rotl(b, 12);
+        a += b; d ^= a; rotl(d, 8);
+        c += d; b ^= c; rotl(b, 7);
+    }
+
+    // Write the next LANES blocks of keystream to out
+    void generate(uint8_t* out) {
+        static constexpr uint32_t SIGMA[4] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+        Vec in[16];
+        for (int i = 0; i < 4; i++) in[i] = Vec{} + SIGMA[i];
+        for (int i = 0; i < 8; i++) in[4 + i] = Vec{} + key_[i];
+        for (size_t lane = 0; lane < LANES; lane++) {
+            uint64_t block = counter_ + lane;
+            in[12][lane] = static_cast<uint32_t>(block);
+            in[13][lane] = static_cast<uint32_t>(block >> 32);
+        }
+        in[14] = in[15] = Vec{};  // Nonce
+        counter_ += LANES;
+
+        Vec x[16];
+        std::copy(in, in + 16, x);
+        for (int round = 0; round < 10; round++) {
+            quarter(x[0], x[4], x[8], x[12]);
+            quarter(x[1], x[5], x[9], x[13]);
+            quarter(x[2], x[6], x[10], x[14]);
+            quarter(x[3], x[7], x[11], x[15]);
+            quarter(x[0], x[5], x[10], x[15]);
+            quarter(x[1], x[6], x[11], x[12]);
+            quarter(x[2], x[7], x[8], x[13]);
+            quarter(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i++) x[i] += in[i];
+
+        // Lane-major to block-major (hosts are little-endian, as is ChaCha)
+        for (size_t lane = 0; lane < LANES; lane++) {
+            for (int i = 0; i < 16; i++) {
+                uint32_t word = x[i][lane];
+                memcpy(out + lane * BLOCK + i * 4, &word, 4);
+            }
+        }
+    }
+
+    Key key_{};
+    uint64_t counter_ = 0;
+    bool seeded_ = false;
+    alignas(64) std::array<uint8_t, BATCH> buf_{};
+    size_t avail_ = 0;  // Unused keystream at the end of buf_
+};
+
+inline ChaChaRng g_entropy;
+
+}  // namespace syscalls
@@ -0,0 +1,125 @@
+// fd_table.hpp - The guest's file descriptor table
+//
+// One dense table numbers every descriptor the guest can hold: VFS files,
+// pipe ends, eventfds, timerfds, sockets, epoll and io_uring instances,
+// terminals and devices.
+// Each slot records what kind of object sits behind the number; syscalls.hpp
+// keeps one operations table per kind, so read/write/poll/close index by
+// kind instead of probing each subsystem in turn. The object itself stays
+// with its owner (VirtualFS handles, NetworkContext sockets, epoll sets),
+// keyed by the same number.
+//
+// Numbers follow Linux: a new descriptor takes the lowest free slot, and a
+// closed one is handed out again.
+
+#pragma once
+
+#include "vfs.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace syscalls {
+
+enum class FdKind : uint8_t {
+    Free,     // Not open
+    Stdin,    // Host terminal input
+    Stdout,   // Host terminal output (fds 1 and 2)
+    Tty,      // /dev/tty and friends opened through the VFS
+    File,     // VFS regular file or directory
+    Pipe,     // VFS pipe end
+    EventFd,
+    Null,     // /dev/null
+    Random,   // /dev/random, /dev/urandom
+    Socket,
+    Epoll,
+    Vh,       // VectorHeart/JSPI host file (Wasm), mapped to its JS handle
+    IoUring,
+    TimerFd,
+};
+inline constexpr size_t FD_KIND_COUNT = static_cast<size_t>(FdKind::TimerFd) + 1;
+
+class FdTable final : public vfs::FdAllocator {
+public:
+    static constexpr int MAX_FDS = 1024;  // Matches the RLIMIT_NOFILE we report
+
+    FdTable() { reset(); }
+
+    // Back to a fresh process: just the three standard descriptors
+    void reset() {
+        slots_.assign({FdKind::Stdin, FdKind::Stdout, FdKind::Stdout});
+        first_free_ = 3;
+    }
+
+    FdKind kind(int fd) const {
+        return fd >= 0 && static_cast<size_t>(fd) < slots_.size() ? slots_[fd] : FdKind::Free;
+    }
+
+    bool is_open(int fd) const { return kind(fd) != FdKind::Free; }
+
+    // Whether any descriptor of this kind is open
+    bool has(FdKind kind) const { return std::find(slots_.begin(), slots_.end(), kind) != slots_.end(); }
+
+    // Lowest free descriptor >= min_fd, or -EMFILE
+    int alloc(FdKind kind, int min_fd = 0) {
+        size_t fd = min_fd > 0 ? static_cast<size_t>(min_fd) : 0;
+        bool from_hint = fd <= first_free_;
+        if (from_hint) fd = first_free_;
+        while (fd < slots_.size() && slots_[fd] != FdKind::Free) fd++;
+        if (fd >= static_cast<size_t>(MAX_FDS)) return -24;  // EMFILE
+        if (fd >= slots_.size()) slots_.resize(fd + 1, FdKind::Free);
+        slots_[fd] = kind;
+        if (from_hint) first_free_ = fd + 1;
+        return static_cast<int>(fd);
+    }
+
+    // Occupy (or retype) a specific number: dup2, and VH fds numbered by JS
+    void install(int fd, FdKind kind) {
+        if (fd < 0) return;
+        if (static_cast<size_t>(fd) >= slots_.size()) slots_.resize(fd + 1, FdKind::Free);
+        slots_[fd] = kind;
+        if (static_cast<size_t>(fd) == first_free_) first_free_ = next_free(first_free_);
+    }
+
+    void release(int fd) {
+        if (!is_open(fd)) return;
+        slots_[fd] = FdKind::Free;
+        if (static_cast<size_t>(fd) < first_free_) first_free_ = fd;
+        while (!slots_.empty() && slots_.back() == FdKind::Free) slots_.pop_back();
+        first_free_ = std::min(first_free_, slots_.size());
+    }
+
+    // Open descriptors in ascending order
+    std::vector<int> open_fds() const {
+        std::vector<int> fds;
+        for (size_t fd = 0; fd < slots_.size(); fd++) {
+            if (slots_[fd] != FdKind::Free) fds.push_back(static_cast<int>(fd));
+        }
+        return fds;
+    }
+
+    // Raw slots, for fork snapshots and checkpoints
+    const std::vector<FdKind>& slots() const { return slots_; }
+    void restore(std::vector<FdKind> slots) {
+        slots_ = std::move(slots);
+        first_free_ = next_free(0);
+    }
+
+    // vfs::FdAllocator: the VFS opens plain files; callers retype pipes,
+    // eventfds and devices after the fact
+    int alloc_fd() override { return alloc(FdKind::File); }
+    void release_fd(int fd) override { release(fd); }
+
+private:
+    std::vector<FdKind> slots_;
+    size_t first_free_ = 0;  // No free slot below this
+
+    size_t next_free(size_t fd) const {
+        while (fd < slots_.size() && slots_[fd] != FdKind::Free) fd++;
+        return fd;
+    }
+};
+
+inline FdTable g_fds;
+
+}  // namespace syscalls
@@ -0,0 +1,78 @@
+// guest_span.hpp - Guest buffers as host memory for syscall I/O
+//
+// With the flat read-write arena, a guest buffer is already a contiguous
+// run of host memory. guest_transfer() hands that run straight to the code
+// that fills or drains it (a VFS inode, a pipe ring, a host socket), so a
+// read or write copies exactly once, with no staging vector. The bounds are
+// the ones libriscv's own flat-arena accessors enforce. A range the arena
+// does not cover (paged memory, or writes below the end of rodata) goes
+// through libriscv's page-by-page gather, which checks page permissions and
+// may split it into several fragments.
+//
+// Like any guest memory access, a range the guest could not touch itself
+// raises a MachineException before anything is transferred.
+
+#pragma once
+
+#include <libriscv/machine.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <sys/types.h>
+#include <type_traits>
+
+namespace syscalls {
+
+enum class GuestAccess { Read, Write };
+
+// The arena span for [addr, addr + len), or nullptr when the range is not
+// entirely inside the part of the arena open to that access
+template <GuestAccess Access, typename Machine>
+inline char* arena_span(Machine& m, uint64_t addr, size_t len) {
+    using Memory = std::remove_reference_t<decltype(m.memory)>;
+    auto& mem = m.memory;
+    if (!mem.uses_flat_memory_arena() || addr + len < addr) return nullptr;
+    uint64_t begin = Access == GuestAccess::Read ? Memory::RWREAD_BEGIN : mem.initial_rodata_end();
+    uint64_t bound = Access == GuestAccess::Read ? mem.memory_arena_read_boundary()
+                                                 : mem.memory_arena_write_boundary();
+    if (addr < begin || addr + len - begin >= bound) return nullptr;
+    return static_cast<char*>(mem.memory_arena_ptr()) + addr;
+}
+
+// Move up to len bytes between guest memory at addr and a host object.
+// xfer(ptr, n, done) moves bytes into (Write) or out of (Read) one host
+// span, where done counts the bytes already moved by earlier spans, and
+// returns how many it moved or a negative errno. Like readv/writev over the
+// spans, this stops at the first short transfer. Returns the total, or the
+// error if nothing was moved.
+template <GuestAccess Access, typename Machine, typename Xfer>
+inline ssize_t guest_transfer(Machine& m, uint64_t addr, size_t len, Xfer&& xfer) {
+    if (char* span = arena_span<Access>(m, addr, len)) return xfer(span, len, size_t{0});
+    if (len == 0) {
+        static char empty;
+        return xfer(&empty, 0, size_t{0});
+    }
+
+    // Enough fragments for a chunk even if no two pages are adjacent
+    constexpr size_t PAGE = riscv::Page::size();
+    constexpr size_t FRAGMENTS = 16;
+    std::array<riscv::vBuffer, FRAGMENTS> frags;
+    size_t done = 0;
+    while (len > 0) {
+        size_t chunk = std::min(len, (FRAGMENTS - 1) * PAGE);
+        size_t count = Access == GuestAccess::Read
+            ? m.memory.gather_buffers_from_range(FRAGMENTS, frags.data(), addr, chunk)
+            : m.memory.gather_writable_buffers_from_range(FRAGMENTS, frags.data(), addr, chunk);
+        for (size_t i = 0; i < count; i++) {
+            ssize_t n = xfer(frags[i].ptr, frags[i].len, done);
+            if (n < 0) return done > 0 ? static_cast<ssize_t>(done) : n;
+            done += n;
+            if (static_cast<size_t>(n) < frags[i].len) return done;
+        }
+        addr += chunk;
+        len -= chunk;
+    }
+    return done;
+}
+
+}  // namespace syscalls
@@ -0,0 +1,397 @@
+// harts.hpp - Guest threads on their own host threads (native builds)
+//
+// By default a CLONE_THREAD thread is a VThread that g_sched multiplexes
+// onto the one Machine. With --parallel-threads, clone instead forks a
+// Machine from the caller and runs it on a new host thread: a hart. Forks
+// share the encompassing arena and the decoded execute segments, so guest
+// memory is common and only the register file is private. AMOs and LR/SC
+// are host atomics on the arena (libriscv rva_instr.cpp), and futex
+// wait/wake become host futexes on the same words.
+//
+// Guest code runs in parallel; syscalls do not. The handlers share global
+// state throughout (fd table, VFS, g_sched, the mmap bump pointer), so each
+// one runs under a single lock, taken in on_syscall_enter and dropped in
+// on_syscall_leave. A handler that waits on the host drops it for the wait
+// (Unlocked). A handler that would have switched VThreads to wait for
+// another thread parks its hart instead (park): the syscall is rewound and
+// retried after the next wake-up anywhere in the syscall layer.
+//
+// The vfork emulation snapshots guest memory and later restores it, so it
+// needs every other hart out of guest code: stop_world() parks them at
+// their next safepoint (a dispatch-chunk boundary or a syscall) until
+// start_world(). fork, vfork and execve are only available on the hart the
+// program started on.
+
+#pragma once
+
+#include <libriscv/machine.hpp>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#ifndef __EMSCRIPTEN__
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace syscalls {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+class Harts {
+public:
+    // Guest instructions between safepoint checks
+    static constexpr uint64_t CHUNK = 1'000'000;
+    // Longest a parked hart sleeps before retrying its syscall anyway, for
+    // readiness nobody signals (host sockets, stdin)
+    static constexpr auto PARK_TIMEOUT = std::chrono::milliseconds(10);
+
+    struct Thread {
+        int tid;
+        uint64_t clear_child_tid;
+    };
+
+    // Set by --parallel-threads before the guest starts
+    bool enabled() const { return primary_ != nullptr; }
+    void enable(Machine& primary) {
+        primary_ = &primary;
+        in_guest_ = 1;
+#ifndef __EMSCRIPTEN__
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+    }
+
+    // True while any hart besides the primary exists
+    bool active() const { return live_.load(std::memory_order_relaxed) > 0; }
+    bool is_primary(const Machine& m) const { return &m == primary_; }
+    // m is a hart other than the primary
+    bool is_hart(const Machine& m) const { return enabled() && &m != primary_; }
+    bool exiting() const { return exiting_.load(std::memory_order_relaxed); }
+
+    // The guest thread a hart runs (nullptr for the primary)
+    Thread* find(const Machine& m) {
+        auto it = threads_.find(&m);
+        return it != threads_.end() ? &it->second : nullptr;
+    }
+
+    // --- The syscall lock (on_syscall_enter / leave / abort) ---
+
+    void enter(Machine& m) {
+        if (!enabled()) return;
+        mutex_.lock();
+        t_locked_ = true;
+        in_guest_--;
+        cv_.notify_all();  // stop_world may be waiting for this
+        wait_for_world();
+        if (!is_primary(m)) m.memory.mmap_address() = primary_->memory.mmap_address();
+    }
+
+    void leave(Machine& m) {
+        if (!t_locked_) return;
+        if (!is_primary(m)) primary_->memory.mmap_address() = m.memory.mmap_address();
+        if (t_parked_) {
+            t_parked_ = false;
+            uint64_t seen = generation_;
+            std::unique_lock<std::mutex> lk(mutex_, std::adopt_lock);
+            cv_.wait_for(lk, PARK_TIMEOUT, [&] { return generation_ != seen || exiting(); });
+            lk.release();
+        }
+        wait_for_world();
+        if (exiting()) stop(m);
+        in_guest_++;
+        t_locked_ = false;
+        mutex_.unlock();
+    }
+
+    // The handler threw; the exception unwinds back into guest code (the
+    // run loop's fault handling retries it)
+    void abort(Machine&) {
+        if (!t_locked_) return;
+        t_parked_ = false;
+        in_guest_++;
+        t_locked_ = false;
+        mutex_.unlock();
+    }
+
+    // Drops the syscall lock for a host wait inside a handler
+    class Unlocked {
+    public:
+        explicit Unlocked(Harts& h) : h_(h), held_(t_locked_) {
+            if (held_) {
+                t_locked_ = false;
+                h_.mutex_.unlock();
+            }
+        }
+        ~Unlocked() {
+            if (!held_) return;
+            h_.mutex_.lock();
+            t_locked_ = true;
+            h_.wait_for_world();
+        }
+        Unlocked(const Unlocked&) = delete;
+        Unlocked& operator=(const Unlocked&) = delete;
+    private:
+        Harts& h_;
+        bool held_;
+    };
+
+    // Instead of blocking, rewind the syscall and have leave() sleep until
+    // the next wake-up. Returns false when there is no other hart to wait
+    // for (the caller then behaves as in a single-threaded guest).
+    bool park(Machine& m) {
+        if (!active() || !t_locked_) return false;
+        m.cpu.increment_pc(-4);
+        t_parked_ = true;
+        return true;
+    }
+
+    // Sleep in a handler with the lock dropped; cut short when the process
+    // exits
+    void sleep_for(std::chrono::nanoseconds d) {
+        if (!t_locked_) {
+            std::this_thread::sleep_for(d);
+            return;
+        }
+        std::unique_lock<std::mutex> lk(mutex_, std::adopt_lock);
+        cv_.wait_for(lk, d, [&] { return exiting(); });
+        lk.release();
+        wait_for_world();
+    }
+
+    // Something a parked hart may wait for happened (called with the lock
+    // held, from ThreadScheduler::wake)
+    void notify() {
+        if (!active()) return;
+        generation_++;
+        cv_.notify_all();
+#ifndef __EMSCRIPTEN__
+        uint64_t one = 1;
+        if (wake_fd_ >= 0) (void)!::write(wake_fd_, &one, sizeof(one));
+#endif
+    }
+
+    // Host fd that becomes readable on notify(), for handlers that block in
+    // poll() (-1 while there is only one hart)
+    int wake_fd() const { return active() ? wake_fd_ : -1; }
+    void drain_wake_fd() {
+#ifndef __EMSCRIPTEN__
+        uint64_t n;
+        if (wake_fd_ >= 0) (void)!::read(wake_fd_, &n, sizeof(n));
+#endif
+    }
+
+    // --- Safepoints ---
+
+    // Called between dispatch chunks: parks this hart while the world is
+    // stopped, and stops its machine once the process is exiting
+    void safepoint(Machine& m) {
+        if (!paused_.load(std::memory_order_relaxed) && !exiting()) return;
+        std::unique_lock<std::mutex> lk(mutex_);
+        in_guest_--;
+        cv_.notify_all();
+        cv_.wait(lk, [&] { return !paused_ || pauser_ == std::this_thread::get_id(); });
+        if (exiting()) stop(m);
+        in_guest_++;
+    }
+
+    // Park every other hart outside guest code. Called from a syscall
+    // handler; lasts until start_world(), across any number of syscalls.
+    void stop_world() {
+        if (!active() || !t_locked_) return;
+        std::unique_lock<std::mutex> lk(mutex_, std::adopt_lock);
+        paused_ = true;
+        pauser_ = std::this_thread::get_id();
+        cv_.wait(lk, [&] { return in_guest_ == 0; });
+        lk.release();
+    }
+
+    void start_world() {
+        if (!paused_) return;
+        paused_ = false;
+        pauser_ = {};
+        cv_.notify_all();
+    }
+
+    // --- Lifetime ---
+
+    // Run a forked machine (registers already set up) on a new host thread.
+    // Called with the lock held.
+    void spawn(std::unique_ptr<Machine> hart, int tid, uint64_t clear_child_tid) {
+        Machine* m = hart.get();
+        threads_[m] = Thread{tid, clear_child_tid};
+        in_guest_++;
+        live_++;
+        std::thread([this, hart = std::move(hart)]() mutable {
+            run(*hart);
+            std::lock_guard<std::mutex> lk(mutex_);
+            in_guest_--;
+            live_--;
+            threads_.erase(hart.get());
+            hart.reset();
+            cv_.notify_all();
+        }).detach();
+    }
+
+    // The primary's thread called exit: like Linux, the process lives on
+    // until the other threads are gone. Called with the lock held.
+    void join_others() {
+        if (!t_locked_) return;
+        std::unique_lock<std::mutex> lk(mutex_, std::adopt_lock);
+        cv_.wait(lk, [&] { return live_ == 0; });
+        lk.release();
+    }
+
+    // exit_group, a crashed hart, or the primary finishing: every hart stops
+    // at its next safepoint or syscall. Called with the lock held.
+    void request_exit(int code) {
+        if (!exiting_.exchange(true)) exit_code_ = code;
+        generation_++;
+        cv_.notify_all();
+#ifndef __EMSCRIPTEN__
+        for (auto& [word, waiters] : waits_) {
+            syscall(SYS_futex, word, 1 /* FUTEX_WAKE */, INT32_MAX, nullptr, nullptr, 0);
+        }
+        uint64_t one = 1;
+        if (wake_fd_ >= 0) (void)!::write(wake_fd_, &one, sizeof(one));
+#endif
+    }
+
+    // The process is exiting (registered with atexit by main): stop the
+    // other harts before the machine they share memory with goes away.
+    // Harts blocked on the host (a stdin read, say) are left there; the lock
+    // is never released again, so they cannot come back.
+    void shutdown() {
+        if (!enabled()) return;
+        std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
+        if (t_locked_) {
+            lk = std::unique_lock<std::mutex>(mutex_, std::adopt_lock);
+        } else {
+            lk.lock();
+            in_guest_--;  // This thread is done running guest code
+        }
+        request_exit(exit_code_);
+        cv_.wait(lk, [&] { return in_guest_ == 0; });
+        lk.release();
+    }
+
+    int exit_code() const { return exit_code_; }
+
+    // --- Host futexes on guest words ---
+
+    // FUTEX_WAIT(_BITSET) on the host. The guest op (private and clock
+    // flags included) and timeout carry over as is. Untimed waits are cut
+    // into 1s rounds so an exiting process cannot miss one of them.
+    long futex_wait(uint32_t* word, int op, uint32_t val, const struct timespec* timeout,
+                    uint32_t bitset) {
+#ifdef __EMSCRIPTEN__
+        return -38;  // ENOSYS: there are no harts
+#else
+        waits_[word]++;
+        long r;
+        {
+            Unlocked unlocked(*this);
+            do {
+                struct timespec round;
+                const struct timespec* ts = timeout;
+                int round_op = op;
+                if (!ts) {
+                    if ((op & 0x7f) == 9) {  // FUTEX_WAIT_BITSET: absolute, CLOCK_MONOTONIC
+                        clock_gettime(CLOCK_MONOTONIC, &round);
+                        round.tv_sec += 1;
+                        round_op &= ~256;  // FUTEX_CLOCK_REALTIME
+                    } else {
+                        round = {1, 0};
+                    }
+                    ts = &round;
+                }
+                r = syscall(SYS_futex, word, round_op, val, ts, nullptr, bitset);
+                if (r < 0) r = -errno;
+            } while (!timeout && r == -110 /* ETIMEDOUT */ && !exiting());
+        }
+        if (--waits_[word] == 0) waits_.erase(word);
+        return r;
+#endif
+    }
+
+    long futex_wake(uint32_t* word, int op, int count, uint32_t bitset) {
+#ifdef __EMSCRIPTEN__
+        return -38;
+#else
+        long r = syscall(SYS_futex, word, op, count, nullptr, nullptr, bitset);
+        return r < 0 ? -errno : r;
+#endif
+    }
+
+    // FUTEX_REQUEUE, FUTEX_CMP_REQUEUE and FUTEX_WAKE_OP (count2 travels in
+    // the timeout slot)
+    long futex_requeue(uint32_t* word, int op, int count, uint32_t count2, uint32_t* word2,
+                       uint32_t val3) {
+#ifdef __EMSCRIPTEN__
+        return -38;
+#else
+        long r = syscall(SYS_futex, word, op, count, static_cast<uintptr_t>(count2), word2, val3);
+        return r < 0 ? -errno : r;
+#endif
+    }
+
+private:
+    Machine* primary_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // Every host thread is in one of: guest code, a syscall (holding the
+    // lock, or in an Unlocked wait), or parked at a safepoint. in_guest_
+    // counts the first kind.
+    int in_guest_ = 0;
+    std::atomic<int> live_{0};
+    std::atomic<bool> paused_{false};
+    std::thread::id pauser_;
+    std::atomic<bool> exiting_{false};
+    int exit_code_ = 0;
+    uint64_t generation_ = 0;
+    int wake_fd_ = -1;
+    std::unordered_map<const Machine*, Thread> threads_;
+    std::unordered_map<uint32_t*, int> waits_;
+
+    static inline thread_local bool t_locked_ = false;
+    static inline thread_local bool t_parked_ = false;
+
+    void wait_for_world() {
+        if (!paused_ || pauser_ == std::this_thread::get_id()) return;
+        std::unique_lock<std::mutex> lk(mutex_, std::adopt_lock);
+        cv_.wait(lk, [&] { return !paused_ || pauser_ == std::this_thread::get_id(); });
+        lk.release();
+    }
+
+    void stop(Machine& m) {
+        m.stop();
+        if (is_primary(m)) m.cpu.reg(riscv::REG_ARG0) = exit_code_;
+    }
+
+    void run(Machine& m) {
+        try {
+            do {
+                m.resume<false>(CHUNK);
+                safepoint(m);
+            } while (m.instruction_limit_reached());
+        } catch (const std::exception& e) {
+            auto* t = find(m);
+            fprintf(stderr, "[hart] tid=%d crashed at pc=0x%lx: %s\n", t ? t->tid : -1,
+                    (long)m.cpu.pc(), e.what());
+            std::lock_guard<std::mutex> lk(mutex_);
+            request_exit(128 + 11);  // As if killed by SIGSEGV
+        }
+    }
+};
+
+// Never destroyed: harts still blocked on the host at exit wait on its lock
+inline Harts& g_harts = *new Harts;
+
+}  // namespace syscalls
@@ -0,0 +1,186 @@
+// host_mount.hpp - Host directories mounted into the VFS (native builds)
+//
+// HostMount implements vfs::MountSource over a host directory with plain
+// POSIX calls, so `--mount /host/src:/work` exposes a project tree to the
+// guest without packing it into the rootfs or copying it into memory.
+// Listings and attributes are read when the VFS asks for them; file I/O is
+// pread/pwrite on host descriptors. A read-only mount never opens anything
+// for writing.
+//
+// Kept out of vfs.hpp: <fcntl.h> defines O_* macros that collide with the
+// guest constants in syscalls.hpp, so include this after it.
+
+#pragma once
+
+#include "vfs.hpp"
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vfs {
+
+class HostMount : public MountSource {
+public:
+    HostMount(std::string root, bool read_only)
+        : root_(std::move(root)), read_only_(read_only) {
+        while (root_.size() > 1 && root_.back() == '/') root_.pop_back();
+    }
+
+    bool read_only() const override { return read_only_; }
+
+    int lstat(const std::string& rel, Attr& out) override {
+        struct stat st;
+        if (::lstat(host_path(rel).c_str(), &st) != 0) return guest_errno();
+        out = to_attr(st);
+        if (out.type == FileType::Symlink) {
+            out.link_target = read_link(AT_FDCWD, host_path(rel).c_str(), st.st_size);
+        }
+        return 0;
+    }
+
+    int list(const std::string& rel, std::vector<DirItem>& out) override {
+        DIR* dir = ::opendir(host_path(rel).c_str());
+        if (!dir) return guest_errno();
+        int dfd = ::dirfd(dir);
+        while (struct dirent* d = ::readdir(dir)) {
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+            struct stat st;
+            if (::fstatat(dfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            DirItem item{d->d_name, to_attr(st)};
+            if (item.attr.type == FileType::Symlink) {
+                item.attr.link_target = read_link(dfd, d->d_name, st.st_size);
+            }
+            out.push_back(std::move(item));
+        }
+        ::closedir(dir);
+        return 0;
+    }
+
+    int open(const std::string& rel, int flags, uint32_t mode) override {
+        if (read_only_ && ((flags & 3) != 0 || (flags & (0100 | 01000)))) return -30;  // EROFS
+        int fd = ::open(host_path(rel).c_str(), host_flags(flags), mode);
+        return fd < 0 ? guest_errno() : fd;
+    }
+
+    void close(int handle) override { ::close(handle); }
+
+    ssize_t pread(int handle, void* buf, size_t len, uint64_t offset) override {
+        ssize_t n = ::pread(handle, buf, len, static_cast<off_t>(offset));
+        return n < 0 ? guest_errno() : n;
+    }
+
+    ssize_t pwrite(int handle, const void* buf, size_t len, uint64_t offset) override {
+        ssize_t n = ::pwrite(handle, buf, len, static_cast<off_t>(offset));
+        return n < 0 ? guest_errno() : n;
+    }
+
+    int ftruncate(int handle, uint64_t len) override {
+        return ::ftruncate(handle, static_cast<off_t>(len)) == 0 ? 0 : guest_errno();
+    }
+
+    int64_t fsize(int handle) override {
+        struct stat st;
+        if (::fstat(handle, &st) != 0) return guest_errno();
+        return st.st_size;
+    }
+
+    int mkdir(const std::string& rel, uint32_t mode) override {
+        if (read_only_) return -30;
+        return ::mkdir(host_path(rel).c_str(), mode) == 0 ? 0 : guest_errno();
+    }
+
+    int unlink(const std::string& rel, bool dir) override {
+        if (read_only_) return -30;
+        int rc = dir ? ::rmdir(host_path(rel).c_str()) : ::unlink(host_path(rel).c_str());
+        return rc == 0 ? 0 : guest_errno();
+    }
+
+    int rename(const std::string& from, const std::string& to) override {
+        if (read_only_) return -30;
+        return ::rename(host_path(from).c_str(), host_path(to).c_str()) == 0 ? 0 : guest_errno();
+    }
+
+    int symlink(const std::string& target, const std::string& rel) override {
+        if (read_only_) return -30;
+        return ::symlink(target.c_str(), host_path(rel).c_str()) == 0 ? 0 : guest_errno();
+    }
+
+    int link(const std::string& from, const std::string& to) override {
+        if (read_only_) return -30;
+        return ::link(host_path(from).c_str(), host_path(to).c_str()) == 0 ? 0 : guest_errno();
+    }
+
+    int truncate(const std::string& rel, uint64_t len) override {
+        if (read_only_) return -30;
+        return ::truncate(host_path(rel).c_str(), static_cast<off_t>(len)) == 0 ? 0 : guest_errno();
+    }
+
+private:
+    std::string root_;
+    bool read_only_;
+
+    std::string host_path(const std::string& rel) const {
+        return rel.empty() ? root_ : root_ + "/" + rel;
+    }
+
+    static Attr to_attr(const struct stat& st) {
+        Attr a;
+        a.type = static_cast<FileType>(st.st_mode & S_IFMT);
+        a.mode = st.st_mode & 07777;
+        a.uid = st.st_uid;
+        a.gid = st.st_gid;
+        a.size = S_ISREG(st.st_mode) ? st.st_size : 0;
+        a.mtime = st.st_mtime;
+        return a;
+    }
+
+    static std::string read_link(int dirfd, const char* path, size_t size_hint) {
+        std::string target(size_hint ? size_hint : 256, '\0');
+        ssize_t n = ::readlinkat(dirfd, path, target.data(), target.size());
+        target.resize(n > 0 ? n : 0);
+        return target;
+    }
+
+    // Guest open flags (Linux generic values) to the host's
+    static int host_flags(int flags) {
+        int out = O_CLOEXEC;
+        switch (flags & 3) {
+            case 0: out |= O_RDONLY; break;
+            case 1: out |= O_WRONLY; break;
+            default: out |= O_RDWR; break;
+        }
+        if (flags & 0100) out |= O_CREAT;
+        if (flags & 0200) out |= O_EXCL;
+        if (flags & 01000) out |= O_TRUNC;
+        if (flags & 02000) out |= O_APPEND;
+        return out;
+    }
+
+    // Host errno as a negative guest (Linux) errno
+    static int guest_errno() {
+        switch (errno) {
+            case EPERM:        return -1;
+            case ENOENT:       return -2;
+            case EBADF:        return -9;
+            case EACCES:       return -13;
+            case EBUSY:        return -16;
+            case EEXIST:       return -17;
+            case EXDEV:        return -18;
+            case ENOTDIR:      return -20;
+            case EISDIR:       return -21;
+            case EINVAL:       return -22;
+            case EFBIG:        return -27;
+            case ENOSPC:       return -28;
+            case EROFS:        return -30;
+            case EMLINK:       return -31;
+            case ENAMETOOLONG: return -36;
+            case ENOTEMPTY:    return -39;
+            case ELOOP:        return -40;
+            default:           return -5;  // EIO
+        }
+    }
+};
+
+}  // namespace vfs
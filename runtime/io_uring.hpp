@@ -0,0 +1,214 @@
+// io_uring.hpp - io_uring rings in guest memory
+//
+// An io_uring fd's submission and completion rings are ordinary guest
+// memory, carved from the mmap area when the guest maps the fd. The guest
+// queues SQEs and reaps CQEs with plain loads and stores, exactly as it
+// would against the kernel, and enters the emulator once per
+// io_uring_enter instead of once per operation. syscalls.hpp runs the
+// operations through the same fd table and syscall handlers as their
+// plain-syscall counterparts.
+//
+// Layout of the ring mapping (IORING_FEAT_SINGLE_MMAP: the SQ and CQ
+// rings share it; the SQE array is mapped separately):
+//
+//   0   SQ head, tail, ring_mask, ring_entries, flags, dropped
+//   32  CQ head, tail, ring_mask, ring_entries, overflow, flags
+//   64  SQ index array (sq_entries x u32)
+//   ..  CQEs (cq_entries x 16 bytes, 16-byte aligned)
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+namespace syscalls {
+
+// Setup and enter flags, features, SQE flags (linux/io_uring.h)
+inline constexpr uint32_t IORING_SETUP_CQSIZE = 1u << 3;
+inline constexpr uint32_t IORING_SETUP_CLAMP = 1u << 4;
+// Hints about who reaps completions; meaningless with one synchronous
+// submitter, so accepted and ignored
+inline constexpr uint32_t IORING_SETUP_IGNORED = (1u << 7) | (1u << 8) | (1u << 9) |
+                                                 (1u << 12) | (1u << 13);
+inline constexpr uint32_t IORING_ENTER_GETEVENTS = 1u << 0;
+inline constexpr uint32_t IORING_ENTER_IGNORED = (1u << 1) | (1u << 2);  // SQ_WAKEUP, SQ_WAIT
+inline constexpr uint32_t IORING_FEATURES = (1u << 0) |  // SINGLE_MMAP
+                                            (1u << 1) |  // NODROP
+                                            (1u << 2) |  // SUBMIT_STABLE
+                                            (1u << 3);   // RW_CUR_POS
+inline constexpr uint8_t IOSQE_FIXED_FILE = 1u << 0;
+inline constexpr uint8_t IOSQE_IO_LINK = 1u << 2;
+inline constexpr uint8_t IOSQE_IO_HARDLINK = 1u << 3;
+inline constexpr uint8_t IOSQE_CQE_SKIP_SUCCESS = 1u << 6;
+inline constexpr uint32_t IORING_SQ_CQ_OVERFLOW = 1u << 1;
+
+// mmap offsets of the ring fd
+inline constexpr uint64_t IORING_OFF_SQ_RING = 0;
+inline constexpr uint64_t IORING_OFF_CQ_RING = 0x8000000;
+inline constexpr uint64_t IORING_OFF_SQES = 0x10000000;
+
+enum IoUringOp : uint8_t {
+    IORING_OP_NOP = 0,
+    IORING_OP_READV = 1,
+    IORING_OP_WRITEV = 2,
+    IORING_OP_POLL_ADD = 6,
+    IORING_OP_TIMEOUT = 11,
+    IORING_OP_ACCEPT = 13,
+    IORING_OP_OPENAT = 18,
+    IORING_OP_CLOSE = 19,
+    IORING_OP_STATX = 21,
+    IORING_OP_READ = 22,
+    IORING_OP_WRITE = 23,
+    IORING_OP_SEND = 26,
+    IORING_OP_RECV = 27,
+};
+
+// struct io_uring_sqe, as the guest lays it out
+struct IoUringSqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off;       // Also addr2
+    uint64_t addr;
+    uint32_t len;
+    uint32_t op_flags;  // rw_flags, msg_flags, poll32_events, open_flags, ...
+    uint64_t user_data;
+    uint16_t buf_index;
+    uint16_t personality;
+    int32_t splice_fd_in;
+    uint64_t addr3;
+    uint64_t pad;
+};
+static_assert(sizeof(IoUringSqe) == 64);
+
+// One submitted SQE still waiting to run
+struct IoUringPending {
+    IoUringSqe sqe;
+    uint64_t deadline_ns = 0;  // TIMEOUT: when it expires
+    uint64_t target = 0;       // TIMEOUT: completion count that ends it early
+};
+
+// A run of IOSQE_IO_LINK'ed SQEs (or a single one); each starts only once
+// the one before it has completed
+using IoUringChain = std::deque<IoUringPending>;
+
+struct IoUring {
+    uint32_t id = 0;
+    uint32_t sq_entries = 0;
+    uint32_t cq_entries = 0;
+    uint64_t rings = 0;  // Guest address of the ring mapping, 0 until mapped
+    uint64_t sqes = 0;   // Guest address of the SQE array, 0 until mapped
+
+    std::deque<IoUringChain> pending;
+    // CQEs that found the CQ full (IORING_FEAT_NODROP)
+    std::deque<std::pair<uint64_t, int32_t>> overflow;
+    uint64_t completions = 0;  // CQEs posted so far, for TIMEOUT counts
+    // SQEs consumed by an io_uring_enter that then blocked; reported when
+    // the call completes
+    uint32_t carried = 0;
+
+    static constexpr uint32_t MAX_ENTRIES = 4096;
+    static constexpr uint64_t SQ_HEAD = 0, SQ_TAIL = 4, SQ_MASK = 8, SQ_ENTRIES = 12,
+                              SQ_FLAGS = 16, SQ_DROPPED = 20;
+    static constexpr uint64_t CQ_HEAD = 32, CQ_TAIL = 36, CQ_MASK = 40, CQ_ENTRIES = 44,
+                              CQ_OVERFLOW = 48, CQ_FLAGS = 52;
+    static constexpr uint64_t SQ_ARRAY = 64;
+
+    uint64_t cqes_offset() const { return (SQ_ARRAY + 4ull * sq_entries + 15) & ~15ull; }
+    uint64_t ring_bytes() const { return cqes_offset() + 16ull * cq_entries; }
+    uint64_t sqe_bytes() const { return 64ull * sq_entries; }
+
+    // Fill in the fields the kernel would after mapping the rings
+    template <typename Machine>
+    void init_rings(Machine& m) {
+        m.memory.template write<uint32_t>(rings + SQ_MASK, sq_entries - 1);
+        m.memory.template write<uint32_t>(rings + SQ_ENTRIES, sq_entries);
+        m.memory.template write<uint32_t>(rings + CQ_MASK, cq_entries - 1);
+        m.memory.template write<uint32_t>(rings + CQ_ENTRIES, cq_entries);
+    }
+
+    bool mapped() const { return rings != 0 && sqes != 0; }
+
+    // Take the next SQE the guest queued, if any, spending budget on each
+    // entry consumed. An entry whose array slot names no SQE is dropped
+    // (counted in SQ_DROPPED) but still spends budget, as on Linux, so a
+    // ring full of garbage costs at most to_submit steps.
+    template <typename Machine>
+    bool next_sqe(Machine& m, IoUringSqe& sqe, uint32_t& budget) {
+        uint32_t head = m.memory.template read<uint32_t>(rings + SQ_HEAD);
+        uint32_t tail = m.memory.template read<uint32_t>(rings + SQ_TAIL);
+        uint32_t dropped = 0;
+        bool found = false;
+        while (!found && budget > 0 && head != tail) {
+            uint32_t index = m.memory.template read<uint32_t>(rings + SQ_ARRAY + 4ull * (head & (sq_entries - 1)));
+            head++;
+            budget--;
+            if (index < sq_entries) {
+                m.memory.memcpy_out(&sqe, sqes + 64ull * index, sizeof(sqe));
+                found = true;
+            } else {
+                dropped++;
+            }
+        }
+        m.memory.template write<uint32_t>(rings + SQ_HEAD, head);
+        if (dropped) {
+            uint32_t total = m.memory.template read<uint32_t>(rings + SQ_DROPPED);
+            m.memory.template write<uint32_t>(rings + SQ_DROPPED, total + dropped);
+        }
+        return found;
+    }
+
+    template <typename Machine>
+    uint32_t cq_ready(Machine& m) const {
+        return m.memory.template read<uint32_t>(rings + CQ_TAIL) -
+               m.memory.template read<uint32_t>(rings + CQ_HEAD);
+    }
+
+    // Post a CQE, holding it back while the CQ is full
+    template <typename Machine>
+    void post(Machine& m, uint64_t user_data, int32_t res) {
+        completions++;
+        if (!overflow.empty() || !push(m, user_data, res)) {
+            overflow.emplace_back(user_data, res);
+            set_sq_flag(m, IORING_SQ_CQ_OVERFLOW, true);
+        }
+    }
+
+    // Move held-back CQEs into space the guest has freed
+    template <typename Machine>
+    void flush_overflow(Machine& m) {
+        while (!overflow.empty() && push(m, overflow.front().first, overflow.front().second)) {
+            overflow.pop_front();
+        }
+        if (overflow.empty()) set_sq_flag(m, IORING_SQ_CQ_OVERFLOW, false);
+    }
+
+private:
+    template <typename Machine>
+    bool push(Machine& m, uint64_t user_data, int32_t res) {
+        uint32_t head = m.memory.template read<uint32_t>(rings + CQ_HEAD);
+        uint32_t tail = m.memory.template read<uint32_t>(rings + CQ_TAIL);
+        if (tail - head >= cq_entries) return false;
+        uint64_t cqe = rings + cqes_offset() + 16ull * (tail & (cq_entries - 1));
+        m.memory.template write<uint64_t>(cqe, user_data);
+        m.memory.template write<int32_t>(cqe + 8, res);
+        m.memory.template write<uint32_t>(cqe + 12, 0);
+        m.memory.template write<uint32_t>(rings + CQ_TAIL, tail + 1);
+        return true;
+    }
+
+    template <typename Machine>
+    void set_sq_flag(Machine& m, uint32_t flag, bool on) {
+        uint32_t flags = m.memory.template read<uint32_t>(rings + SQ_FLAGS);
+        m.memory.template write<uint32_t>(rings + SQ_FLAGS, on ? flags | flag : flags & ~flag);
+    }
+};
+
+// Keyed by fd; dup'ed descriptors share the instance
+inline std::unordered_map<int, std::shared_ptr<IoUring>> g_io_urings;
+inline uint32_t g_next_io_uring_id = 1;
+
+}  // namespace syscalls
@@ -238,21 +238,11 @@ mergeInto(LibraryManager.library, {
   // ========================================================================
   // [700s] Compute — Sync (NOT on JSPI_IMPORTS — zero suspension overhead)
   //
-  // Op codes: 705=getrandom, 703=memmove, 708=json_parse
+  // Op codes: 703=memmove, 708=json_parse (705=getrandom is served in C++)
   // ========================================================================
   js_compute_offload: function(op, p1, l1, p2, l2) {
     var mem = HEAPU8.buffer;
 
-    if (op === 705) { // getrandom
-      var offset = 0;
-      while (offset < l1) {
-        var chunk = Math.min(l1 - offset, 65536);
-        crypto.getRandomValues(new Uint8Array(mem, p1 + offset, chunk));
-        offset += chunk;
-      }
-      return l1;
-    }
-
     if (op === 703) { // memmove
       new Uint8Array(mem, p1, l1).set(new Uint8Array(mem, p2, l2));
       return p1;
@@ -5,7 +5,7 @@
 //
 // Usage:
 //   friscy <riscv64-elf-binary> [args...]
-//   friscy --rootfs <rootfs.tar> <entry-binary> [args...]
+//   friscy --rootfs <rootfs.tar|.tar.gz|.tar.zst> <entry-binary> [args...]
 //
 // The binary can be:
 //   - A standalone statically-linked RISC-V ELF
@@ -19,6 +19,7 @@
 #include "vh_harness.hpp"
 #include "elf_loader.hpp"
 #include "checkpoint.hpp"
+#include "compressed_image.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -30,6 +31,11 @@
 #else
 #include <signal.h>
 #include <execinfo.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "host_mount.hpp"
 static void segfault_handler(int sig) {
     void* bt[32];
     int n = backtrace(bt, 32);
@@ -75,6 +81,11 @@ EMSCRIPTEN_KEEPALIVE int friscy_stopped() {
     return (syscalls::g_waiting_for_stdin || syscalls::g_waiting_for_host_fetch) ? 1 : 0;
 }
 
+// Exit status of the guest program, once friscy_stopped() says it is done
+EMSCRIPTEN_KEEPALIVE int friscy_exit_code() {
+    return g_machine ? syscalls::exit_code(*g_machine) : 0;
+}
+
 // Resume execution. Returns 1 if machine stopped again (needs more stdin), 0 if done.
 // Handles page protection faults by making the faulting page writable and
 // retrying. This acts as a simple page fault handler for pages at the
@@ -83,18 +94,27 @@ EMSCRIPTEN_KEEPALIVE int friscy_resume() {
     if (!g_machine) return 0;
     syscalls::g_waiting_for_stdin = false;
     syscalls::g_waiting_for_host_fetch = false;
+    syscalls::stdin_notify();  // JS resumes us when input (or a timer) arrives
+    if (!syscalls::sched_resume(*g_machine)) {
+        syscalls::g_waiting_for_stdin = true;  // Every thread still waits
+        return 1;
+    }
     static constexpr uint64_t YIELD_CHUNK = 2'000'000;
     static int resume_log_count = 0;
     for (int retries = 0; retries < 8; retries++) {
         try {
             while (true) {
-                g_machine->resume<false>(YIELD_CHUNK);
+                g_machine->resume<false>(syscalls::sched_chunk(*g_machine, YIELD_CHUNK));
+                syscalls::sched_tick(*g_machine);
+                syscalls::g_console.tick();
+                syscalls::vdso_refresh(*g_machine);
                 if (syscalls::g_waiting_for_stdin) break;
                 if (syscalls::g_waiting_for_host_fetch) break;
                 if (syscalls::g_execve_restart) break;
                 if (!g_machine->instruction_limit_reached()) break;
                 // No yield needed — Worker thread doesn't block UI
             }
+            syscalls::g_console.flush();  // Stopped: hand over everything written so far
             // Handle execve: new binary loaded, restart execution
             if (syscalls::g_execve_restart) {
                 syscalls::g_execve_restart = false;
@@ -109,6 +129,7 @@ EMSCRIPTEN_KEEPALIVE int friscy_resume() {
             }
             return friscy_stopped();
         } catch (const riscv::MachineException& e) {
+            syscalls::g_console.flush();
             uint64_t fault_addr = e.data();
             std::cerr << "[resume] MachineException: " << e.what()
                       << " data=0x" << std::hex << fault_addr
@@ -144,6 +165,7 @@ EMSCRIPTEN_KEEPALIVE int friscy_resume() {
             }, e.what(), (uint32_t)e.data(), (uint32_t)g_machine->cpu.pc());
             return 0;
         } catch (const std::exception& e) {
+            syscalls::g_console.flush();
             EM_ASM({
                 if (typeof Module._termWrite === 'function') {
                     Module._termWrite('\r\n\x1b[31m[friscy] Error: ' +
@@ -156,6 +178,14 @@ EMSCRIPTEN_KEEPALIVE int friscy_resume() {
     return friscy_stopped();
 }
 
+// Syscall statistics as JSON (see syscall_stats.hpp). The string stays
+// valid until the next call.
+EMSCRIPTEN_KEEPALIVE const char* friscy_syscall_stats_json() {
+    static std::string json;
+    json = syscalls::g_syscall_stats.json();
+    return json.c_str();
+}
+
 EMSCRIPTEN_KEEPALIVE uint32_t friscy_get_pc() {
     return g_machine ? (uint32_t)g_machine->cpu.pc() : 0;
 }
@@ -225,6 +255,28 @@ static std::vector<uint8_t> load_file(const std::string& path) {
     return data;
 }
 
+// Map a rootfs archive for zero-copy loading into the VFS. Native builds
+// mmap it read-only; Emscripten's MEMFS has no real mmap, so read it once.
+static std::shared_ptr<vfs::ImageBuffer> map_rootfs(const std::string& path) {
+#ifndef __EMSCRIPTEN__
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (p != MAP_FAILED) {
+            return vfs::ImageBuffer::from_mapping(
+                static_cast<const uint8_t*>(p), st.st_size,
+                [](const uint8_t* d, size_t n) { ::munmap(const_cast<uint8_t*>(d), n); });
+        }
+    }
+#endif
+    return vfs::ImageBuffer::from_vector(load_file(path));
+}
+
 // Load binary from VFS (for container mode)
 static std::vector<uint8_t> load_from_vfs(const std::string& path) {
     int fd = g_vfs.open(path, 0);
@@ -514,22 +566,74 @@ static void setup_virtual_files() {
 // Caller must Module._free() the returned pointer after use.
 // ============================================================================
 #ifdef __EMSCRIPTEN__
-extern "C" uint8_t* friscy_export_tar(uint32_t* out_size) {
-    auto tar = g_vfs.save_tar();
-    if (tar.empty()) {
+static uint8_t* export_blob(const std::vector<uint8_t>& data, uint32_t* out_size) {
+    if (data.empty()) {
         if (out_size) *out_size = 0;
         return nullptr;
     }
-    uint8_t* buf = static_cast<uint8_t*>(malloc(tar.size()));
+    uint8_t* buf = static_cast<uint8_t*>(malloc(data.size()));
     if (!buf) {
         if (out_size) *out_size = 0;
         return nullptr;
     }
-    memcpy(buf, tar.data(), tar.size());
-    if (out_size) *out_size = static_cast<uint32_t>(tar.size());
+    memcpy(buf, data.data(), data.size());
+    if (out_size) *out_size = static_cast<uint32_t>(data.size());
     return buf;
 }
+
+extern "C" uint8_t* friscy_export_tar(uint32_t* out_size) {
+    return export_blob(g_vfs.save_tar(), out_size);
+}
+
+// Incremental export: only what changed after generation `since`
+// (0 = everything that differs from the rootfs image), in the
+// VirtualFS delta format. Record friscy_vfs_generation() alongside the
+// result and pass it as `since` next time.
+extern "C" uint8_t* friscy_export_delta(uint64_t since, uint32_t* out_size) {
+    return export_blob(g_vfs.save_delta(since), out_size);
+}
+
+extern "C" uint64_t friscy_vfs_generation() {
+    return g_vfs.generation();
+}
+
+// Replay a saved delta on top of the loaded rootfs. Returns 1 on success.
+extern "C" int friscy_apply_delta(const uint8_t* data, uint32_t size) {
+    return g_vfs.apply_delta(data, size) ? 1 : 0;
+}
+#endif
+
+// Apply a --mount <host-dir>:<guest-dir>[:ro|:rw] spec to the VFS
+static bool mount_host_dir(const std::string& spec) {
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 >= spec.size()) {
+        std::cerr << "Error: --mount expects <host-dir>:<guest-dir>[:ro], got " << spec << "\n";
+        return false;
+    }
+    std::string host_dir = spec.substr(0, colon);
+    std::string guest_dir = spec.substr(colon + 1);
+    bool read_only = false;
+    if (guest_dir.ends_with(":ro")) {
+        read_only = true;
+        guest_dir.resize(guest_dir.size() - 3);
+    } else if (guest_dir.ends_with(":rw")) {
+        guest_dir.resize(guest_dir.size() - 3);
+    }
+#ifdef __EMSCRIPTEN__
+    std::cerr << "Error: --mount is not supported in browser builds\n";
+    return false;
+#else
+    int rc = g_vfs.mount(guest_dir, std::make_shared<vfs::HostMount>(host_dir, read_only));
+    if (rc < 0) {
+        std::cerr << "Error: Failed to mount " << host_dir << " at " << guest_dir
+                  << ": " << strerror(-rc) << "\n";
+        return false;
+    }
+    std::cout << "[friscy] Mounted " << host_dir << " at " << guest_dir
+              << (read_only ? " (read-only)" : "") << "\n";
+    return true;
 #endif
+}
 
 // Print usage
 static void usage(const char* argv0) {
@@ -537,6 +641,12 @@ static void usage(const char* argv0) {
     std::cerr << "Usage:\n";
     std::cerr << "  " << argv0 << " <riscv64-elf-binary> [args...]\n";
     std::cerr << "  " << argv0 << " --rootfs <rootfs.tar> <entry-binary> [args...]\n";
+    std::cerr << "\nOptions:\n";
+    std::cerr << "  --mount <host-dir>:<guest-dir>[:ro]   Mount a host directory (native only)\n";
+    std::cerr << "  --syscall-stats <path>                Write syscall statistics as JSON on exit (- for stderr)\n";
+    std::cerr << "  --time-slice <instructions>           Guest instructions a thread runs before preemption\n";
+    std::cerr << "  --parallel-threads                    Run guest threads on host threads (native only)\n";
+    std::cerr << "  --real-time                           Wait out idle guest time instead of skipping it\n";
     std::cerr << "\nExamples:\n";
     std::cerr << "  " << argv0 << " ./hello                    # Run standalone binary\n";
     std::cerr << "  " << argv0 << " --rootfs alpine.tar /bin/busybox ls -la\n";
@@ -555,11 +665,17 @@ int main(int argc, char** argv) {
     std::string rootfs_path;
     std::string entry_path;
     std::string export_tar_path;
+    std::string export_delta_path;
+    std::string apply_delta_path;
+    uint64_t delta_base_gen = 0;
     std::string export_checkpoint_path;
     std::string load_checkpoint_path;
+    std::string syscall_stats_path;
     std::vector<std::string> guest_args;
     std::vector<std::string> extra_env;
+    std::vector<std::string> mount_specs;
     bool container_mode = false;
+    bool parallel_threads = false;
 
     // Parse arguments
     int i = 1;
@@ -577,12 +693,30 @@ int main(int argc, char** argv) {
                 return 1;
             }
             extra_env.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--mount") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --mount requires <host-dir>:<guest-dir>[:ro]\n";
+                return 1;
+            }
+            mount_specs.push_back(argv[++i]);
         } else if (strcmp(argv[i], "--export-tar") == 0) {
             if (i + 1 >= argc) {
                 std::cerr << "Error: --export-tar requires <path>\n";
                 return 1;
             }
             export_tar_path = argv[++i];
+        } else if (strcmp(argv[i], "--export-delta") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --export-delta requires <path>\n";
+                return 1;
+            }
+            export_delta_path = argv[++i];
+        } else if (strcmp(argv[i], "--apply-delta") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --apply-delta requires <path>\n";
+                return 1;
+            }
+            apply_delta_path = argv[++i];
         } else if (strcmp(argv[i], "--export-checkpoint") == 0) {
             if (i + 1 >= argc) {
                 std::cerr << "Error: --export-checkpoint requires <path>\n";
@@ -595,6 +729,24 @@ int main(int argc, char** argv) {
                 return 1;
             }
             load_checkpoint_path = argv[++i];
+        } else if (strcmp(argv[i], "--syscall-stats") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --syscall-stats requires <path>\n";
+                return 1;
+            }
+            syscall_stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--time-slice") == 0) {
+            uint64_t slice = i + 1 < argc ? strtoull(argv[i + 1], nullptr, 0) : 0;
+            if (slice == 0) {
+                std::cerr << "Error: --time-slice requires a positive instruction count\n";
+                return 1;
+            }
+            syscalls::g_time_slice = slice;
+            i++;
+        } else if (strcmp(argv[i], "--parallel-threads") == 0) {
+            parallel_threads = true;
+        } else if (strcmp(argv[i], "--real-time") == 0) {
+            syscalls::g_clock_fast_forward = false;
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             usage(argv[0]);
             return 0;
@@ -618,6 +770,10 @@ int main(int argc, char** argv) {
         std::cerr << "Error: No entry binary specified\n";
         return 1;
     }
+    if (parallel_threads && (!export_checkpoint_path.empty() || !load_checkpoint_path.empty())) {
+        std::cerr << "Error: --parallel-threads cannot be combined with checkpoints\n";
+        return 1;
+    }
 
     static std::unique_ptr<Machine> machine_ptr;
     try {
@@ -638,10 +794,14 @@ int main(int argc, char** argv) {
         if (container_mode) {
             std::cout << "[friscy] Loading rootfs: " << rootfs_path << "\n";
 
-            // Load tar into VFS
-            auto tar_data = load_file(rootfs_path);
-            if (!g_vfs.load_tar(tar_data.data(), tar_data.size())) {
-                std::cerr << "Error: Failed to parse rootfs tar\n";
+            // Load tar into VFS. The image is mapped (native) or read once
+            // and file bodies borrow from it until first written; .tar.gz
+            // and .tar.zst images are indexed and decompressed on demand.
+            auto image = map_rootfs(rootfs_path);
+            std::string load_error;
+            if (!vfs::load_image(g_vfs, image, &load_error)) {
+                std::cerr << "Error: Failed to parse rootfs tar"
+                          << (load_error.empty() ? "" : ": " + load_error) << "\n";
                 return 1;
             }
 
@@ -651,6 +811,23 @@ int main(int argc, char** argv) {
             // Update /proc/self/exe
             g_vfs.add_virtual_file("/proc/self/exe", entry_path);
 
+            // Session changes are measured from here, so an exported delta
+            // carries the applied one plus whatever this run changes
+            delta_base_gen = g_vfs.generation();
+            if (!apply_delta_path.empty()) {
+                auto delta = load_file(apply_delta_path);
+                if (!g_vfs.apply_delta(delta.data(), delta.size())) {
+                    std::cerr << "Error: Failed to apply delta: " << apply_delta_path << "\n";
+                    return 1;
+                }
+                std::cout << "[friscy] Applied delta: " << apply_delta_path << "\n";
+            }
+
+            // Host mounts go on top of the rootfs (and any delta)
+            for (const auto& spec : mount_specs) {
+                if (!mount_host_dir(spec)) return 1;
+            }
+
             std::cout << "[friscy] Entry point: " << entry_path << "\n";
 
             // Load binary from VFS
@@ -929,8 +1106,8 @@ int main(int argc, char** argv) {
 
         // Set up network bridge function pointers for syscalls.hpp
         // (avoids header include order issues between network.hpp and syscalls.hpp)
-        syscalls::net_is_socket_fd = [](int fd) -> bool {
-            return net::get_network_ctx().is_socket_fd(fd);
+        syscalls::net_close_socket = [](int fd) -> int {
+            return net::get_network_ctx().close_socket(fd);
         };
 #ifndef __EMSCRIPTEN__
         syscalls::net_get_native_fd = [](int fd) -> int {
@@ -1007,7 +1184,8 @@ int main(int argc, char** argv) {
                 interp_base,
                 guest_args,
                 env,
-                stack_top
+                stack_top,
+                vdso::map(machine)
             );
 
             // Set stack pointer
@@ -1025,14 +1203,15 @@ int main(int argc, char** argv) {
                 0,  // no interpreter base
                 guest_args,
                 env,
-                stack_top
+                stack_top,
+                vdso::map(machine)
             );
             machine.cpu.reg(riscv::REG_SP) = sp;
         }
 
-        // Route guest stdout/stderr to host
+        // Route guest stdout/stderr to host, batched by the console sink
 #ifdef __EMSCRIPTEN__
-        machine.set_printer([](const auto&, const char* data, size_t len) {
+        syscalls::g_console.set_output([](const char* data, size_t len) {
             EM_ASM({
                 if (typeof Module._termWrite === 'function') {
                     // Use TextDecoder to handle potential partial UTF-8 sequences between chunks
@@ -1047,47 +1226,25 @@ int main(int argc, char** argv) {
             }, data, len);
         });
 #else
-        machine.set_printer([](const auto&, const char* data, size_t len) {
-            std::cout.write(data, len);
-            std::cout.flush();
+        syscalls::g_console.set_output([](const char* data, size_t len) {
+            std::cout.flush();  // Keep ordering with the runtime's own messages
+            while (len > 0) {
+                ssize_t n = ::write(STDOUT_FILENO, data, len);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                data += n;
+                len -= n;
+            }
         });
+        syscalls::g_console.set_line_buffered(isatty(STDOUT_FILENO));
 #endif
+        machine.set_printer([](const auto&, const char* data, size_t len) {
+            syscalls::g_console.write(data, len);
+        });
 
         // Debug: trace unhandled syscalls with name lookup
         Machine::on_unhandled_syscall = [](Machine& m, size_t nr) {
-            static const std::unordered_map<size_t, const char*> names = {
-                {17,"getcwd"},{19,"eventfd2"},{20,"epoll_create1"},{21,"epoll_ctl"},
-                {22,"epoll_pwait"},{23,"dup"},{24,"dup3"},{25,"fcntl"},{29,"ioctl"},
-                {32,"flock"},{34,"mkdirat"},{35,"unlinkat"},{36,"symlinkat"},
-                {37,"linkat"},{38,"renameat"},{46,"ftruncate"},{48,"faccessat"},
-                {49,"chdir"},{52,"fchmod"},{53,"fchmodat"},{54,"fchownat"},
-                {55,"fchown"},{56,"openat"},{57,"close"},{59,"pipe2"},
-                {61,"getdents64"},{62,"lseek"},{63,"read"},{64,"write"},
-                {65,"readv"},{66,"writev"},{67,"pread64"},{68,"pwrite64"},
-                {70,"pwritev"},{71,"sendfile"},{73,"ppoll"},{78,"readlinkat"},
-                {79,"newfstatat"},{80,"fstat"},{82,"fsync"},{90,"capget"},
-                {93,"exit"},{94,"exit_group"},{96,"set_tid_address"},
-                {98,"futex"},{99,"set_robust_list"},{101,"nanosleep"},
-                {113,"clock_gettime"},{114,"clock_getres"},{120,"sched_getscheduler"},
-                {121,"sched_getparam"},{123,"sched_getaffinity"},{124,"sched_yield"},
-                {129,"kill"},{130,"tkill"},{131,"tgkill"},{132,"sigaltstack"},
-                {134,"sigaction"},{135,"sigprocmask"},{139,"rt_sigreturn"},
-                {148,"getresuid"},{150,"getresgid"},{155,"getpgid"},
-                {158,"getgroups"},{160,"uname"},{166,"umask"},{167,"prctl"},
-                {172,"getpid"},{173,"getppid"},{174,"getuid"},{175,"geteuid"},
-                {176,"getgid"},{177,"getegid"},{178,"gettid"},{179,"sysinfo"},
-                {198,"socket"},{199,"socketpair"},{200,"bind"},{201,"listen"},
-                {202,"accept"},{203,"connect"},{204,"getsockname"},
-                {205,"getpeername"},{206,"sendto"},{207,"recvfrom"},
-                {208,"setsockopt"},{209,"getsockopt"},{210,"shutdown"},
-                {211,"sendmsg"},{212,"recvmsg"},{214,"brk"},{215,"munmap"},
-                {216,"mremap"},{220,"clone"},{221,"execve"},{222,"mmap"},
-                {226,"mprotect"},{233,"madvise"},{260,"wait4"},{261,"prlimit64"},
-                {278,"getrandom"},{283,"membarrier"},{291,"statx"},
-                {293,"rseq"},{425,"io_uring_setup"},{439,"faccessat2"},
-            };
-            auto it = names.find(nr);
-            const char* name = it != names.end() ? it->second : "???";
+            const char* name = syscalls::syscall_name(nr);
             std::cerr << "[syscall] UNHANDLED #" << nr << " (" << name << ")"
                       << " a0=" << m.cpu.reg(10)
                       << " a1=" << m.cpu.reg(11) << "\n";
@@ -1122,6 +1279,15 @@ int main(int argc, char** argv) {
             syscalls::g_checkpoint_on_stdin = true;
         }
 
+#ifndef __EMSCRIPTEN__
+        if (parallel_threads) {
+            syscalls::g_harts.enable(machine);
+            // Stop the other harts on the way out, before machine_ptr (set
+            // up before this) is destroyed
+            std::atexit([] { syscalls::g_harts.shutdown(); });
+        }
+#endif
+
         std::cout << "[friscy] Starting execution...\n";
         std::cout << "----------------------------------------\n";
 
@@ -1144,7 +1310,10 @@ int main(int argc, char** argv) {
                 while (true) {
                     // Use resume<false>() to accumulate instruction counter
                     // across chunks (simulate<false> resets counter to 0 each call)
-                    machine.resume<false>(YIELD_CHUNK);
+                    machine.resume<false>(syscalls::sched_chunk(machine, YIELD_CHUNK));
+                    syscalls::sched_tick(machine);
+                    syscalls::g_console.tick();
+                    syscalls::vdso_refresh(machine);
                     if (syscalls::g_waiting_for_stdin) break;
                     if (syscalls::g_waiting_for_host_fetch) break;
                     if (syscalls::g_execve_restart) break;
@@ -1158,7 +1327,14 @@ int main(int argc, char** argv) {
                     continue;
                 }
 #else
-                machine.simulate(MAX_INSTRUCTIONS);
+                // One chunk while single-threaded; with threads, chunks end
+                // at time-slice boundaries so sched_tick can preempt
+                do {
+                    machine.resume<false>(syscalls::sched_chunk(machine, MAX_INSTRUCTIONS));
+                    syscalls::sched_tick(machine);
+                } while (machine.instruction_limit_reached()
+                         && machine.instruction_counter() < MAX_INSTRUCTIONS);
+                syscalls::g_console.flush();
                 // Checkpoint export: save state when machine first waits for stdin
                 if (syscalls::g_waiting_for_stdin && !export_checkpoint_path.empty()) {
                     fprintf(stderr, "[friscy] Saving checkpoint at stdin wait point...\n");
@@ -1292,7 +1468,7 @@ int main(int argc, char** argv) {
 #endif
                 std::cerr << "[friscy] simulate() returned normally, retries=" << retries
                           << " instructions=" << machine.instruction_counter()
-                          << " exit_code=" << machine.return_value()
+                          << " exit_code=" << syscalls::exit_code(machine)
                           << " pc=0x" << std::hex << machine.cpu.pc() << std::dec
                           << " stopped=" << machine.stopped()
                           << " stdin_wait=" << syscalls::g_waiting_for_stdin
@@ -1354,6 +1530,7 @@ int main(int argc, char** argv) {
                 return 1;
             }
         }
+        syscalls::g_console.flush();
 
 #ifdef __EMSCRIPTEN__
         if (syscalls::g_waiting_for_stdin || syscalls::g_waiting_for_host_fetch) {
@@ -1367,12 +1544,26 @@ int main(int argc, char** argv) {
 
         // Report results
         auto [instructions, _] = machine.get_counters();
-        auto exit_code = machine.return_value();
+        int exit_code = syscalls::exit_code(machine);
 
         std::cout << "[friscy] Execution complete\n";
         std::cout << "[friscy] Instructions: " << instructions << "\n";
         std::cout << "[friscy] Exit code: " << exit_code << "\n";
 
+        if (!syscall_stats_path.empty()) {
+            std::string json = syscalls::g_syscall_stats.json();
+            if (syscall_stats_path == "-") {
+                std::cerr << json;
+            } else {
+                std::ofstream out(syscall_stats_path);
+                if (!out) {
+                    std::cerr << "Error: Could not open syscall stats path: " << syscall_stats_path << "\n";
+                    return 1;
+                }
+                out << json;
+            }
+        }
+
         // Export VFS as tar if requested
         if (!export_tar_path.empty()) {
             std::cout << "[friscy] Exporting VFS to tar: " << export_tar_path << "\n";
@@ -1386,7 +1577,19 @@ int main(int argc, char** argv) {
             std::cout << "[friscy] Exported " << tar_data.size() << " bytes\n";
         }
 
-        return static_cast<int>(exit_code);
+        // Export only the entries this session changed
+        if (!export_delta_path.empty()) {
+            auto delta = g_vfs.save_delta(delta_base_gen);
+            std::ofstream out(export_delta_path, std::ios::binary);
+            if (!out) {
+                std::cerr << "Error: Could not open export delta path: " << export_delta_path << "\n";
+                return 1;
+            }
+            out.write(reinterpret_cast<const char*>(delta.data()), delta.size());
+            std::cout << "[friscy] Exported delta " << delta.size() << " bytes\n";
+        }
+
+        return exit_code;
 
     } catch (const riscv::MachineException& e) {
         std::cerr << "\n[friscy] Machine exception: " << e.what();
@@ -18,6 +18,8 @@
 #pragma once
 
 #include <libriscv/machine.hpp>
+#include "fd_table.hpp"
+#include "guest_span.hpp"
 #include <cstdint>
 #include <unordered_map>
 #include <vector>
@@ -138,10 +140,6 @@ struct VSocket {
 // Network context - holds all virtual sockets
 class NetworkContext {
 public:
-    static constexpr int SOCKET_FD_BASE = 1000;  // Start socket FDs here to avoid VFS collision
-
-    NetworkContext() : next_fd_(SOCKET_FD_BASE) {}
-
     int create_socket(int domain, int type, int protocol) {
         if (domain != af::INET && domain != af::INET6) {
             return err::AFNOSUPPORT;
@@ -158,7 +156,14 @@ public:
         }
 #endif
 
-        int fd = next_fd_++;
+        // Sockets are numbered in the guest's shared fd table
+        int fd = syscalls::g_fds.alloc(syscalls::FdKind::Socket);
+        if (fd < 0) {
+#ifndef __EMSCRIPTEN__
+            ::close(native_fd);
+#endif
+            return fd;
+        }
         VSocket sock;
         sock.fd = fd;
         sock.domain = domain;
@@ -202,15 +207,11 @@ public:
 #endif
 
         sockets_.erase(it);
+        syscalls::g_fds.release(fd);
         return 0;
     }
 
-    bool is_socket_fd(int fd) const {
-        return fd >= SOCKET_FD_BASE && sockets_.count(fd) > 0;
-    }
-
 private:
-    int next_fd_;
     std::unordered_map<int, VSocket> sockets_;
 
 #ifdef __EMSCRIPTEN__
@@ -681,28 +682,26 @@ inline void sys_sendto(Machine& m) {
         return;
     }
 
-    // Read data from guest memory
-    std::vector<uint8_t> data(len);
-    m.memory.memcpy_out(data.data(), buf_ptr, len);
-
+    // Send straight out of guest memory
 #ifdef __EMSCRIPTEN__
-    int result = EM_ASM_INT({
-        if (typeof Module.onSocketSend === 'function') {
-            const data = new Uint8Array(Module.HEAPU8.buffer, $1, $2);
-            return Module.onSocketSend($0, data);
-        }
-        return -38;
-    }, sockfd, data.data(), len);
-
-    m.set_result(result >= 0 ? (int64_t)len : result);
+    m.set_result(syscalls::guest_transfer<syscalls::GuestAccess::Read>(m, buf_ptr, len,
+        [&](char* buf, size_t size, size_t) -> ssize_t {
+            int result = EM_ASM_INT({
+                if (typeof Module.onSocketSend === 'function') {
+                    const data = new Uint8Array(Module.HEAPU8.buffer, $1, $2);
+                    return Module.onSocketSend($0, data);
+                }
+                return -38;
+            }, sockfd, buf, size);
+            return result >= 0 ? (ssize_t)size : result;
+        }));
 #else
     // Native: use real send
-    ssize_t result = ::send(sock->native_fd, data.data(), len, 0);
-    if (result >= 0) {
-        m.set_result(result);
-    } else {
-        m.set_result(-errno);
-    }
+    m.set_result(syscalls::guest_transfer<syscalls::GuestAccess::Read>(m, buf_ptr, len,
+        [&](char* buf, size_t size, size_t) -> ssize_t {
+            ssize_t result = ::send(sock->native_fd, buf, size, 0);
+            return result >= 0 ? result : -errno;
+        }));
 #endif
 }
 
@@ -738,17 +737,19 @@ inline void sys_recvfrom(Machine& m) {
 
     // Drain data from JS network bridge buffer via Module.readSocketData.
     // readSocketData returns an array of bytes or null if no data.
-    // We write directly into guest memory using the arena pointer.
-    auto view = m.memory.memview(buf_ptr, len);
-    int bytes_read = EM_ASM_INT({
-        if (typeof Module.readSocketData !== 'function') return 0;
-        var result = Module.readSocketData($0, $1);
-        if (!result || result.length === 0) return 0;
-        for (var i = 0; i < result.length; i++) {
-            Module.HEAPU8[$2 + i] = result[i];
-        }
-        return result.length;
-    }, sockfd, (int)len, (int)(uintptr_t)view.data());
+    // We write directly into guest memory.
+    ssize_t bytes_read = syscalls::guest_transfer<syscalls::GuestAccess::Write>(m, buf_ptr, len,
+        [&](char* buf, size_t size, size_t) -> ssize_t {
+            return EM_ASM_INT({
+                if (typeof Module.readSocketData !== 'function') return 0;
+                var result = Module.readSocketData($0, $1);
+                if (!result || result.length === 0) return 0;
+                for (var i = 0; i < result.length; i++) {
+                    Module.HEAPU8[$2 + i] = result[i];
+                }
+                return result.length;
+            }, sockfd, (int)size, (int)(uintptr_t)buf);
+        });
 
     if (bytes_read > 0) {
         m.set_result(bytes_read);
@@ -758,17 +759,12 @@ inline void sys_recvfrom(Machine& m) {
     // No data available
     m.set_result(-11);  // EAGAIN
 #else
-    // Native: use real recv
-    std::vector<uint8_t> buf(len);
-    ssize_t result = ::recv(sock->native_fd, buf.data(), len, 0);
-    if (result > 0) {
-        m.memory.memcpy(buf_ptr, buf.data(), result);
-        m.set_result(result);
-    } else if (result == 0) {
-        m.set_result(0);  // Connection closed
-    } else {
-        m.set_result(-errno);
-    }
+    // Native: use real recv, straight into guest memory (0: connection closed)
+    m.set_result(syscalls::guest_transfer<syscalls::GuestAccess::Write>(m, buf_ptr, len,
+        [&](char* buf, size_t size, size_t) -> ssize_t {
+            ssize_t result = ::recv(sock->native_fd, buf, size, 0);
+            return result >= 0 ? result : -errno;
+        }));
 #endif
 }
 
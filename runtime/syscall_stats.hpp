@@ -0,0 +1,249 @@
+// syscall_stats.hpp - Always-on syscall statistics
+//
+// libriscv calls Machine::on_syscall_enter/on_syscall_leave around every
+// dispatched ecall; syscalls.hpp points them at this table. Per syscall
+// number it keeps the call count, host time (total, max, and a log2
+// latency histogram), errors and, for the calls that move data, bytes
+// transferred. Globally it keeps a histogram of guest instructions retired
+// between syscalls. Bookkeeping is two clock reads and a few adds per call,
+// cheap enough to leave on.
+//
+// A dispatch that leaves the CPU somewhere other than just after its ecall
+// (a blocking call rewound for retry, a thread switch, execve, a signal
+// frame) is counted as rescheduled; its result and bytes are not attributed.
+//
+// Readers: /proc/friscy/syscalls (text, regenerated on open), --syscall-stats
+// <path> (JSON at exit), and friscy_syscall_stats_json() for the worker.
+
+#pragma once
+
+#include <libriscv/common.hpp>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace syscalls {
+
+inline const char* syscall_name(size_t nr) {
+    switch (nr) {
+    case 17: return "getcwd"; case 19: return "eventfd2"; case 20: return "epoll_create1";
+    case 21: return "epoll_ctl"; case 22: return "epoll_pwait"; case 23: return "dup";
+    case 24: return "dup3"; case 25: return "fcntl"; case 29: return "ioctl";
+    case 32: return "flock"; case 34: return "mkdirat"; case 35: return "unlinkat";
+    case 36: return "symlinkat"; case 37: return "linkat"; case 38: return "renameat";
+    case 46: return "ftruncate"; case 48: return "faccessat"; case 49: return "chdir";
+    case 52: return "fchmod"; case 53: return "fchmodat"; case 54: return "fchownat";
+    case 55: return "fchown"; case 56: return "openat"; case 57: return "close";
+    case 59: return "pipe2"; case 61: return "getdents64"; case 62: return "lseek";
+    case 63: return "read"; case 64: return "write"; case 65: return "readv";
+    case 66: return "writev"; case 67: return "pread64"; case 68: return "pwrite64";
+    case 69: return "preadv"; case 70: return "pwritev"; case 71: return "sendfile";
+    case 73: return "ppoll"; case 76: return "splice"; case 78: return "readlinkat";
+    case 79: return "newfstatat"; case 80: return "fstat"; case 82: return "fsync";
+    case 85: return "timerfd_create"; case 86: return "timerfd_settime";
+    case 87: return "timerfd_gettime"; case 90: return "capget"; case 93: return "exit"; case 94: return "exit_group";
+    case 96: return "set_tid_address"; case 98: return "futex"; case 99: return "set_robust_list";
+    case 101: return "nanosleep"; case 113: return "clock_gettime"; case 114: return "clock_getres";
+    case 115: return "clock_nanosleep";
+    case 120: return "sched_getscheduler"; case 121: return "sched_getparam";
+    case 123: return "sched_getaffinity"; case 124: return "sched_yield"; case 129: return "kill";
+    case 130: return "tkill"; case 131: return "tgkill"; case 132: return "sigaltstack";
+    case 134: return "sigaction"; case 135: return "sigprocmask"; case 139: return "rt_sigreturn";
+    case 148: return "getresuid"; case 150: return "getresgid"; case 155: return "getpgid";
+    case 158: return "getgroups"; case 160: return "uname"; case 166: return "umask";
+    case 167: return "prctl"; case 169: return "gettimeofday"; case 172: return "getpid";
+    case 173: return "getppid"; case 174: return "getuid"; case 175: return "geteuid";
+    case 176: return "getgid"; case 177: return "getegid"; case 178: return "gettid";
+    case 179: return "sysinfo"; case 198: return "socket"; case 199: return "socketpair";
+    case 200: return "bind"; case 201: return "listen"; case 202: return "accept";
+    case 203: return "connect"; case 204: return "getsockname"; case 205: return "getpeername";
+    case 206: return "sendto"; case 207: return "recvfrom"; case 208: return "setsockopt";
+    case 209: return "getsockopt"; case 210: return "shutdown"; case 211: return "sendmsg";
+    case 212: return "recvmsg"; case 214: return "brk"; case 215: return "munmap";
+    case 216: return "mremap"; case 220: return "clone"; case 221: return "execve";
+    case 222: return "mmap"; case 226: return "mprotect"; case 233: return "madvise";
+    case 242: return "accept4"; case 260: return "wait4"; case 261: return "prlimit64";
+    case 278: return "getrandom"; case 283: return "membarrier"; case 285: return "copy_file_range";
+    case 291: return "statx"; case 293: return "rseq"; case 425: return "io_uring_setup";
+    case 426: return "io_uring_enter"; case 427: return "io_uring_register";
+    case 435: return "clone3"; case 439: return "faccessat2";
+    default: return nr >= 600 && nr <= 803 ? "vh" : "?";
+    }
+}
+
+class SyscallStats {
+public:
+    static constexpr size_t MAX_NR = RISCV_SYSCALLS_MAX;
+    // Latency bucket b holds calls under 2^(b+8) ns (bucket 0: under 256ns);
+    // the last one is open-ended
+    static constexpr int LATENCY_BUCKETS = 20;
+    // Gap bucket b holds runs of under 2^b instructions
+    static constexpr int GAP_BUCKETS = 40;
+
+    struct PerSyscall {
+        uint64_t calls = 0;
+        uint64_t rescheduled = 0;
+        uint64_t errors = 0;
+        uint64_t bytes = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        std::array<uint64_t, LATENCY_BUCKETS> latency{};
+    };
+
+    // Syscalls whose positive result is a byte count
+    void count_bytes(size_t nr) {
+        if (nr < MAX_NR) moves_bytes_[nr] = true;
+    }
+
+    // enter and leave bracket one dispatch on machine. With
+    // --parallel-threads they run under the syscall lock (harts.hpp), which
+    // is what makes adding into the shared table safe.
+    void enter(const void* machine, size_t nr, uint64_t pc, uint64_t instructions) {
+        InFlight& d = t_dispatch_;
+        if (d.machine == machine) {
+            uint64_t gap = instructions >= d.last_instructions ? instructions - d.last_instructions
+                                                               : instructions;
+            gaps_[std::min<int>(std::bit_width(gap), GAP_BUCKETS - 1)]++;
+            guest_instructions_ += gap;
+        } else {
+            // No baseline yet on this thread: a hart's counter starts
+            // wherever the fork left it
+            d.machine = machine;
+        }
+        d.nr = nr;
+        d.pc = pc;
+        d.start_ns = now_ns();
+    }
+
+    void leave(size_t nr, uint64_t pc, int64_t result, uint64_t instructions) {
+        InFlight& d = t_dispatch_;
+        uint64_t ns = now_ns() - d.start_ns;
+        d.last_instructions = instructions;
+        if (nr != d.nr || nr >= MAX_NR) return;
+        auto& s = table_[nr];
+        s.calls++;
+        s.total_ns += ns;
+        s.max_ns = std::max(s.max_ns, ns);
+        s.latency[std::min<int>(std::bit_width(ns >> 8), LATENCY_BUCKETS - 1)]++;
+        if (pc != d.pc) {
+            s.rescheduled++;
+        } else if (result < 0 && result >= -4095) {
+            s.errors++;
+        } else if (result > 0 && moves_bytes_[nr]) {
+            s.bytes += result;
+        }
+    }
+
+    const PerSyscall& operator[](size_t nr) const { return table_[nr]; }
+
+    // Human-readable table, busiest (by host time) first
+    std::string text() const {
+        std::string out;
+        char line[256];
+        snprintf(line, sizeof(line), "%4s %-20s %12s %10s %8s %14s %10s %10s %14s\n",
+                 "nr", "name", "calls", "resched", "errors", "total_us", "avg_ns", "max_ns", "bytes");
+        out += line;
+        for (size_t nr : by_time()) {
+            const auto& s = table_[nr];
+            snprintf(line, sizeof(line),
+                     "%4zu %-20s %12" PRIu64 " %10" PRIu64 " %8" PRIu64 " %14" PRIu64 " %10" PRIu64
+                     " %10" PRIu64 " %14" PRIu64 "\n",
+                     nr, syscall_name(nr), s.calls, s.rescheduled, s.errors, s.total_ns / 1000,
+                     s.total_ns / s.calls, s.max_ns, s.bytes);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "\nguest instructions between syscalls: %" PRIu64 " total\n",
+                 guest_instructions_);
+        out += line;
+        for (int b = 0; b < GAP_BUCKETS; b++) {
+            if (!gaps_[b]) continue;
+            snprintf(line, sizeof(line), "  < 2^%-2d %12" PRIu64 "\n", b, gaps_[b]);
+            out += line;
+        }
+        return out;
+    }
+
+    std::string json() const {
+        std::string out = "{\"syscalls\":[";
+        char buf[256];
+        bool first = true;
+        for (size_t nr : by_time()) {
+            const auto& s = table_[nr];
+            snprintf(buf, sizeof(buf),
+                     "%s{\"nr\":%zu,\"name\":\"%s\",\"calls\":%" PRIu64 ",\"rescheduled\":%" PRIu64
+                     ",\"errors\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"total_ns\":%" PRIu64
+                     ",\"max_ns\":%" PRIu64 ",\"latency_log2_ns\":",
+                     first ? "" : ",", nr, syscall_name(nr), s.calls, s.rescheduled, s.errors,
+                     s.bytes, s.total_ns, s.max_ns);
+            out += buf;
+            append_array(out, s.latency.data(), LATENCY_BUCKETS);
+            out += '}';
+            first = false;
+        }
+        snprintf(buf, sizeof(buf), "],\"guest_instructions\":%" PRIu64 ",\"gap_log2_instructions\":",
+                 guest_instructions_);
+        out += buf;
+        append_array(out, gaps_.data(), GAP_BUCKETS);
+        out += "}\n";
+        return out;
+    }
+
+private:
+    std::array<PerSyscall, MAX_NR> table_{};
+    std::array<bool, MAX_NR> moves_bytes_{};
+    std::array<uint64_t, GAP_BUCKETS> gaps_{};
+    uint64_t guest_instructions_ = 0;
+    // The dispatch in flight. Each hart is a host thread with a Machine
+    // and instruction counter of its own, and a handler that drops the
+    // syscall lock to wait lets the other harts dispatch meanwhile, so this
+    // is kept per thread; the instruction baseline belongs to machine.
+    struct InFlight {
+        const void* machine = nullptr;
+        uint64_t last_instructions = 0;
+        size_t nr = MAX_NR;
+        uint64_t pc = 0;
+        uint64_t start_ns = 0;
+    };
+    static thread_local InFlight t_dispatch_;
+
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::vector<size_t> by_time() const {
+        std::vector<size_t> nrs;
+        for (size_t nr = 0; nr < MAX_NR; nr++) {
+            if (table_[nr].calls) nrs.push_back(nr);
+        }
+        std::sort(nrs.begin(), nrs.end(), [&](size_t a, size_t b) {
+            return table_[a].total_ns > table_[b].total_ns;
+        });
+        return nrs;
+    }
+
+    static void append_array(std::string& out, const uint64_t* v, int n) {
+        // Trailing empty buckets are left out
+        while (n > 0 && v[n - 1] == 0) n--;
+        out += '[';
+        for (int i = 0; i < n; i++) {
+            if (i) out += ',';
+            out += std::to_string(v[i]);
+        }
+        out += ']';
+    }
+};
+
+inline thread_local SyscallStats::InFlight SyscallStats::t_dispatch_;
+
+inline SyscallStats g_syscall_stats;
+
+inline constexpr const char* SYSCALL_STATS_PATH = "/proc/friscy/syscalls";
+
+}  // namespace syscalls
@@ -6,13 +6,27 @@
 
 #include <libriscv/machine.hpp>
 #include "vfs.hpp"
+#include "fd_table.hpp"
+#include "console.hpp"
+#include "entropy.hpp"
+#include "guest_span.hpp"
+#include "io_uring.hpp"
+#include "timers.hpp"
+#include "syscall_stats.hpp"
+#include "harts.hpp"
 #include "elf_loader.hpp"
+#include "vdso.hpp"
 #include <ctime>
 #include <cstring>
-#include <random>
 #include <iostream>
+#include <array>
+#include <deque>
 #include <set>
+#include <stdexcept>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <bit>
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #else
@@ -36,6 +50,16 @@ inline bool g_checkpoint_on_stdin = false;
 inline int g_idle_epoll_count = 0;
 static constexpr int IDLE_EPOLL_THRESHOLD = 3;  // stop after 3 consecutive idle polls
 
+// Exit status for a run the emulator ended on the guest's behalf (a futex
+// deadlock), or -1. a0 cannot carry it: the stopped thread's a0 holds its
+// syscall result, and sched_tick may still switch threads after the stop.
+inline int g_forced_exit_code = -1;
+
+// The exit status to report once the machine has stopped for good
+inline int exit_code(const Machine& m) {
+    return g_forced_exit_code >= 0 ? g_forced_exit_code : m.template return_value<int>();
+}
+
 // Host fetch hypercall (syscall 500): guest does ecall with a7=500,
 // machine stops, Worker performs fetch, writes response, resumes.
 inline bool g_waiting_for_host_fetch = false;
@@ -57,23 +81,50 @@ inline int g_trace_countdown = 0;
 
 // Network bridge function pointers (set by main.cpp after network.hpp is included).
 // Avoids including network.hpp here (which would cause macro clashes with fcntl.h).
-inline bool (*net_is_socket_fd)(int fd) = nullptr;
+inline int  (*net_close_socket)(int fd) = nullptr;
 inline int  (*net_get_native_fd)(int fd) = nullptr;  // returns native fd or -1
 inline void (*net_set_nonblock)(int fd, bool on) = nullptr;  // set O_NONBLOCK on native socket
 
-// eventfd tracking: maps VFS fd → counter (0 means empty/not signaled)
-inline std::unordered_map<int, uint64_t> g_eventfd_counters;
+// eventfds (see "eventfd" below). dup'ed eventfds share one counter.
+struct EventFd {
+    uint32_t id;
+    uint64_t counter = 0;  // 0 means empty/not signaled
+};
+inline std::unordered_map<int, std::shared_ptr<EventFd>> g_eventfds;
+inline uint32_t g_next_eventfd_id = 1;
 
-// Epoll instance (forward declaration — used by eventfd write to wake sleeping threads)
+// Epoll instances (see "epoll readiness" below). dup'ed epoll fds share
+// one instance.
 struct EpollInterest {
     uint32_t events;
     uint64_t data;
+    uint64_t key = 0;       // Watch key of the object behind the fd (0: none)
+    uint32_t seen = 0;      // Last readiness of a polled fd
+    bool polled = false;    // State changes on the host; rechecked every wait
+    bool queued = false;    // On the ready list
+    bool disabled = false;  // EPOLLONESHOT fired; re-armed by EPOLL_CTL_MOD
 };
 struct EpollInstance {
+    uint32_t id;
     std::unordered_map<int, EpollInterest> interests;
+    std::deque<int> ready;    // fds to recheck, each at most once
+    std::vector<int> polled;  // fds with polled interests
 };
-inline std::unordered_map<int, EpollInstance> g_epoll_instances;
-inline int g_next_epoll_fd = 2000;
+inline std::unordered_map<int, std::shared_ptr<EpollInstance>> g_epoll_instances;
+inline uint32_t g_next_epoll_id = 1;
+
+// timerfds (see "timerfd" below). dup'ed timerfds share one timer.
+struct TimerFd {
+    uint32_t id;
+    bool nonblock = false;
+    bool realtime = false;     // Absolute settings are on CLOCK_REALTIME
+    uint64_t deadline = 0;     // Next expiration on the guest clock (0: disarmed)
+    uint64_t interval = 0;     // Period in ns (0: one-shot)
+    uint64_t expirations = 0;  // Not yet read
+    int timer = -1;            // g_timers handle while armed
+};
+inline std::unordered_map<int, std::shared_ptr<TimerFd>> g_timerfds;
+inline uint32_t g_next_timerfd_id = 1;
 
 // Cooperative fork state — single-process vfork emulation.
 // On clone(): save parent registers, return 0 (child runs).
@@ -103,13 +154,13 @@ struct ForkState {
     MemRegion interp_data;
     MemRegion stack_data;
     MemRegion mmap_data;     // guest mmap allocations (TLS, malloc)
-    // VFS fd snapshot: fds open before fork. On child exit, close any
-    // fds not in this set to undo child's dup2/pipe/open changes.
+    // fd snapshot: the table and the VFS fds open before fork. On child
+    // exit, close any fds not in it to undo child's dup2/pipe/open changes.
+    std::vector<FdKind> parent_fds;
     std::set<int> parent_open_fds;
-    // Thread scheduler snapshot: saved as raw bytes to avoid ordering
-    // dependency on ThreadScheduler definition. execve in fork child
-    // resets g_sched; must restore parent's thread state on child exit.
-    alignas(16) uint8_t saved_sched[8192];  // enough for ThreadScheduler (~5KB)
+    // Thread scheduler snapshot (ThreadScheduler::save). execve in fork
+    // child resets g_sched; must restore parent's thread state on child exit.
+    std::vector<uint8_t> saved_sched;
 };
 inline ForkState g_fork = {};
 inline pid_t g_next_pid = 100;
@@ -155,137 +206,652 @@ struct TermiosState {
 };
 // Shared termios for the tty (fd 0/1/2 all refer to the same terminal)
 inline TermiosState g_termios;
-// Track which fds are tty fds (0/1/2 are always tty; /dev/tty opens add more)
-inline std::set<int> g_tty_fds = {0, 1, 2};
-
-// Cooperative thread scheduler for CLONE_THREAD.
-// When clone creates a thread, we save the parent's state and let the child
-// run. When the child calls futex_wait (it's idle), we switch back to the
-// parent. This handles V8's pattern: create thread → main waits on futex →
-// thread does work → thread wakes main.
+
+// Thread scheduler for CLONE_THREAD.
+// Every guest thread runs on the one Machine; a VThread holds the register
+// file of each thread that is not on the CPU. Threads give up the CPU when
+// they block (futex, pipe, epoll, ...) and are preempted when their time
+// slice, counted in guest instructions, runs out. The run loops in main.cpp
+// end each dispatch chunk at the slice boundary (sched_chunk) and switch
+// there (sched_tick), so threads that never make a syscall are preempted
+// too.
 struct VThread {
     uint64_t regs[32];
-    uint64_t pc;
+    uint64_t fregs[32];
+    uint32_t fcsr;
+    uint64_t pc;      // The ecall it left the CPU at; it resumes at pc + 4
     int tid;
     bool active;      // Thread exists
     bool waiting;     // Blocked on futex_wait
     uint64_t futex_addr;  // Address being waited on (if waiting)
-    int32_t futex_val;    // Expected value (if waiting)
+    uint32_t futex_bitset;  // FUTEX_WAIT_BITSET mask (if waiting)
+    uint64_t deadline;    // Guest-clock ns when the wait times out (0: never)
+    int timer;            // Its g_timers handle
+    int32_t timeout_result;  // a0 if it times out
+    bool restart;         // The syscall re-runs when woken (pc is one ecall back)
+    bool timed_out;       // The wait ended at its deadline
+    bool host_wait;       // What it waits for may come from the host
+    uint64_t restart_deadline;  // Deadline a re-running wait keeps (0: none)
     uint64_t clear_child_tid;  // CLONE_CHILD_CLEARTID address (written 0 + futex wake on exit)
-    uint64_t syscall_budget;   // Syscalls remaining before forced yield
+    uint64_t runtime;      // Guest instructions retired on the CPU
+    uint64_t dispatches;   // Times switched onto the CPU
+    uint64_t preemptions;  // Times switched off with its slice used up
+    // Slot links: the run queue while runnable, the free list once the
+    // slot is unused; the futex wait queue while waiting
+    int run_next, run_prev;
+    int wait_next, wait_prev;
 };
-constexpr int MAX_VTHREADS = 16;
-constexpr uint64_t THREAD_QUANTUM = 50000;
+static_assert(std::is_trivially_copyable_v<VThread>);
+constexpr uint64_t DEFAULT_TIME_SLICE = 1'000'000;  // Guest instructions
+// Set by --time-slice; kept out of g_sched so a checkpoint restore keeps it
+inline uint64_t g_time_slice = DEFAULT_TIME_SLICE;
+// wake() count for "every waiter"
+constexpr int WAKE_ALL = INT32_MAX;
+constexpr uint32_t FUTEX_BITSET_ANY = 0xFFFFFFFF;
+
+// The thread table grows as threads are created; exited threads' slots are
+// reused. Runnable threads (the running one included) form a circular run
+// queue, so picking the next one is O(1). Blocked threads hang off a hash
+// table of futex wait queues keyed by address (pipe and epoll waits use
+// synthetic keys), FIFO per bucket, so a wake only looks at threads that
+// hashed to the same bucket. Timed waits also sit in the timer wheel
+// (timers.hpp), owned by their slot index.
 struct ThreadScheduler {
-    VThread threads[MAX_VTHREADS];
+    static constexpr int NONE = -1;
+    static constexpr int MAX_THREADS = 4096;
+    static constexpr size_t FUTEX_BUCKETS = 256;
+    // Wait keys from here up are not guest addresses: the thread waits for
+    // a pipe or epoll set, whose readiness may come from the host
+    static constexpr uint64_t IO_KEY_MIN = 1ULL << 56;
+    // Not a guest address either, and never woken: only the deadline ends
+    // the wait (nanosleep)
+    static constexpr uint64_t SLEEP_KEY = IO_KEY_MIN - 1;
+
+    struct WaitQueue {
+        int head = NONE;
+        int tail = NONE;
+    };
+
+    std::vector<VThread> threads;
     int current = 0;      // Index of currently running thread
     int count = 0;         // Number of active threads
+    uint64_t slice_start = 0;  // Instruction counter when current got the CPU
+    int run_head = NONE;   // Where next_runnable starts when current is not queued
+    int free_head = NONE;  // Unused slots, chained through run_next
+    std::array<WaitQueue, FUTEX_BUCKETS> futex_queues{};
 
     void init(int main_tid) {
+        clear();
+        threads.push_back(VThread{});
         threads[0].tid = main_tid;
         threads[0].active = true;
-        threads[0].waiting = false;
-        current = 0;
+        threads[0].dispatches = 1;
         count = 1;
+        run_link(0);
+    }
+
+    // Forget every thread (exit_group)
+    void clear() {
+        drop_timers();
+        threads.clear();
+        current = 0;
+        count = 0;
+        run_head = free_head = NONE;
+        futex_queues.fill(WaitQueue{});
     }
 
     int add_thread(int tid) {
-        for (int i = 0; i < MAX_VTHREADS; i++) {
-            if (!threads[i].active) {
-                threads[i].tid = tid;
-                threads[i].active = true;
-                threads[i].waiting = false;
-                threads[i].clear_child_tid = 0;
-                threads[i].syscall_budget = THREAD_QUANTUM;
-                count++;
-                return i;
-            }
+        int i = free_head;
+        if (i != NONE) {
+            free_head = threads[i].run_next;
+        } else if (threads.size() < MAX_THREADS) {
+            i = static_cast<int>(threads.size());
+            threads.emplace_back();
+        } else {
+            return -1;  // No slots
+        }
+        threads[i] = VThread{};
+        threads[i].tid = tid;
+        threads[i].active = true;
+        count++;
+        run_link(i);
+        return i;
+    }
+
+    void remove_thread(int idx) {
+        auto& t = threads[idx];
+        if (!t.active) return;
+        if (t.waiting) {
+            wait_unlink(idx);
+            if (t.deadline) g_timers.cancel(t.timer);
+        } else {
+            run_unlink(idx);
         }
-        return -1;  // No slots
+        t.active = false;
+        t.waiting = false;
+        t.run_next = free_head;
+        free_head = idx;
+        count--;
+    }
+
+    // Next runnable thread other than skip, round-robin: the thread queued
+    // after skip (or the current thread), or, if that one has left the
+    // queue, the one that followed it
+    int next_runnable(int skip = -1) const {
+        int from = skip >= 0 ? skip : current;
+        int i = runnable(from) ? threads[from].run_next : run_head;
+        if (i == NONE) return NONE;
+        if (i == skip) i = threads[i].run_next;
+        return i == skip ? NONE : i;
+    }
+
+    // Block thread idx on key until a wake() for it that matches bitset, or
+    // until deadline (guest-clock ns, 0 for none) passes; it then resumes
+    // with -ETIMEDOUT unless the caller sets another timeout_result
+    void block(int idx, uint64_t key, uint32_t bitset = FUTEX_BITSET_ANY, uint64_t deadline = 0) {
+        auto& t = threads[idx];
+        run_unlink(idx);
+        t.waiting = true;
+        t.futex_bitset = bitset;
+        t.deadline = deadline;
+        if (deadline) t.timer = g_timers.add(deadline, idx);
+        t.timeout_result = -110;  // ETIMEDOUT
+        t.restart = t.timed_out = t.host_wait = false;
+        wait_link(idx, key);
+    }
+
+    void unblock(int idx) {
+        auto& t = threads[idx];
+        wait_unlink(idx);
+        if (t.deadline) g_timers.cancel(t.timer);
+        t.deadline = 0;
+        t.waiting = false;
+        run_link(idx);
     }
 
-    // Find next runnable thread (not waiting, not current)
-    int next_runnable(int skip = -1) {
-        for (int i = 0; i < MAX_VTHREADS; i++) {
-            if (i != skip && threads[i].active && !threads[i].waiting) {
-                return i;
-            }
-        }
-        return -1;
+    // g_timers fired thread idx's deadline: it resumes past its ecall with
+    // its timeout result
+    void timeout(int idx) {
+        auto& t = threads[idx];
+        t.deadline = 0;  // The wheel already let go of the timer
+        t.regs[10] = static_cast<uint64_t>(static_cast<int64_t>(t.timeout_result));
+        if (t.restart) t.pc += 4;
+        t.timed_out = true;
+        t.restart_deadline = 0;
+        unblock(idx);
     }
 
-    // Wake threads waiting on a given futex address
-    int wake(uint64_t addr, int max_wake) {
+    // Wake threads waiting on a given futex address, longest waiter first
+    int wake(uint64_t addr, int max_wake, uint32_t bitset = FUTEX_BITSET_ANY) {
+        g_harts.notify();  // Harts parked on the same key retry their syscall
         int woken = 0;
-        for (int i = 0; i < MAX_VTHREADS && woken < max_wake; i++) {
-            if (threads[i].active && threads[i].waiting && threads[i].futex_addr == addr) {
-                threads[i].waiting = false;
+        for (int i = futex_queues[bucket(addr)].head; i != NONE && woken < max_wake;) {
+            int next = threads[i].wait_next;
+            if (threads[i].futex_addr == addr && (threads[i].futex_bitset & bitset)) {
+                unblock(i);
                 woken++;
             }
+            i = next;
         }
         return woken;
     }
 
-    void remove_thread(int tid) {
-        for (int i = 0; i < MAX_VTHREADS; i++) {
-            if (threads[i].active && threads[i].tid == tid) {
-                threads[i].active = false;
-                threads[i].waiting = false;
-                count--;
-                return;
+    // Move up to max_move waiters on from to the back of to's queue, longest
+    // waiter first; they keep their timeouts. The walk ends at the bucket's
+    // tail as it was on entry, so waiters moved within the same bucket (or
+    // with from == to, onto the same key) are not visited again.
+    int requeue(uint64_t from, uint64_t to, int max_move) {
+        int moved = 0;
+        const int last = futex_queues[bucket(from)].tail;
+        for (int i = futex_queues[bucket(from)].head; i != NONE && moved < max_move;) {
+            int next = threads[i].wait_next;
+            if (threads[i].futex_addr == from) {
+                wait_unlink(i);
+                wait_link(i, to);
+                moved++;
+            }
+            if (i == last) break;
+            i = next;
+        }
+        return moved;
+    }
+
+    // The longest waiter on addr, or NONE
+    int first_waiter(uint64_t addr) const {
+        for (int i = futex_queues[bucket(addr)].head; i != NONE; i = threads[i].wait_next) {
+            if (threads[i].futex_addr == addr) return i;
+        }
+        return NONE;
+    }
+
+    // Some blocked thread other than skip, or NONE; with io_only, one
+    // blocked on a pipe or epoll set
+    int any_waiting(int skip, bool io_only = false) const {
+        for (const auto& q : futex_queues) {
+            for (int i = q.head; i != NONE; i = threads[i].wait_next) {
+                if (i != skip && (!io_only || threads[i].futex_addr >= IO_KEY_MIN)) return i;
             }
         }
+        return NONE;
+    }
+
+    // Whether some blocked thread waits on something the host delivers
+    bool any_host_waiter() const {
+        for (const auto& t : threads) {
+            if (t.active && t.waiting && t.host_wait) return true;
+        }
+        return false;
+    }
+
+    // Guest instructions the current thread has run in this slice. The
+    // counter can move backwards (checkpoint restore, simulate()), which
+    // starts the slice over.
+    uint64_t slice_used(uint64_t counter) {
+        if (counter < slice_start) slice_start = 0;
+        return counter - slice_start;
+    }
+
+    // Flat copy of the whole scheduler, for the vfork snapshot and
+    // checkpoints
+    void save(std::vector<uint8_t>& out) const {
+        uint32_t n = static_cast<uint32_t>(threads.size());
+        out.resize(HEADER + n * sizeof(VThread) + sizeof(futex_queues));
+        uint8_t* p = out.data();
+        std::memcpy(p, &n, 4);
+        std::memcpy(p + 4, &current, 4);
+        std::memcpy(p + 8, &count, 4);
+        std::memcpy(p + 12, &run_head, 4);
+        std::memcpy(p + 16, &free_head, 4);
+        std::memcpy(p + 24, &slice_start, 8);
+        std::memcpy(p + HEADER, threads.data(), n * sizeof(VThread));
+        std::memcpy(p + HEADER + n * sizeof(VThread), futex_queues.data(), sizeof(futex_queues));
+    }
+
+    void load(const uint8_t* p, size_t len) {
+        uint32_t n = 0;
+        if (len >= 4) std::memcpy(&n, p, 4);
+        if (len < HEADER || n > MAX_THREADS ||
+            len != HEADER + n * sizeof(VThread) + sizeof(futex_queues))
+            throw std::runtime_error("scheduler state: bad size");
+        drop_timers();
+        std::memcpy(&current, p + 4, 4);
+        std::memcpy(&count, p + 8, 4);
+        std::memcpy(&run_head, p + 12, 4);
+        std::memcpy(&free_head, p + 16, 4);
+        std::memcpy(&slice_start, p + 24, 8);
+        threads.resize(n);
+        std::memcpy(threads.data(), p + HEADER, n * sizeof(VThread));
+        std::memcpy(futex_queues.data(), p + HEADER + n * sizeof(VThread), sizeof(futex_queues));
+        // The saved timer handles belong to another wheel (or another time)
+        for (uint32_t i = 0; i < n; i++) {
+            auto& t = threads[i];
+            if (t.active && t.waiting && t.deadline) t.timer = g_timers.add(t.deadline, i);
+        }
+    }
+
+private:
+    static constexpr size_t HEADER = 32;
+
+    bool runnable(int idx) const {
+        return idx >= 0 && idx < static_cast<int>(threads.size()) &&
+               threads[idx].active && !threads[idx].waiting;
+    }
+
+    void drop_timers() {
+        for (auto& t : threads) {
+            if (t.active && t.waiting && t.deadline) g_timers.cancel(t.timer);
+        }
+    }
+
+    static size_t bucket(uint64_t key) {
+        return (key * 0x9E3779B97F4A7C15ull) >> 56;  // Fibonacci hash, top 8 bits
+    }
+
+    // Queue idx last: just behind the running thread, or behind run_head
+    void run_link(int idx) {
+        auto& t = threads[idx];
+        int at = runnable(current) && current != idx ? current : run_head;
+        if (at == NONE) {
+            t.run_next = t.run_prev = idx;
+            run_head = idx;
+            return;
+        }
+        t.run_next = at;
+        t.run_prev = threads[at].run_prev;
+        threads[t.run_prev].run_next = idx;
+        threads[at].run_prev = idx;
+    }
+
+    void run_unlink(int idx) {
+        auto& t = threads[idx];
+        if (t.run_next == idx) {
+            run_head = NONE;
+            return;
+        }
+        threads[t.run_prev].run_next = t.run_next;
+        threads[t.run_next].run_prev = t.run_prev;
+        run_head = t.run_next;
+    }
+
+    void wait_link(int idx, uint64_t key) {
+        auto& t = threads[idx];
+        auto& q = futex_queues[bucket(key)];
+        t.futex_addr = key;
+        t.wait_next = NONE;
+        t.wait_prev = q.tail;
+        if (q.tail != NONE) {
+            threads[q.tail].wait_next = idx;
+        } else {
+            q.head = idx;
+        }
+        q.tail = idx;
+    }
+
+    // Leaves the thread's deadline alone; unblock() clears it
+    void wait_unlink(int idx) {
+        auto& t = threads[idx];
+        auto& q = futex_queues[bucket(t.futex_addr)];
+        if (t.wait_prev != NONE) {
+            threads[t.wait_prev].wait_next = t.wait_next;
+        } else {
+            q.head = t.wait_next;
+        }
+        if (t.wait_next != NONE) {
+            threads[t.wait_next].wait_prev = t.wait_prev;
+        } else {
+            q.tail = t.wait_prev;
+        }
     }
 };
 inline ThreadScheduler g_sched;
 
 // Save machine state into a VThread slot
 inline void save_thread(Machine& m, VThread& t) {
-    for (int i = 0; i < 32; i++) t.regs[i] = m.cpu.reg(i);
+    auto& regs = m.cpu.registers();
+    for (int i = 0; i < 32; i++) t.regs[i] = regs.get(i);
+    for (int i = 0; i < 32; i++) t.fregs[i] = regs.getfl(i).i64;
+    t.fcsr = regs.fcsr().whole;
     t.pc = m.cpu.pc();
 }
 
 // Restore machine state from a VThread slot
 inline void restore_thread(Machine& m, VThread& t) {
-    for (int i = 0; i < 32; i++) m.cpu.reg(i) = t.regs[i];
+    auto& regs = m.cpu.registers();
+    for (int i = 0; i < 32; i++) regs.get(i) = t.regs[i];
+    for (int i = 0; i < 32; i++) regs.getfl(i).i64 = t.fregs[i];
+    regs.fcsr().whole = t.fcsr;
     m.cpu.jump(t.pc);
 }
 
-// Switch from current thread to target thread
-inline bool switch_to_thread(Machine& m, int target_idx) {
+// Hand the CPU to thread idx, whose registers are already loaded: charge
+// the outgoing thread and start a new slice
+inline void enter_thread(Machine& m, int idx) {
+    uint64_t now = m.instruction_counter();
+    g_sched.threads[g_sched.current].runtime += g_sched.slice_used(now);
+    g_sched.threads[idx].dispatches++;
+    g_sched.current = idx;
+    g_sched.slice_start = now;
+    // End the dispatch chunk in flight when the new slice does
+    if (m.max_instructions() > now + g_time_slice)
+        m.set_max_instructions(now + g_time_slice);
+}
+
+// Switch from current thread to target thread. Inside a syscall handler the
+// dispatcher steps over the ecall once we return; between dispatch chunks
+// (in_syscall false) the 4 bytes are accounted for here instead.
+inline bool switch_to_thread(Machine& m, int target_idx, bool in_syscall = true) {
     if (target_idx < 0 || target_idx == g_sched.current) return false;
     auto& cur = g_sched.threads[g_sched.current];
     auto& tgt = g_sched.threads[target_idx];
     save_thread(m, cur);
     restore_thread(m, tgt);
-
-    g_sched.current = target_idx;
-    // Reset target's budget for its new time slice
-    tgt.syscall_budget = THREAD_QUANTUM;
+    if (!in_syscall) {
+        cur.pc -= 4;
+        m.cpu.jump(tgt.pc + 4);
+    }
+    // Like a kernel context switch, drop the LR reservation so an LR/SC
+    // pair split by preemption fails its SC and retries
+    m.cpu.atomics().store_conditional(8, 0);
+    enter_thread(m, target_idx);
     return true;
 }
 
-// Preemptive yield: called from hot-path syscalls (clock_gettime, etc.).
-// Decrements current thread's budget; when exhausted, switches to next runnable.
-inline void maybe_preempt(Machine& m) {
+// Size of the next dispatch chunk: at most `chunk`, and no further than the
+// end of the current slice while other threads exist (or the next safepoint
+// while other harts do)
+inline uint64_t sched_chunk(const Machine& m, uint64_t chunk) {
+    if (g_harts.active()) chunk = std::min(chunk, Harts::CHUNK);
+    if (g_sched.count <= 1) return chunk;
+    uint64_t used = g_sched.slice_used(m.instruction_counter());
+    return std::min(chunk, used < g_time_slice ? g_time_slice - used : 1);
+}
+
+// g_timers owners: a thread slot, or a timerfd id with this bit set
+constexpr uint64_t TIMERFD_OWNER = 1ULL << 63;
+inline void timerfd_expire(uint32_t id);
+
+// Fire every timer due by now: timed waits end, timerfds count an expiration
+inline void expire_timers(uint64_t now) {
+    g_timers.expire(now, [](uint64_t owner) {
+        if (owner & TIMERFD_OWNER) {
+            timerfd_expire(static_cast<uint32_t>(owner));
+        } else {
+            g_sched.timeout(static_cast<int>(owner));
+        }
+    });
+}
+
+// Called by the run loops after each dispatch chunk: fire due timers, and
+// if the chunk ran the current thread's slice out, preempt it in favour of
+// the next runnable one
+inline void sched_tick(Machine& m) {
+    g_harts.safepoint(m);
+    if (m.stopped() && !m.instruction_limit_reached()) return;  // stop()
+    uint64_t now = m.instruction_counter();
+    // A chunk that enter_thread cut short returns with the caller's limit
+    // restored; report it as reached so the run loop carries on. Other
+    // harts arm timers under the syscall lock; with them around, timers
+    // fire only from syscalls.
+    if (now < m.max_instructions()) m.set_max_instructions(now);
+    if (!g_timers.empty() && !g_harts.active()) expire_timers(guest_clock_ns());
     if (g_sched.count <= 1) return;
-    auto& cur = g_sched.threads[g_sched.current];
-    if (cur.syscall_budget > 0) {
-        cur.syscall_budget--;
+    if (g_sched.slice_used(now) < g_time_slice) return;
+    int prev = g_sched.current;
+    if (switch_to_thread(m, g_sched.next_runnable(prev), false)) {
+        g_sched.threads[prev].preemptions++;
+    } else {
+        g_sched.slice_start = now;  // Nobody else to run: start a new slice
+    }
+}
+
+// Returned by sched_pick_idle in Wasm while the next timeout is still ahead
+constexpr int IDLE_YIELD = -2;
+// How long threads blocked on a pipe or epoll set may go without a retry
+constexpr uint64_t IDLE_POLL_NS = 10'000'000;
+
+// Whether idle guest time may be skipped instead of waited out: nothing the
+// guest waits for (host_wait: the caller's own wait included) can come from
+// the host. An open socket counts even with nobody blocked on it, as a
+// sleeping thread may be pacing a poll loop on it.
+inline bool idle_can_skip(bool host_wait = false) {
+    return g_clock_fast_forward && !host_wait && !g_harts.active() &&
+           !g_sched.any_host_waiter() && !g_fds.has(FdKind::Socket);
+}
+
+// The current thread just blocked and no other thread is runnable: pick the
+// one to run next. When idle_can_skip allows, the guest clock jumps to the
+// earliest timer; otherwise native sleeps until it. A thread blocked on a
+// pipe or epoll set is retried instead when no timeout is due within
+// IDLE_POLL_NS, as its readiness may come from the host (stdin, sockets).
+// Returns the thread, the current one included if its own wait ended;
+// IDLE_YIELD in Wasm, where the caller yields to JS and sched_resume
+// carries on; or -1 when only waits without a timeout remain.
+inline int sched_pick_idle() {
+    while (true) {
+        uint64_t now = guest_clock_ns();
+        expire_timers(now);
+        if (int next = g_sched.next_runnable(); next >= 0) return next;
+        uint64_t deadline = g_timers.next_deadline();
+        if (deadline != UINT64_MAX && idle_can_skip()) {
+            clock_advance_to(deadline);
+            continue;
+        }
+        if (deadline - now > IDLE_POLL_NS) {
+            if (int i = g_sched.any_waiting(-1, true); i >= 0) {
+                g_sched.unblock(i);
+                return i;
+            }
+        }
+        if (deadline == UINT64_MAX) return -1;
+#ifdef __EMSCRIPTEN__
+        return IDLE_YIELD;
+#else
+        g_console.flush();
+        std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now));
+#endif
+    }
+}
+
+// The current thread's wait ended while it still held the CPU. If it timed
+// out, hand it the result and step over the ecall a restarting syscall was
+// rewound to; if it was woken, the a0 it blocked with stands, and a
+// restarting syscall re-runs.
+inline void end_own_wait(Machine& m) {
+    auto& t = g_sched.threads[g_sched.current];
+    if (!t.timed_out) return;
+    t.timed_out = false;
+    m.set_result(t.regs[10]);
+    if (t.restart) m.cpu.increment_pc(4);
+}
+
+// Block the current thread on key until woken or until deadline (see
+// ThreadScheduler::block), and hand the CPU to whichever thread can run.
+// With restart the syscall re-runs once the thread is woken; otherwise it
+// resumes past its ecall with the a0 set before the call, or timeout_result.
+// Returns false if the current thread keeps the CPU instead, with pc back at
+// its ecall: nothing else can run and no timer is armed (it stays blocked),
+// or sched_pick_idle picked it to retry (it no longer is).
+inline bool sched_wait(Machine& m, uint64_t key, uint64_t deadline, int32_t timeout_result,
+                       bool restart, bool host_wait = false, uint32_t bitset = FUTEX_BITSET_ANY) {
+    int cur = g_sched.current;
+    auto& t = g_sched.threads[cur];
+    g_sched.block(cur, key, bitset, deadline);
+    t.timeout_result = timeout_result;
+    t.restart = restart;
+    t.host_wait = host_wait;
+    if (restart) m.cpu.increment_pc(-4);
+    int next = g_sched.next_runnable(cur);
+    if (next < 0) next = sched_pick_idle();
+    if (next == IDLE_YIELD) {
+        // Wasm: every thread waits and the next timeout is ahead. Yield to
+        // JS; sched_resume carries on from here.
+        g_waiting_for_stdin = true;
+        m.stop();
+        return true;
+    }
+    if (next < 0 || (next == cur && !t.timed_out)) {
+        if (restart) m.cpu.increment_pc(4);
+        return false;
+    }
+    end_own_wait(m);
+    if (next != cur) switch_to_thread(m, next);
+    return true;
+}
+
+// No other guest thread can run: let guest time pass up to deadline, or up
+// to the next timer if that comes first, and fire what is due. The clock
+// skips ahead when idle_can_skip allows; otherwise native sleeps, and Wasm
+// returns false without waiting (the caller yields to JS instead).
+inline bool idle_step(uint64_t deadline) {
+    uint64_t now = guest_clock_ns();
+    uint64_t until = std::min(deadline, g_timers.next_deadline());
+    if (until > now) {
+        if (idle_can_skip()) {
+            clock_advance_to(until);
+        } else {
+#ifdef __EMSCRIPTEN__
+            return false;
+#else
+            g_console.flush();
+            g_harts.sleep_for(std::chrono::nanoseconds(until - now));
+#endif
+        }
+    }
+    expire_timers(guest_clock_ns());
+    return true;
+}
+
+// friscy_resume after a wait returned IDLE_YIELD: the thread that blocked
+// (or, after a thread exit, another waiter) is on the CPU, just past its
+// ecall. Switch to a thread that can run now; false if there is none yet.
+inline bool sched_resume(Machine& m) {
+    if (g_sched.count == 0 || !g_sched.threads[g_sched.current].waiting) return true;
+    int next = sched_pick_idle();
+    if (next < 0) return false;
+    if (!g_sched.threads[g_sched.current].waiting) end_own_wait(m);
+    if (next != g_sched.current) switch_to_thread(m, next, false);
+    return true;
+}
+
+// The deadline the current thread parked a re-running wait with, taken (0
+// if it did not park one)
+inline uint64_t take_restart_deadline() {
+    if (g_sched.count == 0) return 0;
+    return std::exchange(g_sched.threads[g_sched.current].restart_deadline, 0);
+}
+
+// Put the current thread to sleep until deadline. Other threads run
+// meanwhile; with none, the clock skips ahead when it may (idle_step).
+inline void sleep_until(Machine& m, uint64_t deadline) {
+    m.set_result(0);
+    // Running alongside other harts, really sleep (a spin-wait backing off)
+    if (g_harts.active()) {
+        uint64_t now = guest_clock_ns();
+        if (deadline > now) g_harts.sleep_for(std::chrono::nanoseconds(deadline - now));
         return;
     }
-    // Budget exhausted — find another runnable thread
-    int next = g_sched.next_runnable(g_sched.current);
-    if (next >= 0) {
-        static int preempt_count = 0;
-        if (++preempt_count <= 20)
-            fprintf(stderr, "[preempt] t%d -> t%d (quantum exhausted)\n",
-                    g_sched.current, next);
-        switch_to_thread(m, next);
-    } else {
-        // No other runnable thread, reset our budget
-        cur.syscall_budget = THREAD_QUANTUM;
+    if (g_sched.count > 1) {
+        // Ends at the deadline: SLEEP_KEY is never woken
+        sched_wait(m, ThreadScheduler::SLEEP_KEY, deadline, 0, false);
+        return;
     }
+    while (guest_clock_ns() < deadline) {
+        if (!idle_step(deadline)) {
+            // Wasm, with the time to wait out for real: yield to the host
+            // event loop instead of blocking the worker (no ASYNCIFY). The
+            // sleep ends there, after the host's 4ms poll interval.
+            g_waiting_for_stdin = true;
+            m.stop();
+            return;
+        }
+    }
+}
+
+// Per-thread accounting for /proc/friscy/threads
+inline std::string sched_text(Machine& m) {
+    std::string out;
+    char line[160];
+    snprintf(line, sizeof(line), "time slice: %" PRIu64 " instructions\n%4s %8s %8s %16s %12s %12s\n",
+             g_time_slice, "slot", "tid", "state", "instructions", "dispatches", "preemptions");
+    out += line;
+    for (int i = 0; i < static_cast<int>(g_sched.threads.size()); i++) {
+        const auto& t = g_sched.threads[i];
+        if (!t.active) continue;
+        uint64_t runtime = t.runtime;
+        if (i == g_sched.current) runtime += g_sched.slice_used(m.instruction_counter());
+        snprintf(line, sizeof(line), "%4d %8d %8s %16" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+                 i, t.tid, i == g_sched.current ? "running" : t.waiting ? "waiting" : "runnable",
+                 runtime, t.dispatches, t.preemptions);
+        out += line;
+    }
+    return out;
+}
+
+inline constexpr const char* SCHED_STATS_PATH = "/proc/friscy/threads";
+
+// Republish the vDSO clock
+inline void vdso_refresh(Machine& m) {
+    vdso::refresh(m, false);
 }
 
 // Execution context saved from initial load — used by execve to
@@ -339,6 +905,7 @@ namespace nr {
     constexpr int pread64       = 67;
     constexpr int pwrite64      = 68;
     constexpr int sendfile      = 71;
+    constexpr int splice        = 76;
     constexpr int ppoll         = 73;
     constexpr int readlinkat    = 78;
     constexpr int newfstatat    = 79;
@@ -348,6 +915,7 @@ namespace nr {
     constexpr int set_tid_address = 96;
     constexpr int set_robust_list = 99;
     constexpr int clock_gettime = 113;
+    constexpr int gettimeofday  = 169;
     constexpr int sigaction     = 134;
     constexpr int sigprocmask   = 135;
     constexpr int getpid        = 172;
@@ -373,6 +941,10 @@ namespace nr {
     constexpr int capget        = 90;
     constexpr int futex         = 98;
     constexpr int nanosleep     = 101;
+    constexpr int clock_nanosleep = 115;
+    constexpr int timerfd_create  = 85;
+    constexpr int timerfd_settime = 86;
+    constexpr int timerfd_gettime = 87;
     constexpr int sched_getscheduler = 120;
     constexpr int sched_getparam     = 121;
     constexpr int sched_getaffinity  = 123;
@@ -386,6 +958,7 @@ namespace nr {
     constexpr int fchmod        = 52;
     constexpr int fchmodat      = 53;
     constexpr int fchownat      = 54;
+    constexpr int preadv        = 69;
     constexpr int pwritev       = 70;
     constexpr int fsync         = 82;
     constexpr int sched_yield   = 124;
@@ -402,14 +975,20 @@ namespace nr {
     constexpr int getgroups     = 158;
     constexpr int umask         = 166;
     constexpr int socketpair    = 199;
+    constexpr int sendto        = 206;
+    constexpr int recvfrom      = 207;
     constexpr int sendmsg       = 211;
+    constexpr int accept4       = 242;
     constexpr int clock_getres  = 114;
     constexpr int recvmsg       = 212;
     constexpr int membarrier    = 283;
+    constexpr int copy_file_range = 285;
     constexpr int statx         = 291;
     constexpr int close_range   = 436;
     constexpr int rseq          = 293;
     constexpr int io_uring_setup = 425;
+    constexpr int io_uring_enter = 426;
+    constexpr int io_uring_register = 427;
     constexpr int clone3        = 435;
     constexpr int faccessat2    = 439;
 }
@@ -448,54 +1027,1372 @@ constexpr int AT_FDCWD = -100;
 constexpr int AT_EMPTY_PATH = 0x1000;
 constexpr int AT_SYMLINK_NOFOLLOW = 0x100;
 
-// O_* flags
-constexpr int O_RDONLY = 0;
-constexpr int O_WRONLY = 1;
-constexpr int O_RDWR = 2;
-constexpr int O_CREAT = 0100;
-constexpr int O_EXCL = 0200;
-constexpr int O_TRUNC = 01000;
-constexpr int O_APPEND = 02000;
-constexpr int O_DIRECTORY = 0200000;
-constexpr int O_CLOEXEC = 02000000;
+// O_* flags
+constexpr int O_RDONLY = 0;
+constexpr int O_WRONLY = 1;
+constexpr int O_RDWR = 2;
+constexpr int O_CREAT = 0100;
+constexpr int O_EXCL = 0200;
+constexpr int O_TRUNC = 01000;
+constexpr int O_APPEND = 02000;
+constexpr int O_DIRECTORY = 0200000;
+constexpr int O_CLOEXEC = 02000000;
+
+// Error codes (negated for syscall return values)
+namespace err {
+    constexpr int64_t PERM = -1;
+    constexpr int64_t NOENT = -2;
+    constexpr int64_t SRCH = -3;
+    constexpr int64_t INTR = -4;
+    constexpr int64_t BADF = -9;
+    constexpr int64_t AGAIN = -11;
+    constexpr int64_t ACCES = -13;
+    constexpr int64_t FAULT = -14;
+    constexpr int64_t EXIST = -17;
+    constexpr int64_t NOTDIR = -20;
+    constexpr int64_t ISDIR = -21;
+    constexpr int64_t INVAL = -22;
+    constexpr int64_t SPIPE = -29;
+    constexpr int64_t DEADLK = -35;
+    constexpr int64_t NOSYS = -38;
+    constexpr int64_t NOTSUP = -95;
+    constexpr int64_t TIMEDOUT = -110;
+}
+
+// The timespec at addr as a guest-clock deadline in ns, relative to now or
+// absolute. 0 without one (addr 0), err::INVAL if it is malformed.
+inline int64_t timespec_deadline(Machine& m, uint64_t addr, bool relative) {
+    if (!addr) return 0;
+    int64_t sec = m.memory.template read<int64_t>(addr);
+    int64_t nsec = m.memory.template read<int64_t>(addr + 8);
+    if (sec < 0 || nsec < 0 || nsec >= 1'000'000'000) return err::INVAL;
+    int64_t base = relative ? static_cast<int64_t>(guest_clock_ns()) : 0;
+    if (sec >= (INT64_MAX - base) / 1'000'000'000 - 1) return INT64_MAX;
+    return std::max<int64_t>(base + sec * 1'000'000'000 + nsec, 1);
+}
+
+// REALTIME, REALTIME_COARSE, REALTIME_ALARM and TAI read the guest's wall
+// clock; every other id reads the guest clock (see timers.hpp)
+inline bool realtime_clock(int clock) {
+    return clock == 0 || clock == 5 || clock == 8 || clock == 11;
+}
+
+// Context passed via machine userdata
+struct SyscallContext {
+    vfs::VirtualFS* fs;
+
+    SyscallContext(vfs::VirtualFS* vfs) : fs(vfs) {}
+};
+
+// Helper to get context from machine
+inline SyscallContext* get_ctx(Machine& m) {
+    return m.template get_userdata<SyscallContext>();
+}
+
+// Helper to get VFS from machine
+inline vfs::VirtualFS& get_fs(Machine& m) {
+    return *get_ctx(m)->fs;
+}
+
+// ============================================================================
+// epoll readiness — descriptors whose state changes inside the guest (pipes,
+// eventfds, timerfds, epoll sets, stdin in Wasm) notify their watchers
+// through a watch key, and each instance keeps a ready list of fds to
+// recheck, so epoll_pwait costs O(ready) rather than O(interests).
+// Descriptors whose state changes on the host (sockets; stdin natively) are
+// polled on every wait. The rest (files, stdout, devices) are always ready:
+// a level-triggered interest in one simply stays on the ready list.
+// ============================================================================
+
+inline constexpr uint32_t EPOLL_ONESHOT = 1u << 30;
+inline constexpr uint32_t EPOLL_ET = 1u << 31;
+
+// Keys share the pipe wait key space (above any guest address)
+inline constexpr uint64_t EVENTFD_KEY_BASE = 1ULL << 61;     // eventfds, by id
+inline constexpr uint64_t STDIN_WATCH_KEY = 1ULL << 60;
+inline constexpr uint64_t EPOLL_SET_KEY_BASE = 1ULL << 59;   // epoll set, by id
+inline constexpr uint64_t EPOLL_WAIT_KEY_BASE = 1ULL << 58;  // threads in epoll_pwait
+inline constexpr uint64_t TIMERFD_KEY_BASE = 1ULL << 57;     // timerfds, by id
+
+inline uint64_t eventfd_key(const EventFd& e) { return EVENTFD_KEY_BASE | e.id; }
+inline uint64_t epoll_set_key(const EpollInstance& inst) { return EPOLL_SET_KEY_BASE | inst.id; }
+inline uint64_t epoll_wait_key(const EpollInstance& inst) { return EPOLL_WAIT_KEY_BASE | inst.id; }
+inline uint64_t timerfd_key(const TimerFd& t) { return TIMERFD_KEY_BASE | t.id; }
+
+// Watch key -> interests registered on it
+inline std::unordered_map<uint64_t, std::vector<std::pair<EpollInstance*, int>>> g_epoll_watchers;
+
+inline void epoll_notify(uint64_t key);
+
+// Put fd on the ready list. The first entry wakes threads blocked on the
+// set and anything watching the set itself.
+inline void epoll_queue(EpollInstance& inst, int fd) {
+    auto it = inst.interests.find(fd);
+    if (it == inst.interests.end() || it->second.queued || it->second.disabled) return;
+    it->second.queued = true;
+    inst.ready.push_back(fd);
+    if (inst.ready.size() == 1) {
+        g_sched.wake(epoll_wait_key(inst), WAKE_ALL);
+        epoll_notify(epoll_set_key(inst));
+    }
+}
+
+// The object behind key changed state
+inline void epoll_notify(uint64_t key) {
+    auto it = g_epoll_watchers.find(key);
+    if (it == g_epoll_watchers.end()) return;
+    for (auto [inst, fd] : it->second) epoll_queue(*inst, fd);
+}
+
+inline void epoll_remove(EpollInstance& inst, int fd) {
+    auto it = inst.interests.find(fd);
+    if (it == inst.interests.end()) return;
+    if (auto w = g_epoll_watchers.find(it->second.key); w != g_epoll_watchers.end()) {
+        auto& regs = w->second;
+        regs.erase(std::remove(regs.begin(), regs.end(), std::make_pair(&inst, fd)), regs.end());
+        if (regs.empty()) g_epoll_watchers.erase(w);
+    }
+    if (it->second.polled) inst.polled.erase(std::find(inst.polled.begin(), inst.polled.end(), fd));
+    if (it->second.queued) inst.ready.erase(std::find(inst.ready.begin(), inst.ready.end(), fd));
+    inst.interests.erase(it);
+}
+
+// A closed fd leaves every set watching it
+inline void epoll_forget(int fd) {
+    for (auto& [epfd, inst] : g_epoll_instances) epoll_remove(*inst, fd);
+}
+
+// ============================================================================
+// Pipe blocking — a reader on an empty pipe or a writer on a full one parks
+// its VThread with a wait key derived from the pipe id (above any guest
+// address, so it never matches a futex). The syscall is rewound and re-runs
+// once the other end makes progress.
+// ============================================================================
+
+inline constexpr uint64_t PIPE_WAIT_KEY_BASE = 1ULL << 62;
+
+// The guest thread making the current syscall
+inline int current_tid(Machine& m) {
+    if (auto* t = g_harts.find(m)) return t->tid;
+    return g_sched.count > 0 ? g_sched.threads[g_sched.current].tid : 1;
+}
+
+// A blocking pipe write parked part-way: the bytes of [addr, addr + len)
+// already in, by thread, so the re-run carries on after them
+struct PipeWrite {
+    int fd;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t done;
+};
+inline std::unordered_map<int, PipeWrite> g_pipe_writes;
+
+inline uint64_t pipe_wait_key(const vfs::PipeBuffer& pipe) {
+    return PIPE_WAIT_KEY_BASE | pipe.id;
+}
+
+// Park the current thread until the pipe changes; the syscall re-runs once
+// it is woken. Threads asleep on a timer count as able to run: the wait
+// goes through sched_wait, so the clock moves on to them. When this thread
+// is picked to retry while they sleep, it waits up to IDLE_POLL_NS and
+// re-runs too. Returns false only when nobody else could ever touch the
+// pipe: a single thread (including a vfork-style child, whose parent only
+// resumes after it exits), or every other one blocked with no timer
+// pending. The caller must not block then.
+inline bool park_on_pipe(Machine& m, const vfs::PipeBuffer& pipe) {
+    if (g_harts.park(m)) return true;
+    if (g_sched.count <= 1) return false;
+    if (sched_wait(m, pipe_wait_key(pipe), 0, 0, /*restart=*/true)) return true;
+    if (g_sched.threads[g_sched.current].waiting) g_sched.unblock(g_sched.current);
+    uint64_t next_timer = g_timers.next_deadline();
+    if (next_timer == UINT64_MAX) return false;
+    if (!idle_step(std::min(next_timer, guest_clock_ns() + IDLE_POLL_NS))) {
+        // Wasm: yield to JS and re-run the syscall when resumed
+        g_waiting_for_stdin = true;
+        m.stop();
+    }
+    m.cpu.increment_pc(-4);
+    return true;
+}
+
+// Wake threads blocked on the pipe itself and epoll sets watching either
+// of its ends
+inline void wake_pipe_waiters(const vfs::PipeBuffer& pipe) {
+    g_sched.wake(pipe_wait_key(pipe), WAKE_ALL);
+    epoll_notify(pipe_wait_key(pipe));
+}
+
+// Pipe readiness as poll/epoll bits (POLLIN=1, POLLOUT=4, POLLERR=8,
+// POLLHUP=0x10 share values with their EPOLL counterparts)
+inline uint32_t pipe_poll_events(const vfs::PipeBuffer& pipe, int fd_flags) {
+    uint32_t ev = 0;
+    int accmode = fd_flags & 3;
+    if (accmode != 1) {  // read end
+        if (pipe.size() > 0) ev |= 0x01;
+        if (pipe.writers == 0) ev |= 0x10;
+    }
+    if (accmode != 0) {  // write end
+        if (pipe.space() > 0) ev |= 0x04;
+        if (pipe.readers == 0) ev |= 0x08;
+    }
+    return ev;
+}
+
+// Read from a VFS fd. An empty blocking pipe parks the thread (parked is
+// set and the caller must return without a result) if may_park allows it;
+// with nobody left to fill it, it reads as EOF.
+inline ssize_t vfs_read(Machine& m, vfs::VirtualFS& fs, int fd, void* buf, size_t count,
+                        bool may_park, bool& parked) {
+    parked = false;
+    ssize_t n = fs.read(fd, buf, count);
+    auto* pipe = fs.get_pipe(fd);
+    if (!pipe) return n;
+    if (n == err::AGAIN && !(fs.get_flags(fd) & 04000)) {
+        if (may_park && park_on_pipe(m, *pipe)) {
+            parked = true;
+            return 0;
+        }
+        if (may_park) n = 0;
+    }
+    if (n > 0) wake_pipe_waiters(*pipe);
+    return n;
+}
+
+// Write to a VFS fd. A full blocking pipe parks the thread like vfs_read;
+// with no reader able to drain it, the ring overflows its capacity rather
+// than deadlocking.
+inline ssize_t vfs_write(Machine& m, vfs::VirtualFS& fs, int fd, const void* buf, size_t count,
+                         bool may_park, bool& parked) {
+    parked = false;
+    ssize_t n = fs.write(fd, buf, count);
+    auto* pipe = fs.get_pipe(fd);
+    if (!pipe) return n;
+    if (n == err::AGAIN && !(fs.get_flags(fd) & 04000)) {
+        if (may_park && park_on_pipe(m, *pipe)) {
+            parked = true;
+            return 0;
+        }
+        if (may_park) n = static_cast<ssize_t>(pipe->write(buf, count, /*overflow=*/true));
+    }
+    if (n > 0) wake_pipe_waiters(*pipe);
+    return n;
+}
+
+// ============================================================================
+// Descriptor operations — one table per FdKind (see fd_table.hpp), so
+// read/write/poll/close are a single indexed call instead of a probe of
+// every subsystem. read and write move bytes between a host buffer and the
+// object behind the fd and return a count or negative errno; like vfs_read
+// they may park the thread (parked set, result ignored) when may_park
+// allows. poll reports readiness as POLL/EPOLL bits. close releases both
+// the object and its number.
+// ============================================================================
+
+struct FdOps {
+    ssize_t (*read)(Machine& m, int fd, void* buf, size_t count, bool may_park, bool& parked);
+    ssize_t (*write)(Machine& m, int fd, const void* buf, size_t count, bool may_park, bool& parked);
+    uint32_t (*poll)(Machine& m, int fd);
+    int (*close)(Machine& m, int fd);
+};
+
+inline ssize_t fd_no_read(Machine&, int, void*, size_t, bool, bool& parked) {
+    parked = false;
+    return err::BADF;
+}
+inline ssize_t fd_no_write(Machine&, int, const void*, size_t, bool, bool& parked) {
+    parked = false;
+    return err::BADF;
+}
+inline ssize_t fd_inval_read(Machine&, int, void*, size_t, bool, bool& parked) {
+    parked = false;
+    return err::INVAL;
+}
+inline ssize_t fd_inval_write(Machine&, int, const void*, size_t, bool, bool& parked) {
+    parked = false;
+    return err::INVAL;
+}
+inline uint32_t fd_always_ready(Machine&, int) { return 0x01 | 0x04; }  // IN | OUT
+inline int fd_release(Machine&, int fd) {
+    g_fds.release(fd);
+    return 0;
+}
+
+#ifndef __EMSCRIPTEN__
+// poll() on host fds. A blocking one drops the syscall lock so other harts
+// run meanwhile, and also returns when one of them changes guest-visible
+// state (Harts::notify). Returns the number of pfds with events, or -1.
+inline int host_poll(std::vector<struct pollfd>& pfds, int timeout_ms) {
+    int wake_fd = timeout_ms != 0 ? g_harts.wake_fd() : -1;
+    if (wake_fd >= 0) pfds.push_back({wake_fd, POLLIN, 0});
+    int n;
+    {
+        Harts::Unlocked unlocked(g_harts);
+        n = ::poll(pfds.data(), pfds.size(), timeout_ms);
+    }
+    if (wake_fd >= 0) {
+        if (pfds.back().revents) {
+            g_harts.drain_wake_fd();
+            n--;
+        }
+        pfds.pop_back();
+    }
+    return n;
+}
+#endif
+
+// --- Host terminal ---
+
+// Without input, Wasm stops the machine until JS delivers some; native
+// blocks on the host (or stops at the stdin-wait point when checkpointing)
+inline ssize_t stdin_read(Machine& m, int, void* buf, size_t count, bool may_park, bool& parked) {
+    parked = false;
+#ifdef __EMSCRIPTEN__
+    int n = EM_ASM_INT({
+        if (Module._stdinBuffer && Module._stdinBuffer.length > 0) {
+            var toRead = Math.min($1, Module._stdinBuffer.length);
+            for (var i = 0; i < toRead; i++) {
+                Module.HEAPU8[$0 + i] = Module._stdinBuffer.shift();
+            }
+            return toRead;
+        }
+        if (Module._stdinEOF) return 0; // EOF
+        return -1; // -1 means "no data yet", NOT EOF
+    }, buf, count);
+    if (n >= 0) return n;
+    if (!may_park) return err::AGAIN;
+    // Rewind to the ecall and stop; the read re-runs when JS resumes us
+    g_waiting_for_stdin = true;
+    m.cpu.increment_pc(-4);
+    m.stop();
+    parked = true;
+    return 0;
+#else
+    if (g_checkpoint_on_stdin && may_park) {
+        // Checkpoint mode: stop at the stdin wait point instead of blocking
+        g_waiting_for_stdin = true;
+        m.cpu.increment_pc(-4);
+        m.stop();
+        parked = true;
+        return 0;
+    }
+    g_console.flush();  // A prompt must be visible before we block
+    if (g_harts.active()) {
+        // Wait where other harts can run, and can end the process
+        std::vector<struct pollfd> pfds{{STDIN_FILENO, POLLIN, 0}};
+        while (host_poll(pfds, -1) <= 0) {
+            if (g_harts.exiting()) return err::INTR;
+        }
+    }
+    ssize_t n = ::read(STDIN_FILENO, buf, count);
+    return n >= 0 ? n : -errno;
+#endif
+}
+
+inline uint32_t stdin_poll(Machine&, int) {
+#ifdef __EMSCRIPTEN__
+    int has_data = EM_ASM_INT({
+        return (Module._stdinBuffer && Module._stdinBuffer.length > 0) ? 1 :
+               (Module._stdinEOF ? -1 : 0);
+    });
+    return has_data == 1 ? 0x01 : has_data == -1 ? 0x10 : 0;  // POLLIN / POLLHUP (EOF)
+#else
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    if (::poll(&pfd, 1, 0) <= 0) return 0;
+    return ((pfd.revents & POLLIN) ? 0x01 : 0) | ((pfd.revents & POLLHUP) ? 0x10 : 0);
+#endif
+}
+
+inline ssize_t stdout_write(Machine&, int, const void* buf, size_t count, bool, bool& parked) {
+    parked = false;
+    g_console.write(static_cast<const char*>(buf), count);
+    return count;
+}
+
+inline uint32_t stdout_poll(Machine&, int) { return 0x04; }  // POLLOUT
+
+inline uint32_t tty_poll(Machine& m, int fd) { return stdin_poll(m, fd) | 0x04; }
+
+// --- VFS files and pipes ---
+
+inline int vfs_close(Machine& m, int fd) {
+    auto& fs = get_fs(m);
+    // Closing the last end of a pipe is EOF / EPIPE for the other side
+    // (hold the ring: closing the last handle frees the inode)
+    auto* entry = fs.get_entry(fd);
+    auto pipe = entry ? entry->pipe : nullptr;
+    fs.close(fd);
+    g_fds.release(fd);
+    if (pipe) wake_pipe_waiters(*pipe);
+    return 0;
+}
+
+inline ssize_t file_read(Machine& m, int fd, void* buf, size_t count, bool may_park, bool& parked) {
+#ifdef __EMSCRIPTEN__
+    // In Wasm an empty pipe dup2'd over fd 0 falls back to the JS stdin
+    // buffer (libuv does pipe2+dup2 on fd 0 but nothing writes to it; real
+    // stdin comes via SAB), so it never parks
+    if (fd == 0) {
+        ssize_t n = vfs_read(m, get_fs(m), fd, buf, count, false, parked);
+        return n > 0 ? n : stdin_read(m, fd, buf, count, may_park, parked);
+    }
+#endif
+    return vfs_read(m, get_fs(m), fd, buf, count, may_park, parked);
+}
+
+inline ssize_t file_write(Machine& m, int fd, const void* buf, size_t count, bool may_park,
+                          bool& parked) {
+    ssize_t n = vfs_write(m, get_fs(m), fd, buf, count, may_park, parked);
+    // Also tap fd 1/2 writes to the console (Node.js dup2's stdio to pipes)
+    if ((fd == 1 || fd == 2) && n > 0 && !parked) {
+        g_console.write(static_cast<const char*>(buf), n);
+    }
+    return n;
+}
+
+// Pipes report real occupancy; anything else in the VFS is always ready
+inline uint32_t file_poll(Machine& m, int fd) {
+    auto& fs = get_fs(m);
+    if (auto* pipe = fs.get_pipe(fd)) return pipe_poll_events(*pipe, fs.get_flags(fd));
+    return 0x01 | 0x04;
+}
+
+// --- eventfd ---
+
+// Return the 8-byte counter value and reset
+inline ssize_t eventfd_read(Machine&, int fd, void* buf, size_t count, bool, bool& parked) {
+    parked = false;
+    if (count < 8) return err::INVAL;  // eventfd reads must be 8 bytes
+    uint64_t& counter = g_eventfds.at(fd)->counter;
+    if (counter == 0) return err::AGAIN;  // No signal pending
+    uint64_t val = counter;
+    counter = 0;
+    std::memcpy(buf, &val, 8);
+    return 8;
+}
+
+// Add the value to the counter and notify epoll sets watching this fd
+inline ssize_t eventfd_write(Machine&, int fd, const void* buf, size_t count, bool,
+                             bool& parked) {
+    parked = false;
+    if (count < 8) return err::INVAL;
+    uint64_t val;
+    std::memcpy(&val, buf, 8);
+    EventFd& e = *g_eventfds.at(fd);
+    e.counter += val;
+    epoll_notify(eventfd_key(e));
+    return 8;
+}
+
+inline uint32_t eventfd_poll(Machine&, int fd) {
+    return (g_eventfds.at(fd)->counter > 0 ? 0x01 : 0) | 0x04;
+}
+
+inline int eventfd_close(Machine& m, int fd) {
+    g_eventfds.erase(fd);
+    return vfs_close(m, fd);
+}
+
+// --- timerfd ---
+
+// g_timers fired timerfd id: count the expiration, and the periods missed
+// since; re-arm a periodic timer; wake readers and epoll sets
+inline void timerfd_expire(uint32_t id) {
+    for (auto& [fd, tp] : g_timerfds) {
+        TimerFd& t = *tp;
+        if (t.id != id) continue;
+        uint64_t n = 1;
+        if (t.interval) {
+            uint64_t now = guest_clock_ns();
+            if (now > t.deadline) n += (now - t.deadline) / t.interval;
+            t.deadline += n * t.interval;
+            t.timer = g_timers.add(t.deadline, TIMERFD_OWNER | id);
+        } else {
+            t.deadline = 0;
+        }
+        t.expirations += n;
+        g_sched.wake(timerfd_key(t), WAKE_ALL);
+        epoll_notify(timerfd_key(t));
+        return;
+    }
+}
+
+// The expirations since the last read, as a u64. With none yet, waits for
+// the next unless the timer is nonblocking or disarmed.
+inline ssize_t timerfd_read(Machine& m, int fd, void* buf, size_t count, bool may_park,
+                            bool& parked) {
+    parked = false;
+    if (count < 8) return err::INVAL;
+    std::shared_ptr<TimerFd> t = g_timerfds.at(fd);
+    if (!g_timers.empty()) expire_timers(guest_clock_ns());
+    while (t->expirations == 0) {
+        if (t->nonblock || !may_park || !t->deadline) return err::AGAIN;
+        uint64_t until = t->deadline;
+        if (g_sched.count > 1) {
+            if (sched_wait(m, timerfd_key(*t), 0, 0, true)) {
+                parked = true;
+                return 0;
+            }
+            // Picked for a retry with nothing else to run: wait here a while
+            if (g_sched.threads[g_sched.current].waiting) g_sched.unblock(g_sched.current);
+            until = std::min(until, guest_clock_ns() + IDLE_POLL_NS);
+        }
+        if (!idle_step(until)) {
+            // Wasm: yield to JS and read again when resumed
+            g_waiting_for_stdin = true;
+            m.cpu.increment_pc(-4);
+            m.stop();
+            parked = true;
+            return 0;
+        }
+    }
+    uint64_t n = std::exchange(t->expirations, 0);
+    std::memcpy(buf, &n, 8);
+    return 8;
+}
+
+inline uint32_t timerfd_poll(Machine&, int fd) {
+    return g_timerfds.at(fd)->expirations ? 0x01 : 0;
+}
+
+// The last descriptor on a timer disarms it
+inline int timerfd_close(Machine&, int fd) {
+    auto it = g_timerfds.find(fd);
+    if (it != g_timerfds.end()) {
+        auto t = std::move(it->second);
+        g_timerfds.erase(it);
+        if (t.use_count() == 1) {
+            if (t->deadline) g_timers.cancel(t->timer);
+            g_sched.wake(timerfd_key(*t), WAKE_ALL);  // Blocked readers re-run into EBADF
+        }
+    }
+    g_fds.release(fd);
+    return 0;
+}
+
+// --- Devices ---
+
+inline ssize_t null_read(Machine&, int, void*, size_t, bool, bool& parked) {
+    parked = false;
+    return 0;  // EOF
+}
+
+inline ssize_t discard_write(Machine&, int, const void*, size_t count, bool, bool& parked) {
+    parked = false;
+    return count;
+}
+
+inline ssize_t random_read(Machine&, int, void* buf, size_t count, bool, bool& parked) {
+    parked = false;
+    g_entropy.fill(buf, count);
+    return count;
+}
+
+// --- Sockets (through the network bridge) ---
+
+inline ssize_t socket_read(Machine&, int fd, void* buf, size_t count, bool, bool& parked) {
+    parked = false;
+#ifdef __EMSCRIPTEN__
+    // Emscripten: read socket data from JS network bridge via RPC
+    int bytes_read = EM_ASM_INT({
+        if (typeof Module.readSocketData !== 'function') return 0;
+        var result = Module.readSocketData($0, $1);
+        if (!result || result.length === 0) return 0;
+        for (var i = 0; i < result.length; i++) {
+            Module.HEAPU8[$2 + i] = result[i];
+        }
+        return result.length;
+    }, fd, (int)count, (int)(uintptr_t)buf);
+    fprintf(stderr, "[read-socket] fd=%d len=%zu bytes_read=%d\n", fd, count, bytes_read);
+    return bytes_read > 0 ? bytes_read : err::AGAIN;
+#else
+    int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
+    if (native_fd < 0) return err::BADF;
+    ssize_t n = ::recv(native_fd, buf, count, 0);
+    return n >= 0 ? n : -errno;
+#endif
+}
+
+inline ssize_t socket_write(Machine&, int fd, const void* buf, size_t count, bool,
+                            bool& parked) {
+    parked = false;
+#ifdef __EMSCRIPTEN__
+    int result = EM_ASM_INT({
+        if (typeof Module.onSocketSend === 'function') {
+            var data = new Uint8Array(Module.HEAPU8.buffer, $1, $2);
+            return Module.onSocketSend($0, data);
+        }
+        return -38;
+    }, fd, buf, count);
+    return result >= 0 ? (ssize_t)count : result;
+#else
+    int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
+    if (native_fd < 0) return err::BADF;
+    ssize_t n = ::send(native_fd, buf, count, 0);
+    return n >= 0 ? n : -errno;
+#endif
+}
+
+inline uint32_t socket_poll(Machine&, int fd) {
+#ifdef __EMSCRIPTEN__
+    // Connected sockets: always writable (we send optimistically); readable
+    // with buffered data or a pending accept
+    int sock_status = EM_ASM_INT({
+        var status = 0;
+        if (typeof Module.hasSocketData === 'function' && Module.hasSocketData($0))
+            status |= 1;
+        if (typeof Module.hasPendingAccept === 'function' && Module.hasPendingAccept($0))
+            status |= 2;
+        return status;
+    }, fd);
+    return (sock_status ? 0x01 : 0) | 0x04;
+#else
+    int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
+    if (native_fd < 0) return 0;
+    struct pollfd pfd = { native_fd, POLLIN | POLLOUT, 0 };
+    if (::poll(&pfd, 1, 0) <= 0) return 0;
+    uint32_t ev = 0;
+    if (pfd.revents & POLLIN)  ev |= 0x01;
+    if (pfd.revents & POLLOUT) ev |= 0x04;
+    if (pfd.revents & (POLLERR | POLLHUP)) ev |= 0x08;  // EPOLLERR
+    return ev;
+#endif
+}
+
+inline int socket_close(Machine&, int fd) {
+    int rc = net_close_socket ? net_close_socket(fd) : 0;
+    g_fds.release(fd);
+    return rc < 0 ? rc : 0;
+}
+
+// --- epoll instances ---
+
+inline uint32_t epoll_poll(Machine&, int fd) {
+    auto it = g_epoll_instances.find(fd);
+    return it != g_epoll_instances.end() && !it->second->ready.empty() ? 0x01 : 0;
+}
+
+// The last fd on an instance takes its interests down with it
+inline int epoll_close(Machine&, int fd) {
+    auto it = g_epoll_instances.find(fd);
+    if (it != g_epoll_instances.end()) {
+        auto inst = std::move(it->second);
+        g_epoll_instances.erase(it);
+        if (inst.use_count() == 1) {
+            while (!inst->interests.empty()) epoll_remove(*inst, inst->interests.begin()->first);
+            g_sched.wake(epoll_wait_key(*inst), WAKE_ALL);
+        }
+    }
+    g_fds.release(fd);
+    return 0;
+}
+
+// --- io_uring instances (see io_uring.hpp) ---
+
+inline uint32_t io_uring_poll(Machine& m, int fd) {
+    auto it = g_io_urings.find(fd);
+    if (it == g_io_urings.end() || !it->second->mapped()) return 0;
+    const IoUring& ring = *it->second;
+    return ring.cq_ready(m) > 0 || !ring.overflow.empty() ? 0x01 : 0;
+}
+
+inline int io_uring_close(Machine&, int fd) {
+    g_io_urings.erase(fd);
+    g_fds.release(fd);
+    return 0;
+}
+
+// --- VectorHeart/JSPI host files (Wasm only) ---
+
+// The JS handle behind each FdKind::Vh descriptor. JS numbers its files
+// itself; the guest sees a number from g_fds like any other.
+inline std::unordered_map<int, long> g_vh_handles;
+
+inline long vh_handle(int fd) {
+    auto it = g_vh_handles.find(fd);
+    return it != g_vh_handles.end() ? it->second : -1;
+}
+
+inline ssize_t vh_read(Machine&, int fd, void* buf, size_t count, bool, bool& parked) {
+    parked = false;
+#ifdef __EMSCRIPTEN__
+    return js_opfs_io(vh_handle(fd), buf, count, 602, 0);
+#else
+    (void)fd;
+    (void)buf;
+    (void)count;
+    return err::BADF;
+#endif
+}
+
+inline ssize_t vh_write(Machine&, int fd, const void* buf, size_t count, bool, bool& parked) {
+    parked = false;
+#ifdef __EMSCRIPTEN__
+    return js_opfs_io(vh_handle(fd), const_cast<void*>(buf), count, 601, 0);
+#else
+    (void)fd;
+    (void)buf;
+    (void)count;
+    return err::BADF;
+#endif
+}
+
+inline int vh_close(Machine&, int fd) {
+    long handle = vh_handle(fd);
+    g_vh_handles.erase(fd);
+    g_fds.release(fd);
+#ifdef __EMSCRIPTEN__
+    return js_opfs_io(handle, nullptr, 0, 603, 0);
+#else
+    (void)handle;
+    return 0;
+#endif
+}
+
+inline constexpr FdOps FREE_FD_OPS   = {fd_no_read, fd_no_write, nullptr, nullptr};
+inline constexpr FdOps STDIN_FD_OPS  = {stdin_read, fd_no_write, stdin_poll, fd_release};
+inline constexpr FdOps STDOUT_FD_OPS = {fd_no_read, stdout_write, stdout_poll, fd_release};
+inline constexpr FdOps TTY_FD_OPS    = {stdin_read, stdout_write, tty_poll, vfs_close};
+inline constexpr FdOps FILE_FD_OPS   = {file_read, file_write, file_poll, vfs_close};
+inline constexpr FdOps EVENTFD_OPS   = {eventfd_read, eventfd_write, eventfd_poll, eventfd_close};
+inline constexpr FdOps NULL_FD_OPS   = {null_read, discard_write, fd_always_ready, vfs_close};
+inline constexpr FdOps RANDOM_FD_OPS = {random_read, discard_write, fd_always_ready, vfs_close};
+inline constexpr FdOps SOCKET_FD_OPS = {socket_read, socket_write, socket_poll, socket_close};
+inline constexpr FdOps EPOLL_FD_OPS  = {fd_inval_read, fd_inval_write, epoll_poll, epoll_close};
+inline constexpr FdOps VH_FD_OPS     = {vh_read, vh_write, fd_always_ready, vh_close};
+inline constexpr FdOps IO_URING_OPS  = {fd_inval_read, fd_inval_write, io_uring_poll, io_uring_close};
+inline constexpr FdOps TIMERFD_OPS   = {timerfd_read, fd_inval_write, timerfd_poll, timerfd_close};
+
+// Indexed by FdKind
+inline constexpr const FdOps* FD_OPS[FD_KIND_COUNT] = {
+    &FREE_FD_OPS, &STDIN_FD_OPS, &STDOUT_FD_OPS, &TTY_FD_OPS,
+    &FILE_FD_OPS,  // File
+    &FILE_FD_OPS,  // Pipe
+    &EVENTFD_OPS, &NULL_FD_OPS, &RANDOM_FD_OPS, &SOCKET_FD_OPS, &EPOLL_FD_OPS, &VH_FD_OPS,
+    &IO_URING_OPS, &TIMERFD_OPS,
+};
+
+inline const FdOps& fd_ops(int fd) {
+    return *FD_OPS[static_cast<size_t>(g_fds.kind(fd))];
+}
+
+inline int fd_close(Machine& m, int fd) {
+    if (!g_fds.is_open(fd)) return err::BADF;
+    epoll_forget(fd);
+    return fd_ops(fd).close(m, fd);
+}
+
+// Readiness of an open fd as POLL/EPOLL bits
+inline uint32_t fd_poll(Machine& m, int fd) {
+    if (!g_fds.is_open(fd)) return 0x20;  // POLLNVAL
+    return fd_ops(fd).poll(m, fd);
+}
+
+// dup/F_DUPFD (lowest free number >= newfd) and dup2/dup3 (exactly newfd,
+// closing whatever was there)
+inline int fd_dup(Machine& m, int oldfd, int newfd, bool exact) {
+    FdKind kind = g_fds.kind(oldfd);
+    if (kind == FdKind::Free) return err::BADF;
+    // Sockets and VH files are keyed by number in their owners, which keep
+    // no reference counts to share one between two numbers
+    if (kind == FdKind::Socket || kind == FdKind::Vh) return err::NOTSUP;
+    if (exact) {
+        if (newfd < 0 || newfd >= FdTable::MAX_FDS) return err::BADF;
+        if (newfd == oldfd) return newfd;
+        fd_close(m, newfd);
+    } else {
+        newfd = g_fds.alloc(kind, newfd);
+        if (newfd < 0) return newfd;
+    }
+
+    switch (kind) {
+        case FdKind::Stdin:
+        case FdKind::Stdout:
+            break;
+        case FdKind::Epoll:
+            g_epoll_instances[newfd] = g_epoll_instances[oldfd];  // Same instance
+            break;
+        case FdKind::IoUring:
+            g_io_urings[newfd] = g_io_urings[oldfd];
+            break;
+        case FdKind::TimerFd:
+            g_timerfds[newfd] = g_timerfds[oldfd];
+            break;
+        default: {
+            // Everything else is a VFS handle
+            int rc = get_fs(m).dup2(oldfd, newfd);
+            if (rc < 0) {
+                g_fds.release(newfd);
+                return rc;
+            }
+            if (kind == FdKind::EventFd) g_eventfds[newfd] = g_eventfds[oldfd];  // Same counter
+            break;
+        }
+    }
+    g_fds.install(newfd, kind);
+    return newfd;
+}
+
+// read/write through the fd's ops, straight between the backing object and
+// guest memory. Only a transfer allowed to park (may_park) may do so, and
+// then nothing was moved: the syscall re-runs when the thread wakes.
+inline ssize_t fd_read(Machine& m, int fd, uint64_t addr, size_t len, bool may_park,
+                       bool& parked) {
+    parked = false;
+    const FdOps& ops = fd_ops(fd);
+    return guest_transfer<GuestAccess::Write>(m, addr, len, [&](char* buf, size_t size, size_t done) {
+        return ops.read(m, fd, buf, size, may_park && done == 0, parked);
+    });
+}
+
+// A blocking pipe write is the exception: like Linux, it returns only once
+// all of it is in, so a short one parks for the rest and the re-run picks
+// up after the bytes already moved (g_pipe_writes). It stops short only
+// when nothing else could drain the pipe meanwhile.
+inline ssize_t fd_write(Machine& m, int fd, uint64_t addr, size_t len, bool may_park,
+                        bool& parked) {
+    parked = false;
+    const FdOps& ops = fd_ops(fd);
+    size_t before = 0;
+    int tid = may_park ? current_tid(m) : 0;  // Parking switches threads
+    if (may_park && !g_pipe_writes.empty()) {
+        if (auto it = g_pipe_writes.find(tid); it != g_pipe_writes.end()) {
+            const PipeWrite& w = it->second;
+            if (w.fd == fd && w.addr == addr && w.len == len && w.done < len) before = w.done;
+            g_pipe_writes.erase(it);
+        }
+    }
+    ssize_t n = guest_transfer<GuestAccess::Read>(m, addr + before, len - before,
+                                                  [&](char* buf, size_t size, size_t done) {
+        return ops.write(m, fd, buf, size, may_park && done == 0, parked);
+    });
+    size_t total = before + (n > 0 && !parked ? n : 0);
+    if (!parked && n >= 0 && total < len && may_park && g_fds.kind(fd) == FdKind::Pipe) {
+        auto& fs = get_fs(m);
+        auto* pipe = fs.get_pipe(fd);
+        if (pipe && pipe->readers > 0 && !(fs.get_flags(fd) & 04000) && park_on_pipe(m, *pipe))
+            parked = true;
+    }
+    if (parked) {
+        if (total > 0) g_pipe_writes[tid] = {fd, addr, len, total};
+        return 0;
+    }
+    return n < 0 && total == 0 ? n : static_cast<ssize_t>(total);
+}
+
+// sendfile/splice: move up to count bytes from a VFS file or pipe to any
+// fd without passing through guest memory or a staging buffer. Source
+// extents and pipe rings go straight to the destination's write op; a copy
+// into a regular file goes through VirtualFS::copy_range, which can share
+// a whole body instead. in_off is the source offset (nullptr: the file
+// position), and out_off likewise for a file destination. Parks like
+// fd_read on an empty source or full destination pipe, and only when
+// nothing has moved yet.
+inline ssize_t fd_splice(Machine& m, int in_fd, uint64_t* in_off, int out_fd, uint64_t* out_off,
+                         size_t count, bool may_park, bool& parked) {
+    parked = false;
+    FdKind in_kind = g_fds.kind(in_fd);
+    if (in_kind == FdKind::Free || !g_fds.is_open(out_fd)) return err::BADF;
+    if (in_kind != FdKind::File && in_kind != FdKind::Pipe) return err::INVAL;
+
+    auto& fs = get_fs(m);
+    if (g_fds.kind(out_fd) == FdKind::File || g_fds.kind(out_fd) == FdKind::Pipe) {
+        vfs::Entry* in = fs.get_entry(in_fd);
+        vfs::Entry* out = fs.get_entry(out_fd);
+        if (in && in == out) return err::INVAL;
+        if (in && out && in->is_file() && out->is_file()) {
+            return fs.copy_range(in_fd, in_off, out_fd, out_off, count);
+        }
+    }
+
+    const FdOps& out = fd_ops(out_fd);
+    size_t done = 0;
+    bool out_parked = false;
+    ssize_t n = fs.read_to(in_fd, in_off, count, [&](const void* data, size_t len) {
+        ssize_t put = out_off ? fs.pwrite(out_fd, data, len, *out_off + done)
+                              : out.write(m, out_fd, data, len, may_park && done == 0, out_parked);
+        if (put > 0) done += put;
+        return out_parked ? ssize_t{0} : put;
+    });
+    if (out_parked) {
+        parked = true;
+        return 0;
+    }
+    if (out_off) *out_off += done;
+
+    auto* pipe = fs.get_pipe(in_fd);
+    if (!pipe) return n;
+    if (n == err::AGAIN && !(fs.get_flags(in_fd) & 04000)) {
+        if (may_park && park_on_pipe(m, *pipe)) {
+            parked = true;
+            return 0;
+        }
+        if (may_park) n = 0;
+    }
+    if (n > 0) wake_pipe_waiters(*pipe);
+    return n;
+}
+
+// readv/recvmsg: fill the iovecs in order until a short read. Only the
+// first transfer may park (if may_park); later ones return what was read
+// so far.
+inline int64_t fd_readv(Machine& m, int fd, uint64_t iov_addr, size_t iovcnt, bool may_park,
+                        bool& parked) {
+    parked = false;
+    if (!g_fds.is_open(fd)) return err::BADF;
+    size_t total = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
+        uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
+        if (len == 0) continue;
+        ssize_t n = fd_read(m, fd, base, len, may_park && total == 0, parked);
+        if (parked) return 0;
+        if (n < 0) return total > 0 ? (int64_t)total : n;
+        total += n;
+        if (static_cast<size_t>(n) < len) break;  // Short read
+    }
+    return total;
+}
+
+// writev/sendmsg: the gathering counterpart of fd_readv
+inline int64_t fd_writev(Machine& m, int fd, uint64_t iov_addr, size_t iovcnt, bool may_park,
+                         bool& parked) {
+    parked = false;
+    if (!g_fds.is_open(fd)) return err::BADF;
+    size_t total = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
+        uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
+        if (len == 0) continue;
+        ssize_t n = fd_write(m, fd, base, len, may_park && total == 0, parked);
+        if (parked) return 0;
+        if (n < 0) return total > 0 ? (int64_t)total : n;
+        total += n;
+        if (static_cast<size_t>(n) < len) break;
+    }
+    return total;
+}
+
+// ----------------------------------------------------------------------------
+// io_uring operations (rings and SQE layout in io_uring.hpp)
+// ----------------------------------------------------------------------------
+
+// mmap of a ring fd. Each region is carved from the mmap area the first
+// time it is mapped; mapping it again returns the same memory.
+inline int64_t io_uring_map(Machine& m, IoUring& ring, uint64_t offset) {
+    uint64_t* where;
+    uint64_t bytes;
+    if (offset == IORING_OFF_SQ_RING || offset == IORING_OFF_CQ_RING) {
+        where = &ring.rings;
+        bytes = ring.ring_bytes();
+    } else if (offset == IORING_OFF_SQES) {
+        where = &ring.sqes;
+        bytes = ring.sqe_bytes();
+    } else {
+        return err::INVAL;
+    }
+    if (*where == 0) {
+        uint64_t length = (bytes + 4095) & ~4095ULL;
+        auto& nextfree = m.memory.mmap_address();
+        if constexpr (riscv::encompassing_Nbit_arena > 0) {
+            if (nextfree + length > riscv::encompassing_arena_mask) return -12;  // ENOMEM
+        }
+        *where = nextfree;
+        nextfree += length;
+        riscv::PageAttributes rw_attr;
+        rw_attr.read = true;
+        rw_attr.write = true;
+        m.memory.set_page_attr(*where, length, rw_attr);
+        m.memory.memdiscard(*where, length, true);
+        if (where == &ring.rings) ring.init_rings(m);
+    }
+    return static_cast<int64_t>(*where);
+}
+
+// Run the installed handler for syscall number nr as if the guest had
+// made the call, then put the guest's argument registers back
+inline int64_t io_uring_syscall(Machine& m, int nr, std::initializer_list<uint64_t> args) {
+    uint64_t saved[6];
+    for (int i = 0; i < 6; i++) saved[i] = m.cpu.reg(riscv::REG_ARG0 + i);
+    int i = 0;
+    for (uint64_t arg : args) m.cpu.reg(riscv::REG_ARG0 + i++) = arg;
+    int64_t res;
+    try {
+        Machine::syscall_handlers.at(nr)(m);
+        res = static_cast<int64_t>(m.cpu.reg(riscv::REG_ARG0));
+    } catch (...) {
+        res = err::FAULT;
+    }
+    for (i = 0; i < 6; i++) m.cpu.reg(riscv::REG_ARG0 + i) = saved[i];
+    return res;
+}
+
+// Run one SQE if it can complete now, never blocking: an op on an fd that
+// is not ready (and a TIMEOUT that has not expired) returns false and stays
+// pending, as the kernel would park it on the fd's wait queue. Otherwise
+// res is its CQE result.
+inline bool io_uring_run(Machine& m, IoUring& ring, IoUringPending& op, int32_t& res) {
+    const IoUringSqe& sqe = op.sqe;
+    constexpr uint64_t CUR_POS = ~0ULL;  // off: the file position (RW_CUR_POS)
+    if (sqe.flags & IOSQE_FIXED_FILE) {  // Nothing can be registered
+        res = static_cast<int32_t>(err::BADF);
+        return true;
+    }
+
+    uint32_t want = 0;
+    switch (sqe.opcode) {
+        case IORING_OP_READ: case IORING_OP_READV: case IORING_OP_RECV: case IORING_OP_ACCEPT:
+            want = 0x01;  // POLLIN
+            break;
+        case IORING_OP_WRITE: case IORING_OP_WRITEV: case IORING_OP_SEND:
+            want = 0x04;  // POLLOUT
+            break;
+        case IORING_OP_POLL_ADD:
+            want = sqe.op_flags & 0xffff;
+            break;
+    }
+    if (want) {
+        if (!g_fds.is_open(sqe.fd)) {
+            res = static_cast<int32_t>(err::BADF);
+            return true;
+        }
+        // POLLERR/POLLHUP complete the op whether asked for or not
+        uint32_t revents = fd_poll(m, sqe.fd) & (want | 0x38);
+        if (!revents) return false;
+        if (sqe.opcode == IORING_OP_POLL_ADD) {
+            res = static_cast<int32_t>(revents);
+            return true;
+        }
+    }
+
+    int64_t r;
+    bool parked;
+    try {
+        switch (sqe.opcode) {
+            case IORING_OP_NOP:
+                r = 0;
+                break;
+            case IORING_OP_READ:
+                r = sqe.off == CUR_POS ? fd_read(m, sqe.fd, sqe.addr, sqe.len, false, parked)
+                                       : io_uring_syscall(m, nr::pread64, {(uint64_t)sqe.fd, sqe.addr, sqe.len, sqe.off});
+                break;
+            case IORING_OP_WRITE:
+                r = sqe.off == CUR_POS ? fd_write(m, sqe.fd, sqe.addr, sqe.len, false, parked)
+                                       : io_uring_syscall(m, nr::pwrite64, {(uint64_t)sqe.fd, sqe.addr, sqe.len, sqe.off});
+                break;
+            case IORING_OP_READV:
+                r = sqe.off == CUR_POS ? fd_readv(m, sqe.fd, sqe.addr, sqe.len, false, parked)
+                                       : io_uring_syscall(m, nr::preadv, {(uint64_t)sqe.fd, sqe.addr, sqe.len, sqe.off});
+                break;
+            case IORING_OP_WRITEV:
+                r = sqe.off == CUR_POS ? fd_writev(m, sqe.fd, sqe.addr, sqe.len, false, parked)
+                                       : io_uring_syscall(m, nr::pwritev, {(uint64_t)sqe.fd, sqe.addr, sqe.len, sqe.off});
+                break;
+            case IORING_OP_SEND:
+                r = io_uring_syscall(m, nr::sendto, {(uint64_t)sqe.fd, sqe.addr, sqe.len, sqe.op_flags, 0, 0});
+                break;
+            case IORING_OP_RECV:
+                r = io_uring_syscall(m, nr::recvfrom, {(uint64_t)sqe.fd, sqe.addr, sqe.len, sqe.op_flags, 0, 0});
+                break;
+            case IORING_OP_ACCEPT:  // addr2 (off) is the addrlen pointer
+                r = io_uring_syscall(m, nr::accept4, {(uint64_t)sqe.fd, sqe.addr, sqe.off, sqe.op_flags});
+                break;
+            case IORING_OP_OPENAT:
+                r = io_uring_syscall(m, nr::openat, {(uint64_t)sqe.fd, sqe.addr, sqe.op_flags, sqe.len});
+                break;
+            case IORING_OP_STATX:  // len is the mask, addr2 (off) the buffer
+                r = io_uring_syscall(m, nr::statx, {(uint64_t)sqe.fd, sqe.addr, sqe.op_flags, sqe.len, sqe.off});
+                break;
+            case IORING_OP_CLOSE:
+                r = fd_close(m, sqe.fd);
+                break;
+            case IORING_OP_TIMEOUT: {
+                if (sqe.len != 1) {
+                    r = err::INVAL;
+                    break;
+                }
+                if (op.deadline_ns == 0) {  // First run: at submission
+                    int64_t sec = m.memory.template read<int64_t>(sqe.addr);
+                    int64_t nsec = m.memory.template read<int64_t>(sqe.addr + 8);
+                    uint64_t ns = static_cast<uint64_t>(sec) * 1'000'000'000ULL + nsec;
+                    if (!(sqe.op_flags & 1))  // IORING_TIMEOUT_ABS
+                        op.deadline_ns = guest_clock_ns() + ns;
+                    else if (sqe.op_flags & 8)  // IORING_TIMEOUT_REALTIME
+                        op.deadline_ns = realtime_to_guest(static_cast<int64_t>(std::min<uint64_t>(ns, INT64_MAX)));
+                    else
+                        op.deadline_ns = ns;
+                    op.deadline_ns = std::max<uint64_t>(op.deadline_ns, 1);
+                    if (sqe.off) op.target = ring.completions + sqe.off;
+                }
+                if (op.target && ring.completions >= op.target) r = 0;
+                else if (guest_clock_ns() >= op.deadline_ns) r = -62;  // ETIME
+                else return false;
+                break;
+            }
+            default:
+                r = err::INVAL;
+                break;
+        }
+    } catch (...) {
+        r = err::FAULT;
+    }
+    if (r == err::AGAIN && want) return false;  // Readiness was a false alarm
+    res = static_cast<int32_t>(r);
+    return true;
+}
+
+// Run a chain as far as it goes, posting CQEs. A failed link cancels the
+// rest of the chain. Returns true once every op in it has completed.
+inline bool io_uring_advance(Machine& m, IoUring& ring, IoUringChain& chain) {
+    while (!chain.empty()) {
+        IoUringPending& op = chain.front();
+        int32_t res;
+        if (!io_uring_run(m, ring, op, res)) return false;
+        if (res < 0 || !(op.sqe.flags & IOSQE_CQE_SKIP_SUCCESS)) ring.post(m, op.sqe.user_data, res);
+        bool broken = res < 0 && !(op.sqe.flags & IOSQE_IO_HARDLINK);
+        chain.pop_front();
+        if (broken) {
+            for (const auto& rest : chain) ring.post(m, rest.sqe.user_data, -125);  // ECANCELED
+            chain.clear();
+        }
+    }
+    return true;
+}
+
+// Consume up to to_submit SQ entries, running each chain at once and
+// keeping what cannot complete yet. Returns how many SQEs were submitted;
+// dropped entries use up to_submit without counting.
+inline uint32_t io_uring_submit(Machine& m, IoUring& ring, uint32_t to_submit) {
+    uint32_t submitted = 0;
+    uint32_t budget = to_submit;
+    IoUringChain chain;
+    IoUringSqe sqe;
+    while (ring.next_sqe(m, sqe, budget)) {
+        submitted++;
+        chain.push_back({sqe});
+        // A link flag on the last SQE of the batch just ends the chain
+        if ((sqe.flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK)) && budget > 0) continue;
+        if (!io_uring_advance(m, ring, chain)) ring.pending.push_back(std::move(chain));
+        chain.clear();
+    }
+    if (!chain.empty() && !io_uring_advance(m, ring, chain)) ring.pending.push_back(std::move(chain));
+    return submitted;
+}
 
-// Error codes (negated for syscall return values)
-namespace err {
-    constexpr int64_t NOENT = -2;
-    constexpr int64_t BADF = -9;
-    constexpr int64_t ACCES = -13;
-    constexpr int64_t EXIST = -17;
-    constexpr int64_t NOTDIR = -20;
-    constexpr int64_t ISDIR = -21;
-    constexpr int64_t INVAL = -22;
-    constexpr int64_t NOSYS = -38;
-    constexpr int64_t NOTSUP = -95;
+// Retry pending chains and deliver held-back CQEs. Completions can satisfy
+// count-based TIMEOUTs, so repeat while anything finishes.
+inline void io_uring_progress(Machine& m, IoUring& ring) {
+    ring.flush_overflow(m);
+    for (bool again = true; again;) {
+        again = false;
+        for (auto it = ring.pending.begin(); it != ring.pending.end();) {
+            if (io_uring_advance(m, ring, *it)) {
+                it = ring.pending.erase(it);
+                again = true;
+            } else {
+                ++it;
+            }
+        }
+    }
 }
 
-// Context passed via machine userdata
-struct SyscallContext {
-    vfs::VirtualFS* fs;
-    std::mt19937 rng;
+#ifndef __EMSCRIPTEN__
+// Block on the host until a pending op might complete: one host poll over
+// the sockets and stdin they wait on, bounded by the nearest TIMEOUT.
+// Returns false if nothing pending waits on anything the host delivers
+// (e.g. only on pipes no other thread will touch). Other harts may complete
+// the rest, so with them around this also waits for a notify.
+inline bool io_uring_wait_host(IoUring& ring) {
+    std::vector<struct pollfd> pfds;
+    uint64_t deadline = UINT64_MAX;
+    for (const auto& chain : ring.pending) {
+        const IoUringSqe& sqe = chain.front().sqe;
+        if (sqe.opcode == IORING_OP_TIMEOUT) {
+            deadline = std::min(deadline, chain.front().deadline_ns);
+            continue;
+        }
+        FdKind kind = g_fds.kind(sqe.fd);
+        int host_fd = -1;
+        if (kind == FdKind::Socket) host_fd = net_get_native_fd ? net_get_native_fd(sqe.fd) : -1;
+        else if (kind == FdKind::Stdin || kind == FdKind::Tty) host_fd = STDIN_FILENO;
+        if (host_fd < 0) continue;
+        struct pollfd pfd;
+        pfd.fd = host_fd;
+        bool out = sqe.opcode == IORING_OP_WRITE || sqe.opcode == IORING_OP_WRITEV ||
+                   sqe.opcode == IORING_OP_SEND;
+        pfd.events = sqe.opcode == IORING_OP_POLL_ADD ? (sqe.op_flags & (POLLIN | POLLOUT | POLLPRI))
+                                                      : (out ? POLLOUT : POLLIN);
+        pfd.revents = 0;
+        pfds.push_back(pfd);
+    }
+    if (pfds.empty() && deadline == UINT64_MAX && g_harts.wake_fd() < 0) return false;
+    if (pfds.empty() && deadline != UINT64_MAX && idle_can_skip()) {
+        // Only timeouts pending and nothing from the host to wait for: skip
+        // the guest clock to the first one (or an earlier timer)
+        idle_step(deadline);
+        return true;
+    }
+    int timeout_ms = -1;
+    if (deadline != UINT64_MAX) {
+        uint64_t now = guest_clock_ns();
+        uint64_t wait_ms = deadline > now ? (deadline - now + 999'999) / 1'000'000 : 0;
+        timeout_ms = static_cast<int>(std::min<uint64_t>(wait_ms, INT32_MAX));
+    }
+    g_console.flush();
+    host_poll(pfds, timeout_ms);
+    return true;
+}
+#endif
 
-    SyscallContext(vfs::VirtualFS* vfs) : fs(vfs) {
-        std::random_device rd;
-        rng.seed(rd());
+// ----------------------------------------------------------------------------
+// epoll sets over the fd table (see "epoll readiness" above)
+// ----------------------------------------------------------------------------
+
+// What tells an interest in fd that it changed: a watch key, polling, or
+// nothing (always ready)
+inline uint64_t epoll_watch_key(Machine& m, int fd, bool& polled) {
+    polled = false;
+    switch (g_fds.kind(fd)) {
+        case FdKind::Pipe:
+            if (auto* pipe = get_fs(m).get_pipe(fd)) return pipe_wait_key(*pipe);
+            return 0;
+        case FdKind::EventFd:
+            return eventfd_key(*g_eventfds.at(fd));
+        case FdKind::Epoll:
+            return epoll_set_key(*g_epoll_instances.at(fd));
+        case FdKind::TimerFd:
+            return timerfd_key(*g_timerfds.at(fd));
+        case FdKind::Stdin:
+        case FdKind::Tty:
+#ifdef __EMSCRIPTEN__
+            return STDIN_WATCH_KEY;  // Input arrives while the machine is stopped
+#else
+            polled = true;
+            return 0;
+#endif
+        case FdKind::Socket:
+            polled = true;
+            return 0;
+        default:
+            return 0;
     }
-};
+}
 
-// Helper to get context from machine
-inline SyscallContext* get_ctx(Machine& m) {
-    return m.template get_userdata<SyscallContext>();
+// Queue an interest given fd's readiness. Level-triggered ones queue while
+// ready; edge-triggered ones when their object notifies or, if polled,
+// when the readiness gains a bit.
+inline void epoll_observe(EpollInstance& inst, int fd, uint32_t revents) {
+    auto& in = inst.interests.at(fd);
+    uint32_t ev = revents & (in.events | 0x18);
+    uint32_t rising = ev & ~in.seen;
+    in.seen = ev;
+    if (ev && (!(in.events & EPOLL_ET) || rising)) epoll_queue(inst, fd);
 }
 
-// Helper to check if fd is managed by VectorHeart/JSPI
-inline bool is_vh_fd(int fd) {
-    return fd >= 500 && fd < 1000;
+// EPOLL_CTL_ADD (also used by checkpoint restore)
+inline int epoll_add(Machine& m, EpollInstance& inst, int fd, uint32_t events, uint64_t data) {
+    if (inst.interests.count(fd)) return -17;  // EEXIST
+    bool polled;
+    uint64_t key = epoll_watch_key(m, fd, polled);
+    auto& in = inst.interests[fd];
+    in.events = events;
+    in.data = data;
+    in.key = key;
+    in.polled = polled;
+    if (key) g_epoll_watchers[key].emplace_back(&inst, fd);
+    if (polled) inst.polled.push_back(fd);
+    // Anything already ready is reported by the next wait
+    epoll_observe(inst, fd, fd_poll(m, fd));
+    return 0;
 }
 
-// Helper to get VFS from machine
-inline vfs::VirtualFS& get_fs(Machine& m) {
-    return *get_ctx(m)->fs;
+// EPOLL_CTL_MOD; also re-arms an EPOLLONESHOT interest
+inline int epoll_modify(Machine& m, EpollInstance& inst, int fd, uint32_t events, uint64_t data) {
+    auto it = inst.interests.find(fd);
+    if (it == inst.interests.end()) return err::NOENT;
+    it->second.events = events;
+    it->second.data = data;
+    it->second.disabled = false;
+    it->second.seen = 0;
+    epoll_observe(inst, fd, fd_poll(m, fd));
+    return 0;
+}
+
+// Recheck the polled fds, waiting up to timeout_ms (native) for one of
+// them to change
+inline void epoll_poll_host(Machine& m, EpollInstance& inst, int timeout_ms) {
+    if (inst.polled.empty()) return;
+#ifdef __EMSCRIPTEN__
+    (void)timeout_ms;
+    for (int fd : inst.polled) epoll_observe(inst, fd, fd_poll(m, fd));
+#else
+    (void)m;
+    if (timeout_ms != 0) g_console.flush();
+    // One host poll for all of them. Other harts may change the set while
+    // we wait, so go by a copy.
+    std::vector<int> fds = inst.polled;
+    std::vector<struct pollfd> pfds;
+    pfds.reserve(fds.size() + 1);
+    for (int fd : fds) {
+        const auto& in = inst.interests.at(fd);
+        bool is_sock = g_fds.kind(fd) == FdKind::Socket;
+        struct pollfd pfd;
+        pfd.fd = is_sock ? (net_get_native_fd ? net_get_native_fd(fd) : -1) : STDIN_FILENO;
+        pfd.events = 0;
+        if (in.events & 0x01) pfd.events |= POLLIN;
+        if ((in.events & 0x04) && is_sock) pfd.events |= POLLOUT;
+        pfd.revents = 0;
+        pfds.push_back(pfd);  // A negative fd is skipped by poll
+    }
+    if (host_poll(pfds, timeout_ms) < 0) return;
+    for (size_t i = 0; i < fds.size(); i++) {
+        int fd = fds[i];
+        if (!inst.interests.count(fd)) continue;
+        FdKind kind = g_fds.kind(fd);
+        uint32_t ev = 0;
+        if (pfds[i].revents & POLLIN)  ev |= 0x01;
+        if (pfds[i].revents & POLLOUT) ev |= 0x04;
+        if (kind == FdKind::Socket) {
+            if (pfds[i].revents & (POLLERR | POLLHUP)) ev |= 0x08;  // EPOLLERR
+        } else {
+            if (pfds[i].revents & POLLHUP) ev |= 0x10;  // EPOLLHUP (EOF)
+            if (kind == FdKind::Tty) ev |= 0x04;        // The terminal is always writable
+        }
+        epoll_observe(inst, fd, ev);
+    }
+#endif
+}
+
+// Move up to maxevents ready interests into the guest's epoll_event array.
+// Stale entries (no longer ready) are dropped; level-triggered ones go back
+// on the list for the next wait.
+inline int epoll_harvest(Machine& m, EpollInstance& inst, uint64_t events_addr, int maxevents) {
+    int ready = 0;
+    std::vector<int> again;
+    for (size_t n = inst.ready.size(); n > 0 && ready < maxevents; n--) {
+        int fd = inst.ready.front();
+        inst.ready.pop_front();
+        auto& in = inst.interests.at(fd);
+        in.queued = false;
+        uint32_t revents = (in.polled ? in.seen : fd_poll(m, fd)) & (in.events | 0x18);
+        if (!revents) continue;
+
+        // struct epoll_event { uint32_t events; [4 pad]; uint64_t data; } = 16 bytes
+        uint64_t offset = events_addr + ready * 16;
+        m.memory.template write<uint32_t>(offset, revents);
+        m.memory.template write<uint32_t>(offset + 4, 0);  // padding
+        m.memory.template write<uint64_t>(offset + 8, in.data);  // caller's data
+        ready++;
+
+        if (in.events & EPOLL_ONESHOT) in.disabled = true;
+        else if (!(in.events & EPOLL_ET)) again.push_back(fd);
+    }
+    for (int fd : again) epoll_queue(inst, fd);
+    return ready;
+}
+
+// Wasm: JS has delivered stdin input (called when the machine resumes)
+inline void stdin_notify() {
+    epoll_notify(STDIN_WATCH_KEY);
 }
 
 // Syscall handlers (static functions, no captures)
@@ -517,19 +2414,28 @@ static void sys_exit_group(Machine& m) {
         sys_exit(m);
         return;
     }
+    // Every hart stops; the primary's run loop then ends with this code
+    if (g_harts.enabled()) g_harts.request_exit(exit_code);
 
     // Kill all cooperative threads
-    for (int i = 0; i < MAX_VTHREADS; i++) {
-        g_sched.threads[i].active = false;
-        g_sched.threads[i].waiting = false;
-    }
-    g_sched.count = 0;
+    g_sched.clear();
 
     m.stop();
     m.set_result(exit_code);
 }
 
 static void sys_exit(Machine& m) {
+    if (auto* t = g_harts.find(m)) {
+        // A hart's thread: CLONE_CHILD_CLEARTID as below, but the joiner
+        // may be blocked on a host futex
+        if (t->clear_child_tid != 0) {
+            m.memory.template write<int32_t>(t->clear_child_tid, 0);
+            if (auto* word = arena_span<GuestAccess::Read>(m, t->clear_child_tid, 4))
+                g_harts.futex_wake(reinterpret_cast<uint32_t*>(word), 1, 1, 0);
+        }
+        m.stop();
+        return;
+    }
     // If a cooperative thread is exiting (not the main thread or a fork child),
     // remove it from the scheduler and switch to another thread.
     if (g_sched.count > 1 && g_sched.current != 0) {
@@ -547,15 +2453,25 @@ static void sys_exit(Machine& m) {
         }
 
         // Remove this thread
-        t.active = false;
-        t.waiting = false;
-        g_sched.count--;
+        g_sched.remove_thread(exiting);
 
-        // Switch to main thread (index 0) or any runnable thread
+        // Switch to main thread (index 0) or any runnable thread; with
+        // every other one waiting, to the first whose timeout ends
         int next = g_sched.next_runnable(exiting);
+        if (next < 0) next = sched_pick_idle();
+        if (next == IDLE_YIELD) {
+            // Wasm: take on one of the waiters and yield to JS;
+            // sched_resume carries on from there
+            next = g_sched.any_waiting(-1);
+            restore_thread(m, g_sched.threads[next]);
+            enter_thread(m, next);
+            g_waiting_for_stdin = true;
+            m.stop();
+            return;
+        }
         if (next >= 0) {
             restore_thread(m, g_sched.threads[next]);
-            g_sched.current = next;
+            enter_thread(m, next);
             return;
         }
         // No other threads — fall through to actual exit
@@ -613,23 +2529,32 @@ static void sys_exit(Machine& m) {
         restore(g_fork.stack_data);
         restore(g_fork.mmap_data);
 
-        // Restore VFS fd state: close any fds the child opened/dup2'd
-        // that the parent didn't have. This undoes pipe redirections
-        // (e.g. dup2(pipe_fd, 1)) so parent's stdout goes to terminal.
+        // Restore fd state: close any fds the child opened/dup2'd that
+        // the parent didn't have, then give back the parent's stdio. This
+        // undoes pipe redirections (e.g. dup2(pipe_fd, 1)) so parent's
+        // stdout goes to terminal.
         {
             auto& fs = get_fs(m);
-            auto current_fds = fs.get_open_fds();
-            for (int fd : current_fds) {
-                if (g_fork.parent_open_fds.count(fd) == 0) {
-                    fs.close(fd);
+            const auto& parent = g_fork.parent_fds;
+            for (int fd : g_fds.open_fds()) {
+                FdKind kind = g_fds.kind(fd);
+                bool inherited = static_cast<size_t>(fd) < parent.size() && parent[fd] == kind
+                    && (!fs.is_open(fd) || g_fork.parent_open_fds.count(fd));
+                if (!inherited) fd_close(m, fd);
+            }
+            for (size_t fd = 0; fd < parent.size(); fd++) {
+                if ((parent[fd] == FdKind::Stdin || parent[fd] == FdKind::Stdout)
+                    && !g_fds.is_open(fd)) {
+                    g_fds.install(fd, parent[fd]);
                 }
             }
+            g_fork.parent_fds.clear();
             g_fork.parent_open_fds.clear();
         }
 
         // Restore cooperative thread scheduler state.
         // The fork child's execve may have reset g_sched.
-        std::memcpy(&g_sched, g_fork.saved_sched, sizeof(g_sched));
+        g_sched.load(g_fork.saved_sched.data(), g_fork.saved_sched.size());
 
         // Restore parent registers (x0-x31)
         for (int i = 1; i < 32; i++) {  // Skip x0 (hardwired zero)
@@ -639,14 +2564,40 @@ static void sys_exit(Machine& m) {
         m.cpu.jump(g_fork.pc);
         // Parent sees child PID as clone() return value
         m.set_result(g_fork.child_pid);
+        g_harts.start_world();
         return;
     }
     int exit_code = m.template sysarg<int>(0);
     fprintf(stderr, "[exit] main thread exit code=%d\n", exit_code);
+    g_harts.join_others();
     m.stop();
     m.set_result(exit_code);
 }
 
+// --parallel-threads: the new thread gets a hart of its own (harts.hpp),
+// starting just after the clone ecall with its stack, TLS and a0 = 0
+inline void clone_hart(Machine& m, int tid, uint64_t sp, bool set_tls, uint64_t tls,
+                       uint64_t clear_child_tid) {
+    riscv::MachineOptions<riscv::RISCV64> opts;
+    opts.use_memory_arena = true;
+    opts.minimal_fork = true;  // Memory is the shared arena; no pages to loan
+    auto hart = std::make_unique<Machine>(m, opts);
+    hart->set_userdata(m.template get_userdata<SyscallContext>());
+    hart->set_printer(m.get_printer());
+    hart->set_stdin(m.get_stdin());
+    hart->set_rdtime(m.get_rdtime());
+    hart->cpu.reg(riscv::REG_SP) = sp;
+    hart->cpu.reg(riscv::REG_ARG0) = 0;
+    if (set_tls) hart->cpu.reg(4) = tls;  // tp register = x4
+    hart->cpu.jump(m.cpu.pc() + 4);
+    g_harts.spawn(std::move(hart), tid, clear_child_tid);
+    m.set_result(tid);
+    // The caller's dispatch chunk may have been sized for a lone hart; end
+    // it at the next safepoint instead
+    uint64_t safepoint = m.instruction_counter() + Harts::CHUNK;
+    if (m.max_instructions() > safepoint) m.set_max_instructions(safepoint);
+}
+
 // clone — cooperative vfork emulation for single-process emulator.
 // Saves parent state, returns 0 (child context). When child calls
 // exit/exit_group, parent state is restored with child PID as return.
@@ -678,17 +2629,21 @@ static void sys_clone(Machine& m) {
             }
         }
 
+        if (g_harts.enabled()) {
+            clone_hart(m, tid, child_stack, flags & F_CLONE_SETTLS, m.sysarg(3),
+                       (flags & F_CLONE_CHILD_CLEARTID) ? m.sysarg(4) : 0);
+            return;
+        }
+
         // Initialize scheduler if this is the first thread
         if (g_sched.count == 0) {
-            g_sched.init(g_next_pid - 2);  // main thread's TID
+            g_sched.init(1);  // Main thread: the TID gettid reported so far
         }
 
         // Add child thread slot
         int child_idx = g_sched.add_thread(tid);
         if (child_idx < 0) {
-            // No thread slots — fall back to fake thread
-            fprintf(stderr, "[clone] thread slots full, faking tid=%d\n", tid);
-            m.set_result(tid);
+            m.set_result(-11);  // -EAGAIN: thread table full
             return;
         }
 
@@ -714,7 +2669,7 @@ static void sys_clone(Machine& m) {
         }
 
         // Switch context: we're now "the child"
-        g_sched.current = child_idx;
+        enter_thread(m, child_idx);
         // Store child's initial state (PC is already at the ecall)
         g_sched.threads[child_idx].pc = m.cpu.pc();
 
@@ -725,15 +2680,18 @@ static void sys_clone(Machine& m) {
 
         // Return: execution continues as the child thread.
         // The parent's state is saved in g_sched.threads[parent_idx].
-        // Preemption (maybe_preempt) will give the parent time slices.
+        // The parent gets the CPU back when the child blocks or is preempted.
         return;
     }
 
-    if (g_fork.in_child) {
-        // Nested fork not supported
+    if (g_fork.in_child || g_harts.is_hart(m)) {
+        // Nested fork not supported, nor forking from a hart (the vfork
+        // emulation relies on the primary's run loop)
         m.set_result(-11);  // -EAGAIN
         return;
     }
+    // The child runs in the parent's memory: keep other harts out of it
+    g_harts.stop_world();
 
     auto child_stack = m.sysarg(1);
     fprintf(stderr, "[clone] fork flags=0x%lx child_stack=0x%lx\n",
@@ -825,14 +2783,14 @@ static void sys_clone(Machine& m) {
         }
     }
 
-    // Save VFS open fd set so child's dup2/pipe/open can be undone
+    // Save the fd table so child's dup2/pipe/open can be undone
+    g_fork.parent_fds = g_fds.slots();
     g_fork.parent_open_fds = get_fs(m).get_open_fds();
 
     // Save cooperative thread scheduler state. The fork child's execve
     // resets g_sched, and we need to restore the parent's thread state
     // when the child exits.
-    static_assert(sizeof(g_fork.saved_sched) >= sizeof(g_sched));
-    std::memcpy(g_fork.saved_sched, &g_sched, sizeof(g_sched));
+    g_sched.save(g_fork.saved_sched);
 
     // Only set in_child AFTER all saves succeed.
     // This way if memcpy_out throws, the retry will re-enter clone
@@ -893,14 +2851,19 @@ static void sys_clone3(Machine& m) {
             }
         }
 
+        if (g_harts.enabled()) {
+            clone_hart(m, tid, child_sp, flags & F_CLONE_SETTLS, tls,
+                       (flags & F_CLONE_CHILD_CLEARTID) ? child_tid : 0);
+            return;
+        }
+
         if (g_sched.count == 0) {
-            g_sched.init(g_next_pid - 2);
+            g_sched.init(1);
         }
 
         int child_idx = g_sched.add_thread(tid);
         if (child_idx < 0) {
-            fprintf(stderr, "[clone3] thread slots full, faking tid=%d\n", tid);
-            m.set_result(tid);
+            m.set_result(-11);  // -EAGAIN
             return;
         }
 
@@ -919,7 +2882,7 @@ static void sys_clone3(Machine& m) {
             g_sched.threads[child_idx].clear_child_tid = child_tid;
         }
 
-        g_sched.current = child_idx;
+        enter_thread(m, child_idx);
         g_sched.threads[child_idx].pc = m.cpu.pc();
 
         static int clone3_thread_count = 0;
@@ -930,10 +2893,11 @@ static void sys_clone3(Machine& m) {
     }
 
     // Fork path — delegate to same vfork emulation
-    if (g_fork.in_child) {
+    if (g_fork.in_child || g_harts.is_hart(m)) {
         m.set_result(-11);  // -EAGAIN
         return;
     }
+    g_harts.stop_world();
 
     fprintf(stderr, "[clone3] fork flags=0x%lx stack=0x%lx+0x%lx\n",
             (long)flags, (long)stack, (long)stack_size);
@@ -989,9 +2953,9 @@ static void sys_clone3(Machine& m) {
             m.memory.memcpy_out(r.data.data(), r.addr, r.size);
         }
     }
+    g_fork.parent_fds = g_fds.slots();
     g_fork.parent_open_fds = get_fs(m).get_open_fds();
-    static_assert(sizeof(g_fork.saved_sched) >= sizeof(g_sched));
-    std::memcpy(g_fork.saved_sched, &g_sched, sizeof(g_sched));
+    g_sched.save(g_fork.saved_sched);
 
     g_fork.in_child = true;
     g_fork.child_reaped = false;
@@ -1098,6 +3062,12 @@ static void sys_execve(Machine& m) {
         m.set_result(-38);  // -ENOSYS
         return;
     }
+    // Replacing the image would first have to end the other harts (a vfork
+    // child's execve is fine: the world is stopped until it exits)
+    if (g_harts.is_hart(m) || (g_harts.active() && !g_fork.in_child)) {
+        m.set_result(-11);  // -EAGAIN
+        return;
+    }
 
     // Read target path
     std::string path;
@@ -1231,7 +3201,7 @@ static void sys_execve(Machine& m) {
             // must not survive into the new binary. If we don't reset,
             // load_elf_segments may crash when libriscv internals interact
             // with stale thread state (e.g. decoder cache entries).
-            g_sched.init(g_sched.threads[g_sched.current].tid);
+            if (g_sched.count > 0) g_sched.init(g_sched.threads[g_sched.current].tid);
 
             // CRITICAL: Evict all stale decoder/execute segments from the old
             // binary BEFORE loading new code. set_page_attr does NOT invalidate
@@ -1407,7 +3377,7 @@ static void sys_execve(Machine& m) {
             // Set up fresh stack
             uint64_t sp = dynlink::setup_dynamic_stack(
                 m, exec_info, interp_base, args,
-                g_exec_ctx.env, new_stack_top);
+                g_exec_ctx.env, new_stack_top, vdso::map(m));
 
             // WORKAROUND: Pre-seed Go's runtime.physPageSize with 4096.
             // Go's sysauxv reads AT_PAGESZ from auxv and stores it via AUIPC+SD.
@@ -1458,9 +3428,11 @@ static void sys_execve(Machine& m) {
     // ---- Same binary (busybox applet) or non-ELF ----
     // Just set up fresh stack with new argv and re-enter the dynamic linker.
 
+    // The old image's vDSO mapping is still in place; reuse it
     uint64_t sp = dynlink::setup_dynamic_stack(
         m, g_exec_ctx.exec_info, g_exec_ctx.interp_base,
-        args, g_exec_ctx.env, g_exec_ctx.original_stack_top);
+        args, g_exec_ctx.env, g_exec_ctx.original_stack_top,
+        vdso::g_vdso_base ? vdso::g_vdso_base + vdso::PAGE : 0);
 
     for (int i = 1; i < 32; i++) m.cpu.reg(i) = 0;
     m.cpu.reg(riscv::REG_SP) = sp;
@@ -1485,27 +3457,47 @@ static void sys_openat(Machine& m) {
         return;
     }
 
+    // Statistics are a snapshot taken at open
+    if (path == SYSCALL_STATS_PATH) fs.add_virtual_file(path, g_syscall_stats.text());
+    if (path == SCHED_STATS_PATH) fs.add_virtual_file(path, sched_text(m));
+
     // Virtual device files: create synthetic VFS entries on demand via open+O_CREAT
-    if ((path == "/dev/urandom" || path == "/dev/random" || path == "/dev/null")
-        && !fs.resolve(path)) {
-        fs.open(path, 0100 /* O_CREAT */);  // creates empty file via VFS open path
+    bool is_random = path == "/dev/urandom" || path == "/dev/random";
+    if ((is_random || path == "/dev/null") && !fs.resolve(path)) {
+        fs.close(fs.open(path, 0100 /* O_CREAT */));  // creates empty file via VFS open path
     }
 
+#ifdef __EMSCRIPTEN__
     // Intercept /mnt/host access for local folder sharing
-    if (path.startsWith("/mnt/host/")) {
+    if (path.starts_with("/mnt/host/")) {
         // Redirect to VectorHeart hypercall 600
         std::string vh_path = path;
         if (flags & O_DIRECTORY) vh_path += "/";
-        long vh_fd = js_opfs_io(0, (void*)vh_path.c_str(), flags, 600, 0);
+        long handle = js_opfs_io(0, (void*)vh_path.c_str(), flags, 600, 0);
+        if (handle < 0) {
+            m.set_result(handle);
+            return;
+        }
+        int vh_fd = g_fds.alloc(FdKind::Vh);
+        if (vh_fd < 0) {
+            js_opfs_io(handle, nullptr, 0, 603, 0);
+            m.set_result(vh_fd);
+            return;
+        }
+        g_vh_handles[vh_fd] = handle;
         m.set_result(vh_fd);
         return;
     }
+#endif
 
     int fd = (flags & O_DIRECTORY) ? fs.opendir(path) : fs.open(path, flags);
-    // Track /dev/tty and /dev/pts/* opens as tty fds for ioctl
-    if (fd >= 0 && (path == "/dev/tty" || path == "/dev/console"
-                    || path.rfind("/dev/pts/", 0) == 0)) {
-        g_tty_fds.insert(fd);
+    // Devices get their own descriptor kind; /dev/tty and /dev/pts/* are
+    // the terminal (reads from stdin, writes to stdout, answers ioctls)
+    if (fd >= 0) {
+        if (is_random) g_fds.install(fd, FdKind::Random);
+        else if (path == "/dev/null") g_fds.install(fd, FdKind::Null);
+        else if (path == "/dev/tty" || path == "/dev/console" || path.rfind("/dev/pts/", 0) == 0)
+            g_fds.install(fd, FdKind::Tty);
     }
     m.set_result(fd);
 }
@@ -1514,430 +3506,58 @@ static void sys_close(Machine& m) {
     int fd = m.template sysarg<int>(0);
     if (g_trace_syscalls && g_trace_countdown-- > 0)
         fprintf(stderr, "[TRACE] close(fd=%d) pc=0x%lx\n", fd, (long)m.cpu.pc());
-    // Remove from tty tracking (but never remove 0/1/2)
-    if (fd > 2) g_tty_fds.erase(fd);
-    // Clean up epoll/eventfd state
-    g_epoll_instances.erase(fd);
-    g_eventfd_counters.erase(fd);
-
-    if (is_vh_fd(fd)) {
-#ifdef __EMSCRIPTEN__
-        m.set_result(js_opfs_io(fd, nullptr, 0, 603, 0));
-        return;
-#endif
-    }
-
-    get_fs(m).close(fd);
-    m.set_result(0);
+    m.set_result(fd_close(m, fd));
 }
 
 static void sys_read(Machine& m) {
-    auto& fs = get_fs(m);
     int fd = m.template sysarg<int>(0);
     auto buf_addr = m.sysarg(1);
     size_t count = m.sysarg(2);
     if (g_trace_syscalls && g_trace_countdown-- > 0)
         fprintf(stderr, "[TRACE] read(fd=%d, count=%zu) pc=0x%lx\n", fd, count, (long)m.cpu.pc());
 
-    // /dev/tty fds (other than 0/1/2) redirect reads to stdin
-    if (fd > 2 && g_tty_fds.count(fd)) {
-        fd = 0;  // treat as stdin read
-    }
-
-    // eventfd: return 8-byte counter value and reset
-    if (fd > 2 && g_eventfd_counters.count(fd)) {
-        if (count < 8) {
-            m.set_result(-22);  // -EINVAL (eventfd reads must be 8 bytes)
-            return;
-        }
-        uint64_t val = g_eventfd_counters[fd];
-        if (val == 0) {
-            // No signal pending — would block (EAGAIN for nonblock)
-            m.set_result(-11);  // -EAGAIN
-            return;
-        }
-        // Reset counter and clear Fifo content so epoll sees empty
-        g_eventfd_counters[fd] = 0;
-        auto& fs2 = get_fs(m);
-        auto entry = fs2.get_entry(fd);
-        if (entry) {
-            entry->content.clear();
-            entry->size = 0;
-        }
-        // Reset file offset for next write
-        fs2.lseek(fd, 0, 0);  // SEEK_SET
-        m.memory.template write<uint64_t>(buf_addr, val);
-        m.set_result(8);
-        return;
-    }
-
-    // /dev/urandom, /dev/random — return random bytes
-    if (fd > 2) {
-        auto path = fs.get_path(fd);
-        if (path == "/dev/urandom" || path == "/dev/random") {
-            auto* ctx = get_ctx(m);
-            std::vector<uint8_t> buf(count);
-            for (size_t i = 0; i < count; i++) buf[i] = ctx->rng() & 0xFF;
-            m.memory.memcpy(buf_addr, buf.data(), count);
-            m.set_result(count);
-            return;
-        }
-        if (path == "/dev/null") {
-            m.set_result(0);  // EOF
-            return;
-        }
-    }
-
-    // If fd has been redirected (e.g. dup2'd to a pipe), try VFS first.
-    // In Emscripten mode, if the VFS pipe is empty (n <= 0), fall through
-    // to the Module._stdinBuffer mechanism — libuv does pipe2+dup2 on fd 0
-    // but nothing writes to that pipe; real stdin comes via SAB.
-    if (fd == 0 && fs.is_open(fd)) {
-        std::vector<uint8_t> buf(count);
-        ssize_t n = fs.read(fd, buf.data(), count);
-        if (n > 0) {
-            m.memory.memcpy(buf_addr, buf.data(), n);
-            m.set_result(n);
-            return;
-        }
-#ifndef __EMSCRIPTEN__
-        m.set_result(n);
-        return;
-#endif
-        // Emscripten: fall through to Module._stdinBuffer below
-    }
-
-    if (fd == 0) {
-#ifdef __EMSCRIPTEN__
-        fprintf(stderr, "[sys_read] fd=0 count=%zu pc=0x%lx\n", (size_t)count, (long)m.cpu.pc());
-        // Try non-blocking read from JavaScript stdin buffer
-        auto view = m.memory.memview(buf_addr, count);
-        int bytes_read = EM_ASM_INT({
-            if (Module._stdinBuffer && Module._stdinBuffer.length > 0) {
-                var toRead = Math.min($1, Module._stdinBuffer.length);
-                for (var i = 0; i < toRead; i++) {
-                    Module.HEAPU8[$0 + i] = Module._stdinBuffer.shift();
-                }
-                return toRead;
-            }
-            if (Module._stdinEOF) return 0; // EOF
-            return -1; // -1 means "no data yet", NOT EOF
-        }, view.data(), count);
-        if (bytes_read >= 0) {
-            m.set_result(bytes_read);
-        } else {
-            // No data available — rewind PC to the ecall instruction
-            // and stop the machine. When resumed, the ecall will
-            // re-execute this syscall handler, retrying the read.
-            g_waiting_for_stdin = true;
-            m.cpu.increment_pc(-4);  // Rewind past ecall (4 bytes)
-            m.stop();
-        }
-#else
-        // Native mode: read from host stdin (pipe or terminal)
-        if (g_checkpoint_on_stdin) {
-            // Checkpoint mode: stop machine at stdin wait point
-            // (don't block on read — we want to capture state here)
-            g_waiting_for_stdin = true;
-            m.cpu.increment_pc(-4);  // Rewind past ecall
-            m.stop();
-        } else {
-            std::vector<uint8_t> buf(count);
-            ssize_t n = ::read(STDIN_FILENO, buf.data(), count);
-            if (n > 0) {
-                m.memory.memcpy(buf_addr, buf.data(), n);
-            }
-            m.set_result(n >= 0 ? n : -errno);
-        }
-#endif
-        return;
-    }
-
-    // Socket FDs: delegate to recv / network bridge
-    if (net_is_socket_fd && net_is_socket_fd(fd)) {
-#ifdef __EMSCRIPTEN__
-        // Emscripten: read socket data from JS network bridge via RPC
-        auto view = m.memory.memview(buf_addr, count);
-        int bytes_read = EM_ASM_INT({
-            if (typeof Module.readSocketData !== 'function') return 0;
-            var result = Module.readSocketData($0, $1);
-            if (!result || result.length === 0) return 0;
-            for (var i = 0; i < result.length; i++) {
-                Module.HEAPU8[$2 + i] = result[i];
-            }
-            return result.length;
-        }, fd, (int)count, (int)(uintptr_t)view.data());
-        fprintf(stderr, "[read-socket] fd=%d len=%zu bytes_read=%d\n", fd, count, bytes_read);
-        m.set_result(bytes_read > 0 ? bytes_read : -11 /*EAGAIN*/);
-        return;
-#else
-        int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
-        if (native_fd >= 0) {
-            std::vector<uint8_t> buf(count);
-            ssize_t n = ::recv(native_fd, buf.data(), count, 0);
-            if (n > 0) {
-                m.memory.memcpy(buf_addr, buf.data(), n);
-            }
-            m.set_result(n >= 0 ? n : -errno);
-            return;
-        }
-#endif
-    }
-
-    // VectorHeart JSPI-managed FDs
-    if (is_vh_fd(fd)) {
-#ifdef __EMSCRIPTEN__
-        auto* buf_ptr = m.memory.memarray<uint8_t>(buf_addr, count);
-        m.set_result(js_opfs_io(fd, buf_ptr, count, 602, 0));
+    bool parked;
+    ssize_t n;
+    try {
+        n = fd_read(m, fd, buf_addr, count, true, parked);
+    } catch (...) {
+        m.set_result(err::FAULT);
         return;
-#endif
-    }
-
-    std::vector<uint8_t> buf(count);
-    ssize_t n = fs.read(fd, buf.data(), count);
-    if (n > 0) {
-        m.memory.memcpy(buf_addr, buf.data(), n);
     }
+    if (parked) return;
     m.set_result(n);
 }
 
 static void sys_write(Machine& m) {
-    auto& fs = get_fs(m);
     int fd = m.template sysarg<int>(0);
     auto buf_addr = m.sysarg(1);
     size_t count = m.sysarg(2);
 
-    // /dev/tty fds (other than 0/1/2) redirect writes to stdout
-    if (fd > 2 && g_tty_fds.count(fd)) {
-        fd = 1;  // treat as stdout write
-    }
-
-    // /dev/null — discard all writes
-    if (fd > 2) {
-        auto path = fs.get_path(fd);
-        if (path == "/dev/null") {
-            m.set_result(count);
-            return;
-        }
-    }
-
-    // eventfd write: add value to counter, signal Fifo
-    if (fd > 2 && g_eventfd_counters.count(fd) && count >= 8) {
-        uint64_t val = m.memory.template read<uint64_t>(buf_addr);
-        g_eventfd_counters[fd] += val;
-        uint64_t total = g_eventfd_counters[fd];
-        // Update Fifo content at offset 0 so epoll sees it as ready
-        auto entry = fs.get_entry(fd);
-        if (entry) {
-            entry->content.resize(8);
-            memcpy(entry->content.data(), &total, 8);
-            entry->size = 8;
-        }
-        // Reset write offset to 0 for consistent eventfd semantics
-        fs.lseek(fd, 0, 0);  // SEEK_SET
-
-        // Wake threads sleeping on epoll instances that watch this eventfd.
-        // Threads mark themselves as waiting with futex_addr = epfd.
-        for (auto& [epfd, inst] : g_epoll_instances) {
-            if (inst.interests.count(fd)) {
-                // This epoll watches the eventfd we just wrote to.
-                // Wake any thread sleeping on this epfd.
-                for (int i = 0; i < MAX_VTHREADS; i++) {
-                    if (g_sched.threads[i].active && g_sched.threads[i].waiting
-                        && g_sched.threads[i].futex_addr == (uint64_t)epfd) {
-                        g_sched.threads[i].waiting = false;
-                        static int ewake = 0;
-                        if (++ewake <= 20)
-                            fprintf(stderr, "[eventfd-wake] write fd=%d → wake t%d (epfd=%d)\n",
-                                    fd, i, epfd);
-                    }
-                }
-            }
-        }
-        m.set_result(8);
-        return;
-    }
-
-    // Check VFS first — fd 1/2 may have been dup2'd to a pipe/file
-    if (fs.is_open(fd)) {
-        std::vector<uint8_t> buf(count);
-        m.memory.memcpy_out(buf.data(), buf_addr, count);
-        // Also tap fd 1/2 writes to host printer (Node.js dup2's stdio to pipes)
-        if (fd == 1 || fd == 2) {
-            m.print(reinterpret_cast<const char*>(buf.data()), count);
-        }
-        ssize_t n = fs.write(fd, buf.data(), count);
-        // Wake threads sleeping on epoll instances watching this pipe fd
-        for (auto& [epfd, inst] : g_epoll_instances) {
-            if (inst.interests.count(fd)) {
-                for (int i = 0; i < MAX_VTHREADS; i++) {
-                    if (g_sched.threads[i].active && g_sched.threads[i].waiting
-                        && g_sched.threads[i].futex_addr == (uint64_t)epfd) {
-                        g_sched.threads[i].waiting = false;
-                    }
-                }
-            }
-        }
-        m.set_result(n);
-        return;
-    }
-
-    // Default stdout/stderr go to host terminal
-    if (fd == 1 || fd == 2) {
-        try {
-            auto view = m.memory.memview(buf_addr, count);
-            m.print(reinterpret_cast<const char*>(view.data()), count);
-            // Trace stderr content for debugging Go runtime errors
-            if (fd == 2 && count > 0 && count < 4096) {
-                std::string dbg(reinterpret_cast<const char*>(view.data()), count);
-                fprintf(stderr, "[guest-stderr] %s", dbg.c_str());
-                if (!dbg.empty() && dbg.back() != '\n') fprintf(stderr, "\n");
-            }
-            m.set_result(count);
-        } catch (...) {
-            m.set_result(err::INVAL);
-        }
-        return;
-    }
-
-    // Socket FDs: delegate to send / network bridge
-    if (net_is_socket_fd && net_is_socket_fd(fd)) {
-#ifdef __EMSCRIPTEN__
-        std::vector<uint8_t> buf(count);
-        m.memory.memcpy_out(buf.data(), buf_addr, count);
-        int result = EM_ASM_INT({
-            if (typeof Module.onSocketSend === 'function') {
-                var data = new Uint8Array(Module.HEAPU8.buffer, $1, $2);
-                return Module.onSocketSend($0, data);
-            }
-            return -38;
-        }, fd, buf.data(), count);
-        m.set_result(result >= 0 ? (int64_t)count : result);
-        return;
-#else
-        int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
-        if (native_fd >= 0) {
-            std::vector<uint8_t> buf(count);
-            m.memory.memcpy_out(buf.data(), buf_addr, count);
-            ssize_t n = ::send(native_fd, buf.data(), count, 0);
-            m.set_result(n >= 0 ? n : -errno);
-            return;
-        }
-#endif
-    }
-
-    // VectorHeart JSPI-managed FDs
-    if (is_vh_fd(fd)) {
-#ifdef __EMSCRIPTEN__
-        auto* buf_ptr = m.memory.memarray<uint8_t>(buf_addr, count);
-        m.set_result(js_opfs_io(fd, buf_ptr, count, 601, 0));
+    bool parked;
+    ssize_t n;
+    try {
+        n = fd_write(m, fd, buf_addr, count, true, parked);
+    } catch (...) {
+        m.set_result(err::FAULT);
         return;
-#endif
     }
-
-    m.set_result(err::BADF);
+    if (parked) return;
+    m.set_result(n);
 }
 
 static void sys_writev(Machine& m) {
-    auto& fs = get_fs(m);
     int fd = m.template sysarg<int>(0);
     auto iov_addr = m.sysarg(1);
     int iovcnt = m.template sysarg<int>(2);
-
-    // Check VFS first — fd 1/2 may have been dup2'd to a pipe/file
-    if (fs.is_open(fd)) {
-        size_t total = 0;
-        for (int i = 0; i < iovcnt; i++) {
-            uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-            uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-            if (len > 0) {
-                std::vector<uint8_t> buf(len);
-                m.memory.memcpy_out(buf.data(), base, len);
-                // Also tap fd 1/2 writes to host printer
-                if (fd == 1 || fd == 2) {
-                    m.print(reinterpret_cast<const char*>(buf.data()), len);
-                }
-                ssize_t n = fs.write(fd, buf.data(), len);
-                if (n < 0) {
-                    m.set_result(total > 0 ? (int64_t)total : n);
-                    return;
-                }
-                total += n;
-            }
-        }
-        m.set_result(total);
-        return;
-    }
-
-    // Default stdout/stderr go to host terminal
-    if (fd == 1 || fd == 2) {
-        size_t total = 0;
-        for (int i = 0; i < iovcnt; i++) {
-            uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-            uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-            if (len > 0) {
-                auto view = m.memory.memview(base, len);
-                m.print(reinterpret_cast<const char*>(view.data()), len);
-                total += len;
-            }
-        }
-        m.set_result(total);
-        return;
-    }
-
-    // Socket FDs: gather iov and send / network bridge
-    if (net_is_socket_fd && net_is_socket_fd(fd)) {
-#ifdef __EMSCRIPTEN__
-        // Gather all iov buffers and send via network bridge
-        size_t total = 0;
-        for (int i = 0; i < iovcnt; i++) {
-            uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-            uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-            if (len > 0) {
-                std::vector<uint8_t> buf(len);
-                m.memory.memcpy_out(buf.data(), base, len);
-                int result = EM_ASM_INT({
-                    if (typeof Module.onSocketSend === 'function') {
-                        var data = new Uint8Array(Module.HEAPU8.buffer, $1, $2);
-                        return Module.onSocketSend($0, data);
-                    }
-                    return -38;
-                }, fd, buf.data(), len);
-                if (result < 0) {
-                    m.set_result(total > 0 ? (int64_t)total : result);
-                    return;
-                }
-                total += len;
-            }
-        }
-        m.set_result(total);
+    if (iovcnt < 0) {
+        m.set_result(err::INVAL);
         return;
-#else
-        int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
-        if (native_fd >= 0) {
-            size_t total = 0;
-            for (int i = 0; i < iovcnt; i++) {
-                uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-                uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-                if (len > 0) {
-                    std::vector<uint8_t> buf(len);
-                    m.memory.memcpy_out(buf.data(), base, len);
-                    ssize_t n = ::send(native_fd, buf.data(), len, 0);
-                    if (n < 0) {
-                        m.set_result(total > 0 ? (int64_t)total : -errno);
-                        return;
-                    }
-                    total += n;
-                    if (static_cast<size_t>(n) < len) break;
-                }
-            }
-            m.set_result(total);
-            return;
-        }
-#endif
     }
 
-    m.set_result(err::BADF);
+    bool parked;
+    int64_t n = fd_writev(m, fd, iov_addr, iovcnt, true, parked);
+    if (parked) return;
+    m.set_result(n);
 }
 
 static void sys_lseek(Machine& m) {
@@ -1945,12 +3565,12 @@ static void sys_lseek(Machine& m) {
     int64_t offset = m.template sysarg<int64_t>(1);
     int whence = m.template sysarg<int>(2);
 
-    if (is_vh_fd(fd)) {
+    if (g_fds.kind(fd) == FdKind::Vh) {
 #ifdef __EMSCRIPTEN__
         // js_opfs_io 604 handles positional reads, but for pure lseek 
         // we might need a dedicated op or manage offset in JS.
         // For now, return the offset to avoid breaking callers.
-        m.set_result(js_opfs_io(fd, nullptr, 0, 605, (long)offset)); // Op 605 = lseek
+        m.set_result(js_opfs_io(vh_handle(fd), nullptr, 0, 605, (long)offset)); // Op 605 = lseek
         return;
 #endif
     }
@@ -1965,20 +3585,17 @@ static void sys_getdents64(Machine& m) {
     auto buf_addr = m.sysarg(1);
     size_t count = m.sysarg(2);
 
-    if (is_vh_fd(fd)) {
+    if (g_fds.kind(fd) == FdKind::Vh) {
 #ifdef __EMSCRIPTEN__
         auto* buf = m.memory.memarray<uint8_t>(buf_addr, count);
-        m.set_result(js_opfs_io(fd, buf, count, 607, 0));
+        m.set_result(js_opfs_io(vh_handle(fd), buf, count, 607, 0));
         return;
 #endif
     }
 
-    std::vector<uint8_t> buf(count);
-    ssize_t n = fs.getdents64(fd, buf.data(), count);
-    if (n > 0) {
-        m.memory.memcpy(buf_addr, buf.data(), n);
-    }
-    m.set_result(n);
+    // Records are laid out straight into the guest buffer
+    auto* buf = m.memory.template memarray<uint8_t>(buf_addr, count, count);
+    m.set_result(fs.getdents64(fd, buf, count));
 }
 
 static void sys_newfstatat(Machine& m) {
@@ -2015,9 +3632,9 @@ static void sys_newfstatat(Machine& m) {
 
     linux_stat64 st = {};
     st.st_dev = 1;
-    st.st_ino = std::hash<std::string>{}(path);
+    st.st_ino = entry.ino;
     st.st_mode = static_cast<uint32_t>(entry.type) | entry.mode;
-    st.st_nlink = entry.is_dir() ? 2 : 1;
+    st.st_nlink = entry.is_dir() ? 2 : std::max(entry.nlink, 1u);
     st.st_uid = entry.uid;
     st.st_gid = entry.gid;
     st.st_size = entry.size;
@@ -2036,12 +3653,12 @@ static void sys_fstat(Machine& m) {
     int fd = m.template sysarg<int>(0);
     auto statbuf_addr = m.sysarg(1);
 
-    if (is_vh_fd(fd)) {
+    if (g_fds.kind(fd) == FdKind::Vh) {
 #ifdef __EMSCRIPTEN__
         // Redirect to VH op 606 (fstat)
         // We pass statbuf_addr as the buffer
         auto* buf = m.memory.memarray<uint8_t>(statbuf_addr, sizeof(linux_stat64));
-        m.set_result(js_opfs_io(fd, buf, sizeof(linux_stat64), 606, 0));
+        m.set_result(js_opfs_io(vh_handle(fd), buf, sizeof(linux_stat64), 606, 0));
         return;
 #endif
     }
@@ -2061,12 +3678,11 @@ static void sys_fstat(Machine& m) {
     // VFS file descriptors
     auto entry = fs.get_entry(fd);
     if (entry) {
-        std::string path = fs.get_path(fd);
         linux_stat64 st = {};
         st.st_dev = 1;
-        st.st_ino = std::hash<std::string>{}(path);
+        st.st_ino = entry->ino;
         st.st_mode = static_cast<uint32_t>(entry->type) | entry->mode;
-        st.st_nlink = entry->is_dir() ? 2 : 1;
+        st.st_nlink = entry->is_dir() ? 2 : std::max(entry->nlink, 1u);
         st.st_uid = entry->uid;
         st.st_gid = entry->gid;
         st.st_size = entry->size;
@@ -2165,12 +3781,7 @@ static void sys_getpid(Machine& m) {
 }
 static void sys_getppid(Machine& m) { m.set_result(0); }
 static void sys_gettid(Machine& m) {
-    int tid;
-    if (g_sched.count > 0) {
-        tid = g_sched.threads[g_sched.current].tid;
-    } else {
-        tid = 1;
-    }
+    int tid = current_tid(m);
     if (g_trace_syscalls && g_trace_countdown-- > 0)
         fprintf(stderr, "[TRACE] gettid() => %d pc=0x%lx\n", tid, (long)m.cpu.pc());
     m.set_result(tid);
@@ -2182,7 +3793,10 @@ static void sys_getegid(Machine& m) { m.set_result(0); }
 static void sys_set_tid_address(Machine& m) {
     auto tidptr = m.sysarg(0);
     // Store clear_child_tid for current thread (used on thread exit)
-    if (g_sched.count > 0) {
+    if (auto* t = g_harts.find(m)) {
+        t->clear_child_tid = tidptr;
+        m.set_result(t->tid);
+    } else if (g_sched.count > 0) {
         g_sched.threads[g_sched.current].clear_child_tid = tidptr;
         m.set_result(g_sched.threads[g_sched.current].tid);
     } else {
@@ -2194,24 +3808,39 @@ static void sys_set_robust_list(Machine& m) { m.set_result(0); }
 static void sys_clock_gettime(Machine& m) {
     auto clk_id = m.template sysarg<int>(0);
     auto tp_addr = m.sysarg(1);
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = realtime_clock(clk_id) ? guest_realtime_ns() : guest_clock_ns();
 
     linux_timespec lts;
-    lts.tv_sec = ts.tv_sec;
-    lts.tv_nsec = ts.tv_nsec;
+    lts.tv_sec = now / 1'000'000'000;
+    lts.tv_nsec = now % 1'000'000'000;
     m.memory.memcpy(tp_addr, &lts, sizeof(lts));
     m.set_result(0);
+    vdso_refresh(m);
 
     if (g_trace_syscalls && g_trace_countdown-- > 0)
         fprintf(stderr, "[TRACE] clock_gettime(clk=%d) => 0 pc=0x%lx\n", clk_id, (long)m.cpu.pc());
+}
 
-    // Preemptive scheduling: yield to other threads periodically
-    maybe_preempt(m);
+// riscv64 libcs normally serve gettimeofday from the vDSO; this is its
+// fallback path
+static void sys_gettimeofday(Machine& m) {
+    auto tv_addr = m.sysarg(0);
+    auto tz_addr = m.sysarg(1);
+    uint64_t now = guest_realtime_ns();
+    if (tv_addr) {
+        int64_t tv[2] = {static_cast<int64_t>(now / 1'000'000'000),
+                         static_cast<int64_t>(now % 1'000'000'000 / 1000)};
+        m.memory.memcpy(tv_addr, tv, sizeof(tv));
+    }
+    if (tz_addr) {
+        int32_t tz[2] = {0, 0};  // UTC, no DST
+        m.memory.memcpy(tz_addr, tz, sizeof(tz));
+    }
+    m.set_result(0);
+    vdso_refresh(m);
 }
 
 static void sys_getrandom(Machine& m) {
-    auto* ctx = get_ctx(m);
     auto buf_addr = m.sysarg(0);
     size_t count = m.sysarg(1);
     auto flags = m.template sysarg<unsigned int>(2);
@@ -2219,23 +3848,11 @@ static void sys_getrandom(Machine& m) {
     fprintf(stderr, "[getrandom] buf=0x%lx count=%zu flags=0x%x pc=0x%lx\n",
             (long)buf_addr, count, flags, (long)m.cpu.pc());
 
-    std::vector<uint8_t> buf(count);
-    // Use host /dev/urandom for better entropy (OpenSSL may check randomness quality)
-    FILE* urandom = fopen("/dev/urandom", "rb");
-    if (urandom) {
-        size_t got = fread(buf.data(), 1, count, urandom);
-        fclose(urandom);
-        if (got < count) {
-            // Fill remainder with PRNG
-            for (size_t i = got; i < count; i++)
-                buf[i] = ctx->rng() & 0xFF;
-        }
-    } else {
-        for (size_t i = 0; i < count; i++)
-            buf[i] = ctx->rng() & 0xFF;
-    }
-    m.memory.memcpy(buf_addr, buf.data(), count);
-    m.set_result(count);
+    m.set_result(guest_transfer<GuestAccess::Write>(m, buf_addr, count,
+        [](char* buf, size_t size, size_t) {
+            g_entropy.fill(buf, size);
+            return static_cast<ssize_t>(size);
+        }));
 }
 
 // Saved reference to libriscv's built-in mmap handler.
@@ -2365,8 +3982,12 @@ static void sys_mmap(Machine& m) {
         if (anon_count <= 20)
             fprintf(stderr, "[mmap-anon] #%d addr=0x%lx len=0x%lx prot=%d flags=0x%x => 0x%lx (bump=0x%lx)\n",
                     anon_count, (long)addr_g, (long)length, prot, flags, (long)result, (long)our_bump);
+        return;
+    }
 
-        maybe_preempt(m);
+    if (g_fds.kind(vfd) == FdKind::IoUring) {
+        auto it = g_io_urings.find(vfd);
+        m.set_result(it != g_io_urings.end() ? io_uring_map(m, *it->second, m.sysarg(5)) : err::BADF);
         return;
     }
 
@@ -2448,12 +4069,12 @@ static void sys_mmap(Machine& m) {
     m.memory.memdiscard(dst, length, true);
 
 
-    // Copy file data from VFS directly into guest memory
-    const auto& content = entry->content;
-    if (offset < content.size()) {
-        size_t avail = content.size() - offset;
-        size_t to_copy = std::min((size_t)length, avail);
-        m.memory.memcpy(dst, content.data() + offset, to_copy);
+    // Copy file data from VFS directly into guest memory (host-mounted
+    // files are read through their descriptor)
+    if (offset < entry->size) {
+        size_t to_copy = std::min<uint64_t>(length, entry->size - offset);
+        auto* guest = m.memory.template memarray<uint8_t>(dst, to_copy, to_copy);
+        ctx->fs->pread(vfd, guest, to_copy, offset);
     }
 
     // Set final page attributes
@@ -2627,47 +4248,99 @@ static void sys_rseq(Machine& m) { m.set_result(err::NOSYS); }
 
 // sendfile(out_fd, in_fd, offset, count) - copy data between fds via VFS
 static void sys_sendfile(Machine& m) {
-    auto* ctx = get_ctx(m);
     int out_fd = m.template sysarg<int>(0);
     int in_fd = m.template sysarg<int>(1);
     auto offset_ptr = m.sysarg(2);
     size_t count = m.sysarg(3);
 
-    // Read from in_fd
-    if (count > 65536) count = 65536;  // cap single transfer
-    std::vector<uint8_t> buf(count);
-
-    // Handle offset if provided
+    uint64_t offset = 0;
     if (offset_ptr != 0) {
         int64_t off = m.memory.template read<int64_t>(offset_ptr);
-        ssize_t n = ctx->fs->pread(in_fd, buf.data(), count, off);
-        if (n < 0) { m.set_result(n); return; }
-        // Update the offset
-        m.memory.template write<int64_t>(offset_ptr, off + n);
-        count = n;
-    } else {
-        ssize_t n = ctx->fs->read(in_fd, buf.data(), count);
-        if (n < 0) { m.set_result(n); return; }
-        count = n;
+        if (off < 0) { m.set_result(err::INVAL); return; }
+        offset = off;
     }
 
-    if (count == 0) { m.set_result(0); return; }
+    bool parked;
+    ssize_t n = fd_splice(m, in_fd, offset_ptr ? &offset : nullptr, out_fd, nullptr, count, true,
+                          parked);
+    if (parked) return;
+    if (n > 0 && offset_ptr != 0) m.memory.template write<int64_t>(offset_ptr, offset);
+    m.set_result(n);
+}
 
-    // Write to out_fd
-    if (out_fd == 1 || out_fd == 2) {
-        // stdout/stderr - use printer
-        m.print(reinterpret_cast<const char*>(buf.data()), count);
-        m.set_result(count);
-    } else {
-        ssize_t n = ctx->fs->write(out_fd, buf.data(), count);
-        m.set_result(n);
+// splice: like sendfile, but one end must be a pipe, and an offset applies
+// to the non-pipe end (ESPIPE on the pipe end)
+static void sys_splice(Machine& m) {
+    int in_fd = m.template sysarg<int>(0);
+    auto in_off_ptr = m.sysarg(1);
+    int out_fd = m.template sysarg<int>(2);
+    auto out_off_ptr = m.sysarg(3);
+    size_t count = m.sysarg(4);
+    unsigned flags = m.template sysarg<unsigned>(5);
+    constexpr unsigned SPLICE_F_NONBLOCK = 2;
+
+    if (!g_fds.is_open(in_fd) || !g_fds.is_open(out_fd)) { m.set_result(err::BADF); return; }
+    bool in_pipe = g_fds.kind(in_fd) == FdKind::Pipe;
+    bool out_pipe = g_fds.kind(out_fd) == FdKind::Pipe;
+    if (!in_pipe && !out_pipe) { m.set_result(err::INVAL); return; }
+    if ((in_pipe && in_off_ptr) || (out_pipe && out_off_ptr)) { m.set_result(err::SPIPE); return; }
+
+    // At most one of these is used: the offset of the non-pipe end
+    uint64_t offset = 0;
+    if (in_off_ptr || out_off_ptr) {
+        int64_t off = m.memory.template read<int64_t>(in_off_ptr ? in_off_ptr : out_off_ptr);
+        if (off < 0) { m.set_result(err::INVAL); return; }
+        offset = off;
+    }
+
+    bool parked;
+    ssize_t n = fd_splice(m, in_fd, in_off_ptr ? &offset : nullptr,
+                          out_fd, out_off_ptr ? &offset : nullptr, count,
+                          !(flags & SPLICE_F_NONBLOCK), parked);
+    if (parked) return;
+    if (n > 0 && (in_off_ptr || out_off_ptr)) {
+        m.memory.template write<int64_t>(in_off_ptr ? in_off_ptr : out_off_ptr, offset);
+    }
+    m.set_result(n);
+}
+
+// copy_file_range: regular file to regular file, inside the VFS
+static void sys_copy_file_range(Machine& m) {
+    int in_fd = m.template sysarg<int>(0);
+    auto in_off_ptr = m.sysarg(1);
+    int out_fd = m.template sysarg<int>(2);
+    auto out_off_ptr = m.sysarg(3);
+    size_t count = m.sysarg(4);
+    unsigned flags = m.template sysarg<unsigned>(5);
+
+    if (!g_fds.is_open(in_fd) || !g_fds.is_open(out_fd)) { m.set_result(err::BADF); return; }
+    if (flags != 0 || g_fds.kind(in_fd) != FdKind::File || g_fds.kind(out_fd) != FdKind::File) {
+        m.set_result(err::INVAL);
+        return;
+    }
+
+    uint64_t in_off = 0, out_off = 0;
+    if (in_off_ptr) in_off = m.memory.template read<int64_t>(in_off_ptr);
+    if (out_off_ptr) out_off = m.memory.template read<int64_t>(out_off_ptr);
+    if (static_cast<int64_t>(in_off) < 0 || static_cast<int64_t>(out_off) < 0) {
+        m.set_result(err::INVAL);
+        return;
+    }
+
+    ssize_t n = get_fs(m).copy_range(in_fd, in_off_ptr ? &in_off : nullptr,
+                                     out_fd, out_off_ptr ? &out_off : nullptr, count);
+    if (n > 0) {
+        if (in_off_ptr) m.memory.template write<int64_t>(in_off_ptr, in_off);
+        if (out_off_ptr) m.memory.template write<int64_t>(out_off_ptr, out_off);
     }
+    m.set_result(n);
 }
 
 static void sys_ioctl(Machine& m) {
     int fd = m.template sysarg<int>(0);
     unsigned long request = m.sysarg(1);
-    bool is_tty = g_tty_fds.count(fd) > 0;
+    FdKind kind = g_fds.kind(fd);
+    bool is_tty = kind == FdKind::Stdin || kind == FdKind::Stdout || kind == FdKind::Tty;
 
     // TIOCGWINSZ - get window size (all tty fds)
     if (request == 0x5413) {
@@ -2740,13 +4413,21 @@ static void sys_ioctl(Machine& m) {
 
     // FIONBIO - set non-blocking mode (libuv uses this on pipes/sockets)
     if (request == 0x5421) {
+        auto& fs = get_fs(m);
+        int flags = fs.get_flags(fd);
+        if (flags >= 0) {
+            int on = m.memory.template read<int32_t>(m.sysarg(2));
+            fs.set_flags(fd, on ? (flags | 04000) : (flags & ~04000));
+        } else if (auto it = g_timerfds.find(fd); it != g_timerfds.end()) {
+            it->second->nonblock = m.memory.template read<int32_t>(m.sysarg(2)) != 0;
+        }
         m.set_result(0);
         return;
     }
 
     // FIONREAD - bytes available in buffer
     if (request == 0x541b) {
-        if (fd == 0) {
+        if (kind == FdKind::Stdin) {
             auto count_addr = m.sysarg(2);
             int32_t avail = 0;
 #ifdef __EMSCRIPTEN__
@@ -2758,6 +4439,12 @@ static void sys_ioctl(Machine& m) {
             m.set_result(0);
             return;
         }
+        if (auto* pipe = get_fs(m).get_pipe(fd)) {
+            int32_t avail = static_cast<int32_t>(pipe->size());
+            m.memory.memcpy(m.sysarg(2), &avail, 4);
+            m.set_result(0);
+            return;
+        }
     }
 
     fprintf(stderr, "[ioctl] fd=%d request=0x%lx => -ENOTSUP\n", fd, (long)request);
@@ -2769,12 +4456,9 @@ static void sys_fcntl(Machine& m) {
     int fd = m.template sysarg<int>(0);
     int cmd = m.template sysarg<int>(1);
 
-    // Validate fd: 0-2 are always valid (stdin/stdout/stderr),
-    // other fds must be open in VFS, be a socket fd, or be an epoll fd.
-    // Return -EBADF for invalid fds
+    // Return -EBADF for fds not in the table
     // (critical: loops like libuv's fd-cloexec rely on -EBADF to terminate).
-    bool valid = (fd >= 0 && fd <= 2) || fs.is_open(fd) || net_is_socket_fd(fd)
-                 || g_epoll_instances.count(fd) || g_eventfd_counters.count(fd);
+    bool valid = g_fds.is_open(fd);
     fprintf(stderr, "[fcntl] fd=%d cmd=%d valid=%d\n", fd, cmd, (int)valid);
     if (!valid) {
         m.set_result(err::BADF);
@@ -2787,30 +4471,19 @@ static void sys_fcntl(Machine& m) {
     constexpr int F_GETFL = 3;
     constexpr int F_SETFL = 4;
     constexpr int F_DUPFD_CLOEXEC = 1030;
+    constexpr int F_SETPIPE_SZ = 1031;
+    constexpr int F_GETPIPE_SZ = 1032;
 
     switch (cmd) {
         case F_DUPFD:
         case F_DUPFD_CLOEXEC: {
-            // Epoll fds: dup by creating alias in g_epoll_instances
-            if (g_epoll_instances.count(fd)) {
-                int newfd = g_next_epoll_fd++;
-                g_epoll_instances[newfd] = g_epoll_instances[fd];
-                fprintf(stderr, "[fcntl] F_DUPFD epoll fd=%d -> newfd=%d\n", fd, newfd);
-                m.set_result(newfd);
-                return;
-            }
-            // Eventfd: dup by creating alias in VFS + counter map
-            if (g_eventfd_counters.count(fd)) {
-                int newfd = fs.dup(fd);
-                if (newfd >= 0) g_eventfd_counters[newfd] = g_eventfd_counters[fd];
-                m.set_result(newfd);
+            // Lowest free fd at or above arg
+            int min_fd = m.template sysarg<int>(2);
+            if (min_fd < 0 || min_fd >= FdTable::MAX_FDS) {
+                m.set_result(err::INVAL);
                 return;
             }
-            int newfd = fs.dup(fd);
-            // Propagate tty status to new fd
-            if (newfd >= 0 && g_tty_fds.count(fd))
-                g_tty_fds.insert(newfd);
-            m.set_result(newfd);
+            m.set_result(fd_dup(m, fd, min_fd, false));
             return;
         }
         case F_GETFD:
@@ -2819,13 +4492,26 @@ static void sys_fcntl(Machine& m) {
         case F_SETFD:
             m.set_result(0);
             return;
-        case F_GETFL:
-            m.set_result((fd == 1 || fd == 2) ? 1 : 0);
+        case F_GETFL: {
+            if (auto it = g_timerfds.find(fd); it != g_timerfds.end()) {
+                m.set_result(0x2 | (it->second->nonblock ? 0x800 : 0));  // O_RDWR
+                return;
+            }
+            int flags = fs.get_flags(fd);
+            if (flags >= 0) {
+                m.set_result(flags);
+                return;
+            }
+            m.set_result(g_fds.kind(fd) == FdKind::Stdout ? 1 : 0);
             return;
+        }
         case F_SETFL: {
+            if (auto it = g_timerfds.find(fd); it != g_timerfds.end())
+                it->second->nonblock = m.template sysarg<int>(2) & 0x800;
+            fs.set_flags(fd, m.template sysarg<int>(2));
 #ifndef __EMSCRIPTEN__
             // For socket FDs, forward nonblocking flag to the real socket
-            if (net_is_socket_fd(fd) && net_set_nonblock) {
+            if (g_fds.kind(fd) == FdKind::Socket && net_set_nonblock) {
                 int arg = m.template sysarg<int>(2);
                 net_set_nonblock(fd, (arg & 0x800) != 0);
             }
@@ -2833,6 +4519,22 @@ static void sys_fcntl(Machine& m) {
             m.set_result(0);
             return;
         }
+        case F_GETPIPE_SZ:
+        case F_SETPIPE_SZ: {
+            auto* pipe = fs.get_pipe(fd);
+            if (!pipe) {
+                m.set_result(err::BADF);
+                return;
+            }
+            if (cmd == F_GETPIPE_SZ) {
+                m.set_result(pipe->capacity());
+                return;
+            }
+            m.set_result(pipe->set_capacity(m.sysarg(2)));
+            // A larger ring may unblock a waiting writer
+            wake_pipe_waiters(*pipe);
+            return;
+        }
         default:
             m.set_result(0);
             return;
@@ -2849,48 +4551,40 @@ static void sys_close_range(Machine& m) {
 }
 
 static void sys_dup(Machine& m) {
-    auto& fs = get_fs(m);
     int oldfd = m.template sysarg<int>(0);
-    int result = fs.dup(oldfd);
-    // Propagate tty status to new fd
-    if (result >= 0 && g_tty_fds.count(oldfd))
-        g_tty_fds.insert(result);
-    m.set_result(result);
+    m.set_result(fd_dup(m, oldfd, 0, false));
 }
 
 static void sys_dup3(Machine& m) {
-    auto& fs = get_fs(m);
     int oldfd = m.template sysarg<int>(0);
     int newfd = m.template sysarg<int>(1);
     if (oldfd == newfd) {
         m.set_result(err::INVAL);
         return;
     }
-    int result = fs.dup2(oldfd, newfd);
-    // Propagate tty status: if old fd is tty, new fd becomes tty
-    if (result >= 0) {
-        if (g_tty_fds.count(oldfd))
-            g_tty_fds.insert(newfd);
-        else if (newfd > 2)
-            g_tty_fds.erase(newfd);  // dup'd non-tty over a tty fd
-    }
-    m.set_result(result);
+    m.set_result(fd_dup(m, oldfd, newfd, true));
 }
 
 static void sys_pipe2(Machine& m) {
     auto& fs = get_fs(m);
     auto pipefd_addr = m.sysarg(0);
+    int flags = m.template sysarg<int>(1);
 
-    // Create a pipe using two connected in-memory file handles
-    // Write end writes to a shared buffer, read end reads from it
-    auto pipe_entry = std::make_shared<vfs::Entry>();
-    pipe_entry->type = vfs::FileType::Fifo;
-    pipe_entry->mode = 0600;
-    pipe_entry->size = 0;
+    // Two handles on one ring buffer: the write end fills it, the read end
+    // drains it (see vfs::PipeBuffer)
+    auto pipe_entry = fs.make_pipe();
 
     // Allocate two fds - read end and write end
-    int read_fd = fs.open_pipe(pipe_entry, 0);
-    int write_fd = fs.open_pipe(pipe_entry, 1);
+    int read_fd = fs.open_pipe(pipe_entry, 0, flags);
+    int write_fd = fs.open_pipe(pipe_entry, 1, flags);
+    if (read_fd < 0 || write_fd < 0) {
+        fs.close(read_fd);
+        fs.close(write_fd);
+        m.set_result(read_fd < 0 ? read_fd : write_fd);
+        return;
+    }
+    g_fds.install(read_fd, FdKind::Pipe);
+    g_fds.install(write_fd, FdKind::Pipe);
 
     int32_t fds[2] = { read_fd, write_fd };
     m.memory.memcpy(pipefd_addr, fds, sizeof(fds));
@@ -2899,131 +4593,18 @@ static void sys_pipe2(Machine& m) {
 }
 
 static void sys_readv(Machine& m) {
-    auto& fs = get_fs(m);
     int fd = m.template sysarg<int>(0);
     auto iov_addr = m.sysarg(1);
     int iovcnt = m.template sysarg<int>(2);
-
-    // /dev/tty fds (other than 0/1/2) redirect reads to stdin
-    if (fd > 2 && g_tty_fds.count(fd)) {
-        fd = 0;  // treat as stdin read
-    }
-
-    // If fd 0 has been redirected (e.g. dup2'd to a pipe), try VFS first.
-    // In Emscripten mode, if the VFS pipe is empty, fall through to
-    // Module._stdinBuffer — libuv does pipe2+dup2 but real stdin comes via SAB.
-    if (fd == 0 && fs.is_open(fd)) {
-        size_t total = 0;
-        for (int i = 0; i < iovcnt; i++) {
-            uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-            uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-            if (len > 0) {
-                std::vector<uint8_t> buf(len);
-                ssize_t n = fs.read(fd, buf.data(), len);
-                if (n < 0) {
-                    m.set_result(total > 0 ? (int64_t)total : n);
-                    return;
-                }
-                if (n > 0) {
-                    m.memory.memcpy(base, buf.data(), n);
-                    total += n;
-                }
-                if (static_cast<size_t>(n) < len) break;
-            }
-        }
-        if (total > 0) {
-            m.set_result(total);
-            return;
-        }
-#ifndef __EMSCRIPTEN__
-        m.set_result(0);
-        return;
-#endif
-        // Emscripten: fall through to Module._stdinBuffer below
-    }
-
-    if (fd == 0) {
-#ifdef __EMSCRIPTEN__
-        // Try non-blocking read from JavaScript stdin buffer into iovec
-        int has_data = EM_ASM_INT({
-            return (Module._stdinBuffer && Module._stdinBuffer.length > 0) ? 1 :
-                   (Module._stdinEOF ? -1 : 0);
-        });
-        if (has_data == -1) {
-            // EOF
-            m.set_result(0);
-            return;
-        }
-        if (has_data == 0) {
-            // No data — rewind PC and stop machine so main loop can yield
-            g_waiting_for_stdin = true;
-            m.cpu.increment_pc(-4);  // Rewind past ecall (4 bytes)
-            m.stop();
-            return;
-        }
-        size_t total = 0;
-        for (int i = 0; i < iovcnt; i++) {
-            uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-            uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-            if (len > 0) {
-                auto view = m.memory.memview(base, len);
-                int bytes_read = EM_ASM_INT({
-                    if (Module._stdinBuffer && Module._stdinBuffer.length > 0) {
-                        var toRead = Math.min($1, Module._stdinBuffer.length);
-                        for (var i = 0; i < toRead; i++) {
-                            Module.HEAPU8[$0 + i] = Module._stdinBuffer.shift();
-                        }
-                        return toRead;
-                    }
-                    return 0;
-                }, view.data(), len);
-                if (bytes_read > 0) {
-                    total += bytes_read;
-                }
-                if (static_cast<size_t>(bytes_read) < len) break;
-            }
-        }
-        m.set_result(total);
-#else
-        // Native mode: read from host stdin into iovec
-        size_t total = 0;
-        for (int i = 0; i < iovcnt; i++) {
-            uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-            uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-            if (len > 0) {
-                std::vector<uint8_t> buf(len);
-                ssize_t n = ::read(STDIN_FILENO, buf.data(), len);
-                if (n > 0) {
-                    m.memory.memcpy(base, buf.data(), n);
-                    total += n;
-                }
-                if (n <= 0 || static_cast<size_t>(n) < len) break;
-            }
-        }
-        m.set_result(total > 0 ? (int64_t)total : 0);
-#endif
+    if (iovcnt < 0) {
+        m.set_result(err::INVAL);
         return;
     }
 
-    size_t total = 0;
-    for (int i = 0; i < iovcnt; i++) {
-        uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-        uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-        if (len > 0) {
-            std::vector<uint8_t> buf(len);
-            ssize_t n = fs.read(fd, buf.data(), len);
-            if (n < 0) {
-                m.set_result(total > 0 ? (int64_t)total : n);
-                return;
-            }
-            if (n > 0) {
-                m.memory.memcpy(base, buf.data(), n);
-                total += n;
-            }
-            if (static_cast<size_t>(n) < len) break;  // Short read
-        }
-    }
-    m.set_result(total);
+    bool parked;
+    int64_t n = fd_readv(m, fd, iov_addr, iovcnt, true, parked);
+    if (parked) return;
+    m.set_result(n);
 }
 
 static void sys_pread64(Machine& m) {
@@ -3033,12 +4614,8 @@ static void sys_pread64(Machine& m) {
     size_t count = m.sysarg(2);
     uint64_t offset = m.sysarg(3);
 
-    std::vector<uint8_t> buf(count);
-    ssize_t n = fs.pread(fd, buf.data(), count, offset);
-    if (n > 0) {
-        m.memory.memcpy(buf_addr, buf.data(), n);
-    }
-    m.set_result(n);
+    m.set_result(guest_transfer<GuestAccess::Write>(m, buf_addr, count,
+        [&](char* buf, size_t size, size_t done) { return fs.pread(fd, buf, size, offset + done); }));
 }
 
 static void sys_pwrite64(Machine& m) {
@@ -3048,10 +4625,8 @@ static void sys_pwrite64(Machine& m) {
     size_t count = m.sysarg(2);
     uint64_t offset = m.sysarg(3);
 
-    std::vector<uint8_t> buf(count);
-    m.memory.memcpy_out(buf.data(), buf_addr, count);
-    ssize_t n = fs.pwrite(fd, buf.data(), count, offset);
-    m.set_result(n);
+    m.set_result(guest_transfer<GuestAccess::Read>(m, buf_addr, count,
+        [&](char* buf, size_t size, size_t done) { return fs.pwrite(fd, buf, size, offset + done); }));
 }
 
 static void sys_ftruncate(Machine& m) {
@@ -3198,122 +4773,155 @@ static void sys_ppoll(Machine& m) {
     auto timeout_addr = m.sysarg(2);
     // arg3: sigmask (ignored), arg4: sigsetsize (ignored)
 
-    if (nfds == 0) {
-        m.set_result(0);
-        return;
-    }
-    if (nfds > 64) nfds = 64;
-
-    // Read timeout: NULL = block forever, {0,0} = return immediately
+    // Read timeout: NULL = block forever, {0,0} = return immediately. A
+    // re-run of a wait this thread parked in keeps its first deadline.
     bool has_timeout = (timeout_addr != 0);
     bool zero_timeout = false;
+    uint64_t deadline = take_restart_deadline();
     if (has_timeout) {
         int64_t tv_sec = m.memory.template read<int64_t>(timeout_addr);
         int64_t tv_nsec = m.memory.template read<int64_t>(timeout_addr + 8);
         zero_timeout = (tv_sec == 0 && tv_nsec == 0);
+        if (!deadline) {
+            int64_t d = timespec_deadline(m, timeout_addr, true);
+            if (d < 0) {
+                m.set_result(d);
+                return;
+            }
+            deadline = d;
+        }
     }
-    int ready = 0;
-    bool needs_stdin = false;
 
-    for (uint64_t i = 0; i < nfds; i++) {
-        uint64_t entry_addr = fds_addr + i * 8;
-        int32_t fd = m.memory.template read<int32_t>(entry_addr);
-        int16_t events = m.memory.template read<int16_t>(entry_addr + 4);
-        int16_t revents = 0;
+    if (nfds == 0) {
+        // A plain sleep
+        if (has_timeout && !zero_timeout) {
+            sleep_until(m, deadline);
+        } else {
+            m.set_result(0);
+        }
+        return;
+    }
+    if (nfds > 64) nfds = 64;
 
-        if (fd == 0 && (events & 0x0001 /*POLLIN*/)) {
-#ifdef __EMSCRIPTEN__
-            int has_data = EM_ASM_INT({
-                return (Module._stdinBuffer && Module._stdinBuffer.length > 0) ? 1 :
-                       (Module._stdinEOF ? -1 : 0);
-            });
-            if (has_data == 1) {
-                revents |= 0x0001; // POLLIN
-                ready++;
-            } else if (has_data == -1) {
-                revents |= 0x0010; // POLLHUP (EOF)
-                ready++;
-            } else {
-                needs_stdin = true;
-            }
-#else
-            // Native mode: use real poll on stdin
-            struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
-            int ret = ::poll(&pfd, 1, 0);
-            if (ret > 0 && (pfd.revents & POLLIN)) {
-                revents |= 0x0001; // POLLIN
-                ready++;
-            } else if (ret > 0 && (pfd.revents & POLLHUP)) {
-                revents |= 0x0010; // POLLHUP
-                ready++;
-            }
-            // else: no data yet, don't set needs_stdin for native mode
-#endif
-        } else if (fd == 1 || fd == 2) {
-            if (events & 0x0004 /*POLLOUT*/) {
-                revents |= 0x0004;
-                ready++;
-            }
-        } else if (fd >= 0) {
+    // Whether one of the fds changes state on the host
+    bool host = false;
+    auto scan = [&] {
+        int ready = 0;
+        for (uint64_t i = 0; i < nfds; i++) {
+            uint64_t entry_addr = fds_addr + i * 8;
+            int32_t fd = m.memory.template read<int32_t>(entry_addr);
+            int16_t events = m.memory.template read<int16_t>(entry_addr + 4);
+            int16_t revents = 0;
+
+            if (fd >= 0) {
+                FdKind kind = g_fds.kind(fd);
+                host |= kind == FdKind::Socket || kind == FdKind::Stdin || kind == FdKind::Tty;
 #ifndef __EMSCRIPTEN__
-            // For socket FDs, use real poll on the native fd
-            if (net_is_socket_fd && net_is_socket_fd(fd) && net_get_native_fd) {
-                int native_fd = net_get_native_fd(fd);
-                if (native_fd >= 0) {
-                    struct pollfd pfd;
-                    pfd.fd = native_fd;
-                    pfd.events = events;
-                    pfd.revents = 0;
-                    // Use a short timeout to avoid blocking forever
-                    int timeout_ms = zero_timeout ? 0 : (has_timeout ? 10 : 100);
-                    int pr = ::poll(&pfd, 1, timeout_ms);
-                    if (pr > 0) {
-                        revents = pfd.revents;
-                        ready++;
+                // For socket FDs, use real poll on the native fd
+                if (kind == FdKind::Socket && net_get_native_fd) {
+                    int native_fd = net_get_native_fd(fd);
+                    if (native_fd >= 0) {
+                        std::vector<struct pollfd> pfd{{native_fd, events, 0}};
+                        // Use a short timeout to avoid blocking forever
+                        int timeout_ms = zero_timeout ? 0 : (has_timeout ? 10 : 100);
+                        if (timeout_ms) g_console.flush();
+                        int pr = host_poll(pfd, timeout_ms);
+                        if (pr > 0) {
+                            revents = pfd[0].revents;
+                            ready++;
+                        }
+                        m.memory.template write<int16_t>(entry_addr + 6, revents);
+                        continue;
                     }
-                    m.memory.template write<int16_t>(entry_addr + 6, revents);
-                    continue;
                 }
-            }
 #endif
-            // VFS file descriptors are always ready
-            revents |= (events & 0x0001); // POLLIN if requested
-            if (revents) ready++;
-        }
+                // POLLERR/POLLHUP/POLLNVAL are reported whether asked for or not
+                revents = fd_poll(m, fd) & (events | 0x0038);
+                if (revents) ready++;
+            }
 
-        m.memory.template write<int16_t>(entry_addr + 6, revents);
-    }
+            m.memory.template write<int16_t>(entry_addr + 6, revents);
+        }
+        return ready;
+    };
+    expire_timers(guest_clock_ns());  // Due timerfds read as ready
+    int ready = scan();
 
     if (ready > 0) {
         m.set_result(ready);
-    } else if (zero_timeout) {
+        return;
+    }
+    if (zero_timeout || (has_timeout && guest_clock_ns() >= deadline)) {
         m.set_result(0);
-    } else if (needs_stdin) {
-        // No data on stdin — stop and let JS resume when data arrives
-        g_waiting_for_stdin = true;
-        m.cpu.increment_pc(-4);
-        m.stop();
-    } else {
-        // Nothing ready and no stdin to wait for.
-        // This happens when the shell polls for signals (SIGCHLD)
-        // after a fork+wait cycle. Without stopping, this creates
-        // a spin loop consuming billions of instructions.
-        // Treat as a stdin-wait so the JS event loop can process.
-        g_waiting_for_stdin = true;
+        return;
+    }
+    if (int next = g_sched.count > 1 ? g_sched.next_runnable(g_sched.current) : -1; next >= 0) {
+        // Let another thread run (e.g. the other end of a pipe); this
+        // thread re-enters ppoll when rescheduled
+        if (has_timeout) g_sched.threads[g_sched.current].restart_deadline = deadline;
         m.cpu.increment_pc(-4);
-        m.stop();
+        switch_to_thread(m, next);
+        return;
+    }
+    if (g_harts.active()) {
+        // Another hart may make one ready: without a timeout, retry after
+        // its next wake-up; with one, after a short sleep like epoll_pwait
+        if (has_timeout) {
+            g_harts.sleep_for(std::chrono::milliseconds(10));
+            m.set_result(0);
+        } else {
+            g_harts.park(m);
+        }
+        return;
+    }
+    if (!host && idle_can_skip() && (has_timeout || !g_timers.empty())) {
+        // Only a timer can change anything: a timerfd in the set, a thread
+        // whose timed wait ends, or the timeout itself. Skip the guest
+        // clock from one to the next.
+        while (has_timeout || !g_timers.empty()) {
+            idle_step(has_timeout ? deadline : UINT64_MAX);
+            if ((ready = scan()) > 0) {
+                m.set_result(ready);
+                return;
+            }
+            if (has_timeout && guest_clock_ns() >= deadline) {
+                m.set_result(0);
+                return;
+            }
+            if (int next = g_sched.count > 1 ? g_sched.next_runnable(g_sched.current) : -1;
+                next >= 0) {
+                if (has_timeout) g_sched.threads[g_sched.current].restart_deadline = deadline;
+                m.cpu.increment_pc(-4);
+                switch_to_thread(m, next);
+                return;
+            }
+        }
     }
+    // Nothing ready: stop and let the host resume us when stdin has
+    // data. This also covers the shell polling for signals (SIGCHLD)
+    // after a fork+wait cycle; without stopping, that spin loop
+    // consumes billions of instructions.
+    if (has_timeout && g_sched.count > 0) g_sched.threads[g_sched.current].restart_deadline = deadline;
+    g_waiting_for_stdin = true;
+    m.cpu.increment_pc(-4);
+    m.stop();
 }
 
 // ============================================================================
 // epoll — I/O event notification for libuv (Node.js event loop)
 // ============================================================================
 
-// (EpollInterest, EpollInstance, g_epoll_instances, g_next_epoll_fd declared near top of file)
+// (EpollInterest, EpollInstance, g_epoll_instances declared near top of file)
 
 static void sys_epoll_create1(Machine& m) {
-    int fd = g_next_epoll_fd++;
-    g_epoll_instances[fd] = EpollInstance{};
+    int fd = g_fds.alloc(FdKind::Epoll);
+    if (fd < 0) {
+        m.set_result(fd);
+        return;
+    }
+    auto inst = std::make_shared<EpollInstance>();
+    inst->id = g_next_epoll_id++;
+    g_epoll_instances[fd] = std::move(inst);
     fprintf(stderr, "[epoll_create1] => fd=%d\n", fd);
     m.set_result(fd);
 }
@@ -3325,10 +4933,15 @@ static void sys_epoll_ctl(Machine& m) {
     auto event_addr = m.sysarg(3);
 
     auto it = g_epoll_instances.find(epfd);
-    if (it == g_epoll_instances.end()) {
+    if (it == g_epoll_instances.end() || !g_fds.is_open(fd)) {
         m.set_result(-9);  // -EBADF
         return;
     }
+    if (fd == epfd) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    EpollInstance& inst = *it->second;
 
     constexpr int EPOLL_CTL_ADD = 1;
     constexpr int EPOLL_CTL_DEL = 2;
@@ -3338,13 +4951,12 @@ static void sys_epoll_ctl(Machine& m) {
         // struct epoll_event { uint32_t events; [pad]; uint64_t data; } = 16 bytes
         uint32_t events = m.memory.template read<uint32_t>(event_addr);
         uint64_t data   = m.memory.template read<uint64_t>(event_addr + 8);
-        it->second.interests[fd] = EpollInterest{events, data};
         fprintf(stderr, "[epoll_ctl] %s epfd=%d fd=%d events=0x%x data=0x%lx\n",
                 op == 1 ? "ADD" : "MOD", epfd, fd, events, (unsigned long)data);
-        m.set_result(0);
+        m.set_result(op == EPOLL_CTL_ADD ? epoll_add(m, inst, fd, events, data)
+                                         : epoll_modify(m, inst, fd, events, data));
     } else if (op == EPOLL_CTL_DEL) {
-        it->second.interests.erase(fd);
-        m.set_result(0);
+        m.set_result(inst.interests.count(fd) ? (epoll_remove(inst, fd), 0) : err::NOENT);
     } else {
         m.set_result(err::INVAL);
     }
@@ -3361,6 +4973,11 @@ static void sys_epoll_pwait(Machine& m) {
         m.set_result(-4);  // -EINTR (avoid libuv assertion on cleanup)
         return;
     }
+    if (maxevents <= 0) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    std::shared_ptr<EpollInstance> inst = it->second;
 
 #ifdef __EMSCRIPTEN__
     // Debug: log epoll interests to see which fds are watched
@@ -3368,351 +4985,425 @@ static void sys_epoll_pwait(Machine& m) {
     if (epoll_log_count < 40) {
         epoll_log_count++;
         fprintf(stderr, "[epoll] epfd=%d timeout=%d maxev=%d interests:", epfd, timeout, maxevents);
-        for (auto& [fd2, int2] : it->second.interests) {
-            bool is_sock = net_is_socket_fd && net_is_socket_fd(fd2);
+        for (auto& [fd2, int2] : inst->interests) {
+            bool is_sock = g_fds.kind(fd2) == FdKind::Socket;
             fprintf(stderr, " fd=%d(ev=0x%x,d=0x%lx%s)", fd2, int2.events, (unsigned long)int2.data, is_sock ? ",sock" : "");
         }
         fprintf(stderr, "\n");
     }
 #endif
 
-    auto& fs = get_fs(m);
-    int ready = 0;
-#ifdef __EMSCRIPTEN__
-    bool socket_waiting_for_data = false;  // Socket has EPOLLIN interest but no data yet
-#endif
-
-    // Check each interest for readiness
-    for (auto& [fd, interest] : it->second.interests) {
-        if (ready >= maxevents) break;
-
-        uint32_t revents = 0;
-
-        if (fd == 0) {
-            // stdin — check JS buffer
-#ifdef __EMSCRIPTEN__
-            int has_data = EM_ASM_INT({
-                return (Module._stdinBuffer && Module._stdinBuffer.length > 0) ? 1 : 0;
-            });
-            if (has_data && (interest.events & 0x01 /*EPOLLIN*/))
-                revents |= 0x01;
-#endif
-        } else if (fd == 1 || fd == 2) {
-            // stdout/stderr always writable
-            if (interest.events & 0x04 /*EPOLLOUT*/)
-                revents |= 0x04;
-        } else if (fs.is_open(fd)) {
-            // VFS fds: pipes may have data, regular files always ready
-            auto entry = fs.get_entry(fd);
-            if (entry && entry->type == vfs::FileType::Fifo) {
-                // Pipe: check if data available
-                if ((interest.events & 0x01) && entry->content.size() > 0)
-                    revents |= 0x01;
-                if (interest.events & 0x04)
-                    revents |= 0x04;
-            } else {
-                // Regular file: always ready
-                if (interest.events & 0x01) revents |= 0x01;
-                if (interest.events & 0x04) revents |= 0x04;
-            }
-        }
-#ifdef __EMSCRIPTEN__
-        else if (net_is_socket_fd && net_is_socket_fd(fd)) {
-            // Socket FDs in Emscripten: check JS bridge for readiness
-            // Connected sockets: always writable, check JS buffer for readable
-            int sock_status = EM_ASM_INT({
-                // Returns bitmask: bit 0 = has recv data, bit 1 = has pending accept
-                var status = 0;
-                if (typeof Module.hasSocketData === 'function' && Module.hasSocketData($0))
-                    status |= 1;
-                if (typeof Module.hasPendingAccept === 'function' && Module.hasPendingAccept($0))
-                    status |= 2;
-                return status;
-            }, fd);
-            // Sockets are always writable (we send optimistically)
-            if (interest.events & 0x04 /*EPOLLOUT*/)
-                revents |= 0x04;
-            if ((sock_status & 1) && (interest.events & 0x01 /*EPOLLIN*/))
-                revents |= 0x01;
-            else if (interest.events & 0x01 /*EPOLLIN*/)
-                socket_waiting_for_data = true;  // Wants EPOLLIN but no data yet
-            if ((sock_status & 2) && (interest.events & 0x01 /*EPOLLIN*/))
-                revents |= 0x01;
-        }
-#else
-        else if (net_is_socket_fd && net_is_socket_fd(fd)) {
-            // Socket FDs: use ::poll() to check readiness
-            int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
-            if (native_fd >= 0) {
-                struct pollfd pfd;
-                pfd.fd = native_fd;
-                pfd.events = 0;
-                if (interest.events & 0x01) pfd.events |= POLLIN;
-                if (interest.events & 0x04) pfd.events |= POLLOUT;
-                pfd.revents = 0;
-                if (::poll(&pfd, 1, 0) > 0) {
-                    if (pfd.revents & POLLIN)  revents |= 0x01;
-                    if (pfd.revents & POLLOUT) revents |= 0x04;
-                    if (pfd.revents & (POLLERR | POLLHUP)) revents |= 0x08;  // EPOLLERR
-                }
-            }
-        }
-#endif
-
-        if (revents) {
-            // struct epoll_event { uint32_t events; [4 pad]; uint64_t data; } = 16 bytes
-            uint64_t offset = events_addr + ready * 16;
-            m.memory.template write<uint32_t>(offset, revents);
-            m.memory.template write<uint32_t>(offset + 4, 0);  // padding
-            m.memory.template write<uint64_t>(offset + 8, interest.data);  // caller's data
-            ready++;
-#ifdef __EMSCRIPTEN__
-            if (epoll_log_count <= 40) {
-                fprintf(stderr, "[epoll-ev] fd=%d revents=0x%x data=0x%lx\n", fd, revents, (unsigned long)interest.data);
-            }
-#endif
-        }
-    }
+    // Everything else already queued itself when its state changed (a
+    // timerfd when its timer fires); only the polled fds need looking at
+    expire_timers(guest_clock_ns());
+    epoll_poll_host(m, *inst, 0);
+    int ready = epoll_harvest(m, *inst, events_addr, maxevents);
 
 #ifdef __EMSCRIPTEN__
     if (epoll_log_count <= 40) {
-        fprintf(stderr, "[epoll] result: ready=%d socket_waiting=%d\n", ready, (int)socket_waiting_for_data);
+        fprintf(stderr, "[epoll] result: ready=%d\n", ready);
     }
 #endif
 
+    // A re-run of a wait this thread parked in keeps its first deadline
+    uint64_t restart_deadline = take_restart_deadline();
     if (ready > 0) {
         g_idle_epoll_count = 0;  // Reset idle counter on activity
         m.set_result(ready);
-    } else if (timeout == 0) {
+        return;
+    }
+    if (timeout == 0) {
         // Non-blocking poll, nothing ready
         m.set_result(0);
-    } else {
+        return;
+    }
+    uint64_t now = guest_clock_ns();
+    uint64_t deadline = timeout < 0 ? 0
+                      : restart_deadline ? restart_deadline
+                      : now + static_cast<uint64_t>(timeout) * 1'000'000;
+    if (deadline && deadline <= now) {
+        m.set_result(0);
+        return;
+    }
+    // Readiness that comes from the host (polled fds, stdin in Wasm) keeps
+    // the guest clock from skipping while we wait
+    bool host = !inst->polled.empty();
+    for (const auto& [fd2, in] : inst->interests) host |= in.key == STDIN_WATCH_KEY;
 #ifndef __EMSCRIPTEN__
-        // Native mode: collect socket fds and do a blocking poll
-        std::vector<struct pollfd> pfds;
-        std::vector<std::pair<int, EpollInterest*>> pfd_map;  // index → {guest_fd, interest}
-        for (auto& [fd2, interest2] : it->second.interests) {
-            if (net_is_socket_fd && net_is_socket_fd(fd2)) {
-                int native_fd = net_get_native_fd ? net_get_native_fd(fd2) : -1;
-                if (native_fd >= 0) {
-                    struct pollfd pfd;
-                    pfd.fd = native_fd;
-                    pfd.events = 0;
-                    if (interest2.events & 0x01) pfd.events |= POLLIN;
-                    if (interest2.events & 0x04) pfd.events |= POLLOUT;
-                    pfd.revents = 0;
-                    pfds.push_back(pfd);
-                    pfd_map.push_back({fd2, &interest2});
-                }
-            }
-        }
-        if (!pfds.empty()) {
-            // Native mode: do a real blocking poll with the actual timeout.
-            // This blocks the emulator (fine for server workloads).
-            int poll_timeout = timeout;  // -1 = infinite, >0 = ms
-            int ret = ::poll(pfds.data(), pfds.size(), poll_timeout);
-            if (ret > 0) {
-                for (size_t i = 0; i < pfds.size() && ready < maxevents; i++) {
-                    uint32_t revents2 = 0;
-                    if (pfds[i].revents & POLLIN)  revents2 |= 0x01;
-                    if (pfds[i].revents & POLLOUT) revents2 |= 0x04;
-                    if (pfds[i].revents & (POLLERR | POLLHUP)) revents2 |= 0x08;
-                    if (revents2) {
-                        uint64_t offset = events_addr + ready * 16;
-                        m.memory.template write<uint32_t>(offset, revents2);
-                        m.memory.template write<uint32_t>(offset + 4, 0);
-                        m.memory.template write<uint64_t>(offset + 8, pfd_map[i].second->data);
-                        ready++;
-                    }
-                }
-            }
-            // ret == 0: timeout expired, nothing ready
-            // ret < 0: error (e.g. EINTR)
+    bool has_sockets = false;
+    for (int fd2 : inst->polled) has_sockets |= g_fds.kind(fd2) == FdKind::Socket;
+    if (has_sockets) {
+        // Native mode: do a real blocking poll with the actual timeout.
+        // This blocks the emulator (fine for server workloads).
+        epoll_poll_host(m, *inst, timeout);  // -1 = infinite, >0 = ms
+        m.set_result(epoll_harvest(m, *inst, events_addr, maxevents));
+        return;
+    }
+#endif
+    // Nothing ready — block this thread until something is queued on the
+    // instance's ready list or the timeout passes, and run the others
+    if (g_sched.count > 1) {
+        auto& self = g_sched.threads[g_sched.current];
+        m.set_result(0);  // Returned on timeout; a wake re-runs the call
+        self.restart_deadline = deadline;
+        if (sched_wait(m, epoll_wait_key(*inst), deadline, 0, true, host)) return;
+        self.restart_deadline = 0;
+        // Only this thread could make progress, on host readiness: unmark
+        // and look again
+        if (self.waiting) g_sched.unblock(g_sched.current);
+        epoll_poll_host(m, *inst, 0);
+        if ((ready = epoll_harvest(m, *inst, events_addr, maxevents)) > 0) {
             m.set_result(ready);
             return;
         }
-#endif
-        // Nothing ready — use cooperative threading to schedule other threads.
-        if (timeout == -1) {
-            // Infinite timeout: block this thread until an eventfd wakes it.
-            if (g_sched.count > 1) {
-                auto& cur = g_sched.threads[g_sched.current];
-                cur.waiting = true;
-                cur.futex_addr = (uint64_t)epfd;  // epoll fd as wakeup key
-                m.set_result(0);  // Will re-execute when woken
-                m.cpu.increment_pc(-4);  // Rewind to ecall
-                int next = g_sched.next_runnable(g_sched.current);
-                if (next >= 0) {
-                    switch_to_thread(m, next);
-                    return;
-                }
-                // All threads waiting — deadlock. Force-wake one.
-                for (int i = 0; i < MAX_VTHREADS; i++) {
-                    if (i != g_sched.current && g_sched.threads[i].active && g_sched.threads[i].waiting) {
-                        g_sched.threads[i].waiting = false;
-                        switch_to_thread(m, i);
-                        return;
-                    }
-                }
-                // Truly alone — unmark and fall through
-                cur.waiting = false;
+    } else if (!host && idle_can_skip() && (deadline || !g_timers.empty())) {
+        // Only a timer can end this wait: a timerfd in the set, or the
+        // timeout itself. Skip the guest clock from one to the next.
+        while (deadline || !g_timers.empty()) {
+            idle_step(deadline ? deadline : UINT64_MAX);
+            if ((ready = epoll_harvest(m, *inst, events_addr, maxevents)) > 0) {
+                m.set_result(ready);
+                return;
             }
+            if (deadline && guest_clock_ns() >= deadline) {
+                m.set_result(0);
+                return;
+            }
+        }
+    }
+    if (timeout == -1) {
 #ifdef __EMSCRIPTEN__
-            // In Wasm: yield to JS event loop (can't usleep — blocks everything).
-            // Return -EINTR (same as native) so the event loop handles it properly.
-            // Do NOT rewind PC — let the event loop continue past epoll_pwait.
+        // In Wasm: yield to JS event loop (can't usleep — blocks everything).
+        // Return -EINTR (same as native) so the event loop handles it properly.
+        // Do NOT rewind PC — let the event loop continue past epoll_pwait.
+        g_waiting_for_stdin = true;
+        m.set_result(-4);  // -EINTR
+        m.stop();
+        return;
+#else
+        if (g_checkpoint_on_stdin) {
+            // Checkpoint mode: stop at idle point
             g_waiting_for_stdin = true;
-            m.set_result(-4);  // -EINTR
+            m.cpu.increment_pc(-4);
             m.stop();
             return;
+        }
+        g_console.flush();
+        // Another hart may queue something: retry after its next wake-up
+        if (g_harts.park(m)) return;
+        // Native: sleep 10ms, return -EINTR
+        g_harts.sleep_for(std::chrono::milliseconds(10));
+        m.set_result(-4);  // -EINTR
+        return;
+#endif
+    }
+    // Finite timeout: sleep briefly and return 0
+#ifdef __EMSCRIPTEN__
+    // In Wasm: yield to JS for timers/network.
+    // IMPORTANT: Do NOT rewind PC. Return 0 events so the event loop
+    // continues past epoll_pwait and processes pending callbacks.
+    // If we rewound PC, the machine would re-enter epoll_pwait forever
+    // in a tight loop without processing any event loop callbacks.
+    g_waiting_for_stdin = true;
+    m.set_result(0);
+    m.stop();
 #else
-            if (g_checkpoint_on_stdin) {
-                // Checkpoint mode: stop at idle point
-                g_waiting_for_stdin = true;
-                m.cpu.increment_pc(-4);
-                m.stop();
-                return;
-            }
-            // Native: sleep 10ms, return -EINTR
-            usleep(10000);
-            m.set_result(-4);  // -EINTR
+    if (g_checkpoint_on_stdin) {
+        // Checkpoint mode: count consecutive idle epoll waits.
+        // After several idle polls, the system is truly idle (waiting for user input).
+        g_idle_epoll_count++;
+        if (g_idle_epoll_count >= IDLE_EPOLL_THRESHOLD) {
+            g_waiting_for_stdin = true;
+            m.cpu.increment_pc(-4);
+            m.stop();
             return;
-#endif
         }
-        // Finite timeout > 0: yield to runnable threads first, then
-        // sleep briefly and return 0.
-        if (g_sched.count > 1) {
-            int next = g_sched.next_runnable(g_sched.current);
-            if (next >= 0) {
-                // Let runnable worker threads execute (e.g. DNS resolution).
-                // Rewind PC so this thread re-enters epoll_pwait when rescheduled.
-                m.cpu.increment_pc(-4);
-                switch_to_thread(m, next);
-                return;
-            }
+    }
+    g_console.flush();
+    g_harts.sleep_for(std::chrono::nanoseconds(std::min<uint64_t>(deadline - now, IDLE_POLL_NS)));
+    m.set_result(0);
+#endif
+}
+
+// ============================================================================
+// futex — thread synchronization
+// ============================================================================
+
+namespace futex {
+    constexpr int WAIT = 0;
+    constexpr int WAKE = 1;
+    constexpr int REQUEUE = 3;
+    constexpr int CMP_REQUEUE = 4;
+    constexpr int WAKE_OP = 5;
+    constexpr int LOCK_PI = 6;
+    constexpr int UNLOCK_PI = 7;
+    constexpr int TRYLOCK_PI = 8;
+    constexpr int WAIT_BITSET = 9;
+    constexpr int WAKE_BITSET = 10;
+    constexpr int LOCK_PI2 = 13;
+    constexpr int CLOCK_REALTIME_FLAG = 256;
+    // PI futex word layout
+    constexpr uint32_t WAITERS = 0x80000000;
+    constexpr uint32_t TID_MASK = 0x3FFFFFFF;
+}
+
+// Block the current thread on uaddr until a wake matching bitset, or until
+// deadline. The thread resumes with 0, or -ETIMEDOUT.
+// Exit status of a deadlocked run, as if the process had been killed by
+// SIGABRT
+inline constexpr int DEADLOCK_EXIT_CODE = 128 + 6;
+
+// Every guest thread is blocked with no timeout and nothing pending that
+// could wake one (a signal would, on Linux, but none is coming). Linux
+// would hang here; leave the threads blocked, say so and end the run.
+inline void futex_deadlock(Machine& m, uint64_t uaddr) {
+    fprintf(stderr, "[futex] deadlock: %d thread(s) blocked for good, t%d on 0x%lx; stopping\n",
+            std::max(g_sched.count, 1), g_sched.current, (long)uaddr);
+    g_forced_exit_code = DEADLOCK_EXIT_CODE;
+    m.stop();
+}
+
+inline void futex_block(Machine& m, uint64_t uaddr, uint32_t bitset, int64_t deadline) {
+    if (g_sched.count <= 1) {
+        // Nobody can wake us
+        if (!deadline) {
+            futex_deadlock(m, uaddr);
+            return;
         }
-        // No runnable threads — sleep briefly and return 0.
-#ifdef __EMSCRIPTEN__
-        // In Wasm: yield to JS for timers/network.
-        // IMPORTANT: Do NOT rewind PC. Return 0 events so the event loop
-        // continues past epoll_pwait and processes pending callbacks.
-        // If we rewound PC, the machine would re-enter epoll_pwait forever
-        // in a tight loop without processing any event loop callbacks.
-        g_waiting_for_stdin = true;
-        m.set_result(0);
-        m.stop();
-#else
-        if (g_checkpoint_on_stdin) {
-            // Checkpoint mode: count consecutive idle epoll waits.
-            // After several idle polls, the system is truly idle (waiting for user input).
-            g_idle_epoll_count++;
-            if (g_idle_epoll_count >= IDLE_EPOLL_THRESHOLD) {
+        while (guest_clock_ns() < static_cast<uint64_t>(deadline)) {
+            if (!idle_step(deadline)) {
+                // Wasm: yield to JS for one tick; the caller re-checks
+                // its clock
                 g_waiting_for_stdin = true;
-                m.cpu.increment_pc(-4);
                 m.stop();
-                return;
+                break;
             }
         }
-        {
-            if (timeout > 0) {
-                int sleep_ms = std::min(timeout, 10);
-                usleep(sleep_ms * 1000);
+        m.set_result(err::TIMEDOUT);
+        return;
+    }
+
+    m.set_result(0);  // Return value when this thread is woken
+    if (sched_wait(m, uaddr, deadline, err::TIMEDOUT, false, false, bitset)) return;
+    if (g_sched.threads[g_sched.current].waiting) futex_deadlock(m, uaddr);
+}
+
+// FUTEX_WAKE_OP: apply the operation encoded in op to the word at uaddr2
+// and return whether its old value passes the encoded comparison, or
+// err::NOSYS for an unknown operation
+inline int futex_wake_op(Machine& m, uint64_t uaddr2, uint32_t op) {
+    int code = (op >> 28) & 7;
+    int cmp = (op >> 24) & 15;
+    int32_t oparg = static_cast<int32_t>(op << 8) >> 20;
+    int32_t cmparg = static_cast<int32_t>(op << 20) >> 20;
+    if (op & (8u << 28)) oparg = 1 << (oparg & 31);  // FUTEX_OP_OPARG_SHIFT
+    int32_t old = m.memory.template read<int32_t>(uaddr2);
+    int32_t val;
+    switch (code) {
+    case 0: val = oparg; break;         // SET
+    case 1: val = old + oparg; break;   // ADD
+    case 2: val = old | oparg; break;   // OR
+    case 3: val = old & ~oparg; break;  // ANDN
+    case 4: val = old ^ oparg; break;   // XOR
+    default: return err::NOSYS;
+    }
+    switch (cmp) {
+    case 0: cmp = old == cmparg; break;
+    case 1: cmp = old != cmparg; break;
+    case 2: cmp = old < cmparg; break;
+    case 3: cmp = old <= cmparg; break;
+    case 4: cmp = old > cmparg; break;
+    case 5: cmp = old >= cmparg; break;
+    default: return err::NOSYS;
+    }
+    m.memory.template write<int32_t>(uaddr2, val);
+    return cmp;
+}
+
+// With harts, the words are shared arena memory: wait, wake and requeue
+// with host futexes on them. PI futexes hold guest TIDs, which the host
+// cannot interpret, so those are not available.
+inline void futex_host(Machine& m, int cmd) {
+    int op = m.template sysarg<int>(1);
+    auto uaddr = m.sysarg(0);
+    auto* word = reinterpret_cast<uint32_t*>(arena_span<GuestAccess::Read>(m, uaddr, 4));
+    if (!word || uaddr % 4) {
+        m.set_result(word ? err::INVAL : err::FAULT);
+        return;
+    }
+    uint32_t val = m.template sysarg<uint32_t>(2);
+    uint32_t val3 = m.template sysarg<uint32_t>(5);
+    switch (cmd) {
+    case futex::WAIT:
+    case futex::WAIT_BITSET: {
+        struct timespec ts;
+        auto timeout_addr = m.sysarg(3);
+        if (timeout_addr) {
+            ts.tv_sec = m.memory.template read<int64_t>(timeout_addr);
+            ts.tv_nsec = m.memory.template read<int64_t>(timeout_addr + 8);
+            if (cmd == futex::WAIT_BITSET) {
+                // Absolute: move the deadline from the guest's clocks to
+                // the host's CLOCK_MONOTONIC
+                int64_t deadline = timespec_deadline(m, timeout_addr, false);
+                if (deadline < 0) {
+                    m.set_result(deadline);
+                    return;
+                }
+                if (op & futex::CLOCK_REALTIME_FLAG) deadline = realtime_to_guest(deadline);
+                deadline = std::max<int64_t>(guest_to_host(deadline), 0);
+                ts.tv_sec = deadline / 1'000'000'000;
+                ts.tv_nsec = deadline % 1'000'000'000;
+                op &= ~futex::CLOCK_REALTIME_FLAG;
             }
-            m.set_result(0);
         }
-#endif
+        m.set_result(g_harts.futex_wait(word, op, val, timeout_addr ? &ts : nullptr, val3));
+        return;
+    }
+    case futex::WAKE:
+    case futex::WAKE_BITSET:
+        m.set_result(g_harts.futex_wake(word, op, val, val3));
+        return;
+    case futex::REQUEUE:
+    case futex::CMP_REQUEUE:
+    case futex::WAKE_OP: {
+        auto uaddr2 = m.sysarg(4);
+        auto* word2 = reinterpret_cast<uint32_t*>(arena_span<GuestAccess::Read>(m, uaddr2, 4));
+        if (!word2 || uaddr2 % 4) {
+            m.set_result(word2 ? err::INVAL : err::FAULT);
+            return;
+        }
+        m.set_result(g_harts.futex_requeue(word, op, val, m.template sysarg<uint32_t>(3), word2, val3));
+        return;
+    }
+    default:
+        m.set_result(err::NOSYS);
     }
 }
 
-// ============================================================================
-// futex — thread synchronization (single-threaded: mostly no-ops)
-// ============================================================================
-
 static void sys_futex(Machine& m) {
     auto uaddr = m.sysarg(0);
     int op = m.template sysarg<int>(1);
 
-    // Mask off FUTEX_PRIVATE_FLAG (128) and FUTEX_CLOCK_REALTIME (256)
+    // Mask off FUTEX_PRIVATE_FLAG (128) and FUTEX_CLOCK_REALTIME (256), which
+    // only says which clock an absolute timeout is on
     int cmd = op & 0x7f;
+    bool realtime = op & futex::CLOCK_REALTIME_FLAG;
 
-    constexpr int FUTEX_WAIT = 0;
-    constexpr int FUTEX_WAKE = 1;
-    constexpr int FUTEX_WAIT_BITSET = 9;
-    constexpr int FUTEX_WAKE_BITSET = 10;
+    if (g_harts.active()) {
+        futex_host(m, cmd);
+        return;
+    }
+    if (uaddr % 4) {
+        m.set_result(err::INVAL);
+        return;
+    }
 
-    if (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET) {
-        int32_t expected = m.template sysarg<int>(2);
-        int32_t actual = m.memory.template read<int32_t>(uaddr);
-        if (actual != expected) {
-            m.set_result(-11);  // -EAGAIN
+    int val = m.template sysarg<int>(2);
+    uint32_t val3 = m.template sysarg<uint32_t>(5);
+    int tid = g_sched.count > 0 ? g_sched.threads[g_sched.current].tid : 1;
+
+    switch (cmd) {
+    case futex::WAIT:
+    case futex::WAIT_BITSET: {
+        uint32_t bitset = cmd == futex::WAIT ? FUTEX_BITSET_ANY : val3;
+        int64_t deadline = timespec_deadline(m, m.sysarg(3), cmd == futex::WAIT);
+        if (cmd == futex::WAIT_BITSET && realtime && deadline > 0)
+            deadline = realtime_to_guest(deadline);
+        if (!bitset || deadline < 0) {
+            m.set_result(err::INVAL);
+        } else if (m.memory.template read<int32_t>(uaddr) != val) {
+            m.set_result(err::AGAIN);
+        } else {
+            futex_block(m, uaddr, bitset, deadline);
+        }
+        return;
+    }
+    case futex::WAKE:
+    case futex::WAKE_BITSET: {
+        uint32_t bitset = cmd == futex::WAKE ? FUTEX_BITSET_ANY : val3;
+        m.set_result(bitset ? g_sched.wake(uaddr, val, bitset) : err::INVAL);
+        return;
+    }
+    case futex::REQUEUE:
+    case futex::CMP_REQUEUE: {
+        int val2 = m.template sysarg<int>(3);
+        auto uaddr2 = m.sysarg(4);
+        if (val < 0 || val2 < 0 || uaddr2 % 4) {
+            m.set_result(err::INVAL);
+        } else if (cmd == futex::CMP_REQUEUE &&
+                   m.memory.template read<uint32_t>(uaddr) != val3) {
+            m.set_result(err::AGAIN);
+        } else {
+            // Wake a few and move the rest over, so a condvar broadcast
+            // does not start a thundering herd on the mutex
+            int n = g_sched.wake(uaddr, val);
+            m.set_result(n + g_sched.requeue(uaddr, uaddr2, val2));
+        }
+        return;
+    }
+    case futex::WAKE_OP: {
+        auto uaddr2 = m.sysarg(4);
+        if (uaddr2 % 4) {
+            m.set_result(err::INVAL);
             return;
         }
-
-        // Cooperative scheduling: if another thread is runnable, switch to it.
-        // This handles the pattern: main creates thread → main waits → thread runs.
-        if (g_sched.count > 1) {
-            auto& cur = g_sched.threads[g_sched.current];
-            cur.waiting = true;
-            cur.futex_addr = uaddr;
-            cur.futex_val = expected;
-            // Return value when this thread resumes: 0 (woken successfully)
+        int pass = futex_wake_op(m, uaddr2, val3);
+        if (pass < 0) {
+            m.set_result(pass);
+            return;
+        }
+        int n = g_sched.wake(uaddr, val);
+        if (pass) n += g_sched.wake(uaddr2, m.template sysarg<int>(3));
+        m.set_result(n);
+        return;
+    }
+    // Priority inheritance: the word holds the owner's TID, and the kernel
+    // hands the lock straight to the longest waiter on unlock. All guest
+    // threads share one priority, so there is nothing to inherit.
+    case futex::LOCK_PI:
+    case futex::LOCK_PI2:
+    case futex::TRYLOCK_PI: {
+        uint32_t word = m.memory.template read<uint32_t>(uaddr);
+        uint32_t owner = word & futex::TID_MASK;
+        if (owner == 0) {
+            m.memory.template write<uint32_t>(uaddr, tid | (word & futex::WAITERS));
             m.set_result(0);
-
-            int next = g_sched.next_runnable(g_sched.current);
-            if (next >= 0) {
-                static int switch_count = 0;
-                if (++switch_count <= 50)
-                    fprintf(stderr, "[futex] WAIT switch t%d->t%d addr=0x%lx exp=0x%x\n",
-                            g_sched.current, next, (long)uaddr, (unsigned)expected);
-                switch_to_thread(m, next);
-                return;
-            }
-            // All threads waiting — cooperative deadlock. Force-wake a sleeping
-            // thread so it can observe any shutdown signals written to memory.
-            // This simulates parallel execution where threads run concurrently.
-            for (int i = 0; i < MAX_VTHREADS; i++) {
-                if (i != g_sched.current && g_sched.threads[i].active && g_sched.threads[i].waiting) {
-                    g_sched.threads[i].waiting = false;
-                    static int deadlock_count = 0;
-                    if (++deadlock_count <= 50)
-                        fprintf(stderr, "[futex] deadlock-break: force-wake t%d, switch from t%d\n",
-                                i, g_sched.current);
-                    switch_to_thread(m, i);
-                    return;
-                }
+        } else if (owner == static_cast<uint32_t>(tid)) {
+            m.set_result(err::DEADLK);
+        } else if (cmd == futex::TRYLOCK_PI) {
+            m.set_result(err::AGAIN);
+        } else if (g_sched.count <= 1) {
+            m.set_result(err::SRCH);  // The owner is not a live thread
+        } else if (int64_t deadline = timespec_deadline(m, m.sysarg(3), false); deadline < 0) {
+            m.set_result(err::INVAL);
+        } else {
+            // LOCK_PI times out on CLOCK_REALTIME, LOCK_PI2 on the flag's clock
+            if (deadline && (cmd == futex::LOCK_PI || realtime)) deadline = realtime_to_guest(deadline);
+            m.memory.template write<uint32_t>(uaddr, word | futex::WAITERS);
+            futex_block(m, uaddr, FUTEX_BITSET_ANY, deadline);
+        }
+        return;
+    }
+    case futex::UNLOCK_PI: {
+        uint32_t word = m.memory.template read<uint32_t>(uaddr);
+        if ((word & futex::TID_MASK) != static_cast<uint32_t>(tid)) {
+            m.set_result(err::PERM);
+            return;
+        }
+        uint32_t next_word = 0;
+        if (g_sched.count > 1) {
+            if (int next = g_sched.first_waiter(uaddr); next >= 0) {
+                g_sched.unblock(next);  // Returns 0 from its LOCK_PI, owning the lock
+                next_word = g_sched.threads[next].tid;
+                if (g_sched.first_waiter(uaddr) >= 0) next_word |= futex::WAITERS;
             }
-            // Truly no other threads — fall through
-            cur.waiting = false;
-        }
-
-        // Fallback: single-threaded (or all threads exited).
-        // No other thread can wake us. Force-unlock the futex word so
-        // glibc's __lll_lock_wait CAS loop can acquire the lock.
-        // Stack canary is zeroed (AT_RANDOM=0) to prevent false positives
-        // from any glibc state disruption this may cause.
-        static int futex_wait_count = 0;
-        if (++futex_wait_count <= 50) {
-            fprintf(stderr, "[futex] WAIT fallback addr=0x%lx exp=0x%x actual=0x%x count=%d pc=0x%lx\n",
-                    (long)uaddr, (unsigned)expected, (unsigned)actual,
-                    g_sched.count, (long)m.cpu.pc());
-        }
-        m.memory.template write<int32_t>(uaddr, 0);
-        m.set_result(-11);  // -EAGAIN: value changed, re-check
-
-    } else if (cmd == FUTEX_WAKE || cmd == FUTEX_WAKE_BITSET) {
-        int max_wake = m.template sysarg<int>(2);
-        int woken = g_sched.wake(uaddr, max_wake);
-
-        // If we woke a thread, optionally switch to it
-        if (woken > 0) {
-            static int wake_count = 0;
-            if (++wake_count <= 20)
-                fprintf(stderr, "[futex] WAKE addr=0x%lx woke=%d\n",
-                        (long)uaddr, woken);
-        }
-        m.set_result(woken);
-    } else {
-        m.set_result(-38);  // -ENOSYS for other futex ops
+        }
+        m.memory.template write<uint32_t>(uaddr, next_word);
+        m.set_result(0);
+        return;
+    }
+    default:
+        m.set_result(err::NOSYS);  // FUTEX_WAIT_REQUEUE_PI, FUTEX_CMP_REQUEUE_PI
     }
 }
 
@@ -3766,7 +5457,7 @@ static void sys_statx(Machine& m) {
 
     // stx_attributes (offset 8) — 0
     // stx_nlink (offset 16)
-    uint32_t nlink = entry->is_dir() ? 2 : 1;
+    uint32_t nlink = entry->is_dir() ? 2 : std::max(entry->nlink, 1u);
     std::memcpy(buf + 16, &nlink, 4);
 
     // stx_uid (offset 20), stx_gid (offset 24)
@@ -3781,12 +5472,12 @@ static void sys_statx(Machine& m) {
     else                       mode |= 0100000;  // S_IFREG
     std::memcpy(buf + 28, &mode, 2);
 
-    // stx_ino (offset 32) — use pointer as fake inode
-    uint64_t ino = reinterpret_cast<uintptr_t>(entry.get()) & 0xFFFFFFFF;
+    // stx_ino (offset 32)
+    uint64_t ino = entry->ino;
     std::memcpy(buf + 32, &ino, 8);
 
     // stx_size (offset 40)
-    uint64_t size = entry->is_dir() ? 4096 : entry->content.size();
+    uint64_t size = entry->is_dir() ? 4096 : entry->size;
     std::memcpy(buf + 40, &size, 8);
 
     // stx_blocks (offset 48)
@@ -3841,36 +5532,34 @@ static void sys_uname(Machine& m) {
 }
 
 // ============================================================================
-// nanosleep — sleep for specified duration
+// nanosleep, clock_nanosleep — sleep on the guest clock
 // ============================================================================
 
 static void sys_nanosleep(Machine& m) {
-    auto req_addr = m.sysarg(0);
-
-    int64_t tv_sec = m.memory.template read<int64_t>(req_addr);
-    int64_t tv_nsec = m.memory.template read<int64_t>(req_addr + 8);
-    int ms = static_cast<int>(tv_sec * 1000 + tv_nsec / 1000000);
-    if (ms < 1) ms = 1;
-
-    // Cooperative scheduling: nanosleep is a natural yield point
-    if (g_sched.count > 1) {
-        int next = g_sched.next_runnable(g_sched.current);
-        if (next >= 0) {
-            switch_to_thread(m, next);
-            return;
-        }
+    int64_t deadline = timespec_deadline(m, m.sysarg(0), true);
+    if (deadline <= 0) {
+        m.set_result(deadline < 0 ? deadline : err::FAULT);
+        return;
     }
+    sleep_until(m, deadline);
+}
 
-#ifdef __EMSCRIPTEN__
-    // Yield to host event loop — emscripten_sleep is not available (no ASYNCIFY).
-    // Don't rewind PC: nanosleep should return 0 on resume (sleep "completed").
-    // The host's 4ms poll interval provides a natural minimum sleep.
-    g_waiting_for_stdin = true;
-    m.set_result(0);
-    m.stop();
-    return;
-#endif
-    m.set_result(0);
+static void sys_clock_nanosleep(Machine& m) {
+    int clock = m.template sysarg<int>(0);
+    int flags = m.template sysarg<int>(1);
+    // As on Linux, the calling thread's CPU-time clock cannot be slept on
+    if (clock == 3) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    bool absolute = flags & 1;  // TIMER_ABSTIME
+    int64_t deadline = timespec_deadline(m, m.sysarg(2), !absolute);
+    if (absolute && realtime_clock(clock) && deadline > 0) deadline = realtime_to_guest(deadline);
+    if (deadline <= 0) {
+        m.set_result(deadline < 0 ? deadline : err::FAULT);
+        return;
+    }
+    sleep_until(m, deadline);
 }
 
 // ============================================================================
@@ -3914,22 +5603,283 @@ static void sys_eventfd2(Machine& m) {
     // read(fd, &val, 8) to consume.
     uint32_t initval = m.template sysarg<uint32_t>(0);
     auto& fs = get_fs(m);
-    auto entry = std::make_shared<vfs::Entry>();
-    entry->type = vfs::FileType::Fifo;  // Pipe-like: only ready when data available
-    entry->mode = 0600;
-    entry->size = 0;
-    // Start with empty content (no signal pending)
+    // The Fifo inode only gives the fd a VFS identity; the counter is in g_eventfds
+    auto* entry = fs.make_anon(vfs::FileType::Fifo, 0600);
     int fd = fs.open_pipe(entry, 0);
-    g_eventfd_counters[fd] = initval;
-    // If initval > 0, mark as having data
-    if (initval > 0) {
-        entry->content.resize(8);
-        memcpy(entry->content.data(), &initval, sizeof(initval));
+    if (fd < 0) {
+        m.set_result(fd);
+        return;
     }
+    g_fds.install(fd, FdKind::EventFd);
+    auto e = std::make_shared<EventFd>();
+    e->id = g_next_eventfd_id++;
+    e->counter = initval;
+    g_eventfds[fd] = std::move(e);
     fprintf(stderr, "[eventfd2] => fd=%d initval=%u\n", fd, initval);
     m.set_result(fd);
 }
-static void sys_io_uring_setup(Machine& m) { m.set_result(err::NOSYS); }
+
+// ============================================================================
+// timerfd — timers on the guest clock, read as expiration counts (see
+// "timerfd" with the other fd ops)
+// ============================================================================
+
+// The itimerspec at addr in ns: interval, then value. False if malformed.
+inline bool read_itimerspec(Machine& m, uint64_t addr, uint64_t& interval, uint64_t& value) {
+    uint64_t ns[2];
+    for (int i = 0; i < 2; i++) {
+        int64_t sec = m.memory.template read<int64_t>(addr + i * 16);
+        int64_t nsec = m.memory.template read<int64_t>(addr + i * 16 + 8);
+        if (sec < 0 || nsec < 0 || nsec >= 1'000'000'000) return false;
+        ns[i] = sec >= INT64_MAX / 1'000'000'000 - 1 ? INT64_MAX : sec * 1'000'000'000 + nsec;
+    }
+    interval = ns[0];
+    value = ns[1];
+    return true;
+}
+
+// The timer's setting as an itimerspec: its period and the time left
+inline void write_itimerspec(Machine& m, uint64_t addr, const TimerFd& t) {
+    uint64_t now = guest_clock_ns();
+    uint64_t left = t.deadline > now ? t.deadline - now : 0;
+    linux_timespec spec[2] = {
+        {static_cast<int64_t>(t.interval / 1'000'000'000), static_cast<int64_t>(t.interval % 1'000'000'000)},
+        {static_cast<int64_t>(left / 1'000'000'000), static_cast<int64_t>(left % 1'000'000'000)},
+    };
+    m.memory.memcpy(addr, spec, sizeof(spec));
+}
+
+// The timerfd behind fd, or nullptr with the error set
+inline TimerFd* timerfd_arg(Machine& m, int fd) {
+    auto it = g_timerfds.find(fd);
+    if (it != g_timerfds.end()) return it->second.get();
+    m.set_result(g_fds.is_open(fd) ? err::INVAL : err::BADF);
+    return nullptr;
+}
+
+static void sys_timerfd_create(Machine& m) {
+    int clock = m.template sysarg<int>(0);
+    int flags = m.template sysarg<int>(1);
+    constexpr int TFD_NONBLOCK = 0x800;
+    constexpr int TFD_CLOEXEC = 0x80000;
+    // REALTIME, MONOTONIC, BOOTTIME and the _ALARM ones
+    bool known_clock = clock == 0 || clock == 1 || clock == 7 || clock == 8 || clock == 9;
+    if (!known_clock || (flags & ~(TFD_NONBLOCK | TFD_CLOEXEC))) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    int fd = g_fds.alloc(FdKind::TimerFd);
+    if (fd < 0) {
+        m.set_result(fd);
+        return;
+    }
+    auto t = std::make_shared<TimerFd>();
+    t->id = g_next_timerfd_id++;
+    t->nonblock = flags & TFD_NONBLOCK;
+    t->realtime = realtime_clock(clock);
+    g_timerfds[fd] = std::move(t);
+    m.set_result(fd);
+}
+
+static void sys_timerfd_settime(Machine& m) {
+    int fd = m.template sysarg<int>(0);
+    int flags = m.template sysarg<int>(1);
+    auto new_addr = m.sysarg(2);
+    auto old_addr = m.sysarg(3);
+    constexpr int TFD_TIMER_ABSTIME = 1;
+    constexpr int TFD_TIMER_CANCEL_ON_SET = 2;  // The guest clock is never set
+    TimerFd* t = timerfd_arg(m, fd);
+    if (!t) return;
+    uint64_t interval, value;
+    if ((flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET)) ||
+        !read_itimerspec(m, new_addr, interval, value)) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    uint64_t now = guest_clock_ns();
+    expire_timers(now);
+    if (old_addr) write_itimerspec(m, old_addr, *t);
+    // Re-arming forgets the expirations not yet read
+    if (t->deadline) g_timers.cancel(t->timer);
+    t->deadline = 0;
+    t->expirations = 0;
+    t->interval = interval;
+    if (value) {
+        if (!(flags & TFD_TIMER_ABSTIME))
+            t->deadline = value < UINT64_MAX - now ? now + value : UINT64_MAX;
+        else if (t->realtime)
+            t->deadline = realtime_to_guest(static_cast<int64_t>(std::min<uint64_t>(value, INT64_MAX)));
+        else
+            t->deadline = value;
+        t->timer = g_timers.add(t->deadline, TIMERFD_OWNER | t->id);
+    }
+    m.set_result(0);
+}
+
+static void sys_timerfd_gettime(Machine& m) {
+    int fd = m.template sysarg<int>(0);
+    TimerFd* t = timerfd_arg(m, fd);
+    if (!t) return;
+    expire_timers(guest_clock_ns());
+    write_itimerspec(m, m.sysarg(1), *t);
+    m.set_result(0);
+}
+// ============================================================================
+// io_uring — batched I/O through rings in guest memory (see io_uring.hpp)
+// ============================================================================
+
+static void sys_io_uring_setup(Machine& m) {
+    uint32_t entries = m.template sysarg<uint32_t>(0);
+    auto params_addr = m.sysarg(1);
+
+    // struct io_uring_params: sq_entries, cq_entries, flags, ..., features
+    // at 20, sq_off at 40, cq_off at 80
+    uint32_t flags = m.memory.template read<uint32_t>(params_addr + 8);
+    if (flags & ~(IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_IGNORED)) {
+        m.set_result(err::INVAL);  // SQPOLL, IOPOLL, ...
+        return;
+    }
+    bool clamp = flags & IORING_SETUP_CLAMP;
+    if (entries == 0 || (entries > IoUring::MAX_ENTRIES && !clamp)) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    uint32_t sq_entries = std::bit_ceil(std::min(entries, IoUring::MAX_ENTRIES));
+    uint32_t cq_entries = 2 * sq_entries;
+    if (flags & IORING_SETUP_CQSIZE) {
+        uint32_t wanted = m.memory.template read<uint32_t>(params_addr + 4);
+        if (wanted == 0 || (wanted > 2 * IoUring::MAX_ENTRIES && !clamp)) {
+            m.set_result(err::INVAL);
+            return;
+        }
+        cq_entries = std::bit_ceil(std::min(wanted, 2 * IoUring::MAX_ENTRIES));
+        if (cq_entries < sq_entries) {
+            m.set_result(err::INVAL);
+            return;
+        }
+    }
+
+    int fd = g_fds.alloc(FdKind::IoUring);
+    if (fd < 0) {
+        m.set_result(fd);
+        return;
+    }
+    auto ring = std::make_shared<IoUring>();
+    ring->id = g_next_io_uring_id++;
+    ring->sq_entries = sq_entries;
+    ring->cq_entries = cq_entries;
+    uint64_t cqes = ring->cqes_offset();
+    g_io_urings[fd] = std::move(ring);
+
+    m.memory.template write<uint32_t>(params_addr, sq_entries);
+    m.memory.template write<uint32_t>(params_addr + 4, cq_entries);
+    m.memory.template write<uint32_t>(params_addr + 20, IORING_FEATURES);
+    const uint32_t sq_off[8] = {
+        (uint32_t)IoUring::SQ_HEAD, (uint32_t)IoUring::SQ_TAIL, (uint32_t)IoUring::SQ_MASK,
+        (uint32_t)IoUring::SQ_ENTRIES, (uint32_t)IoUring::SQ_FLAGS, (uint32_t)IoUring::SQ_DROPPED,
+        (uint32_t)IoUring::SQ_ARRAY, 0};
+    const uint32_t cq_off[8] = {
+        (uint32_t)IoUring::CQ_HEAD, (uint32_t)IoUring::CQ_TAIL, (uint32_t)IoUring::CQ_MASK,
+        (uint32_t)IoUring::CQ_ENTRIES, (uint32_t)IoUring::CQ_OVERFLOW, (uint32_t)cqes,
+        (uint32_t)IoUring::CQ_FLAGS, 0};
+    m.memory.memcpy(params_addr + 40, sq_off, sizeof(sq_off));
+    m.memory.template write<uint64_t>(params_addr + 72, 0);  // user_addr
+    m.memory.memcpy(params_addr + 80, cq_off, sizeof(cq_off));
+    m.memory.template write<uint64_t>(params_addr + 112, 0);
+    m.set_result(fd);
+}
+
+// io_uring_enter: submit, then (GETEVENTS) wait for min_complete CQEs.
+// Waiting works like ppoll: let another thread run, else stop for the host
+// (Wasm) or block in one host poll (native), re-entering the call each
+// time; only SQEs not yet consumed are submitted again.
+static void sys_io_uring_enter(Machine& m) {
+    int fd = m.template sysarg<int>(0);
+    uint32_t to_submit = m.template sysarg<uint32_t>(1);
+    uint32_t min_complete = m.template sysarg<uint32_t>(2);
+    uint32_t flags = m.template sysarg<uint32_t>(3);
+
+    auto it = g_io_urings.find(fd);
+    if (it == g_io_urings.end()) {
+        m.set_result(g_fds.is_open(fd) ? err::NOTSUP : err::BADF);
+        return;
+    }
+    if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_IGNORED)) {
+        m.set_result(err::INVAL);  // EXT_ARG, REGISTERED_RING: not offered
+        return;
+    }
+    std::shared_ptr<IoUring> ring = it->second;  // An op may close the fd
+    if (!ring->mapped()) {
+        m.set_result(err::FAULT);
+        return;
+    }
+
+    uint32_t submitted = io_uring_submit(m, *ring, to_submit) + std::exchange(ring->carried, 0);
+    io_uring_progress(m, *ring);
+    if (flags & IORING_ENTER_GETEVENTS) {
+        min_complete = std::min(min_complete, ring->cq_entries);
+        while (ring->cq_ready(m) < min_complete && !ring->pending.empty()) {
+            if (int next = g_sched.count > 1 ? g_sched.next_runnable(g_sched.current) : -1;
+                next >= 0) {
+                ring->carried = submitted;
+                m.cpu.increment_pc(-4);
+                switch_to_thread(m, next);
+                return;
+            }
+#ifdef __EMSCRIPTEN__
+            // JS resumes us on input or a timer tick
+            ring->carried = submitted;
+            g_waiting_for_stdin = true;
+            m.cpu.increment_pc(-4);
+            m.stop();
+            return;
+#else
+            if (!io_uring_wait_host(*ring)) break;  // Nothing pending can finish
+            io_uring_progress(m, *ring);
+#endif
+        }
+    }
+    m.set_result(submitted);
+}
+
+// io_uring_register: no fixed files or buffers, but PROBE lets liburing
+// ask which opcodes are supported
+static void sys_io_uring_register(Machine& m) {
+    int fd = m.template sysarg<int>(0);
+    uint32_t opcode = m.template sysarg<uint32_t>(1);
+    auto arg = m.sysarg(2);
+    uint32_t nr_args = m.template sysarg<uint32_t>(3);
+    constexpr uint32_t IORING_REGISTER_PROBE = 8;
+
+    if (!g_io_urings.count(fd)) {
+        m.set_result(g_fds.is_open(fd) ? err::NOTSUP : err::BADF);
+        return;
+    }
+    if (opcode != IORING_REGISTER_PROBE) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    // struct io_uring_probe { u8 last_op, ops_len; ...; io_uring_probe_op ops[] }
+    // with 8-byte ops { u8 op, resv; u16 flags; u32 resv2 } from offset 16
+    constexpr uint8_t SUPPORTED[] = {
+        IORING_OP_NOP, IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_POLL_ADD,
+        IORING_OP_TIMEOUT, IORING_OP_ACCEPT, IORING_OP_OPENAT, IORING_OP_CLOSE,
+        IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_SEND, IORING_OP_RECV,
+    };
+    constexpr uint8_t LAST_OP = IORING_OP_RECV;
+    uint32_t ops_len = std::min<uint32_t>(nr_args, LAST_OP + 1);
+    m.memory.memset(arg, 0, 16 + 8ull * nr_args);
+    m.memory.template write<uint8_t>(arg, LAST_OP);
+    m.memory.template write<uint8_t>(arg + 1, static_cast<uint8_t>(ops_len));
+    for (uint32_t op = 0; op < ops_len; op++) {
+        m.memory.template write<uint8_t>(arg + 16 + 8 * op, static_cast<uint8_t>(op));
+    }
+    for (uint8_t op : SUPPORTED) {
+        if (op < ops_len) m.memory.template write<uint16_t>(arg + 16 + 8 * op + 2, 1);  // IO_URING_OP_SUPPORTED
+    }
+    m.set_result(0);
+}
+
 static void sys_capget(Machine& m) { m.set_result(-1); }  // -EPERM
 
 static void sys_sched_getscheduler(Machine& m) {
@@ -4060,8 +6010,6 @@ static void sys_recvmsg(Machine& m) {
     auto msghdr_addr = m.sysarg(1);
     // int flags = m.template sysarg<int>(2);
 
-    auto& fs = get_fs(m);
-
     // struct msghdr {
     //   void *msg_name;          // 0:  8 bytes
     //   socklen_t msg_namelen;   // 8:  4 bytes (+4 pad)
@@ -4074,24 +6022,13 @@ static void sys_recvmsg(Machine& m) {
     auto iov_addr = m.memory.template read<uint64_t>(msghdr_addr + 16);
     auto iovlen   = m.memory.template read<uint64_t>(msghdr_addr + 24);
 
-    // Read into iovec buffers, similar to readv
-    size_t total = 0;
-    for (uint64_t i = 0; i < iovlen && i < 16; i++) {
-        uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-        uint64_t len  = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-        if (len > 0) {
-            std::vector<uint8_t> buf(len);
-            ssize_t n = fs.read(fd, buf.data(), len);
-            if (n < 0) {
-                m.set_result(total > 0 ? (int64_t)total : n);
-                return;
-            }
-            if (n > 0) {
-                m.memory.memcpy(base, buf.data(), n);
-                total += n;
-            }
-            if (static_cast<size_t>(n) < len) break;
-        }
+    // Read into iovec buffers, like readv
+    bool parked;
+    int64_t n = fd_readv(m, fd, iov_addr, std::min<uint64_t>(iovlen, 16), true, parked);
+    if (parked) return;
+    if (n < 0) {
+        m.set_result(n);
+        return;
     }
 
     // Zero out msg_controllen (no ancillary data)
@@ -4099,7 +6036,7 @@ static void sys_recvmsg(Machine& m) {
     // Clear msg_flags
     m.memory.template write<int32_t>(msghdr_addr + 48, 0);
 
-    m.set_result(total);
+    m.set_result(n);
 }
 
 // ============================================================================
@@ -4123,6 +6060,7 @@ static void sys_fchmod(Machine& m) {
     auto entry = fs.get_entry(fd);
     if (!entry) { m.set_result(err::BADF); return; }
     entry->mode = mode & 07777;
+    fs.mark_dirty(*entry);
     m.set_result(0);
 }
 
@@ -4140,6 +6078,7 @@ static void sys_fchmodat(Machine& m) {
     auto entry = fs.resolve(path);
     if (!entry) { m.set_result(err::NOENT); return; }
     entry->mode = mode & 07777;
+    fs.mark_dirty(*entry);
     m.set_result(0);
 }
 
@@ -4232,6 +6171,11 @@ static void sys_tkill(Machine& m) {
 
 static void sys_sched_yield(Machine& m) {
     m.set_result(0);
+    if (g_harts.active()) {
+        Harts::Unlocked unlocked(g_harts);
+        std::this_thread::yield();
+        return;
+    }
     // Cooperative scheduling: yield to another thread if available
     if (g_sched.count > 1) {
         int next = g_sched.next_runnable(g_sched.current);
@@ -4247,78 +6191,82 @@ static void sys_rt_sigreturn(Machine& m) {
     m.set_result(0);
 }
 
-static void sys_pwritev(Machine& m) {
+static void sys_preadv(Machine& m) {
     auto& fs = get_fs(m);
     int fd = m.template sysarg<int>(0);
     auto iov_addr = m.sysarg(1);
     int iovcnt = m.template sysarg<int>(2);
     int64_t offset = m.template sysarg<int64_t>(3);
 
-    // Collect all iovec data into a single buffer, then pwrite
-    std::vector<uint8_t> combined;
+    // Fill each iovec in place from the advancing offset
+    size_t total = 0;
     for (int i = 0; i < iovcnt && i < 16; i++) {
         uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
         uint64_t len  = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-        if (len > 0) {
-            size_t prev = combined.size();
-            combined.resize(prev + len);
-            m.memory.memcpy_out(combined.data() + prev, base, len);
+        if (len == 0) continue;
+        ssize_t n = guest_transfer<GuestAccess::Write>(m, base, len,
+            [&](char* buf, size_t size, size_t done) { return fs.pread(fd, buf, size, offset + total + done); });
+        if (n < 0) {
+            m.set_result(total > 0 ? (int64_t)total : n);
+            return;
         }
+        total += n;
+        if (static_cast<size_t>(n) < len) break;
     }
+    m.set_result(total);
+}
 
-    if (combined.empty()) { m.set_result(0); return; }
-    ssize_t n = fs.pwrite(fd, combined.data(), combined.size(), offset);
-    m.set_result(n);
+static void sys_pwritev(Machine& m) {
+    auto& fs = get_fs(m);
+    int fd = m.template sysarg<int>(0);
+    auto iov_addr = m.sysarg(1);
+    int iovcnt = m.template sysarg<int>(2);
+    int64_t offset = m.template sysarg<int64_t>(3);
+
+    // Write each iovec in place at the advancing offset
+    size_t total = 0;
+    for (int i = 0; i < iovcnt && i < 16; i++) {
+        uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
+        uint64_t len  = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
+        if (len == 0) continue;
+        ssize_t n = guest_transfer<GuestAccess::Read>(m, base, len,
+            [&](char* buf, size_t size, size_t done) { return fs.pwrite(fd, buf, size, offset + total + done); });
+        if (n < 0) {
+            m.set_result(total > 0 ? (int64_t)total : n);
+            return;
+        }
+        total += n;
+        if (static_cast<size_t>(n) < len) break;
+    }
+    m.set_result(total);
 }
 
 // socketpair — bidirectional pipe for IPC (Next.js uses for worker communication)
 static void sys_socketpair(Machine& m) {
     auto& fs = get_fs(m);
     // int domain = m.template sysarg<int>(0);
-    // int type = m.template sysarg<int>(1);
+    int type = m.template sysarg<int>(1);
     // int protocol = m.template sysarg<int>(2);
     auto sv_addr = m.sysarg(3);
 
-    // Implement as two cross-connected pipes:
-    // Writing to fd[0] → readable from fd[1], and vice versa
-    auto pipe_a = std::make_shared<vfs::Entry>();
-    pipe_a->type = vfs::FileType::Fifo;
-    pipe_a->mode = 0600;
-    pipe_a->size = 0;
-
-    auto pipe_b = std::make_shared<vfs::Entry>();
-    pipe_b->type = vfs::FileType::Fifo;
-    pipe_b->mode = 0600;
-    pipe_b->size = 0;
-
-    // fd[0]: reads from pipe_a, writes to pipe_b
-    // fd[1]: reads from pipe_b, writes to pipe_a
-    // We approximate with two separate pipes — each end reads its own pipe
-    // and writes to the other. VFS pipe semantics: write appends to content,
-    // read drains from content.
-    int fd0_read = fs.open_pipe(pipe_a, 0);   // read end of pipe_a
-    int fd0_write = fs.open_pipe(pipe_b, 1);  // write end of pipe_b
-
-    int fd1_read = fs.open_pipe(pipe_b, 0);   // read end of pipe_b
-    int fd1_write = fs.open_pipe(pipe_a, 1);  // write end of pipe_a
-
-    // The issue: each socket fd needs to be BOTH readable and writable,
-    // but our pipe fds are one-directional. We need a duplex fd abstraction.
-    // For now, use dup3 to merge: fd[0] = fd0_read, and intercept writes
-    // Actually, the simplest approach: just use two regular pipes.
-    // sv[0] reads from pipe_a, writes go to pipe_b
-    // sv[1] reads from pipe_b, writes go to pipe_a
-    // This requires the write handler to know about cross-wiring.
-    //
-    // SIMPLER: just create two unidirectional pipes and return them.
-    // Most socketpair usage is parent writes sv[0], child reads sv[1].
-    // This matches a regular pipe(). Close the unused ends.
-    fs.close(fd0_write);
-    fs.close(fd1_read);
+    // Approximated as one unidirectional pipe: our fds have no duplex
+    // abstraction, and most socketpair usage is parent writes sv[0],
+    // child reads sv[1]. SOCK_NONBLOCK shares O_NONBLOCK's value.
+    auto pipe_entry = fs.make_pipe();
 
     // sv[0] = write end (parent writes here)
     // sv[1] = read end (child reads here)
-    int32_t sv[2] = { fd1_write, fd0_read };
+    int read_fd = fs.open_pipe(pipe_entry, 0, type);
+    int write_fd = fs.open_pipe(pipe_entry, 1, type);
+    if (read_fd < 0 || write_fd < 0) {
+        fs.close(read_fd);
+        fs.close(write_fd);
+        m.set_result(read_fd < 0 ? read_fd : write_fd);
+        return;
+    }
+    g_fds.install(read_fd, FdKind::Pipe);
+    g_fds.install(write_fd, FdKind::Pipe);
+    int32_t sv[2] = { write_fd, read_fd };
     m.memory.memcpy(sv_addr, sv, sizeof(sv));
     m.set_result(0);
 }
@@ -4329,28 +6277,13 @@ static void sys_sendmsg(Machine& m) {
     auto msghdr_addr = m.sysarg(1);
     // int flags = m.template sysarg<int>(2);
 
-    auto& fs = get_fs(m);
-
     auto iov_addr = m.memory.template read<uint64_t>(msghdr_addr + 16);
     auto iovlen   = m.memory.template read<uint64_t>(msghdr_addr + 24);
 
-    size_t total = 0;
-    for (uint64_t i = 0; i < iovlen && i < 16; i++) {
-        uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
-        uint64_t len  = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
-        if (len > 0) {
-            std::vector<uint8_t> buf(len);
-            m.memory.memcpy_out(buf.data(), base, len);
-            ssize_t n = fs.write(fd, buf.data(), len);
-            if (n < 0) {
-                m.set_result(total > 0 ? (int64_t)total : n);
-                return;
-            }
-            total += n;
-            if (static_cast<size_t>(n) < len) break;
-        }
-    }
-    m.set_result(total);
+    bool parked;
+    int64_t n = fd_writev(m, fd, iov_addr, std::min<uint64_t>(iovlen, 16), true, parked);
+    if (parked) return;
+    m.set_result(n);
 }
 
 }  // namespace handlers
@@ -4431,6 +6364,10 @@ static void sys_riscv_hwprobe(Machine& m) {
 // First invocation: store request, stop machine (Worker performs fetch)
 // Re-entry after resume: copy response to guest buffer, return bytes_written in a0
 static void sys_host_fetch(Machine& m) {
+    if (g_harts.is_hart(m)) {
+        m.set_result(-38);  // The fetch is run by the primary's run loop
+        return;
+    }
     if (g_host_fetch_response_ready) {
         // Re-entry after Worker completed the fetch
         auto resp_buf = m.sysarg(2);
@@ -4464,6 +6401,27 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     // Create and store context
     static SyscallContext ctx(&fs);
     machine.set_userdata(&ctx);
+    // VFS descriptors are numbered in the shared fd table
+    fs.set_fd_allocator(&g_fds);
+
+    Machine::on_syscall_enter = [](Machine& m, size_t nr) {
+        g_harts.enter(m);
+        g_syscall_stats.enter(&m, nr, m.cpu.pc(), m.instruction_counter());
+    };
+    Machine::on_syscall_leave = [](Machine& m, size_t nr) {
+        g_syscall_stats.leave(nr, m.cpu.pc(), static_cast<int64_t>(m.cpu.reg(riscv::REG_ARG0)),
+                              m.instruction_counter());
+        g_harts.leave(m);
+    };
+    Machine::on_syscall_abort = [](Machine& m, size_t) {
+        g_harts.abort(m);
+    };
+    for (int nr : {nr::read, nr::write, nr::readv, nr::writev, nr::pread64, nr::pwrite64,
+                   nr::preadv, nr::pwritev, nr::sendfile, nr::splice, nr::copy_file_range,
+                   nr::sendto, nr::recvfrom, nr::sendmsg, nr::recvmsg, nr::getrandom,
+                   nr::getdents64}) {
+        g_syscall_stats.count_bytes(nr);
+    }
 
     // Install handlers
     using namespace handlers;
@@ -4492,6 +6450,7 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     machine.install_syscall_handler(nr::set_tid_address, sys_set_tid_address);
     machine.install_syscall_handler(nr::set_robust_list, sys_set_robust_list);
     machine.install_syscall_handler(nr::clock_gettime, sys_clock_gettime);
+    machine.install_syscall_handler(nr::gettimeofday, sys_gettimeofday);
     machine.install_syscall_handler(nr::getrandom, sys_getrandom);
     machine.install_syscall_handler(nr::clone, sys_clone);
     machine.install_syscall_handler(nr::clone3, sys_clone3);
@@ -4520,6 +6479,8 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     machine.install_syscall_handler(nr::readv, sys_readv);
     machine.install_syscall_handler(nr::ppoll, sys_ppoll);
     machine.install_syscall_handler(nr::sendfile, sys_sendfile);
+    machine.install_syscall_handler(nr::splice, sys_splice);
+    machine.install_syscall_handler(nr::copy_file_range, sys_copy_file_range);
     machine.install_syscall_handler(nr::pread64, sys_pread64);
     machine.install_syscall_handler(nr::pwrite64, sys_pwrite64);
     machine.install_syscall_handler(nr::ftruncate, sys_ftruncate);
@@ -4544,8 +6505,12 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     // uname — system identification
     machine.install_syscall_handler(nr::uname, sys_uname);
 
-    // nanosleep
+    // nanosleep, clock_nanosleep, timerfd — the guest clock
     machine.install_syscall_handler(nr::nanosleep, sys_nanosleep);
+    machine.install_syscall_handler(nr::clock_nanosleep, sys_clock_nanosleep);
+    machine.install_syscall_handler(nr::timerfd_create, sys_timerfd_create);
+    machine.install_syscall_handler(nr::timerfd_settime, sys_timerfd_settime);
+    machine.install_syscall_handler(nr::timerfd_gettime, sys_timerfd_gettime);
 
     // Stubs
     machine.install_syscall_handler(nr::madvise, sys_madvise);
@@ -4553,6 +6518,8 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     machine.install_syscall_handler(nr::mremap, sys_mremap);
     machine.install_syscall_handler(nr::eventfd2, sys_eventfd2);
     machine.install_syscall_handler(nr::io_uring_setup, sys_io_uring_setup);
+    machine.install_syscall_handler(nr::io_uring_enter, sys_io_uring_enter);
+    machine.install_syscall_handler(nr::io_uring_register, sys_io_uring_register);
     machine.install_syscall_handler(nr::capget, sys_capget);
     machine.install_syscall_handler(nr::sched_getscheduler, sys_sched_getscheduler);
     machine.install_syscall_handler(nr::sched_getparam, sys_sched_getparam);
@@ -4584,6 +6551,7 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     machine.install_syscall_handler(nr::sched_yield, sys_sched_yield);
     machine.install_syscall_handler(nr::close_range, sys_close_range);
     machine.install_syscall_handler(nr::rt_sigreturn, sys_rt_sigreturn);
+    machine.install_syscall_handler(nr::preadv, sys_preadv);
     machine.install_syscall_handler(nr::pwritev, sys_pwritev);
     machine.install_syscall_handler(nr::socketpair, sys_socketpair);
     machine.install_syscall_handler(nr::sendmsg, sys_sendmsg);
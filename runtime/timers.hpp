@@ -0,0 +1,244 @@
+// timers.hpp - The guest clock and the timer wheel behind guest timeouts
+//
+// Guest time is the host's steady clock plus an offset that only grows.
+// When every guest thread is blocked on a timeout and nothing can arrive
+// from the host, the scheduler does not wait the time out: it adds the gap
+// to the offset, and the clock jumps straight to the next deadline
+// (sched_pick_idle in syscalls.hpp). A program that sleeps, or retries on a
+// timer, then runs as fast as it computes, and every skipped wait lasts,
+// as the guest sees it, exactly as long as it asked for. --real-time turns
+// the skipping off. CLOCK_REALTIME is the guest clock plus an epoch taken
+// from the host once, so it moves with it; the host's wall clock being set
+// never reaches the guest.
+//
+// Timed waits (nanosleep, futex and epoll timeouts) and armed timerfds all
+// sit in one hierarchical timing wheel keyed by their guest-clock deadline:
+// arming and cancelling are O(1), and the next deadline is in the first
+// occupied slot of the lowest occupied level.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+namespace syscalls {
+
+// Guest ns skipped over idle time; only grows
+inline uint64_t g_clock_offset = 0;
+// Guest clock minus (host steady clock + offset): 0 in a fresh process, set
+// on checkpoint restore so the guest clock carries on from the saved one
+inline int64_t g_clock_base = 0;
+// CLOCK_REALTIME minus the guest clock, INT64_MIN until first needed
+inline int64_t g_clock_epoch = INT64_MIN;
+// Cleared by --real-time: idle time is waited out on the host
+inline bool g_clock_fast_forward = true;
+
+inline uint64_t host_steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The clock guest timeouts and deadlines are measured against; the
+// monotonic clock ids read it (vdso.hpp reads it as rdtime)
+inline uint64_t guest_clock_ns() {
+    return host_steady_ns() + g_clock_base + g_clock_offset;
+}
+
+// CLOCK_REALTIME minus the guest clock. Taken from the host on first use,
+// not at static init, which Wizer runs at build time; the guest's wall
+// clock then starts as the host's and gains whatever idle time is skipped.
+inline int64_t clock_epoch() {
+    if (g_clock_epoch == INT64_MIN) {
+        int64_t realtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        g_clock_epoch = realtime - static_cast<int64_t>(host_steady_ns()) - g_clock_base;
+    }
+    return g_clock_epoch;
+}
+
+// The guest's CLOCK_REALTIME
+inline uint64_t guest_realtime_ns() {
+    return guest_clock_ns() + clock_epoch();
+}
+
+// A CLOCK_REALTIME deadline on the guest clock (never 0, which means none)
+inline int64_t realtime_to_guest(int64_t deadline) {
+    if (deadline == INT64_MAX) return deadline;
+    return std::max<int64_t>(deadline - clock_epoch(), 1);
+}
+
+// A guest-clock deadline on the host's steady clock (CLOCK_MONOTONIC), for
+// waits the host does itself
+inline int64_t guest_to_host(int64_t deadline) {
+    if (deadline == INT64_MAX) return deadline;
+    return deadline - g_clock_base - static_cast<int64_t>(g_clock_offset);
+}
+
+// Move the guest clock forward to deadline, if it is not there yet
+inline void clock_advance_to(uint64_t deadline) {
+    uint64_t now = guest_clock_ns();
+    if (deadline > now) g_clock_offset += deadline - now;
+}
+
+class TimerWheel {
+public:
+    static constexpr int NONE = -1;
+
+    bool empty() const { return live_ == 0; }
+
+    // Arm a timer for owner at deadline (guest-clock ns); returns its handle
+    int add(uint64_t deadline, uint64_t owner) {
+        int h = free_;
+        if (h != NONE) {
+            free_ = nodes_[h].next;
+        } else {
+            h = static_cast<int>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        nodes_[h].deadline = deadline;
+        nodes_[h].owner = owner;
+        nodes_[h].seq = seq_++;
+        link(h);
+        live_++;
+        return h;
+    }
+
+    void cancel(int h) {
+        unlink(h);
+        release(h);
+    }
+
+    // The earliest deadline, or UINT64_MAX with nothing armed
+    uint64_t next_deadline() const {
+        int level = lowest();
+        if (level < 0) return UINT64_MAX;
+        uint64_t earliest = UINT64_MAX;
+        for (int h = heads_[level][first_slot(level)]; h != NONE; h = nodes_[h].next)
+            earliest = std::min(earliest, nodes_[h].deadline);
+        return earliest;
+    }
+
+    // Disarm every timer due by now and pass its owner to fire, earliest
+    // first (ties in the order they were armed). fire may arm new timers.
+    template <typename Fire>
+    void expire(uint64_t now, Fire&& fire) {
+        uint64_t target = std::max(now >> TICK_SHIFT, tick_);
+        std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> due;  // deadline, seq, owner
+        for (int level = lowest(); level >= 0; level = lowest()) {
+            int slot = first_slot(level);
+            uint64_t start = slot_start(level, slot);
+            if (start > target) break;
+            int h = heads_[level][slot];
+            heads_[level][slot] = NONE;
+            occupied_[level] &= ~(1ULL << slot);
+            tick_ = std::max(tick_, start);
+            while (h != NONE) {
+                int next = nodes_[h].next;
+                if (nodes_[h].deadline <= now) {
+                    due.emplace_back(nodes_[h].deadline, nodes_[h].seq, nodes_[h].owner);
+                    release(h);
+                } else {
+                    link(h);  // Down a level, or back into the slot of the current tick
+                }
+                h = next;
+            }
+            if (level == 0 && start == target) break;
+        }
+        tick_ = target;
+        std::sort(due.begin(), due.end());
+        for (const auto& [deadline, seq, owner] : due) fire(owner);
+    }
+
+private:
+    // Level 0 slots are 1024 ns wide, and each level's slots span a whole
+    // level below; nine levels of 64 cover the full 64-bit range
+    static constexpr int TICK_SHIFT = 10;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr int LEVELS = 9;
+
+    struct Node {
+        uint64_t deadline;
+        uint64_t owner;
+        uint64_t seq;
+        int next, prev;  // Slot list; next chains the free list
+        uint8_t level, slot;
+    };
+
+    std::vector<Node> nodes_;
+    int free_ = NONE;
+    size_t live_ = 0;
+    uint64_t seq_ = 0;
+    // Wheel time in ticks. A timer sits on the level of the highest 6-bit
+    // digit in which its tick differs from this one, so every timer on a
+    // level expires after all those below it, and its slot is never behind
+    // the digit of the current tick.
+    uint64_t tick_ = 0;
+    std::array<std::array<int, SLOTS>, LEVELS> heads_ = [] {
+        std::array<std::array<int, SLOTS>, LEVELS> heads;
+        for (auto& level : heads) level.fill(NONE);
+        return heads;
+    }();
+    std::array<uint64_t, LEVELS> occupied_{};  // Bit per non-empty slot
+
+    int lowest() const {
+        for (int level = 0; level < LEVELS; level++) {
+            if (occupied_[level]) return level;
+        }
+        return -1;
+    }
+
+    int first_slot(int level) const {
+        int digit = static_cast<int>(tick_ >> (level * SLOT_BITS)) & (SLOTS - 1);
+        uint64_t ahead = occupied_[level] & (~0ULL << digit);
+        return std::countr_zero(ahead ? ahead : occupied_[level]);
+    }
+
+    // First tick the slot covers
+    uint64_t slot_start(int level, int slot) const {
+        int above = (level + 1) * SLOT_BITS;
+        uint64_t base = above < 64 ? tick_ >> above << above : 0;
+        return base | static_cast<uint64_t>(slot) << (level * SLOT_BITS);
+    }
+
+    void link(int h) {
+        auto& n = nodes_[h];
+        uint64_t tick = std::max(n.deadline >> TICK_SHIFT, tick_);
+        uint64_t diff = tick ^ tick_;
+        int level = diff ? (std::bit_width(diff) - 1) / SLOT_BITS : 0;
+        int slot = static_cast<int>(tick >> (level * SLOT_BITS)) & (SLOTS - 1);
+        n.level = static_cast<uint8_t>(level);
+        n.slot = static_cast<uint8_t>(slot);
+        n.prev = NONE;
+        n.next = heads_[level][slot];
+        if (n.next != NONE) nodes_[n.next].prev = h;
+        heads_[level][slot] = h;
+        occupied_[level] |= 1ULL << slot;
+    }
+
+    void unlink(int h) {
+        auto& n = nodes_[h];
+        if (n.prev != NONE) {
+            nodes_[n.prev].next = n.next;
+        } else {
+            heads_[n.level][n.slot] = n.next;
+        }
+        if (n.next != NONE) nodes_[n.next].prev = n.prev;
+        if (heads_[n.level][n.slot] == NONE) occupied_[n.level] &= ~(1ULL << n.slot);
+    }
+
+    void release(int h) {
+        nodes_[h].next = free_;
+        free_ = h;
+        live_--;
+    }
+};
+
+inline TimerWheel g_timers;
+
+}  // namespace syscalls
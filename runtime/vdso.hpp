@@ -0,0 +1,348 @@
+// vdso.hpp - Guest vDSO serving clock_gettime/gettimeofday without an ecall
+//
+// Node and Go read the clock constantly, and each read used to be a full
+// syscall round trip through the dispatcher. Like the kernel, we instead
+// map a small shared object into every process and advertise it with
+// AT_SYSINFO_EHDR; libc (glibc, musl) and the Go runtime look up
+// __vdso_clock_gettime / __vdso_gettimeofday there and call them directly.
+//
+// Two pages, allocated from the mmap area at exec time:
+//
+//   base          data page, written by the host under a seqlock
+//   base + 4096   ELF image (headers, dynamic section, DT_HASH, symbols,
+//                 hand-assembled RV64 code)
+//
+// `rdtime` reads the guest clock itself (installed here), and realtime is
+// that plus the epoch the host publishes (see timers.hpp), so the guest
+// computes every clock on its own and the page only changes when the
+// epoch does or the syscall fallback is toggled. The monotonic ids read the
+// guest clock, the realtime ones add the epoch, as sys_clock_gettime does.
+// While `use_syscall` is set the functions fall back to the real ecall.
+//
+// No symbol versions are emitted: glibc, musl and Go all accept an
+// unversioned definition when the vDSO has no DT_VERSYM.
+
+#pragma once
+
+#include "elf_loader.hpp"
+#include "timers.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace vdso {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+// Data page layout
+inline constexpr uint64_t DATA_SEQ = 0;          // u32, odd while an update is in progress
+inline constexpr uint64_t DATA_USE_SYSCALL = 4;  // u32, non-zero: take the ecall
+inline constexpr uint64_t DATA_EPOCH = 8;        // i64, CLOCK_REALTIME minus the guest clock
+
+inline constexpr uint64_t PAGE = 4096;
+inline constexpr uint64_t MAPPING_SIZE = 2 * PAGE;
+
+// Guest address of the data page, 0 when no vDSO is mapped
+inline uint64_t g_vdso_base = 0;
+
+// rdtime source: the guest clock in ns, in every build (libriscv's default
+// reads 0 under Emscripten), skipped idle time included
+inline uint64_t rdtime_ns(const Machine&) {
+    return syscalls::guest_clock_ns();
+}
+
+// Clock ids that read realtime: REALTIME, REALTIME_COARSE, REALTIME_ALARM
+// and TAI (the guest has no leap seconds)
+inline constexpr uint32_t REALTIME_IDS = 1u << 0 | 1u << 5 | 1u << 8 | 1u << 11;
+
+namespace rv {
+
+// Registers used by the generated code
+enum : uint32_t { ZERO = 0, RA = 1, T0 = 5, T1 = 6, T2 = 7, A0 = 10, A1 = 11, A2 = 12, A7 = 17,
+                  T3 = 28, T4 = 29, T5 = 30, T6 = 31 };
+
+inline uint32_t r_type(uint32_t f7, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t op) {
+    return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+}
+inline uint32_t i_type(int32_t imm, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t op) {
+    return (uint32_t(imm) & 0xFFF) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+}
+inline uint32_t s_type(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = uint32_t(imm);
+    return (u >> 5 & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | (u & 0x1F) << 7 | 0x23;
+}
+inline uint32_t b_type(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = uint32_t(imm);
+    return (u >> 12 & 1) << 31 | (u >> 5 & 0x3F) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 |
+           (u >> 1 & 0xF) << 8 | (u >> 11 & 1) << 7 | 0x63;
+}
+
+inline uint32_t lw(uint32_t rd, uint32_t rs1, int32_t off) { return i_type(off, rs1, 2, rd, 0x03); }
+inline uint32_t ld(uint32_t rd, uint32_t rs1, int32_t off) { return i_type(off, rs1, 3, rd, 0x03); }
+inline uint32_t sw(uint32_t rs2, uint32_t rs1, int32_t off) { return s_type(off, rs2, rs1, 2); }
+inline uint32_t sd(uint32_t rs2, uint32_t rs1, int32_t off) { return s_type(off, rs2, rs1, 3); }
+inline uint32_t addi(uint32_t rd, uint32_t rs1, int32_t imm) { return i_type(imm, rs1, 0, rd, 0x13); }
+inline uint32_t andi(uint32_t rd, uint32_t rs1, int32_t imm) { return i_type(imm, rs1, 7, rd, 0x13); }
+inline uint32_t sltiu(uint32_t rd, uint32_t rs1, int32_t imm) { return i_type(imm, rs1, 3, rd, 0x13); }
+inline uint32_t add(uint32_t rd, uint32_t rs1, uint32_t rs2) { return r_type(0, rs2, rs1, 0, rd, 0x33); }
+inline uint32_t sub(uint32_t rd, uint32_t rs1, uint32_t rs2) { return r_type(0x20, rs2, rs1, 0, rd, 0x33); }
+inline uint32_t srl(uint32_t rd, uint32_t rs1, uint32_t rs2) { return r_type(0, rs2, rs1, 5, rd, 0x33); }
+inline uint32_t divu(uint32_t rd, uint32_t rs1, uint32_t rs2) { return r_type(1, rs2, rs1, 5, rd, 0x33); }
+inline uint32_t remu(uint32_t rd, uint32_t rs1, uint32_t rs2) { return r_type(1, rs2, rs1, 7, rd, 0x33); }
+inline uint32_t lui(uint32_t rd, int32_t imm20) { return (uint32_t(imm20) & 0xFFFFF) << 12 | rd << 7 | 0x37; }
+inline uint32_t auipc(uint32_t rd, int32_t imm20) { return (uint32_t(imm20) & 0xFFFFF) << 12 | rd << 7 | 0x17; }
+inline uint32_t rdtime(uint32_t rd) { return i_type(0xC01, ZERO, 2, rd, 0x73); }  // csrrs rd, time, zero
+inline uint32_t fence_r_r() { return i_type(0x22, ZERO, 0, ZERO, 0x0F); }
+inline uint32_t ecall() { return 0x73; }
+inline uint32_t ret() { return i_type(0, RA, 0, ZERO, 0x67); }
+
+// Straight-line assembler with forward branches
+struct Asm {
+    std::vector<uint32_t> code;
+    struct Fixup { size_t at; int label; uint32_t rs1, rs2, f3; };
+    std::vector<Fixup> fixups;
+    std::vector<int64_t> labels;
+
+    size_t here() const { return code.size() * 4; }
+    void emit(uint32_t insn) { code.push_back(insn); }
+    int label() { labels.push_back(-1); return int(labels.size()) - 1; }
+    void bind(int l) { labels[l] = int64_t(here()); }
+    void branch(uint32_t f3, uint32_t rs1, uint32_t rs2, int l) {
+        fixups.push_back({code.size(), l, rs1, rs2, f3});
+        emit(0);
+    }
+    void beqz(uint32_t rs, int l) { branch(0, rs, ZERO, l); }
+    void bnez(uint32_t rs, int l) { branch(1, rs, ZERO, l); }
+    void bne(uint32_t rs1, uint32_t rs2, int l) { branch(1, rs1, rs2, l); }
+
+    void resolve() {
+        for (auto& f : fixups) {
+            int32_t off = int32_t(labels[f.label] - int64_t(f.at * 4));
+            code[f.at] = b_type(off, f.rs2, f.rs1, f.f3);
+        }
+        fixups.clear();
+    }
+};
+
+// Load the clock into t5 (seconds) and t6 (nanoseconds), or jump to
+// `fallback`: realtime if a2 is non-zero, else the guest clock.
+// `image_offset` is where the code starts in the image; the data page sits
+// one page below the image.
+inline void emit_read_clock(Asm& a, uint64_t image_offset, int fallback) {
+    int64_t delta = -int64_t(PAGE) - int64_t(image_offset + a.here());
+    int32_t hi = int32_t((delta + 0x800) >> 12);
+    a.emit(auipc(T0, hi));
+    a.emit(addi(T0, T0, int32_t(delta - (int64_t(hi) << 12))));
+    int retry = a.label(), monotonic = a.label();
+    a.bind(retry);
+    a.emit(lw(T1, T0, DATA_SEQ));
+    a.emit(andi(T2, T1, 1));
+    a.bnez(T2, retry);
+    a.emit(lw(T2, T0, DATA_USE_SYSCALL));
+    a.bnez(T2, fallback);
+    a.emit(fence_r_r());
+    a.emit(rdtime(T3));
+    a.emit(ld(T5, T0, DATA_EPOCH));
+    a.emit(fence_r_r());
+    a.emit(lw(T6, T0, DATA_SEQ));
+    a.bne(T6, T1, retry);
+    a.beqz(A2, monotonic);
+    a.emit(add(T3, T3, T5));
+    a.bind(monotonic);
+    a.emit(lui(T4, 0x3B9AD));  // 1'000'000'000
+    a.emit(addi(T4, T4, -0x600));
+    a.emit(divu(T5, T3, T4));
+    a.emit(remu(T6, T3, T4));
+}
+
+}  // namespace rv
+
+// Build the ELF image. It is position independent (linked at 0), so the
+// same bytes serve every mapping.
+inline const std::vector<uint8_t>& image() {
+    static const std::vector<uint8_t> built = [] {
+        constexpr int64_t DT_NULL = 0, DT_HASH = 4, DT_STRTAB = 5, DT_SYMTAB = 6,
+                          DT_STRSZ = 10, DT_SYMENT = 11;
+        struct Sym {
+            uint32_t st_name;
+            uint8_t st_info;
+            uint8_t st_other;
+            uint16_t st_shndx;
+            uint64_t st_value;
+            uint64_t st_size;
+        };
+        struct Dyn { int64_t d_tag; uint64_t d_val; };
+
+        const char* names[] = {"__vdso_clock_gettime", "__vdso_gettimeofday"};
+        constexpr size_t NSYMS = 3;  // Null symbol + exports
+
+        // Fixed-size parts first, so the code knows its own offset
+        uint64_t phoff = sizeof(elf::Elf64_Ehdr);
+        uint64_t dynoff = phoff + 2 * sizeof(elf::Elf64_Phdr);
+        constexpr size_t NDYN = 6;
+        uint64_t hashoff = dynoff + NDYN * sizeof(Dyn);
+        uint64_t symoff = (hashoff + (2 + 1 + NSYMS) * 4 + 7) & ~7ull;
+        uint64_t stroff = symoff + NSYMS * sizeof(Sym);
+        std::vector<char> strtab(1, '\0');
+        uint32_t name_off[2];
+        for (int i = 0; i < 2; i++) {
+            name_off[i] = uint32_t(strtab.size());
+            strtab.insert(strtab.end(), names[i], names[i] + strlen(names[i]) + 1);
+        }
+        uint64_t codeoff = (stroff + strtab.size() + 15) & ~15ull;
+
+        using namespace rv;
+        Asm a;
+        // int __vdso_clock_gettime(clockid_t, struct timespec*)
+        uint64_t cgt = codeoff + a.here();
+        {
+            int fallback = a.label();
+            // Clock ids past TAI (and the dynamic CPU-time ones, which are
+            // negative) take the syscall
+            a.emit(sltiu(T2, A0, 12));
+            a.beqz(T2, fallback);
+            constexpr int32_t ids_hi = (REALTIME_IDS + 0x800) >> 12;
+            a.emit(lui(T1, ids_hi));
+            a.emit(addi(T1, T1, int32_t(REALTIME_IDS) - (ids_hi << 12)));
+            a.emit(srl(T1, T1, A0));
+            a.emit(andi(A2, T1, 1));
+            emit_read_clock(a, codeoff, fallback);
+            a.emit(sd(T5, A1, 0));
+            a.emit(sd(T6, A1, 8));
+            a.emit(addi(A0, ZERO, 0));
+            a.emit(ret());
+            a.bind(fallback);
+            a.emit(addi(A7, ZERO, 113));
+            a.emit(ecall());
+            a.emit(ret());
+        }
+        uint64_t cgt_size = codeoff + a.here() - cgt;
+        // int __vdso_gettimeofday(struct timeval*, struct timezone*)
+        uint64_t gtod = codeoff + a.here();
+        {
+            int fallback = a.label(), no_tv = a.label(), done = a.label();
+            a.emit(addi(A2, ZERO, 1));
+            emit_read_clock(a, codeoff, fallback);
+            a.beqz(A0, no_tv);
+            a.emit(sd(T5, A0, 0));
+            a.emit(addi(T4, ZERO, 1000));
+            a.emit(divu(T6, T6, T4));
+            a.emit(sd(T6, A0, 8));
+            a.bind(no_tv);
+            a.beqz(A1, done);
+            a.emit(sw(ZERO, A1, 0));
+            a.emit(sw(ZERO, A1, 4));
+            a.bind(done);
+            a.emit(addi(A0, ZERO, 0));
+            a.emit(ret());
+            a.bind(fallback);
+            a.emit(addi(A7, ZERO, 169));
+            a.emit(ecall());
+            a.emit(ret());
+        }
+        uint64_t gtod_size = codeoff + a.here() - gtod;
+        a.resolve();
+
+        uint64_t size = codeoff + a.here();
+        std::vector<uint8_t> img(size, 0);
+
+        elf::Elf64_Ehdr eh{};
+        memcpy(eh.e_ident, "\x7f" "ELF", 4);
+        eh.e_ident[4] = 2;  // ELFCLASS64
+        eh.e_ident[5] = 1;  // ELFDATA2LSB
+        eh.e_ident[6] = 1;  // EV_CURRENT
+        eh.e_type = elf::ET_DYN;
+        eh.e_machine = elf::EM_RISCV;
+        eh.e_version = 1;
+        eh.e_phoff = phoff;
+        eh.e_flags = 0x5;  // EF_RISCV_RVC | EF_RISCV_FLOAT_ABI_DOUBLE
+        eh.e_ehsize = sizeof(eh);
+        eh.e_phentsize = sizeof(elf::Elf64_Phdr);
+        eh.e_phnum = 2;
+        memcpy(img.data(), &eh, sizeof(eh));
+
+        elf::Elf64_Phdr ph[2]{};
+        ph[0].p_type = elf::PT_LOAD;
+        ph[0].p_flags = elf::PF_R | elf::PF_X;
+        ph[0].p_filesz = ph[0].p_memsz = size;
+        ph[0].p_align = PAGE;
+        ph[1].p_type = elf::PT_DYNAMIC;
+        ph[1].p_flags = elf::PF_R;
+        ph[1].p_offset = ph[1].p_vaddr = ph[1].p_paddr = dynoff;
+        ph[1].p_filesz = ph[1].p_memsz = NDYN * sizeof(Dyn);
+        ph[1].p_align = 8;
+        memcpy(img.data() + phoff, ph, sizeof(ph));
+
+        const Dyn dyn[NDYN] = {
+            {DT_HASH, hashoff}, {DT_SYMTAB, symoff}, {DT_STRTAB, stroff},
+            {DT_STRSZ, strtab.size()}, {DT_SYMENT, sizeof(Sym)}, {DT_NULL, 0},
+        };
+        memcpy(img.data() + dynoff, dyn, sizeof(dyn));
+
+        // One bucket holding every symbol
+        const uint32_t hash[2 + 1 + NSYMS] = {1, NSYMS, 1, 0, 2, 0};
+        memcpy(img.data() + hashoff, hash, sizeof(hash));
+
+        constexpr uint8_t GLOBAL_FUNC = (1 << 4) | 2;  // STB_GLOBAL, STT_FUNC
+        const Sym syms[NSYMS] = {
+            {},
+            {name_off[0], GLOBAL_FUNC, 0, 1, cgt, cgt_size},
+            {name_off[1], GLOBAL_FUNC, 0, 1, gtod, gtod_size},
+        };
+        memcpy(img.data() + symoff, syms, sizeof(syms));
+        memcpy(img.data() + stroff, strtab.data(), strtab.size());
+        memcpy(img.data() + codeoff, a.code.data(), a.here());
+        return img;
+    }();
+    return built;
+}
+
+// Publish the realtime epoch to the data page
+inline void refresh(Machine& m, bool use_syscall) {
+    if (g_vdso_base == 0) return;
+    int64_t epoch = syscalls::clock_epoch();
+    uint32_t seq = m.memory.read<uint32_t>(g_vdso_base + DATA_SEQ);
+    m.memory.write<uint32_t>(g_vdso_base + DATA_SEQ, seq + 1);
+    m.memory.write<uint32_t>(g_vdso_base + DATA_USE_SYSCALL, use_syscall ? 1 : 0);
+    m.memory.write<int64_t>(g_vdso_base + DATA_EPOCH, epoch);
+    m.memory.write<uint32_t>(g_vdso_base + DATA_SEQ, seq + 2);
+}
+
+// Re-attach to a vDSO already in guest memory (checkpoint restore)
+inline void attach(Machine& m, uint64_t base) {
+    g_vdso_base = base;
+    m.set_rdtime(rdtime_ns);
+}
+
+// Map a fresh vDSO for a new process image. Returns the AT_SYSINFO_EHDR
+// value, or 0 if the mmap area is exhausted (libc then uses the syscalls).
+inline uint64_t map(Machine& m) {
+    const auto& img = image();
+    auto& nextfree = m.memory.mmap_address();
+    if constexpr (riscv::encompassing_Nbit_arena > 0) {
+        if (nextfree + MAPPING_SIZE > riscv::encompassing_arena_mask) return 0;
+    }
+    uint64_t base = nextfree;
+    nextfree += MAPPING_SIZE;
+
+    riscv::PageAttributes data_attr;
+    data_attr.read = true;
+    data_attr.write = true;  // Host stores go through the page tables too
+    m.memory.set_page_attr(base, PAGE, data_attr);
+    m.memory.memdiscard(base, PAGE, true);
+    // Writable until the image is in, then read+exec for the decoder
+    m.memory.set_page_attr(base + PAGE, PAGE, data_attr);
+    m.memory.memdiscard(base + PAGE, PAGE, true);
+    m.memory.memcpy(base + PAGE, img.data(), img.size());
+    riscv::PageAttributes code_attr;
+    code_attr.read = true;
+    code_attr.exec = true;
+    m.memory.set_page_attr(base + PAGE, PAGE, code_attr);
+
+    attach(m, base);
+    refresh(m, false);
+    return base + PAGE;
+}
+
+}  // namespace vdso
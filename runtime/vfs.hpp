@@ -3,14 +3,18 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <deque>
 #include <memory>
 #include <algorithm>
 #include <set>
+#include <functional>
 
 namespace vfs {
 
@@ -25,9 +29,628 @@ enum class FileType : uint16_t {
     Socket     = 0140000,
 };
 
-// A file/directory entry in the VFS
+// Immutable backing store for a loaded rootfs image.
+// Regular files borrow slices of it instead of copying their bodies out of
+// the tar; the image stays alive for as long as any entry references it.
+// Native builds map the archive read-only (see map_rootfs in main.cpp), so
+// untouched files never cost more than page cache.
+class ImageBuffer {
+public:
+    using Release = std::function<void(const uint8_t*, size_t)>;
+
+    ImageBuffer(const ImageBuffer&) = delete;
+    ImageBuffer& operator=(const ImageBuffer&) = delete;
+
+    ~ImageBuffer() {
+        if (release_) release_(data_, size_);
+    }
+
+    // Take ownership of an in-memory archive
+    static std::shared_ptr<ImageBuffer> from_vector(std::vector<uint8_t> bytes) {
+        auto img = std::shared_ptr<ImageBuffer>(new ImageBuffer());
+        img->owned_ = std::move(bytes);
+        img->data_ = img->owned_.data();
+        img->size_ = img->owned_.size();
+        return img;
+    }
+
+    // Wrap externally owned memory (e.g. an mmap'd archive); release is
+    // called once the last borrower is gone.
+    static std::shared_ptr<ImageBuffer> from_mapping(const uint8_t* data, size_t size,
+                                                     Release release) {
+        auto img = std::shared_ptr<ImageBuffer>(new ImageBuffer());
+        img->data_ = data;
+        img->size_ = size;
+        img->release_ = std::move(release);
+        return img;
+    }
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    ImageBuffer() = default;
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<uint8_t> owned_;
+    Release release_;
+};
+
+// Archive bytes that are produced on demand rather than mapped, e.g. a
+// compressed rootfs (see compressed_image.hpp). fetch() copies
+// [offset, offset + len) of the uncompressed archive into out.
+class ContentSource {
+public:
+    virtual ~ContentSource() = default;
+    virtual bool fetch(uint64_t offset, uint8_t* out, size_t len) = 0;
+};
+
+// A host directory mounted into the VFS (see host_mount.hpp). Paths are
+// relative to the mount root, "" being the root itself; open() returns a
+// handle for the pread/pwrite family. Flags use the guest's (Linux generic)
+// O_* values and failures are negative guest errnos.
+class MountSource {
+public:
+    struct Attr {
+        FileType type;
+        uint32_t mode, uid, gid;
+        uint64_t size, mtime;
+        std::string link_target;
+    };
+    struct DirItem {
+        std::string name;
+        Attr attr;
+    };
+
+    virtual ~MountSource() = default;
+    virtual bool read_only() const = 0;
+    virtual int lstat(const std::string& rel, Attr& out) = 0;
+    virtual int list(const std::string& rel, std::vector<DirItem>& out) = 0;
+    virtual int open(const std::string& rel, int flags, uint32_t mode) = 0;
+    virtual void close(int handle) = 0;
+    virtual ssize_t pread(int handle, void* buf, size_t len, uint64_t offset) = 0;
+    virtual ssize_t pwrite(int handle, const void* buf, size_t len, uint64_t offset) = 0;
+    virtual int ftruncate(int handle, uint64_t len) = 0;
+    virtual int64_t fsize(int handle) = 0;
+    virtual int mkdir(const std::string& rel, uint32_t mode) = 0;
+    virtual int unlink(const std::string& rel, bool dir) = 0;
+    virtual int rename(const std::string& from, const std::string& to) = 0;
+    virtual int symlink(const std::string& target, const std::string& rel) = 0;
+    virtual int link(const std::string& from, const std::string& to) = 0;
+    virtual int truncate(const std::string& rel, uint64_t len) = 0;
+};
+
+// An open file on a mount, shared by dup'd handles
+struct HostFile {
+    MountSource* source;
+    int handle;
+
+    HostFile(MountSource* s, int h) : source(s), handle(h) {}
+    ~HostFile() { source->close(handle); }
+    HostFile(const HostFile&) = delete;
+    HostFile& operator=(const HostFile&) = delete;
+};
+
+// Body of a regular file, stored as fixed-size extents.
+//
+// Each CHUNK_SIZE extent is either absent or owned, and only owned extents
+// are stored (keyed by index). Absent extents read through to the base (a
+// borrowed slice of an ImageBuffer) or, past it, as zeros, so files are
+// sparse: pwrite past EOF and ftruncate up cost nothing for the gap, however
+// far it reaches. Writes privatize only the extents they touch, and appends
+// grow the last extent in place until it is full, then start a new one, so
+// a growing log never reallocates or copies what it already holds.
+//
+// A lazy body (a reference into a ContentSource, e.g. a compressed rootfs)
+// is fetched into extents on first access.
+class FileData {
+public:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    uint64_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    bool is_borrowed() const { return base_ != nullptr; }
+    bool is_lazy() const { return source_ != nullptr; }
+
+    // True if the whole body is one borrowed slice with no private extents
+    bool borrows_whole() const {
+        return base_ && !source_ && size_ == base_size_ && chunks_.empty();
+    }
+
+    // Start of the first data byte at or after offset, as SEEK_DATA finds
+    // it; size() if only hole remains. Extents are the granularity.
+    uint64_t next_data(uint64_t offset) const {
+        if (source_ || offset >= size_ || offset < base_size_) return std::min(offset, size_);
+        auto it = chunks_.lower_bound(offset / CHUNK_SIZE);
+        if (it == chunks_.end()) return size_;
+        return std::min(std::max(offset, it->first * CHUNK_SIZE), size_);
+    }
+
+    // Start of the first hole at or after offset, as SEEK_HOLE finds it;
+    // EOF counts as a hole
+    uint64_t next_hole(uint64_t offset) const {
+        if (source_) return size_;
+        uint64_t pos = std::max(offset, base_size_);
+        for (auto it = chunks_.lower_bound(pos / CHUNK_SIZE);
+             it != chunks_.end() && it->first == pos / CHUNK_SIZE; ++it)
+            pos = (it->first + 1) * CHUNK_SIZE;
+        return std::min(pos, size_);
+    }
+
+    // Copy up to len bytes starting at offset; returns the count copied
+    // (short at EOF). Holes read as zeros.
+    size_t read_at(uint64_t offset, void* out, size_t len) const {
+        if (source_) materialize();
+        if (offset >= size_) return 0;
+        len = (size_t)std::min<uint64_t>(len, size_ - offset);
+        uint8_t* dst = static_cast<uint8_t*>(out);
+        size_t done = 0;
+        while (done < len) {
+            uint64_t pos = offset + done;
+            size_t in_chunk = pos % CHUNK_SIZE;
+            size_t n = std::min(len - done, CHUNK_SIZE - in_chunk);
+            size_t have = 0;
+            auto it = chunks_.find(pos / CHUNK_SIZE);
+            if (it != chunks_.end()) {
+                const auto& bytes = it->second;
+                if (in_chunk < bytes.size()) {
+                    have = std::min(n, bytes.size() - in_chunk);
+                    memcpy(dst + done, bytes.data() + in_chunk, have);
+                }
+            } else if (pos < base_size_) {
+                have = (size_t)std::min<uint64_t>(n, base_size_ - pos);
+                memcpy(dst + done, base_ + pos, have);
+            }
+            if (have < n) memset(dst + done + have, 0, n - have);
+            done += n;
+        }
+        return len;
+    }
+
+    // Hand [offset, offset + len) to sink(data, n) extent by extent, in
+    // place; holes come from a zero page. sink returns the bytes it took or
+    // a negative errno, and a short take ends the walk. Returns the total
+    // taken (short at EOF), or the errno if nothing was taken.
+    template <typename Sink>
+    ssize_t visit(uint64_t offset, size_t len, Sink&& sink) const {
+        static const uint8_t zeros[4096] = {};
+        if (source_) materialize();
+        if (offset >= size_) return 0;
+        len = (size_t)std::min<uint64_t>(len, size_ - offset);
+        size_t done = 0;
+        while (done < len) {
+            uint64_t pos = offset + done;
+            size_t in_chunk = pos % CHUNK_SIZE;
+            size_t n = std::min(len - done, CHUNK_SIZE - in_chunk);
+            const uint8_t* data = nullptr;
+            auto it = chunks_.find(pos / CHUNK_SIZE);
+            if (it != chunks_.end()) {
+                const auto& bytes = it->second;
+                if (in_chunk < bytes.size()) {
+                    data = bytes.data() + in_chunk;
+                    n = std::min(n, bytes.size() - in_chunk);
+                }
+            } else if (pos < base_size_) {
+                data = base_ + pos;
+                n = (size_t)std::min<uint64_t>(n, base_size_ - pos);
+            }
+            if (!data) {
+                data = zeros;
+                n = std::min(n, sizeof(zeros));
+            }
+            ssize_t took = sink(data, n);
+            if (took < 0) return done > 0 ? static_cast<ssize_t>(done) : took;
+            done += took;
+            if (static_cast<size_t>(took) < n) break;
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    // Become a copy-on-write alias of src, as a reflink would. Only a body
+    // that is one borrowed slice (an image or content-store blob) can be
+    // shared; returns false for anything else.
+    bool share(const FileData& src) {
+        if (!src.borrows_whole()) return false;
+        assign_borrowed(src.base_image_, src.base_, src.size_);
+        return true;
+    }
+
+    // Make the body one borrowed slice so that it can be share()d: lazy
+    // and private extents are gathered into an immutable blob of their own
+    void seal() {
+        if (size_ == 0 || borrows_whole()) return;
+        std::vector<uint8_t> bytes;
+        bytes.reserve(size_);
+        append_to(bytes);
+        std::shared_ptr<const ImageBuffer> blob = ImageBuffer::from_vector(std::move(bytes));
+        assign_borrowed(blob, blob->data(), blob->size());
+    }
+
+    void write_at(uint64_t offset, const void* in, size_t len) {
+        if (source_) materialize();
+        if (len == 0) return;
+        uint64_t end = offset + len;
+        const uint8_t* src = static_cast<const uint8_t*>(in);
+        size_t done = 0;
+        while (done < len) {
+            uint64_t pos = offset + done;
+            size_t in_chunk = pos % CHUNK_SIZE;
+            size_t n = std::min(len - done, CHUNK_SIZE - in_chunk);
+            auto& bytes = own_chunk(pos / CHUNK_SIZE);
+            if (bytes.size() < in_chunk + n) bytes.resize(in_chunk + n);
+            memcpy(bytes.data() + in_chunk, src + done, n);
+            done += n;
+        }
+        if (end > size_) size_ = end;
+    }
+
+    // Truncate or extend; extension leaves a hole
+    void resize(uint64_t n) {
+        if (source_) materialize();
+        if (n < size_) {
+            uint64_t keep = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+            chunks_.erase(chunks_.lower_bound(keep), chunks_.end());
+            size_t tail = n % CHUNK_SIZE;
+            auto last = chunks_.find(keep - 1);
+            if (tail && last != chunks_.end() && last->second.size() > tail)
+                last->second.resize(tail);
+            if (n < base_size_) base_size_ = n;
+            if (base_size_ == 0) release_base();
+        }
+        size_ = n;
+    }
+
+    void clear() {
+        release_base();
+        source_.reset();
+        chunks_.clear();
+        size_ = 0;
+    }
+
+    void assign(const uint8_t* p, size_t n) {
+        clear();
+        write_at(0, p, n);
+    }
+
+    void assign_borrowed(std::shared_ptr<const ImageBuffer> image,
+                         const uint8_t* p, size_t n) {
+        clear();
+        base_image_ = std::move(image);
+        base_ = p;
+        base_size_ = n;
+        size_ = n;
+    }
+
+    void assign_lazy(std::shared_ptr<ContentSource> source, uint64_t offset, size_t n) {
+        clear();
+        source_ = std::move(source);
+        source_offset_ = offset;
+        size_ = n;
+    }
+
+    // Append the whole body to out. Unlike read_at, a lazy body is streamed
+    // from its source without being cached (used by tar export).
+    void append_to(std::vector<uint8_t>& out) const {
+        size_t at = out.size();
+        out.resize(at + size_);
+        if (source_) {
+            if (!source_->fetch(source_offset_, out.data() + at, size_))
+                std::fill(out.begin() + at, out.end(), 0);
+            return;
+        }
+        read_at(0, out.data() + at, size_);
+    }
+
+private:
+    // Make extent idx owned, seeding it from the base if it overlaps it
+    std::vector<uint8_t>& own_chunk(uint64_t idx) {
+        auto [it, added] = chunks_.try_emplace(idx);
+        uint64_t start = idx * CHUNK_SIZE;
+        if (added && start < base_size_) {
+            size_t n = (size_t)std::min<uint64_t>(CHUNK_SIZE, base_size_ - start);
+            it->second.assign(base_ + start, base_ + start + n);
+        }
+        return it->second;
+    }
+
+    void materialize() const {
+        auto source = std::move(source_);
+        source_.reset();
+        uint64_t count = (size_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        chunks_.clear();
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t start = i * CHUNK_SIZE;
+            auto& bytes = chunks_[i];
+            bytes.resize((size_t)std::min<uint64_t>(CHUNK_SIZE, size_ - start));
+            if (!source->fetch(source_offset_ + start, bytes.data(), bytes.size())) {
+                fprintf(stderr, "[vfs] failed to fetch %zu bytes at archive offset %llu\n",
+                        bytes.size(), (unsigned long long)(source_offset_ + start));
+                std::fill(bytes.begin(), bytes.end(), 0);
+            }
+        }
+    }
+
+    void release_base() {
+        base_image_.reset();
+        base_ = nullptr;
+        base_size_ = 0;
+    }
+
+    std::shared_ptr<const ImageBuffer> base_image_;
+    const uint8_t* base_ = nullptr;
+    uint64_t base_size_ = 0;
+    // Lazy bodies are filled in from const accessors, hence mutable
+    mutable std::shared_ptr<ContentSource> source_;
+    uint64_t source_offset_ = 0;
+    // Owned extents by index; each may be shorter than CHUNK_SIZE (the rest
+    // reads as zero)
+    mutable std::map<uint64_t, std::vector<uint8_t>> chunks_;
+    uint64_t size_ = 0;
+};
+
+// Content-addressed store for file bodies. Identical bodies share one
+// immutable blob, which FileData borrows copy-on-write exactly like a slice
+// of the rootfs image: the first write to an extent privatizes just that
+// extent. Blobs are held weakly and go away with their last borrower.
+//
+// Bodies are interned when they become private memory: when a lazily
+// decompressed file is first opened, when the last writer of a file whose
+// body was rewritten from the start (truncated to empty, or written at
+// offset 0 over its whole size) closes it, and when a delta is applied.
+// Interning copies and hashes the whole body, so in-place edits and
+// appends leave it private: an open/pwrite/close loop on a large file, or
+// an open/append/close one, would otherwise cost O(size) per close. Bodies
+// still borrowed from a mapped image are left alone; they cost no heap to
+// begin with.
+class ContentStore {
+public:
+    static constexpr size_t MIN_SIZE = 1024;      // Smaller bodies aren't worth a blob
+    static constexpr size_t MAX_SIZE = 64 << 20;  // Don't rehash huge files on every close
+
+    // Move content's body into the store. Returns true if it matched an
+    // existing blob (i.e. memory was saved).
+    bool intern(FileData& content) {
+        uint64_t n = content.size();
+        if (n < MIN_SIZE || n > MAX_SIZE || content.borrows_whole()) return false;
+
+        std::vector<uint8_t> bytes;
+        bytes.reserve(n);
+        content.append_to(bytes);
+        auto& bucket = blobs_[hash_bytes(bytes.data(), bytes.size())];
+
+        std::erase_if(bucket, [](const auto& weak) { return weak.expired(); });
+        for (const auto& weak : bucket) {
+            auto blob = weak.lock();
+            if (blob->size() == n && memcmp(blob->data(), bytes.data(), n) == 0) {
+                content.assign_borrowed(blob, blob->data(), n);
+                return true;
+            }
+        }
+        std::shared_ptr<const ImageBuffer> blob = ImageBuffer::from_vector(std::move(bytes));
+        bucket.push_back(blob);
+        content.assign_borrowed(blob, blob->data(), n);
+        return false;
+    }
+
+private:
+    std::unordered_map<uint64_t, std::vector<std::weak_ptr<const ImageBuffer>>> blobs_;
+
+    // Word-at-a-time multiply/xorshift mix; matches are confirmed with
+    // memcmp, so this only has to spread keys
+    static uint64_t hash_bytes(const uint8_t* p, size_t n) {
+        uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t w;
+            memcpy(&w, p + i, 8);
+            h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 31;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, p + i, n - i);
+        h = (h ^ tail) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 29);
+    }
+};
+
+// Sequential view of a tar archive consumed by VirtualFS::load_tar.
+// read() hands out header blocks, skip() steps over bodies and bind()
+// attaches a body to a file without reading it.
+class TarReader {
+public:
+    virtual ~TarReader() = default;
+    virtual bool read(uint8_t* out, size_t len) = 0;  // false at end of input
+    virtual bool skip(uint64_t len) = 0;
+    virtual uint64_t tell() const = 0;
+    virtual bool bind(FileData& content, uint64_t offset, uint64_t len) = 0;
+};
+
+// TarReader over an in-memory (or mapped) archive; bodies are borrowed
+class ImageTarReader : public TarReader {
+public:
+    explicit ImageTarReader(std::shared_ptr<const ImageBuffer> image)
+        : image_(std::move(image)) {}
+
+    bool read(uint8_t* out, size_t len) override {
+        if (pos_ + len > image_->size()) return false;
+        memcpy(out, image_->data() + pos_, len);
+        pos_ += len;
+        return true;
+    }
+    bool skip(uint64_t len) override {
+        if (pos_ + len > image_->size()) return false;
+        pos_ += len;
+        return true;
+    }
+    uint64_t tell() const override { return pos_; }
+    bool bind(FileData& content, uint64_t offset, uint64_t len) override {
+        if (offset + len > image_->size()) return false;
+        content.assign_borrowed(image_, image_->data() + offset, len);
+        return true;
+    }
+
+private:
+    std::shared_ptr<const ImageBuffer> image_;
+    uint64_t pos_ = 0;
+};
+
+// Bounded byte ring behind a pipe (pipe2 / socketpair).
+// Storage is allocated on the first write, so idle pipes cost nothing.
+// Readers and writers count the open handles on each end; they decide
+// EOF (no writers) and EPIPE (no readers).
+class PipeBuffer {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+    static constexpr size_t MAX_CAPACITY = 1024 * 1024;  // /proc/sys/fs/pipe-max-size
+    static constexpr size_t ATOMIC_WRITE = 4096;         // PIPE_BUF
+
+    const uint64_t id;
+    int readers = 0;
+    int writers = 0;
+
+    explicit PipeBuffer(uint64_t pipe_id) : id(pipe_id) {}
+
+    size_t size() const { return count_; }
+    size_t capacity() const { return capacity_; }
+    size_t space() const { return count_ < capacity_ ? capacity_ - count_ : 0; }
+
+    // Drain up to len bytes
+    size_t read(void* out, size_t len) {
+        size_t n = std::min(len, count_);
+        auto* dst = static_cast<uint8_t*>(out);
+        size_t first = std::min(n, ring_.size() - head_);
+        if (n > 0) {
+            std::memcpy(dst, ring_.data() + head_, first);
+            std::memcpy(dst + first, ring_.data(), n - first);
+        }
+        consume(n);
+        return n;
+    }
+
+    // Hand up to len buffered bytes to sink(data, n) in place (at most two
+    // spans) and drop what it took; same sink contract as FileData::visit
+    template <typename Sink>
+    ssize_t drain_to(size_t len, Sink&& sink) {
+        size_t want = std::min(len, count_);
+        size_t done = 0;
+        while (done < want) {
+            size_t span = std::min(want - done, ring_.size() - head_);
+            ssize_t took = sink(ring_.data() + head_, span);
+            if (took < 0) return done > 0 ? static_cast<ssize_t>(done) : took;
+            consume(took);
+            done += took;
+            if (static_cast<size_t>(took) < span) break;
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    // Append up to space() bytes. With overflow set the ring grows past its
+    // capacity instead, for a writer that has nobody left to wait for.
+    size_t write(const void* in, size_t len, bool overflow = false) {
+        size_t n = overflow ? len : std::min(len, space());
+        if (n == 0) return 0;
+        if (count_ + n > ring_.size())
+            relocate(std::max(capacity_, count_ + n));
+        size_t tail = (head_ + count_) % ring_.size();
+        size_t first = std::min(n, ring_.size() - tail);
+        auto* src = static_cast<const uint8_t*>(in);
+        std::memcpy(ring_.data() + tail, src, first);
+        std::memcpy(ring_.data(), src + first, n - first);
+        count_ += n;
+        return n;
+    }
+
+    // F_SETPIPE_SZ: round up to a power of two pages, like Linux.
+    // Returns the new capacity, -EPERM above the limit or -EBUSY if the
+    // buffered data would not fit.
+    int64_t set_capacity(uint64_t want) {
+        if (want > MAX_CAPACITY) return -1;  // EPERM
+        size_t cap = ATOMIC_WRITE;
+        while (cap < want) cap <<= 1;
+        if (cap < count_) return -16;  // EBUSY
+        capacity_ = cap;
+        if (!ring_.empty() && ring_.size() != cap && count_ <= cap) relocate(cap);
+        return static_cast<int64_t>(cap);
+    }
+
+private:
+    std::vector<uint8_t> ring_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t capacity_ = DEFAULT_CAPACITY;
+
+    void consume(size_t n) {
+        head_ = (head_ + n) % (ring_.empty() ? 1 : ring_.size());
+        count_ -= n;
+        if (count_ == 0) {
+            head_ = 0;
+            // Drop storage left over from an overflow write
+            if (ring_.size() > capacity_) std::vector<uint8_t>().swap(ring_);
+        }
+    }
+
+    // Move the buffered bytes to the front of a fresh ring of the given size
+    void relocate(size_t new_size) {
+        std::vector<uint8_t> next(new_size);
+        read_into(next.data());
+        ring_.swap(next);
+        head_ = 0;
+    }
+
+    void read_into(uint8_t* dst) const {
+        if (count_ == 0) return;
+        size_t first = std::min(count_, ring_.size() - head_);
+        std::memcpy(dst, ring_.data() + head_, first);
+        std::memcpy(dst + first, ring_.data(), count_ - first);
+    }
+};
+
+// Inode number: an index into VirtualFS's inode table. 0 is never a valid
+// inode; the root directory is always 1.
+using Ino = uint32_t;
+constexpr Ino NO_INO = 0;
+constexpr Ino ROOT_INO = 1;
+
+// Interned path component. Every distinct name is stored once, so directory
+// entries are two integers and lookups hash each component only once.
+using NameId = uint32_t;
+
+class NamePool {
+public:
+    static constexpr NameId NONE = ~NameId(0);
+
+    NameId intern(std::string_view name) {
+        auto it = ids_.find(name);
+        if (it != ids_.end()) return it->second;
+        NameId id = static_cast<NameId>(names_.size());
+        names_.emplace_back(name);
+        ids_.emplace(names_.back(), id);
+        return id;
+    }
+
+    // Id of an already-interned name, or NONE (the name occurs nowhere)
+    NameId find(std::string_view name) const {
+        auto it = ids_.find(name);
+        return it == ids_.end() ? NONE : it->second;
+    }
+
+    const std::string& str(NameId id) const { return names_[id]; }
+
+private:
+    std::deque<std::string> names_;  // deque: views into it stay valid
+    std::unordered_map<std::string_view, NameId> ids_;
+};
+
+// One name in a directory
+struct DirEntry {
+    NameId name;
+    Ino ino;
+};
+
+// An inode in the VFS
 struct Entry {
-    std::string name;
+    Ino ino = NO_INO;
     FileType type;
     uint32_t mode;        // Permission bits
     uint32_t uid;
@@ -35,12 +658,24 @@ struct Entry {
     uint64_t size;
     uint64_t mtime;
     std::string link_target;  // For symlinks
+    uint64_t gen = 0;         // VirtualFS generation of the last change (0 = rootfs image)
+    uint32_t nlink = 0;       // Directory entries naming this inode
+    uint32_t refs = 0;        // Open handles; the inode is freed once both are 0
+    uint32_t writers = 0;     // Open handles that may write a regular file's body
+    bool rewritten = false;   // Body replaced from offset 0 since it was last interned
+    bool host = false;        // Lives on a host mount (not saved in tars or deltas)
+    bool pending = false;     // Directory whose children are still only below
+                              // (on the host mount or in the lower layer)
+
+    // File content (for regular files); may borrow from the rootfs image
+    FileData content;
 
-    // File content (for regular files)
-    std::vector<uint8_t> content;
+    // Ring buffer (for pipes)
+    std::shared_ptr<PipeBuffer> pipe;
 
-    // Children (for directories)
-    std::unordered_map<std::string, std::shared_ptr<Entry>> children;
+    // Children (for directories), sorted by name so directory listings
+    // can resume from a cursor instead of copying and sorting
+    std::vector<DirEntry> children;
 
     bool is_dir() const { return type == FileType::Directory; }
     bool is_file() const { return type == FileType::Regular; }
@@ -49,50 +684,153 @@ struct Entry {
 
 // Open file handle
 struct FileHandle {
-    std::shared_ptr<Entry> entry;
+    Entry* entry;
     uint64_t offset;
     int flags;
+    std::shared_ptr<HostFile> host;  // Set for files on a host mount
     std::string path;  // For debugging
 
-    FileHandle(std::shared_ptr<Entry> e, int f, const std::string& p)
-        : entry(e), offset(0), flags(f), path(p) {}
+    FileHandle(Entry* e, int f, const std::string& p)
+        : entry(e), offset(0), flags(f), path(p) {
+        entry->refs++;
+        if (auto* pipe = entry->pipe.get()) {
+            if (reads()) pipe->readers++;
+            if (writes()) pipe->writers++;
+        } else if (writes()) {
+            entry->writers++;
+        }
+    }
+
+    ~FileHandle() {
+        if (auto* pipe = entry->pipe.get()) {
+            if (reads()) pipe->readers--;
+            if (writes()) pipe->writers--;
+        } else if (writes()) {
+            entry->writers--;
+        }
+        entry->refs--;
+    }
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    bool reads() const { return (flags & 3) != 1; }   // O_RDONLY / O_RDWR
+    bool writes() const { return (flags & 3) != 0; }  // O_WRONLY / O_RDWR
 };
 
-// Directory listing state
+// Directory listing state: a cursor into the directory's ordered children.
+// Nothing is copied at open; getdents64 resumes after the last name it
+// returned, so entries created or removed in between never shift the rest.
 struct DirHandle {
-    std::shared_ptr<Entry> entry;
-    std::vector<std::string> names;
-    size_t index;
+    Entry* entry;
+    const NamePool* names;
+    std::string cursor;  // Last name returned (meaningful once pos > 0)
+    uint64_t pos = 0;    // Entries returned so far; doubles as the d_off cookie
     std::string path;
 
-    DirHandle(std::shared_ptr<Entry> e, const std::string& p)
-        : entry(e), index(0), path(p) {
-        for (const auto& [name, _] : e->children) {
-            names.push_back(name);
-        }
-        std::sort(names.begin(), names.end());
+    DirHandle(Entry* e, const NamePool& n, const std::string& p)
+        : entry(e), names(&n), path(p) {
+        entry->refs++;
+    }
+
+    ~DirHandle() { entry->refs--; }
+
+    DirHandle(const DirHandle&) = delete;
+    DirHandle& operator=(const DirHandle&) = delete;
+
+    // Index of the next child to return
+    size_t next() const {
+        if (pos == 0) return 0;
+        auto it = std::upper_bound(entry->children.begin(), entry->children.end(), cursor,
+                                   [&](const std::string& name, const DirEntry& d) {
+                                       return name < names->str(d.name);
+                                   });
+        return it - entry->children.begin();
     }
+
+    // Position at the pos-th entry (seekdir/rewinddir)
+    void seek(uint64_t target) {
+        size_t n = std::min<uint64_t>(target, entry->children.size());
+        cursor = n > 0 ? names->str(entry->children[n - 1].name) : std::string();
+        pos = target;
+    }
+};
+
+// Hands out descriptor numbers when the VFS shares a numbering space with
+// other kinds of fds (the guest's fd table). Without one the VFS counts up
+// from 3 on its own.
+struct FdAllocator {
+    virtual ~FdAllocator() = default;
+    virtual int alloc_fd() = 0;         // Lowest free number, or -EMFILE
+    virtual void release_fd(int fd) = 0;
 };
 
 class VirtualFS {
 public:
+    static constexpr int MAX_SYMLINK_DEPTH = 16;
+
     VirtualFS() {
+        inodes_.emplace_back();  // Slot 0: NO_INO
         // Create root directory
-        root_ = std::make_shared<Entry>();
-        root_->name = "";
-        root_->type = FileType::Directory;
-        root_->mode = 0755;
+        Entry* root = alloc_inode(FileType::Directory, 0755);
+        root->nlink = 1;
         cwd_ = "/";
     }
 
-    // Load from tar archive in memory
+    // Freeze a loaded tree into a lower layer for views. Every file body
+    // becomes one immutable blob (deduplicated through the content store),
+    // so views only ever borrow from it and nothing below is written again,
+    // whichever threads the views run on. That includes lazy bodies: they
+    // are all fetched here, so sealing a tree loaded from a compressed
+    // rootfs decompresses the whole image up front and gives up the lazy
+    // loading load_tar set up. The tree must be a plain loaded one, not
+    // itself a view.
+    static std::shared_ptr<const VirtualFS> seal(std::unique_ptr<VirtualFS> fs) {
+        for (Entry& e : fs->inodes_) {
+            if (!e.is_file() || e.host) continue;
+            fs->content_store_.intern(e.content);
+            e.content.seal();
+        }
+        fs->sealed_ = true;
+        return std::shared_ptr<const VirtualFS>(std::move(fs));
+    }
+
+    // A copy-on-write view of `lower`, a tree frozen by seal(), or nullptr
+    // if lower was not sealed. Any number of views can share one lower
+    // layer: a view copies a directory's entries up the first time it is
+    // walked into, and copied files borrow the lower's blobs (FileData is
+    // copy-on-write per extent), so the image is held once however many
+    // views use it. Creates, writes and removals only ever touch the view;
+    // a removed lower entry stays removed because its directory is never
+    // re-read.
+    static std::unique_ptr<VirtualFS> view(std::shared_ptr<const VirtualFS> lower) {
+        if (!lower || !lower->sealed_) return nullptr;
+        return std::unique_ptr<VirtualFS>(new VirtualFS(std::move(lower)));
+    }
+
+    VirtualFS(const VirtualFS&) = delete;
+    VirtualFS& operator=(const VirtualFS&) = delete;
+
+    // Load from tar archive in memory (copies the archive once; file
+    // bodies then borrow from that copy)
     bool load_tar(const uint8_t* data, size_t size) {
-        size_t offset = 0;
+        return load_tar(ImageBuffer::from_vector(std::vector<uint8_t>(data, data + size)));
+    }
 
-        while (offset + 512 <= size) {
-            // TAR header is 512 bytes
-            const uint8_t* header = data + offset;
+    // Load from a tar image without copying file bodies. Entries keep the
+    // image alive until they are rewritten or removed.
+    bool load_tar(std::shared_ptr<const ImageBuffer> image) {
+        if (!image) return false;
+        ImageTarReader reader(std::move(image));
+        return load_tar(reader);
+    }
+
+    // Load from any tar stream. Only headers are read here; file bodies are
+    // bound through the reader (borrowed or lazily fetched) and skipped.
+    bool load_tar(TarReader& reader) {
+        uint8_t header[512];
 
+        while (reader.read(header, 512)) {
             // Check for end-of-archive (two zero blocks)
             bool all_zero = true;
             for (int i = 0; i < 512 && all_zero; i++) {
@@ -107,13 +845,13 @@ public:
             // Handle long names (GNU tar format)
             if (name == "././@LongLink") {
                 // Next block contains the long name
-                offset += 512;
                 size_t name_len = parse_octal(header + 124, 12);
                 size_t name_blocks = (name_len + 511) / 512;
-                name = std::string(reinterpret_cast<const char*>(data + offset), name_len);
-                name = name.c_str();  // Trim at null
-                offset += name_blocks * 512;
-                header = data + offset;
+                std::string long_name(name_blocks * 512, '\0');
+                if (!reader.read(reinterpret_cast<uint8_t*>(long_name.data()), long_name.size()))
+                    break;
+                name = long_name.c_str();  // Trim at null
+                if (!reader.read(header, 512)) break;
             }
 
             // UStar prefix
@@ -130,7 +868,6 @@ public:
                 name = name.substr(2);
             }
             if (name.empty()) {
-                offset += 512;
                 continue;
             }
 
@@ -152,7 +889,7 @@ public:
                 case '0': case '\0':
                     type = FileType::Regular;
                     break;
-                case '1':  // Hard link (treat as regular file, copy content later)
+                case '1':  // Hard link (resolved to its target below)
                     type = FileType::Regular;
                     break;
                 case '2':
@@ -174,113 +911,58 @@ public:
                     type = FileType::Regular;
             }
 
-            // Create entry
-            auto entry = std::make_shared<Entry>();
-            entry->name = name.substr(name.rfind('/') + 1);
-            if (entry->name.empty() && type == FileType::Directory) {
-                entry->name = name;
+            // Hard link: share the target's entry, as link() does. A link
+            // whose target isn't in the tree yet falls back to an empty file.
+            if (type_flag == '1') {
+                std::string target = link_target.starts_with("./") ? link_target.substr(2)
+                                                                   : link_target;
+                Entry* existing = walk_no_symlink("/" + target);
+                if (existing && !existing->is_dir()) {
+                    insert_entry("/" + name, existing);
+                    continue;
+                }
             }
-            entry->type = type;
-            entry->mode = mode;
+
+            // Create entry
+            Entry* entry = alloc_inode(type, mode);
             entry->uid = uid;
             entry->gid = gid;
             entry->size = file_size;
             entry->mtime = mtime;
             entry->link_target = link_target;
 
-            // Move to content
-            offset += 512;
-
-            // Read file content
+            // Bind file content, then step over it (rounded up to a block)
+            bool more = true;
             if (type == FileType::Regular && file_size > 0) {
-                if (offset + file_size > size) break;
-                entry->content.assign(data + offset, data + offset + file_size);
-                offset += ((file_size + 511) / 512) * 512;  // Round up to block
+                if (!reader.bind(entry->content, reader.tell(), file_size)) {
+                    release(*entry);  // Unnamed and unopened
+                    break;
+                }
+                more = reader.skip(((file_size + 511) / 512) * 512);
             }
 
             // Insert into VFS tree
             insert_entry("/" + name, entry);
+            if (!more) break;
         }
 
         return true;
     }
 
     // Resolve a path (following symlinks up to max_depth times)
-    std::shared_ptr<Entry> resolve(const std::string& path, int max_depth = 16) {
+    Entry* resolve(const std::string& path, int max_depth = MAX_SYMLINK_DEPTH) {
         std::string abs_path = make_absolute(path);
-
-        // Split path into components
-        std::vector<std::string> parts;
-        size_t start = 1;
-        while (start < abs_path.size()) {
-            size_t end = abs_path.find('/', start);
-            if (end == std::string::npos) end = abs_path.size();
-            if (end > start) {
-                parts.push_back(abs_path.substr(start, end - start));
-            }
-            start = end + 1;
-        }
-
-        // Traverse
-        auto current = root_;
-        std::string current_path = "";
-
-        for (size_t i = 0; i < parts.size(); i++) {
-            const auto& part = parts[i];
-
-            if (!current || !current->is_dir()) {
-                return nullptr;  // Not a directory
-            }
-
-            if (part == ".") {
-                continue;
-            } else if (part == "..") {
-                // Go up - find parent
-                size_t last_slash = current_path.rfind('/');
-                if (last_slash != std::string::npos) {
-                    current_path = current_path.substr(0, last_slash);
-                    current = resolve_no_symlink(current_path.empty() ? "/" : current_path);
-                }
-                continue;
-            }
-
-            auto it = current->children.find(part);
-            if (it == current->children.end()) {
-                return nullptr;  // Not found
-            }
-
-            current = it->second;
-            current_path += "/" + part;
-
-            // Handle symlinks
-            if (current->is_symlink() && max_depth > 0) {
-                std::string target = current->link_target;
-                if (!target.starts_with("/")) {
-                    // Relative symlink
-                    size_t last_slash = current_path.rfind('/');
-                    if (last_slash != std::string::npos) {
-                        target = current_path.substr(0, last_slash) + "/" + target;
-                    }
-                }
-
-                // Resolve the symlink target + remaining path
-                std::string remaining;
-                for (size_t j = i + 1; j < parts.size(); j++) {
-                    remaining += "/" + parts[j];
-                }
-
-                return resolve(target + remaining, max_depth - 1);
-            }
-        }
-
-        return current;
+        if (max_depth != MAX_SYMLINK_DEPTH) return walk(abs_path, max_depth);
+        return dcache_lookup(dcache_follow_, abs_path,
+                             [&] { return walk(abs_path, max_depth); });
     }
 
-    // Stat a path
+    // Stat a path (metadata only; content and children are not copied)
     bool stat(const std::string& path, Entry& out) {
         auto entry = resolve(path);
         if (!entry) return false;
-        out = *entry;
+        if (entry->host) host_refresh(*entry);
+        copy_meta(*entry, out);
         return true;
     }
 
@@ -288,18 +970,20 @@ public:
     bool lstat(const std::string& path, Entry& out) {
         auto entry = resolve_no_symlink(path);
         if (!entry) return false;
-        out = *entry;
+        if (entry->host) host_refresh(*entry);
+        copy_meta(*entry, out);
         return true;
     }
 
     // Open a file
     int open(const std::string& path, int flags) {
-        auto entry = resolve(path);
+        Entry* entry = resolve(path);
         if (!entry) {
             // Create file if O_CREAT
             if (flags & 0100) {  // O_CREAT
-                entry = create_file(path);
-                if (!entry) return -2;  // ENOENT (parent doesn't exist)
+                int error = -2;  // ENOENT (parent doesn't exist)
+                entry = create_file(path, error);
+                if (!entry) return error;
             } else {
                 return -2;  // ENOENT
             }
@@ -312,13 +996,23 @@ public:
             return -21;  // EISDIR
         }
 
+        if (entry->host) return open_host(*entry, flags, path);
+
         // O_TRUNC: truncate to zero length
         if (flags & 01000) {
             entry->content.clear();
             entry->size = 0;
+            entry->rewritten = true;
+            mark_dirty(*entry);
         }
 
-        int fd = next_fd_++;
+        // First open of a lazily decompressed body: fetch it into the
+        // content store so duplicates across the image are held once (a
+        // truncated body is dropped above without being fetched)
+        if (entry->content.is_lazy()) intern(*entry);
+
+        int fd = alloc_fd();
+        if (fd < 0) return fd;
         open_files_[fd] = std::make_unique<FileHandle>(entry, flags, path);
 
         // O_APPEND: position at end
@@ -334,16 +1028,31 @@ public:
         auto entry = resolve(path);
         if (!entry) return -2;  // ENOENT
         if (!entry->is_dir()) return -20;  // ENOTDIR
+        load_children(*entry);
 
-        int fd = next_fd_++;
-        open_dirs_[fd] = std::make_unique<DirHandle>(entry, path);
+        int fd = alloc_fd();
+        if (fd < 0) return fd;
+        open_dirs_[fd] = std::make_unique<DirHandle>(entry, names_, path);
         return fd;
     }
 
     // Close
     void close(int fd) {
-        open_files_.erase(fd);
-        open_dirs_.erase(fd);
+        auto it = open_files_.find(fd);
+        if (it != open_files_.end()) {
+            Entry* entry = it->second->entry;
+            open_files_.erase(it);
+            if (entry->rewritten && entry->writers == 0) intern(*entry);
+            release(*entry);
+            release_fd(fd);
+        }
+        auto dit = open_dirs_.find(fd);
+        if (dit != open_dirs_.end()) {
+            Entry* entry = dit->second->entry;
+            open_dirs_.erase(dit);
+            release(*entry);
+            release_fd(fd);
+        }
     }
 
     // Read from file or pipe
@@ -354,10 +1063,21 @@ public:
         auto& fh = it->second;
         if (fh->entry->is_dir()) return -21;  // EISDIR
 
-        size_t available = fh->entry->content.size() - fh->offset;
-        size_t to_read = std::min(count, available);
+        // Pipe: drain the ring; empty means EOF once every writer is gone,
+        // otherwise EAGAIN and the caller decides whether to block
+        if (auto* pipe = fh->entry->pipe.get()) {
+            size_t n = pipe->read(buf, count);
+            if (n > 0 || count == 0 || pipe->writers == 0) return static_cast<ssize_t>(n);
+            return -11;  // EAGAIN
+        }
 
-        memcpy(buf, fh->entry->content.data() + fh->offset, to_read);
+        if (fh->host) {
+            ssize_t n = fh->host->source->pread(fh->host->handle, buf, count, fh->offset);
+            if (n > 0) fh->offset += n;
+            return n;
+        }
+
+        size_t to_read = fh->entry->content.read_at(fh->offset, buf, count);
         fh->offset += to_read;
 
         return static_cast<ssize_t>(to_read);
@@ -371,15 +1091,35 @@ public:
         auto& fh = it->second;
         if (fh->entry->is_dir()) return -21;  // EISDIR
 
-        // Extend if needed
-        size_t end_pos = fh->offset + count;
-        if (end_pos > fh->entry->content.size()) {
-            fh->entry->content.resize(end_pos);
-            fh->entry->size = end_pos;
+        // Pipe: writes up to PIPE_BUF are all-or-nothing, larger ones may
+        // be short; a full ring is EAGAIN
+        if (auto* pipe = fh->entry->pipe.get()) {
+            if (pipe->readers == 0) return -32;  // EPIPE
+            if (count == 0) return 0;
+            size_t room = pipe->space();
+            if (room == 0 || (count <= PipeBuffer::ATOMIC_WRITE && room < count))
+                return -11;  // EAGAIN
+            return static_cast<ssize_t>(pipe->write(buf, count));
         }
 
-        memcpy(fh->entry->content.data() + fh->offset, buf, count);
+        if (fh->host) {
+            if (fh->flags & 02000) {
+                int64_t end = fh->host->source->fsize(fh->host->handle);
+                if (end >= 0) fh->offset = end;
+            }
+            ssize_t n = host_pwrite(*fh, buf, count, fh->offset);
+            if (n > 0) fh->offset += n;
+            return n;
+        }
+
+        // O_APPEND: every write lands at the current end of file
+        if (fh->flags & 02000) fh->offset = fh->entry->content.size();
+
+        if (fh->offset == 0 && count >= fh->entry->content.size()) fh->entry->rewritten = true;
+        fh->entry->content.write_at(fh->offset, buf, count);
+        fh->entry->size = fh->entry->content.size();
         fh->offset += count;
+        mark_dirty(*fh->entry);
 
         return static_cast<ssize_t>(count);
     }
@@ -387,9 +1127,22 @@ public:
     // Seek
     off_t lseek(int fd, off_t offset, int whence) {
         auto it = open_files_.find(fd);
-        if (it == open_files_.end()) return -9;
+        if (it == open_files_.end()) {
+            // Directory: offsets are getdents64 d_off cookies
+            auto dit = open_dirs_.find(fd);
+            if (dit == open_dirs_.end()) return -9;
+            auto& dh = dit->second;
+            int64_t target;
+            if (whence == 0) target = offset;                           // SEEK_SET
+            else if (whence == 1) target = (int64_t)dh->pos + offset;   // SEEK_CUR
+            else return -22;                                            // EINVAL
+            if (target < 0) return -22;
+            if ((uint64_t)target != dh->pos) dh->seek(target);
+            return target;
+        }
 
         auto& fh = it->second;
+        if (fh->entry->pipe) return -29;  // ESPIPE
         int64_t new_offset;
 
         switch (whence) {
@@ -400,8 +1153,28 @@ public:
                 new_offset = fh->offset + offset;
                 break;
             case 2:  // SEEK_END
+                if (fh->host) {
+                    int64_t end = fh->host->source->fsize(fh->host->handle);
+                    if (end >= 0) fh->entry->size = end;
+                }
                 new_offset = fh->entry->size + offset;
                 break;
+            case 3:    // SEEK_DATA
+            case 4: {  // SEEK_HOLE
+                // Host files are all data; bodies know their extents
+                const FileData& body = fh->entry->content;
+                uint64_t end = body.size();
+                if (fh->host) {
+                    int64_t hsize = fh->host->source->fsize(fh->host->handle);
+                    if (hsize < 0) return hsize;
+                    end = hsize;
+                }
+                if (offset < 0 || (uint64_t)offset >= end) return -6;  // ENXIO
+                if (fh->host) new_offset = whence == 3 ? offset : (int64_t)end;
+                else if (whence == 4) new_offset = body.next_hole(offset);
+                else if ((new_offset = body.next_data(offset)) == (int64_t)end) return -6;
+                break;
+            }
             default:
                 return -22;  // EINVAL
         }
@@ -420,7 +1193,7 @@ public:
             if (fit != open_files_.end() && fit->second->entry->is_dir()) {
                 // Convert to dir handle
                 open_dirs_[fd] = std::make_unique<DirHandle>(
-                    fit->second->entry, fit->second->path);
+                    fit->second->entry, names_, fit->second->path);
                 open_files_.erase(fd);
                 return getdents64(fd, buf, count);
             }
@@ -428,12 +1201,15 @@ public:
         }
 
         auto& dh = it->second;
+        load_children(*dh->entry);
         uint8_t* out = static_cast<uint8_t*>(buf);
         size_t written = 0;
 
-        while (dh->index < dh->names.size()) {
-            const auto& name = dh->names[dh->index];
-            auto entry = dh->entry->children[name];
+        const auto& children = dh->entry->children;
+        size_t last = children.size();
+        for (size_t i = dh->next(); i < children.size(); i++) {
+            const std::string& name = names_.str(children[i].name);
+            const Entry& entry = inode(children[i].ino);
 
             // Calculate record size (d_ino + d_off + d_reclen + d_type + name + null)
             size_t reclen = 8 + 8 + 2 + 1 + name.size() + 1;
@@ -442,12 +1218,12 @@ public:
             if (written + reclen > count) break;
 
             // Write dirent64 structure
-            uint64_t d_ino = dh->index + 1;
-            uint64_t d_off = dh->index + 1;
+            uint64_t d_ino = entry.ino;
+            uint64_t d_off = dh->pos + 1;
             uint16_t d_reclen = reclen;
             uint8_t d_type;
 
-            switch (entry->type) {
+            switch (entry.type) {
                 case FileType::Regular:   d_type = 8; break;  // DT_REG
                 case FileType::Directory: d_type = 4; break;  // DT_DIR
                 case FileType::Symlink:   d_type = 10; break; // DT_LNK
@@ -465,15 +1241,17 @@ public:
             memcpy(out + written + 19, name.c_str(), name.size() + 1);
 
             written += reclen;
-            dh->index++;
+            dh->pos++;
+            last = i;
         }
+        if (last != children.size()) dh->cursor = names_.str(children[last].name);
 
         return static_cast<ssize_t>(written);
     }
 
     // Readlink
     ssize_t readlink(const std::string& path, char* buf, size_t bufsiz) {
-        auto entry = resolve_no_symlink(path);
+        Entry* entry = resolve_no_symlink(path);
         if (!entry) return -2;
         if (!entry->is_symlink()) return -22;
 
@@ -493,12 +1271,12 @@ public:
         return true;
     }
 
-    // Add a file at runtime (for /proc, /dev emulation)
+    // Add a file at runtime (for /proc, /dev emulation). Like the rootfs
+    // image it is rebuilt on every boot, so it is left out of deltas
+    // unless the guest later changes it.
     void add_virtual_file(const std::string& path, const std::vector<uint8_t>& content) {
-        auto entry = std::make_shared<Entry>();
-        entry->type = FileType::Regular;
-        entry->mode = 0444;
-        entry->content = content;
+        Entry* entry = alloc_inode(FileType::Regular, 0444);
+        entry->content.assign(content.data(), content.size());
         entry->size = content.size();
         insert_entry(path, entry);
     }
@@ -519,16 +1297,20 @@ public:
         // Check parent exists and is a directory
         size_t last_slash = abs_path.rfind('/');
         std::string parent_path = (last_slash == 0) ? "/" : abs_path.substr(0, last_slash);
-        auto parent = resolve(parent_path);
+        Entry* parent = resolve(parent_path);
         if (!parent || !parent->is_dir()) {
             return -2;  // ENOENT
         }
 
-        auto entry = std::make_shared<Entry>();
-        entry->type = FileType::Directory;
-        entry->mode = mode & 0777;
-        entry->uid = 0;
-        entry->gid = 0;
+        if (parent->host) {
+            std::string name = abs_path.substr(last_slash + 1);
+            return host_create(*parent, name, [&](MountSource& src, const std::string& rel) {
+                return src.mkdir(rel, mode & 0777);
+            });
+        }
+
+        Entry* entry = alloc_inode(FileType::Directory, mode & 0777);
+        mark_dirty(*entry);
         insert_entry(abs_path, entry);
         return 0;
     }
@@ -543,20 +1325,30 @@ public:
         std::string parent_path = (last_slash == 0) ? "/" : abs_path.substr(0, last_slash);
         std::string name = abs_path.substr(last_slash + 1);
 
-        auto parent = resolve(parent_path);
+        Entry* parent = resolve(parent_path);
         if (!parent || !parent->is_dir()) return -2;  // ENOENT
 
-        auto it = parent->children.find(name);
-        if (it == parent->children.end()) return -2;  // ENOENT
+        Entry* entry = lookup(*parent, name);
+        if (!entry) return -2;  // ENOENT
 
-        bool is_dir = it->second->is_dir();
+        bool is_dir = entry->is_dir();
         bool at_removedir = (flags & 0x200) != 0;  // AT_REMOVEDIR
 
         if (is_dir && !at_removedir) return -21;  // EISDIR
         if (!is_dir && at_removedir) return -20;  // ENOTDIR
-        if (is_dir && !it->second->children.empty()) return -39;  // ENOTEMPTY
+        if (is_dir && !entry->host) load_children(*entry);
+        if (is_dir && !entry->children.empty()) return -39;  // ENOTEMPTY
+
+        if (entry->host) {
+            if (!parent->host) return -16;  // EBUSY: a mount point
+            MountSource& src = host_source(*parent);
+            if (src.read_only()) return -30;  // EROFS
+            int rc = src.unlink(host_rel(*parent, name), is_dir);
+            if (rc < 0) return rc;
+        }
 
-        parent->children.erase(it);
+        unlink_child(*parent, name);
+        mark_removed(abs_path);
         return 0;
     }
 
@@ -569,24 +1361,47 @@ public:
             return -17;  // EEXIST
         }
 
-        auto entry = std::make_shared<Entry>();
-        entry->type = FileType::Symlink;
-        entry->mode = 0777;
+        size_t last_slash = abs_path.rfind('/');
+        Entry* parent = resolve_no_symlink(last_slash == 0 ? "/" : abs_path.substr(0, last_slash));
+        if (parent && parent->host) {
+            return host_create(*parent, abs_path.substr(last_slash + 1),
+                               [&](MountSource& src, const std::string& rel) {
+                                   return src.symlink(target, rel);
+                               });
+        }
+
+        Entry* entry = alloc_inode(FileType::Symlink, 0777);
         entry->link_target = target;
+        mark_dirty(*entry);
         insert_entry(abs_path, entry);
         return 0;
     }
 
     // Create a hard link
     int link(const std::string& oldpath, const std::string& newpath) {
-        auto target = resolve(oldpath);
+        Entry* target = resolve(oldpath);
         if (!target) return -2;  // ENOENT
         if (target->is_dir()) return -31;  // EMLINK (can't hardlink dirs)
 
         std::string abs_new = make_absolute(newpath);
         if (resolve_no_symlink(abs_new)) return -17;  // EEXIST
 
+        // On a mount the host makes the link; the new name gets its own inode
+        size_t last_slash = abs_new.rfind('/');
+        Entry* parent = resolve(last_slash == 0 ? "/" : abs_new.substr(0, last_slash));
+        if (target->host || (parent && parent->host)) {
+            if (!target->host || !parent || !parent->host ||
+                host_nodes_.at(target->ino).mount != host_nodes_.at(parent->ino).mount)
+                return -18;  // EXDEV
+            std::string from = host_nodes_.at(target->ino).rel;
+            return host_create(*parent, abs_new.substr(last_slash + 1),
+                               [&](MountSource& src, const std::string& rel) {
+                                   return src.link(from, rel);
+                               });
+        }
+
         // Insert the same entry under a new name
+        mark_dirty(*target);
         insert_entry(abs_new, target);
         return 0;
     }
@@ -599,7 +1414,7 @@ public:
         if (abs_old == "/" || abs_new == "/") return -16;  // EBUSY
 
         // Find old entry
-        auto entry = resolve_no_symlink(abs_old);
+        Entry* entry = resolve_no_symlink(abs_old);
         if (!entry) return -2;  // ENOENT
 
         // Remove from old location
@@ -607,34 +1422,69 @@ public:
         std::string old_parent_path = (old_slash == 0) ? "/" : abs_old.substr(0, old_slash);
         std::string old_name = abs_old.substr(old_slash + 1);
 
-        auto old_parent = resolve(old_parent_path);
+        Entry* old_parent = resolve(old_parent_path);
         if (!old_parent) return -2;
 
         // Check new parent exists
         size_t new_slash = abs_new.rfind('/');
         std::string new_parent_path = (new_slash == 0) ? "/" : abs_new.substr(0, new_slash);
-        auto new_parent = resolve(new_parent_path);
+        Entry* new_parent = resolve(new_parent_path);
         if (!new_parent || !new_parent->is_dir()) return -2;
 
-        // Remove any existing entry at the destination
+        // An existing destination is replaced, unless it is the same inode
+        // or a directory that still has entries (which includes every
+        // ancestor of the source)
         std::string new_name = abs_new.substr(new_slash + 1);
-        new_parent->children.erase(new_name);
+        Entry* existing = lookup(*new_parent, new_name);
+        if (existing == entry) return 0;
+        if (existing && existing->is_dir() && !existing->host) load_children(*existing);
+        if (existing && existing->is_dir() && !existing->children.empty()) return -39;  // ENOTEMPTY
+        if (entry->is_dir() && abs_new.starts_with(abs_old + "/")) return -22;  // EINVAL
+
+        // Within a mount the host renames first; nothing crosses a mount
+        // boundary (mount points themselves move freely)
+        bool on_host = old_parent->host || new_parent->host;
+        if (on_host) {
+            if (!old_parent->host || !new_parent->host || !entry->host ||
+                host_nodes_.at(old_parent->ino).mount != host_nodes_.at(new_parent->ino).mount)
+                return -18;  // EXDEV
+            MountSource& src = host_source(*old_parent);
+            if (src.read_only()) return -30;  // EROFS
+            int rc = src.rename(host_rel(*old_parent, old_name), host_rel(*new_parent, new_name));
+            if (rc < 0) return rc;
+        }
 
-        // Move: remove from old parent, insert in new parent
-        old_parent->children.erase(old_name);
-        entry->name = new_name;
-        new_parent->children[new_name] = entry;
+        // Move: link under the new name first so the inode never drops to
+        // zero links in between
+        link_child(*new_parent, new_name, *entry);
+        unlink_child(*old_parent, old_name);
+        if (on_host) host_rehome(*entry, host_rel(*new_parent, new_name));
+        // Everything below the new name has a new path
+        mark_removed(abs_old);
+        mark_created(abs_new, *entry);
+        mark_subtree_dirty(*entry);
         return 0;
     }
 
     // Truncate a file by path
     int truncate(const std::string& path, uint64_t length) {
-        auto entry = resolve(path);
+        Entry* entry = resolve(path);
         if (!entry) return -2;  // ENOENT
         if (!entry->is_file()) return -21;  // EISDIR
 
+        if (entry->host) {
+            MountSource& src = host_source(*entry);
+            if (src.read_only()) return -30;  // EROFS
+            int rc = src.truncate(host_nodes_.at(entry->ino).rel, length);
+            if (rc < 0) return rc;
+            entry->size = length;
+            return 0;
+        }
+
         entry->content.resize(length);
         entry->size = length;
+        if (length == 0) entry->rewritten = true;
+        mark_dirty(*entry);
         return 0;
     }
 
@@ -646,8 +1496,18 @@ public:
         auto& fh = it->second;
         if (!fh->entry->is_file()) return -22;  // EINVAL
 
+        if (fh->host) {
+            int rc = fh->host->source->ftruncate(fh->host->handle, length);
+            if (rc < 0) return rc;
+            fh->entry->size = length;
+            if (fh->offset > length) fh->offset = length;
+            return 0;
+        }
+
         fh->entry->content.resize(length);
         fh->entry->size = length;
+        if (length == 0) fh->entry->rewritten = true;
+        mark_dirty(*fh->entry);
         if (fh->offset > length) fh->offset = length;
         return 0;
     }
@@ -660,12 +1520,9 @@ public:
         auto& fh = it->second;
         if (!fh->entry->is_file()) return -21;
 
-        if (offset >= fh->entry->content.size()) return 0;
-        size_t available = fh->entry->content.size() - offset;
-        size_t to_read = std::min(count, available);
+        if (fh->host) return fh->host->source->pread(fh->host->handle, buf, count, offset);
 
-        memcpy(buf, fh->entry->content.data() + offset, to_read);
-        return static_cast<ssize_t>(to_read);
+        return static_cast<ssize_t>(fh->entry->content.read_at(offset, buf, count));
     }
 
     // Positional write (does not change offset)
@@ -676,38 +1533,135 @@ public:
         auto& fh = it->second;
         if (!fh->entry->is_file()) return -21;
 
-        size_t end_pos = offset + count;
-        if (end_pos > fh->entry->content.size()) {
-            fh->entry->content.resize(end_pos);
-            fh->entry->size = end_pos;
-        }
+        if (fh->host) return host_pwrite(*fh, buf, count, offset);
 
-        memcpy(fh->entry->content.data() + offset, buf, count);
+        if (offset == 0 && count >= fh->entry->content.size()) fh->entry->rewritten = true;
+        fh->entry->content.write_at(offset, buf, count);
+        fh->entry->size = fh->entry->content.size();
+        mark_dirty(*fh->entry);
         return static_cast<ssize_t>(count);
     }
 
+    // Feed up to count bytes of fd to sink(data, n) without a caller
+    // buffer (sendfile, splice, copy_file_range); in-memory bodies and pipe
+    // rings are handed over in place. Same sink contract as
+    // FileData::visit. Files advance *offset when given, else the handle's
+    // offset; pipes drop what was taken, and like read() an empty pipe
+    // with writers left is EAGAIN.
+    template <typename Sink>
+    ssize_t read_to(int fd, uint64_t* offset, size_t count, Sink&& sink) {
+        auto it = open_files_.find(fd);
+        if (it == open_files_.end()) return -9;  // EBADF
+
+        auto& fh = *it->second;
+        if (fh.entry->is_dir()) return -21;  // EISDIR
+        if (!fh.reads()) return -9;
+
+        if (auto* pipe = fh.entry->pipe.get()) {
+            if (offset) return -29;  // ESPIPE
+            ssize_t n = pipe->drain_to(count, sink);
+            if (n != 0 || count == 0 || pipe->writers == 0) return n;
+            return -11;  // EAGAIN
+        }
+
+        uint64_t pos = offset ? *offset : fh.offset;
+        ssize_t n = 0;
+        if (fh.host) {
+            // Host files have no body in memory: bounce through pread
+            std::vector<uint8_t> bounce(std::min(count, FileData::CHUNK_SIZE));
+            while (static_cast<size_t>(n) < count) {
+                size_t want = std::min(count - n, bounce.size());
+                ssize_t got = fh.host->source->pread(fh.host->handle, bounce.data(), want, pos + n);
+                if (got < 0 && n == 0) return got;
+                if (got <= 0) break;
+                ssize_t took = sink(bounce.data(), static_cast<size_t>(got));
+                if (took < 0 && n == 0) return took;
+                if (took < 0) break;
+                n += took;
+                if (took < got) break;
+            }
+        } else {
+            n = fh.entry->content.visit(pos, count, sink);
+        }
+        if (n > 0) (offset ? *offset : fh.offset) += n;
+        return n;
+    }
+
+    // copy_file_range between regular files. Copying a whole body over a
+    // file it entirely replaces shares the body copy-on-write, like a
+    // reflink; anything else is copied extent by extent. Offsets as for
+    // read_to.
+    ssize_t copy_range(int in_fd, uint64_t* in_off, int out_fd, uint64_t* out_off, size_t count) {
+        auto in = open_files_.find(in_fd);
+        auto out = open_files_.find(out_fd);
+        if (in == open_files_.end() || out == open_files_.end()) return -9;  // EBADF
+        FileHandle& src = *in->second;
+        FileHandle& dst = *out->second;
+        if (!src.reads() || !dst.writes() || (dst.flags & 02000)) return -9;
+        if (!src.entry->is_file() || !dst.entry->is_file()) return -22;  // EINVAL
+
+        uint64_t from = in_off ? *in_off : src.offset;
+        uint64_t to = out_off ? *out_off : dst.offset;
+        if (src.entry == dst.entry && from < to + count && to < from + count) return -22;
+
+        ssize_t n;
+        uint64_t size = src.entry->content.size();
+        if (!src.host && !dst.host && from == 0 && to == 0 && size > 0 && count >= size &&
+            dst.entry->size <= size && dst.entry->content.share(src.entry->content)) {
+            n = static_cast<ssize_t>(size);
+            dst.entry->size = size;
+            mark_dirty(*dst.entry);
+            from += n;
+        } else {
+            // Within one file, writing can reallocate the extent the source
+            // bytes point into; copy each piece (at most an extent) aside
+            bool same = src.entry == dst.entry;
+            std::vector<uint8_t> bounce;
+            uint64_t at = to;
+            n = read_to(in_fd, &from, count, [&](const void* data, size_t len) -> ssize_t {
+                if (same) {
+                    const uint8_t* p = static_cast<const uint8_t*>(data);
+                    bounce.assign(p, p + len);
+                    data = bounce.data();
+                }
+                ssize_t put = pwrite(out_fd, data, len, at);
+                if (put > 0) at += put;
+                return put;
+            });
+            if (n < 0) return n;
+        }
+        (in_off ? *in_off : src.offset) = from;
+        (out_off ? *out_off : dst.offset) = to + n;
+        return n;
+    }
+
     // Duplicate a file descriptor
     int dup(int oldfd) {
         auto it = open_files_.find(oldfd);
         if (it != open_files_.end()) {
-            int newfd = next_fd_++;
+            int newfd = alloc_fd();
+            if (newfd < 0) return newfd;
             open_files_[newfd] = std::make_unique<FileHandle>(
                 it->second->entry, it->second->flags, it->second->path);
             open_files_[newfd]->offset = it->second->offset;
+            open_files_[newfd]->host = it->second->host;
             return newfd;
         }
         auto dit = open_dirs_.find(oldfd);
         if (dit != open_dirs_.end()) {
-            int newfd = next_fd_++;
+            int newfd = alloc_fd();
+            if (newfd < 0) return newfd;
             open_dirs_[newfd] = std::make_unique<DirHandle>(
-                dit->second->entry, dit->second->path);
-            open_dirs_[newfd]->index = dit->second->index;
+                dit->second->entry, names_, dit->second->path);
+            open_dirs_[newfd]->cursor = dit->second->cursor;
+            open_dirs_[newfd]->pos = dit->second->pos;
             return newfd;
         }
         return -9;  // EBADF
     }
 
-    // Duplicate a file descriptor to a specific fd
+    // Duplicate a file descriptor to a specific fd. The number is the
+    // caller's choice, so an fd allocator is not consulted for it.
     int dup2(int oldfd, int newfd) {
         if (oldfd == newfd) return newfd;
         // Close newfd if open
@@ -718,33 +1672,74 @@ public:
             open_files_[newfd] = std::make_unique<FileHandle>(
                 it->second->entry, it->second->flags, it->second->path);
             open_files_[newfd]->offset = it->second->offset;
+            open_files_[newfd]->host = it->second->host;
             return newfd;
         }
         auto dit = open_dirs_.find(oldfd);
         if (dit != open_dirs_.end()) {
             open_dirs_[newfd] = std::make_unique<DirHandle>(
-                dit->second->entry, dit->second->path);
-            open_dirs_[newfd]->index = dit->second->index;
+                dit->second->entry, names_, dit->second->path);
+            open_dirs_[newfd]->cursor = dit->second->cursor;
+            open_dirs_[newfd]->pos = dit->second->pos;
             return newfd;
         }
         return -9;  // EBADF
     }
 
-    // Open a pipe end (0 = read, 1 = write)
-    int open_pipe(std::shared_ptr<Entry> pipe_entry, int end) {
-        int fd = next_fd_++;
+    // Create an inode that no directory names (pipes, eventfds). It lives
+    // until its last open handle is closed, so open it right away.
+    Entry* make_anon(FileType type, uint32_t mode) {
+        return alloc_inode(type, mode);
+    }
+
+    // Create an anonymous pipe inode backed by a ring buffer
+    Entry* make_pipe() {
+        Entry* entry = make_anon(FileType::Fifo, 0600);
+        entry->pipe = std::make_shared<PipeBuffer>(next_pipe_id_++);
+        return entry;
+    }
+
+    // Open a pipe end (0 = read, 1 = write); status_flags may carry O_NONBLOCK
+    int open_pipe(Entry* pipe_entry, int end, int status_flags = 0) {
+        int fd = alloc_fd();
+        if (fd < 0) return fd;
         int flags = (end == 0) ? 0 : 1;  // O_RDONLY or O_WRONLY
+        flags |= status_flags & 04000;   // O_NONBLOCK
         open_files_[fd] = std::make_unique<FileHandle>(pipe_entry, flags, "[pipe]");
         return fd;
     }
 
+    // Ring buffer behind an open pipe fd, or null
+    PipeBuffer* get_pipe(int fd) const {
+        auto it = open_files_.find(fd);
+        if (it == open_files_.end()) return nullptr;
+        return it->second->entry->pipe.get();
+    }
+
+    // F_GETFL: access mode plus status flags of an open fd
+    int get_flags(int fd) const {
+        auto it = open_files_.find(fd);
+        if (it != open_files_.end()) return it->second->flags & (3 | 02000 | 04000);
+        if (open_dirs_.count(fd)) return 0200000;  // O_DIRECTORY
+        return -9;  // EBADF
+    }
+
+    // F_SETFL: only O_APPEND and O_NONBLOCK can be changed
+    int set_flags(int fd, int flags) {
+        auto it = open_files_.find(fd);
+        if (it == open_files_.end()) return open_dirs_.count(fd) ? 0 : -9;
+        constexpr int MUTABLE = 02000 | 04000;
+        it->second->flags = (it->second->flags & ~MUTABLE) | (flags & MUTABLE);
+        return 0;
+    }
+
     // Check if fd is open
     bool is_open(int fd) const {
         return open_files_.count(fd) > 0 || open_dirs_.count(fd) > 0;
     }
 
     // Get entry for an open fd (for fstat)
-    std::shared_ptr<Entry> get_entry(int fd) {
+    Entry* get_entry(int fd) {
         auto it = open_files_.find(fd);
         if (it != open_files_.end()) return it->second->entry;
         auto dit = open_dirs_.find(fd);
@@ -752,6 +1747,9 @@ public:
         return nullptr;
     }
 
+    // Take descriptor numbers from a shared table instead of counting alone
+    void set_fd_allocator(FdAllocator* alloc) { fd_alloc_ = alloc; }
+
     // Get set of all open file descriptor numbers
     std::set<int> get_open_fds() const {
         std::set<int> fds;
@@ -769,43 +1767,521 @@ public:
         return "";
     }
 
+    // --- Host mounts ---
+    //
+    // mount() puts a host directory at guest_path, shadowing whatever the
+    // rootfs had there. Nothing is read up front: a directory's listing is
+    // read from the host the first time it is walked into or listed, stat
+    // re-reads attributes, and file I/O goes straight to the host. Entries
+    // the host adds to an already-listed directory are not seen. Mounted
+    // trees are left out of save_tar and save_delta.
+    int mount(const std::string& guest_path, std::shared_ptr<MountSource> source) {
+        std::string abs_path = make_absolute(guest_path);
+        if (abs_path == "/") return -16;  // EBUSY
+        MountSource::Attr attr;
+        int rc = source->lstat("", attr);
+        if (rc < 0) return rc;
+        if (attr.type != FileType::Directory) return -20;  // ENOTDIR
+
+        Entry* dir = alloc_inode(FileType::Directory, 0);
+        host_nodes_[dir->ino] = HostNode{static_cast<uint32_t>(mounts_.size()), ""};
+        mounts_.push_back(std::move(source));
+        host_init(*dir, attr);
+        insert_entry(abs_path, dir);
+        return 0;
+    }
+
     // Serialize the VFS tree to a POSIX tar archive
     std::vector<uint8_t> save_tar() {
         std::vector<uint8_t> out;
-        // Walk the tree depth-first starting from root children
-        save_tar_recursive(out, root_, "");
+        // Walk the tree depth-first starting from root children (a view
+        // copies each directory up as the walk reaches it, the root too)
+        load_children(inode(ROOT_INO));
+        save_tar_recursive(out, inode(ROOT_INO), "");
         // End-of-archive: two 512-byte zero blocks
         out.resize(out.size() + 1024, 0);
         return out;
     }
 
+    // --- Change tracking ---
+    //
+    // Every mutation stamps the entry with a new generation (entries from
+    // the rootfs image stay at 0) and every removed or renamed-away path is
+    // remembered with the generation it disappeared at, until a removal
+    // above it or a non-directory at the same path makes the record
+    // redundant. save_delta(since) emits just what changed after `since`,
+    // so persisting a session after a small edit does not re-serialize the
+    // whole tree.
+    //
+    // Delta format (integers little-endian):
+    //   header  "FSD1", u64 since, u64 generation
+    //   record  u8 op, u32 path_len, path, then for DELTA_ENTRY:
+    //           u32 mode (type | permission bits), u32 uid, u32 gid,
+    //           u64 mtime, u64 payload_len, payload (file body for regular
+    //           files, target for symlinks, empty otherwise)
+    //           for DELTA_LINK: u32 target_len, target (a path written
+    //           earlier in the same delta whose inode this path shares)
+    //   end     u8 DELTA_END
+    // Removals come first, then entries in pre-order (parents before
+    // children), so applying the records in order rebuilds the tree.
+    // Paths are absolute with no empty, "." or ".." components.
+    static constexpr uint8_t DELTA_END = 0;
+    static constexpr uint8_t DELTA_REMOVE = 1;
+    static constexpr uint8_t DELTA_ENTRY = 2;
+    static constexpr uint8_t DELTA_LINK = 3;
+
+    uint64_t generation() const { return generation_; }
+
+    // For metadata changes made outside the VFS (fchmod etc.)
+    void mark_dirty(Entry& entry) { entry.gen = ++generation_; }
+
+    std::vector<uint8_t> save_delta(uint64_t since) {
+        std::vector<uint8_t> out = {'F', 'S', 'D', '1'};
+        put_le(out, since, 8);
+        put_le(out, generation_, 8);
+        for (const auto& [path, gen] : removed_paths_) {
+            if (gen <= since) continue;
+            out.push_back(DELTA_REMOVE);
+            put_le(out, path.size(), 4);
+            out.insert(out.end(), path.begin(), path.end());
+        }
+        std::unordered_map<Ino, std::string> linked;  // Hard-linked inode -> first path
+        for (const auto& child : inode(ROOT_INO).children) {
+            save_delta_recursive(out, inode(child.ino), "/" + names_.str(child.name), since, linked);
+        }
+        out.push_back(DELTA_END);
+        return out;
+    }
+
+    // Replay a delta from save_delta on top of the current tree
+    bool apply_delta(const uint8_t* data, size_t size) {
+        size_t pos = 0;
+        auto take = [&](size_t n) -> const uint8_t* {
+            if (size - pos < n) return nullptr;
+            const uint8_t* p = data + pos;
+            pos += n;
+            return p;
+        };
+        auto take_le = [&](size_t n, uint64_t& val) {
+            const uint8_t* p = take(n);
+            if (!p) return false;
+            val = 0;
+            for (size_t i = 0; i < n; i++) val |= static_cast<uint64_t>(p[i]) << (8 * i);
+            return true;
+        };
+
+        const uint8_t* magic = take(4);
+        uint64_t since, gen;
+        if (!magic || memcmp(magic, "FSD1", 4) != 0) return false;
+        if (!take_le(8, since) || !take_le(8, gen)) return false;
+
+        while (const uint8_t* op = take(1)) {
+            if (*op == DELTA_END) return true;
+            uint64_t path_len;
+            if (!take_le(4, path_len)) return false;
+            const uint8_t* path_bytes = take(path_len);
+            if (!path_bytes) return false;
+            std::string path(reinterpret_cast<const char*>(path_bytes), path_len);
+            if (!delta_path_ok(path) || !delta_parent_ok(path)) return false;
+
+            if (*op == DELTA_REMOVE) {
+                remove_path(path);
+                continue;
+            }
+            if (*op == DELTA_LINK) {
+                uint64_t target_len;
+                if (!take_le(4, target_len)) return false;
+                const uint8_t* target_bytes = take(target_len);
+                if (!target_bytes) return false;
+                std::string target_path(reinterpret_cast<const char*>(target_bytes), target_len);
+                if (!delta_path_ok(target_path)) return false;
+                Entry* target = resolve_no_symlink(target_path);
+                if (!target || target->is_dir() || target->host) return false;
+                if (resolve_no_symlink(path) != target) insert_entry(path, target);
+                mark_dirty(*target);
+                continue;
+            }
+            if (*op != DELTA_ENTRY) return false;
+
+            uint64_t mode, uid, gid, mtime, payload_len;
+            if (!take_le(4, mode) || !take_le(4, uid) || !take_le(4, gid) ||
+                !take_le(8, mtime) || !take_le(8, payload_len))
+                return false;
+            const uint8_t* payload = take(payload_len);
+            if (!payload) return false;
+
+            auto type = static_cast<FileType>(mode & 0170000);
+            switch (type) {
+            case FileType::Regular: case FileType::Directory: case FileType::Symlink:
+            case FileType::CharDev: case FileType::BlockDev: case FileType::Fifo:
+            case FileType::Socket:
+                break;
+            default:
+                return false;
+            }
+            Entry* existing = resolve_no_symlink(path);
+            Entry* entry;
+            if (existing && existing->is_dir() && type == FileType::Directory) {
+                entry = existing;  // Keep its children
+            } else {
+                entry = alloc_inode(type, 0);
+                if (type == FileType::Regular) {
+                    entry->content.assign(payload, payload_len);
+                    entry->size = payload_len;
+                    intern(*entry);
+                } else if (type == FileType::Symlink) {
+                    entry->link_target.assign(reinterpret_cast<const char*>(payload), payload_len);
+                }
+            }
+            entry->mode = mode & 07777;
+            entry->uid = uid;
+            entry->gid = gid;
+            entry->mtime = mtime;
+            mark_dirty(*entry);
+            if (entry != existing) insert_entry(path, entry);
+        }
+        return false;  // Truncated: no DELTA_END
+    }
+
 private:
-    std::shared_ptr<Entry> root_;
+    // --- Inode table ---
+    //
+    // Inodes live in one table indexed by inode number; directories hold
+    // sorted (name id, inode) arrays and a single hash keyed by (directory
+    // inode, name id) answers every path-component lookup. A deque keeps
+    // Entry addresses stable as the table grows, so handles and the dentry
+    // cache hold plain pointers. Freed slots are reused; interned names are
+    // never released.
+    NamePool names_;
+    std::deque<Entry> inodes_;
+    std::vector<Ino> free_inos_;
+    std::unordered_map<uint64_t, Ino> dentries_;  // (dir ino << 32 | name id) -> ino
+
+    // Host mounts; inodes on one map to a path below its root
+    struct HostNode {
+        uint32_t mount;   // Index into mounts_
+        std::string rel;  // Path below the mount root
+    };
+    std::vector<std::shared_ptr<MountSource>> mounts_;
+    std::unordered_map<Ino, HostNode> host_nodes_;
+
+    // Lower layer of a view; pending directories map to their lower inode
+    std::shared_ptr<const VirtualFS> lower_;
+    std::unordered_map<Ino, Ino> lower_dirs_;
+    std::unordered_map<Ino, Ino> lower_links_;  // Hard-linked lower file -> its copy
+    bool sealed_ = false;                        // Frozen as a lower layer by seal()
+
     std::string cwd_;
-    int next_fd_ = 3;  // 0, 1, 2 reserved for stdin/out/err
+    FdAllocator* fd_alloc_ = nullptr;
+    int next_fd_ = 3;  // 0, 1, 2 reserved for stdin/out/err (without fd_alloc_)
+    uint64_t next_pipe_id_ = 1;
+    uint64_t generation_ = 0;
+    ContentStore content_store_;
+    // Path -> generation it was removed at; ordered, so a subtree is a range
+    std::map<std::string, uint64_t> removed_paths_;
+    // Declared after the inode table: handles are destroyed first
     std::unordered_map<int, std::unique_ptr<FileHandle>> open_files_;
     std::unordered_map<int, std::unique_ptr<DirHandle>> open_dirs_;
 
-    // Create a new regular file, returns null if parent doesn't exist
-    std::shared_ptr<Entry> create_file(const std::string& path) {
+    Entry& inode(Ino ino) { return inodes_[ino]; }
+
+    int alloc_fd() { return fd_alloc_ ? fd_alloc_->alloc_fd() : next_fd_++; }
+    void release_fd(int fd) { if (fd_alloc_) fd_alloc_->release_fd(fd); }
+
+    Entry* alloc_inode(FileType type, uint32_t mode) {
+        Ino ino;
+        if (!free_inos_.empty()) {
+            ino = free_inos_.back();
+            free_inos_.pop_back();
+        } else {
+            ino = static_cast<Ino>(inodes_.size());
+            inodes_.emplace_back();
+        }
+        Entry& e = inodes_[ino];
+        e.ino = ino;
+        e.type = type;
+        e.mode = mode;
+        e.uid = 0;
+        e.gid = 0;
+        e.size = 0;
+        e.mtime = 0;
+        return &e;
+    }
+
+    static uint64_t dentry_key(Ino dir, NameId name) {
+        return (static_cast<uint64_t>(dir) << 32) | name;
+    }
+
+    Entry* lookup(Entry& dir, std::string_view name) {
+        load_children(dir);
+        NameId id = names_.find(name);
+        if (id == NamePool::NONE) return nullptr;
+        auto it = dentries_.find(dentry_key(dir.ino, id));
+        return it == dentries_.end() ? nullptr : &inode(it->second);
+    }
+
+    auto child_slot(Entry& dir, const std::string& name) {
+        return std::lower_bound(dir.children.begin(), dir.children.end(), name,
+                                [&](const DirEntry& d, const std::string& n) {
+                                    return names_.str(d.name) < n;
+                                });
+    }
+
+    // Name `child` in `dir`, replacing (and unlinking) any existing entry
+    void link_child(Entry& dir, const std::string& name, Entry& child) {
+        load_children(dir);
+        NameId id = names_.intern(name);
+        child.nlink++;
+        auto [slot, inserted] = dentries_.try_emplace(dentry_key(dir.ino, id), child.ino);
+        if (inserted) {
+            // Archives are mostly sorted, so appending is the common case
+            if (dir.children.empty() || names_.str(dir.children.back().name) < name) {
+                dir.children.push_back({id, child.ino});
+            } else {
+                dir.children.insert(child_slot(dir, name), DirEntry{id, child.ino});
+            }
+        } else {
+            Ino old = slot->second;
+            slot->second = child.ino;
+            child_slot(dir, name)->ino = child.ino;
+            dentries_removed();  // replaced an existing entry
+            drop_link(inode(old));
+        }
+        dentries_created();
+    }
+
+    bool unlink_child(Entry& dir, const std::string& name) {
+        load_children(dir);
+        NameId id = names_.find(name);
+        if (id == NamePool::NONE) return false;
+        auto it = dentries_.find(dentry_key(dir.ino, id));
+        if (it == dentries_.end()) return false;
+        Ino ino = it->second;
+        dentries_.erase(it);
+        dir.children.erase(child_slot(dir, name));
+        dentries_removed();
+        drop_link(inode(ino));
+        return true;
+    }
+
+    void drop_link(Entry& e) {
+        e.nlink--;
+        release(e);
+    }
+
+    // Move a body that became private memory into the content store
+    void intern(Entry& e) {
+        content_store_.intern(e.content);
+        e.rewritten = false;
+    }
+
+    // Free an inode nothing names or holds open; a directory's children
+    // lose their link from it
+    void release(Entry& e) {
+        if (e.nlink > 0 || e.refs > 0 || e.ino == ROOT_INO) return;
+        for (const auto& child : e.children) {
+            dentries_.erase(dentry_key(e.ino, child.name));
+            drop_link(inode(child.ino));
+        }
+        Ino ino = e.ino;
+        if (e.host) host_nodes_.erase(ino);
+        if (e.pending) lower_dirs_.erase(ino);
+        if (!lower_links_.empty()) {
+            std::erase_if(lower_links_, [&](const auto& link) { return link.second == ino; });
+        }
+        e = Entry{};
+        free_inos_.push_back(ino);
+    }
+
+    // Create a new regular file; returns null (and sets error) on failure
+    Entry* create_file(const std::string& path, int& error) {
         std::string abs_path = make_absolute(path);
 
         size_t last_slash = abs_path.rfind('/');
         std::string parent_path = (last_slash == 0) ? "/" : abs_path.substr(0, last_slash);
 
-        auto parent = resolve(parent_path);
+        Entry* parent = resolve(parent_path);
         if (!parent || !parent->is_dir()) return nullptr;
 
-        auto entry = std::make_shared<Entry>();
-        entry->type = FileType::Regular;
-        entry->mode = 0644;
-        entry->uid = 0;
-        entry->gid = 0;
-        entry->size = 0;
+        if (parent->host) {
+            std::string name = abs_path.substr(last_slash + 1);
+            error = host_create(*parent, name, [](MountSource& src, const std::string& rel) {
+                int h = src.open(rel, 0100 | 0200 | 1, 0644);  // O_CREAT | O_EXCL | O_WRONLY
+                if (h >= 0) src.close(h);
+                return h < 0 ? h : 0;
+            });
+            return error < 0 ? nullptr : lookup(*parent, name);
+        }
+
+        Entry* entry = alloc_inode(FileType::Regular, 0644);
+        mark_dirty(*entry);
         insert_entry(abs_path, entry);
         return entry;
     }
 
+    // Bring in a directory's children from below if not done yet
+    void load_children(Entry& dir) {
+        if (!dir.pending) return;
+        if (dir.host) host_populate(dir);
+        else lower_populate(dir);
+    }
+
+    // --- Lower layer helpers ---
+
+    explicit VirtualFS(std::shared_ptr<const VirtualFS> lower) : VirtualFS() {
+        lower_ = std::move(lower);
+        const Entry& root = lower_->inodes_[ROOT_INO];
+        Entry& top = inode(ROOT_INO);
+        top.mode = root.mode;
+        top.uid = root.uid;
+        top.gid = root.gid;
+        top.mtime = root.mtime;
+        top.pending = true;
+        lower_dirs_[ROOT_INO] = ROOT_INO;
+    }
+
+    // Copies up every child of dir, not only the ones about to be used or
+    // changed: walking into a directory costs the view an inode per entry
+    // (attributes and a borrowed body handle, no file data). Lookups then
+    // never have to consult the lower layer, which keeps path resolution
+    // and the dentry cache the same as for a plain tree.
+    void lower_populate(Entry& dir) {
+        dir.pending = false;
+        auto it = lower_dirs_.find(dir.ino);
+        if (it == lower_dirs_.end()) return;
+        const Entry& below = lower_->inodes_[it->second];
+        lower_dirs_.erase(it);
+        for (const auto& child : below.children) {
+            const Entry& src = lower_->inodes_[child.ino];
+            if (src.host) continue;  // The lower's own mounts are not part of its image
+            const std::string& name = lower_->names_.str(child.name);
+            if (lookup(dir, name)) continue;
+            link_child(dir, name, copy_up(src));
+        }
+    }
+
+    Entry& copy_up(const Entry& src) {
+        if (src.nlink > 1 && !src.is_dir()) {
+            auto it = lower_links_.find(src.ino);
+            if (it != lower_links_.end()) return inode(it->second);
+        }
+        Entry* e = alloc_inode(src.type, src.mode);
+        e->uid = src.uid;
+        e->gid = src.gid;
+        e->size = src.size;
+        e->mtime = src.mtime;
+        e->link_target = src.link_target;
+        e->content.share(src.content);  // seal() left every lower body one blob
+        if (e->is_dir()) {
+            e->pending = true;
+            lower_dirs_[e->ino] = src.ino;
+        } else if (src.nlink > 1) {
+            lower_links_[src.ino] = e->ino;
+        }
+        return *e;
+    }
+
+    // --- Host mount helpers ---
+
+    MountSource& host_source(const Entry& e) { return *mounts_[host_nodes_.at(e.ino).mount]; }
+
+    std::string host_rel(const Entry& dir, const std::string& name) const {
+        const std::string& rel = host_nodes_.at(dir.ino).rel;
+        return rel.empty() ? name : rel + "/" + name;
+    }
+
+    static void host_attr(Entry& e, const MountSource::Attr& attr) {
+        e.mode = attr.mode & 07777;
+        e.uid = attr.uid;
+        e.gid = attr.gid;
+        e.size = attr.size;
+        e.mtime = attr.mtime;
+        e.link_target = attr.link_target;
+    }
+
+    // e is registered in host_nodes_
+    void host_init(Entry& e, const MountSource::Attr& attr) {
+        e.type = attr.type;
+        host_attr(e, attr);
+        e.host = true;
+        e.pending = e.is_dir();
+    }
+
+    Entry* host_inode(const Entry& dir, const std::string& name, const MountSource::Attr& attr) {
+        Entry* e = alloc_inode(attr.type, 0);
+        host_nodes_[e->ino] = HostNode{host_nodes_.at(dir.ino).mount, host_rel(dir, name)};
+        host_init(*e, attr);
+        return e;
+    }
+
+    void host_refresh(Entry& e) {
+        MountSource::Attr attr;
+        if (host_source(e).lstat(host_nodes_.at(e.ino).rel, attr) == 0) host_attr(e, attr);
+    }
+
+    // Read a mounted directory's listing into inodes
+    void host_populate(Entry& dir) {
+        dir.pending = false;
+        std::vector<MountSource::DirItem> items;
+        if (host_source(dir).list(host_nodes_.at(dir.ino).rel, items) < 0) return;
+        std::sort(items.begin(), items.end(),
+                  [](const auto& a, const auto& b) { return a.name < b.name; });
+        for (const auto& item : items) {
+            if (lookup(dir, item.name)) continue;  // Shadowed by a guest entry
+            link_child(dir, item.name, *host_inode(dir, item.name, item.attr));
+        }
+    }
+
+    // Run a host operation that creates rel, then give the result an inode
+    template <typename Op>
+    int host_create(Entry& dir, const std::string& name, Op&& op) {
+        MountSource& src = host_source(dir);
+        if (src.read_only()) return -30;  // EROFS
+        std::string rel = host_rel(dir, name);
+        int rc = op(src, rel);
+        if (rc < 0) return rc;
+        MountSource::Attr attr;
+        rc = src.lstat(rel, attr);
+        if (rc < 0) return rc;
+        link_child(dir, name, *host_inode(dir, name, attr));
+        return 0;
+    }
+
+    int open_host(Entry& entry, int flags, const std::string& path) {
+        MountSource& src = host_source(entry);
+        bool writes = (flags & 3) != 0 || (flags & 01000);
+        if (writes && src.read_only()) return -30;  // EROFS
+        int handle = src.open(host_nodes_.at(entry.ino).rel, flags & (3 | 01000 | 02000), 0);
+        if (handle < 0) return handle;
+        if (flags & 01000) entry.size = 0;
+
+        int fd = alloc_fd();
+        if (fd < 0) {
+            src.close(handle);
+            return fd;
+        }
+        auto fh = std::make_unique<FileHandle>(&entry, flags, path);
+        fh->host = std::make_shared<HostFile>(&src, handle);
+        if (flags & 02000) fh->offset = entry.size;
+        open_files_[fd] = std::move(fh);
+        return fd;
+    }
+
+    ssize_t host_pwrite(FileHandle& fh, const void* buf, size_t count, uint64_t offset) {
+        ssize_t n = fh.host->source->pwrite(fh.host->handle, buf, count, offset);
+        if (n > 0) fh.entry->size = std::max<uint64_t>(fh.entry->size, offset + n);
+        return n;
+    }
+
+    // After a rename on the host: point the moved subtree at its new path
+    void host_rehome(Entry& e, const std::string& rel) {
+        if (!e.host) return;
+        host_nodes_.at(e.ino).rel = rel;
+        for (const auto& child : e.children) {
+            host_rehome(inode(child.ino), rel + "/" + names_.str(child.name));
+        }
+    }
+
     static uint64_t parse_octal(const uint8_t* p, size_t len) {
         uint64_t val = 0;
         for (size_t i = 0; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
@@ -821,10 +2297,135 @@ private:
         return cwd_ + "/" + path;
     }
 
-    std::shared_ptr<Entry> resolve_no_symlink(const std::string& path) {
+    // --- Dentry cache ---
+    //
+    // Absolute path -> resolved entry, with null meaning a cached ENOENT.
+    // Positive entries stay valid until something is removed or replaced
+    // (unlink, rename, overwrite); negative entries until something is
+    // created (mkdir, symlink, link, O_CREAT, rename). Each side is tracked
+    // by a generation counter so invalidation is O(1) and stale slots are
+    // simply refilled on the next miss.
+    struct CachedDentry {
+        Entry* entry;
+        uint64_t gen;
+    };
+    static constexpr size_t DENTRY_CACHE_MAX = 65536;
+    std::unordered_map<std::string, CachedDentry> dcache_follow_;
+    std::unordered_map<std::string, CachedDentry> dcache_nofollow_;
+    uint64_t dcache_removed_gen_ = 0;
+    uint64_t dcache_created_gen_ = 0;
+
+    template <typename Walk>
+    Entry* dcache_lookup(std::unordered_map<std::string, CachedDentry>& cache,
+                         const std::string& abs_path, Walk&& walk_fn) {
+        auto it = cache.find(abs_path);
+        if (it != cache.end()) {
+            const auto& hit = it->second;
+            uint64_t gen = hit.entry ? dcache_removed_gen_ : dcache_created_gen_;
+            if (hit.gen == gen) return hit.entry;
+        }
+        Entry* entry = walk_fn();
+        uint64_t gen = entry ? dcache_removed_gen_ : dcache_created_gen_;
+        if (it != cache.end()) {
+            it->second = CachedDentry{entry, gen};
+        } else {
+            if (cache.size() >= DENTRY_CACHE_MAX) cache.clear();
+            cache.emplace(abs_path, CachedDentry{entry, gen});
+        }
+        return entry;
+    }
+
+    void dentries_created() { ++dcache_created_gen_; }
+    void dentries_removed() { ++dcache_removed_gen_; }
+
+    static void copy_meta(const Entry& e, Entry& out) {
+        out.ino = e.ino;
+        out.nlink = e.nlink;
+        out.type = e.type;
+        out.mode = e.mode;
+        out.uid = e.uid;
+        out.gid = e.gid;
+        out.size = e.size;
+        out.mtime = e.mtime;
+        out.link_target = e.link_target;
+    }
+
+    // Uncached path walk; abs_path must already be absolute
+    Entry* walk(const std::string& abs_path, int max_depth) {
+        // Split path into components
+        std::vector<std::string> parts;
+        size_t start = 1;
+        while (start < abs_path.size()) {
+            size_t end = abs_path.find('/', start);
+            if (end == std::string::npos) end = abs_path.size();
+            if (end > start) {
+                parts.push_back(abs_path.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+
+        // Traverse
+        Entry* current = &inode(ROOT_INO);
+        std::string current_path = "";
+
+        for (size_t i = 0; i < parts.size(); i++) {
+            const auto& part = parts[i];
+
+            if (!current || !current->is_dir()) {
+                return nullptr;  // Not a directory
+            }
+
+            if (part == ".") {
+                continue;
+            } else if (part == "..") {
+                // Go up - find parent
+                size_t last_slash = current_path.rfind('/');
+                if (last_slash != std::string::npos) {
+                    current_path = current_path.substr(0, last_slash);
+                    current = resolve_no_symlink(current_path.empty() ? "/" : current_path);
+                }
+                continue;
+            }
+
+            current = lookup(*current, part);
+            if (!current) {
+                return nullptr;  // Not found
+            }
+
+            current_path += "/" + part;
+
+            // Handle symlinks
+            if (current->is_symlink() && max_depth > 0) {
+                std::string target = current->link_target;
+                if (!target.starts_with("/")) {
+                    // Relative symlink
+                    size_t last_slash = current_path.rfind('/');
+                    if (last_slash != std::string::npos) {
+                        target = current_path.substr(0, last_slash) + "/" + target;
+                    }
+                }
+
+                // Resolve the symlink target + remaining path
+                std::string remaining;
+                for (size_t j = i + 1; j < parts.size(); j++) {
+                    remaining += "/" + parts[j];
+                }
+
+                return walk(make_absolute(target + remaining), max_depth - 1);
+            }
+        }
+
+        return current;
+    }
+
+    Entry* resolve_no_symlink(const std::string& path) {
         std::string abs_path = make_absolute(path);
-        if (abs_path == "/") return root_;
+        if (abs_path == "/") return &inode(ROOT_INO);
+        return dcache_lookup(dcache_nofollow_, abs_path,
+                             [&] { return walk_no_symlink(abs_path); });
+    }
 
+    Entry* walk_no_symlink(const std::string& abs_path) {
         std::vector<std::string> parts;
         size_t start = 1;
         while (start < abs_path.size()) {
@@ -836,9 +2437,9 @@ private:
             start = end + 1;
         }
 
-        auto current = root_;
-        std::vector<std::shared_ptr<Entry>> stack;
-        stack.push_back(root_);
+        Entry* current = &inode(ROOT_INO);
+        std::vector<Entry*> stack;
+        stack.push_back(current);
         for (const auto& part : parts) {
             if (!current || !current->is_dir()) return nullptr;
             if (part == ".") {
@@ -848,15 +2449,14 @@ private:
                 current = stack.back();
                 continue;
             }
-            auto it = current->children.find(part);
-            if (it == current->children.end()) return nullptr;
-            current = it->second;
+            current = lookup(*current, part);
+            if (!current) return nullptr;
             stack.push_back(current);
         }
         return current;
     }
 
-    void insert_entry(const std::string& path, std::shared_ptr<Entry> entry) {
+    void insert_entry(const std::string& path, Entry* entry) {
         std::string abs_path = path;
         if (!abs_path.starts_with("/")) abs_path = "/" + abs_path;
 
@@ -871,12 +2471,13 @@ private:
         std::string name = abs_path.substr(last_slash + 1);
 
         if (parent_path.empty()) parent_path = "/";
-        if (name.empty()) return;
-
-        entry->name = name;
+        if (name.empty()) {
+            release(*entry);  // Unnamed and unopened
+            return;
+        }
 
         // Create parent directories as needed
-        std::shared_ptr<Entry> parent = root_;
+        Entry* parent = &inode(ROOT_INO);
         if (parent_path != "/") {
             std::vector<std::string> parts;
             size_t start = 1;
@@ -890,21 +2491,124 @@ private:
             }
 
             for (const auto& part : parts) {
-                auto it = parent->children.find(part);
-                if (it == parent->children.end()) {
-                    auto dir = std::make_shared<Entry>();
-                    dir->name = part;
-                    dir->type = FileType::Directory;
-                    dir->mode = 0755;
-                    parent->children[part] = dir;
-                    parent = dir;
-                } else {
-                    parent = it->second;
+                Entry* child = lookup(*parent, part);
+                if (!child) {
+                    child = alloc_inode(FileType::Directory, 0755);
+                    child->gen = entry->gen;
+                    link_child(*parent, part, *child);
                 }
+                parent = child;
             }
         }
 
-        parent->children[name] = entry;
+        link_child(*parent, name, *entry);
+        mark_created(abs_path, *entry);
+    }
+
+    // --- Change tracking helpers ---
+
+    // Removing a directory covers earlier removals below it, so those go
+    void mark_removed(const std::string& abs_path) {
+        removed_paths_.erase(removed_paths_.lower_bound(abs_path + "/"),
+                             removed_paths_.lower_bound(abs_path + "0"));  // '0' follows '/'
+        removed_paths_[abs_path] = ++generation_;
+    }
+
+    // abs_path names an entry again. A non-directory entry record replaces
+    // whatever a base had there, so the removal is no longer needed; a
+    // directory merges with the base's, so its removal has to stay.
+    void mark_created(const std::string& abs_path, const Entry& entry) {
+        if (!entry.is_dir() && !removed_paths_.empty()) removed_paths_.erase(abs_path);
+    }
+
+    void mark_subtree_dirty(Entry& entry) {
+        mark_dirty(entry);
+        if (!entry.host) load_children(entry);
+        for (const auto& child : entry.children) mark_subtree_dirty(inode(child.ino));
+    }
+
+    // Drop a path and everything below it (delta replay)
+    void remove_path(const std::string& abs_path) {
+        size_t last_slash = abs_path.rfind('/');
+        if (last_slash == std::string::npos || last_slash + 1 == abs_path.size()) return;
+        std::string parent_path = (last_slash == 0) ? "/" : abs_path.substr(0, last_slash);
+        Entry* parent = resolve_no_symlink(parent_path);
+        if (!parent || !parent->is_dir()) return;
+        if (!unlink_child(*parent, abs_path.substr(last_slash + 1))) return;
+        mark_removed(abs_path);
+    }
+
+    static void put_le(std::vector<uint8_t>& out, uint64_t val, size_t n) {
+        for (size_t i = 0; i < n; i++) out.push_back(static_cast<uint8_t>(val >> (8 * i)));
+    }
+
+    // Absolute, and every component a real name
+    static bool delta_path_ok(const std::string& path) {
+        if (path.size() < 2 || path[0] != '/' || path.find('\0') != std::string::npos) return false;
+        for (size_t start = 1; start <= path.size();) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) end = path.size();
+            std::string_view name(path.data() + start, end - start);
+            if (name.empty() || name == "." || name == "..") return false;
+            start = end + 1;
+        }
+        return true;
+    }
+
+    // Every component above the last that already exists is a directory,
+    // so a record can neither hang a child off a file nor reach through a
+    // symlink; missing ones are created by insert_entry
+    bool delta_parent_ok(const std::string& path) {
+        Entry* dir = &inode(ROOT_INO);
+        for (size_t start = 1;;) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) return true;
+            Entry* child = lookup(*dir, std::string_view(path).substr(start, end - start));
+            if (!child) return true;
+            if (!child->is_dir()) return false;
+            dir = child;
+            start = end + 1;
+        }
+    }
+
+    // A link changes the inode's generation, so every name of a dirty inode
+    // is visited; the first carries the entry, later ones link to it.
+    void save_delta_recursive(std::vector<uint8_t>& out, const Entry& entry,
+                              const std::string& path, uint64_t since,
+                              std::unordered_map<Ino, std::string>& linked) {
+        if (entry.host) return;  // Lives on the host
+        if (entry.gen > since && entry.nlink > 1 && !entry.is_dir()) {
+            auto [it, first] = linked.try_emplace(entry.ino, path);
+            if (!first) {
+                out.push_back(DELTA_LINK);
+                put_le(out, path.size(), 4);
+                out.insert(out.end(), path.begin(), path.end());
+                put_le(out, it->second.size(), 4);
+                out.insert(out.end(), it->second.begin(), it->second.end());
+                return;
+            }
+        }
+        if (entry.gen > since) {
+            out.push_back(DELTA_ENTRY);
+            put_le(out, path.size(), 4);
+            out.insert(out.end(), path.begin(), path.end());
+            put_le(out, static_cast<uint32_t>(entry.type) | (entry.mode & 07777), 4);
+            put_le(out, entry.uid, 4);
+            put_le(out, entry.gid, 4);
+            put_le(out, entry.mtime, 8);
+            if (entry.type == FileType::Regular) {
+                put_le(out, entry.content.size(), 8);
+                entry.content.append_to(out);
+            } else if (entry.type == FileType::Symlink) {
+                put_le(out, entry.link_target.size(), 8);
+                out.insert(out.end(), entry.link_target.begin(), entry.link_target.end());
+            } else {
+                put_le(out, 0, 8);
+            }
+        }
+        for (const auto& child : entry.children) {
+            save_delta_recursive(out, inode(child.ino), path + "/" + names_.str(child.name), since, linked);
+        }
     }
 
     // --- Tar serialization helpers ---
@@ -978,11 +2682,11 @@ private:
     }
 
     void emit_tar_header(std::vector<uint8_t>& out, const std::string& path,
-                         const std::shared_ptr<Entry>& entry) {
+                         const Entry& entry) {
         std::string tar_path = path;
 
         // Directories get trailing slash
-        if (entry->is_dir() && !tar_path.empty() && tar_path.back() != '/') {
+        if (entry.is_dir() && !tar_path.empty() && tar_path.back() != '/') {
             tar_path += '/';
         }
 
@@ -999,25 +2703,25 @@ private:
         memcpy(header, tar_path.c_str(), name_copy);
 
         // Mode
-        write_octal(header + 100, 8, entry->mode);
+        write_octal(header + 100, 8, entry.mode);
         // UID
-        write_octal(header + 108, 8, entry->uid);
+        write_octal(header + 108, 8, entry.uid);
         // GID
-        write_octal(header + 116, 8, entry->gid);
+        write_octal(header + 116, 8, entry.gid);
 
         // Size (only for regular files with content)
         uint64_t content_size = 0;
-        if (entry->type == FileType::Regular) {
-            content_size = entry->content.size();
+        if (entry.type == FileType::Regular) {
+            content_size = entry.content.size();
         }
         write_octal(header + 124, 12, content_size);
 
         // Mtime
-        write_octal(header + 136, 12, entry->mtime);
+        write_octal(header + 136, 12, entry.mtime);
 
         // Type flag
         char type_flag = '0';
-        switch (entry->type) {
+        switch (entry.type) {
             case FileType::Regular:  type_flag = '0'; break;
             case FileType::Directory: type_flag = '5'; break;
             case FileType::Symlink:  type_flag = '2'; break;
@@ -1029,9 +2733,9 @@ private:
         header[156] = type_flag;
 
         // Link target for symlinks
-        if (entry->type == FileType::Symlink) {
-            size_t link_copy = std::min(entry->link_target.size(), (size_t)100);
-            memcpy(header + 157, entry->link_target.c_str(), link_copy);
+        if (entry.type == FileType::Symlink) {
+            size_t link_copy = std::min(entry.link_target.size(), (size_t)100);
+            memcpy(header + 157, entry.link_target.c_str(), link_copy);
         }
 
         // UStar magic and version
@@ -1053,8 +2757,8 @@ private:
         out.insert(out.end(), header, header + 512);
 
         // Write file content if regular file
-        if (entry->type == FileType::Regular && content_size > 0) {
-            out.insert(out.end(), entry->content.begin(), entry->content.end());
+        if (entry.type == FileType::Regular && content_size > 0) {
+            entry.content.append_to(out);
             // Pad to 512-byte boundary
             size_t remainder = content_size % 512;
             if (remainder != 0) {
@@ -1064,26 +2768,21 @@ private:
         }
     }
 
-    void save_tar_recursive(std::vector<uint8_t>& out,
-                            const std::shared_ptr<Entry>& node,
+    void save_tar_recursive(std::vector<uint8_t>& out, const Entry& node,
                             const std::string& prefix) {
-        // Collect and sort children for deterministic output
-        std::vector<std::string> names;
-        names.reserve(node->children.size());
-        for (const auto& [name, _] : node->children) {
-            names.push_back(name);
-        }
-        std::sort(names.begin(), names.end());
-
-        for (const auto& name : names) {
-            auto& child = node->children.at(name);
+        // Children are kept in name order, so output is deterministic
+        for (const auto& dirent : node.children) {
+            const std::string& name = names_.str(dirent.name);
+            const Entry& child = inode(dirent.ino);
+            if (child.host) continue;  // Lives on the host
             std::string child_path = prefix.empty() ? name : prefix + "/" + name;
 
             // Emit tar header for this entry
             emit_tar_header(out, child_path, child);
 
             // Recurse into directories
-            if (child->is_dir()) {
+            if (child.is_dir()) {
+                load_children(inode(dirent.ino));
                 save_tar_recursive(out, child, child_path);
             }
         }
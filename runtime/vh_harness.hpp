@@ -17,6 +17,8 @@
 #pragma once
 
 #include <libriscv/machine.hpp>
+#include "entropy.hpp"
+#include "guest_span.hpp"
 #include <cstring>
 #include <iostream>
 #include <sys/time.h>
@@ -145,11 +147,15 @@ inline void setup_vh_harness(Machine& machine) {
     });
 
     // 705: getrandom(buf_ptr, len, flags) -> bytes_written
+    // Same generator as getrandom(2), written straight into the guest buffer
     machine.install_syscall_handler(705, [](Machine& m) {
         auto buf_addr = m.sysarg(0);
         auto len = (size_t)m.sysarg(1);
-        auto* buf = m.memory.memarray<uint8_t>(buf_addr, len);
-        m.set_result(js_compute_offload(705, buf, len, nullptr, 0));
+        m.set_result(syscalls::guest_transfer<syscalls::GuestAccess::Write>(m, buf_addr, len,
+            [](char* buf, size_t size, size_t) {
+                syscalls::g_entropy.fill(buf, size);
+                return static_cast<ssize_t>(size);
+            }));
     });
 
     // 706: iconv(cd, ib, ibl, ob, obl) -> converted
@@ -83,6 +83,7 @@ export interface EmscriptenModule {
     FS: EmscriptenFS;
     callMain(args: string[]): Promise<number>;
     _friscy_stopped(): boolean;
+    _friscy_exit_code(): number;
     _friscy_resume(): Promise<boolean>;
     _friscy_get_pc(): number;
     _friscy_set_pc(pc: number): void;
@@ -92,6 +93,9 @@ export interface EmscriptenModule {
     _friscy_get_fetch_request_len(): number;
     _friscy_set_fetch_response(ptr: number, len: number): void;
     _friscy_export_tar(sizePtr: number): number;
+    _friscy_export_delta(since: bigint, sizePtr: number): number;
+    _friscy_vfs_generation(): bigint;
+    _friscy_apply_delta(ptr: number, len: number): number;
     _malloc(size: number): number;
     _free(ptr: number): void;
     HEAPU8: Uint8Array;
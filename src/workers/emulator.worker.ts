@@ -369,7 +369,7 @@ ctx.onmessage = async (e: MessageEvent<WorkerMessage>) => {
             await emModule.callMain(args);
             if (emModule._friscy_stopped && emModule._friscy_stopped()) await runResumeLoop();
             maybePostJitStats(true);
-            signalExit(0);
+            signalExit(emModule._friscy_exit_code ? emModule._friscy_exit_code() : 0);
         } catch (e: any) {
             const errMsg = e?.message || String(e);
             writeStdoutRing(encoder.encode(`\r\n[worker] Error: ${errMsg}\r\n`));
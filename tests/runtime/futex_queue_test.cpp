@@ -0,0 +1,64 @@
+// Futex wait queues (ThreadScheduler::requeue): moving waiters onto their
+// own key, or onto another key in the same bucket, visits each once.
+
+#include "check.hpp"
+#include "syscalls.hpp"
+
+#include <cstdio>
+#include <vector>
+
+using syscalls::ThreadScheduler;
+
+namespace {
+
+constexpr int WAITERS = 3;
+
+// ThreadScheduler's bucket hash
+size_t bucket(uint64_t key) { return (key * 0x9E3779B97F4A7C15ull) >> 56; }
+
+// The waiters on key, longest waiter first
+std::vector<int> waiters(const ThreadScheduler& s, uint64_t key) {
+    std::vector<int> out;
+    for (int i = s.first_waiter(key); i != ThreadScheduler::NONE; i = s.threads[i].wait_next) {
+        if (s.threads[i].futex_addr == key) out.push_back(i);
+    }
+    return out;
+}
+
+// WAITERS threads besides the main one, all blocked on key
+std::vector<int> block_all(ThreadScheduler& s, uint64_t key) {
+    s.init(1);
+    std::vector<int> blocked;
+    for (int t = 0; t < WAITERS; t++) {
+        int i = s.add_thread(100 + t);
+        s.block(i, key);
+        blocked.push_back(i);
+    }
+    return blocked;
+}
+
+}  // namespace
+
+int main() {
+    ThreadScheduler s;
+    const uint64_t key = 0x20000;
+
+    // Onto the same key: everyone counts once and keeps their place
+    std::vector<int> blocked = block_all(s, key);
+    CHECK(s.requeue(key, key, syscalls::WAKE_ALL) == WAITERS);
+    CHECK(waiters(s, key) == blocked);
+    CHECK(s.requeue(key, key, 2) == 2);
+    CHECK(waiters(s, key) == (std::vector<int>{blocked[2], blocked[0], blocked[1]}));
+
+    // Onto another key hashing to the same bucket
+    uint64_t other = key + 4;
+    while (bucket(other) != bucket(key)) other += 4;
+    blocked = block_all(s, key);
+    CHECK(s.requeue(key, other, syscalls::WAKE_ALL) == WAITERS);
+    CHECK(waiters(s, key).empty());
+    CHECK(waiters(s, other) == blocked);
+    CHECK(s.wake(other, syscalls::WAKE_ALL) == WAITERS);
+
+    printf("futex_queue_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Blocking pipe reads with the writer asleep on a timer (park_on_pipe).
+//
+// A hand-assembled guest makes a pipe and a thread. The thread sleeps,
+// then writes; the main thread reads at once, finds the pipe empty and must
+// wait for the write rather than read EOF while a writer is still open.
+// The guest exits with the read's result.
+
+#include "check.hpp"
+#include "syscalls.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+constexpr uint64_t TEXT = 0x10000;        // Code, read-execute
+constexpr uint64_t DATA = 0x20000;        // Data and the thread's stack
+constexpr uint64_t FDS = DATA;            // int[2] from pipe2
+constexpr uint64_t BUF = DATA + 0x10;     // Where the main thread reads to
+constexpr uint64_t MSG = DATA + 0x20;     // What the thread writes
+constexpr uint64_t SLEEP = DATA + 0x30;   // struct timespec for nanosleep
+constexpr uint64_t STACK_TOP = DATA + 0x3000;
+constexpr uint64_t DATA_SIZE = 0x3000;
+
+// RV64I encodings of the few instructions the guest needs
+enum Reg : uint32_t { ZERO = 0, A0 = 10, A1 = 11, A2 = 12, A3 = 13, A4 = 14, A7 = 17 };
+
+struct Asm {
+    std::vector<uint32_t> code;
+
+    size_t here() const { return code.size(); }
+    void addi(Reg rd, Reg rs, int32_t imm) {
+        code.push_back((uint32_t(imm & 0xFFF) << 20) | (rs << 15) | (rd << 7) | 0x13);
+    }
+    void lw(Reg rd, Reg rs, int32_t imm) {
+        code.push_back((uint32_t(imm & 0xFFF) << 20) | (rs << 15) | (2 << 12) | (rd << 7) | 0x03);
+    }
+    void li(Reg rd, uint32_t v) {
+        uint32_t hi = (v + 0x800) >> 12;
+        if (hi) {
+            code.push_back((hi << 12) | (rd << 7) | 0x37);  // lui
+            addi(rd, rd, int32_t(v - (hi << 12)));
+        } else {
+            addi(rd, ZERO, int32_t(v));
+        }
+    }
+    void syscall(uint32_t nr) {
+        li(A7, nr);
+        code.push_back(0x73);  // ecall
+    }
+    // beq rs1, rs2 to an instruction patched in later by bind
+    size_t beq(Reg rs1, Reg rs2) {
+        code.push_back((rs2 << 20) | (rs1 << 15) | 0x63);
+        return here() - 1;
+    }
+    void bind(size_t branch) {
+        uint32_t off = uint32_t(here() - branch) * 4;
+        code[branch] |= ((off >> 12 & 1) << 31) | ((off >> 5 & 0x3F) << 25) |
+                        ((off >> 1 & 0xF) << 8) | ((off >> 11 & 1) << 7);
+    }
+};
+
+template <typename T>
+void put_at(std::vector<uint8_t>& elf, size_t at, T val) {
+    memcpy(elf.data() + at, &val, sizeof(val));
+}
+
+// A static ELF with the code at TEXT and the initialized data at DATA
+std::vector<uint8_t> make_elf(const std::vector<uint32_t>& code, const std::vector<uint8_t>& data) {
+    constexpr size_t PAGE = 0x1000;
+    std::vector<uint8_t> elf(2 * PAGE + data.size());
+    memcpy(elf.data(), "\x7f" "ELF\x02\x01\x01", 7);  // 64-bit, little-endian
+    put_at<uint16_t>(elf, 16, 2);                      // ET_EXEC
+    put_at<uint16_t>(elf, 18, 243);                    // EM_RISCV
+    put_at<uint32_t>(elf, 20, 1);
+    put_at<uint64_t>(elf, 24, TEXT);                   // Entry: first instruction
+    put_at<uint64_t>(elf, 32, 64);                     // Program headers
+    put_at<uint16_t>(elf, 52, 64);
+    put_at<uint16_t>(elf, 54, 56);
+    put_at<uint16_t>(elf, 56, 2);
+    // libriscv looks sections up by name: a null one and .shstrtab
+    put_at<uint64_t>(elf, 40, 0x200);
+    put_at<uint16_t>(elf, 58, 64);
+    put_at<uint16_t>(elf, 60, 2);
+    put_at<uint16_t>(elf, 62, 1);
+    put_at<uint32_t>(elf, 0x240, 1);       // sh_name
+    put_at<uint32_t>(elf, 0x244, 3);       // SHT_STRTAB
+    put_at<uint64_t>(elf, 0x258, 0x300);   // sh_offset
+    put_at<uint64_t>(elf, 0x260, 11);      // sh_size
+    memcpy(elf.data() + 0x301, ".shstrtab", 9);
+    auto phdr = [&](size_t at, uint32_t flags, uint64_t off, uint64_t vaddr, uint64_t filesz,
+                    uint64_t memsz) {
+        put_at<uint32_t>(elf, at, 1);  // PT_LOAD
+        put_at<uint32_t>(elf, at + 4, flags);
+        put_at<uint64_t>(elf, at + 8, off);
+        put_at<uint64_t>(elf, at + 16, vaddr);
+        put_at<uint64_t>(elf, at + 24, vaddr);
+        put_at<uint64_t>(elf, at + 32, filesz);
+        put_at<uint64_t>(elf, at + 40, memsz);
+        put_at<uint64_t>(elf, at + 48, PAGE);
+    };
+    phdr(64, 5, PAGE, TEXT, code.size() * 4, code.size() * 4);  // R-X
+    phdr(120, 6, 2 * PAGE, DATA, data.size(), DATA_SIZE);       // RW-
+    memcpy(elf.data() + PAGE, code.data(), code.size() * 4);
+    memcpy(elf.data() + 2 * PAGE, data.data(), data.size());
+    return elf;
+}
+
+// Run the guest to exit_group like main.cpp's native loop; its exit code
+int run(Machine& machine) {
+    constexpr uint64_t MAX_INSTRUCTIONS = 100'000'000;
+    do {
+        machine.resume<false>(syscalls::sched_chunk(machine, MAX_INSTRUCTIONS));
+        syscalls::sched_tick(machine);
+    } while (machine.instruction_limit_reached() &&
+             machine.instruction_counter() < MAX_INSTRUCTIONS);
+    CHECK(!machine.instruction_limit_reached());
+    return machine.return_value<int>();
+}
+
+}  // namespace
+
+int main() {
+    Asm a;
+    a.li(A0, FDS);
+    a.li(A1, 0);
+    a.syscall(59);  // pipe2(fds, 0)
+    a.li(A0, 0x10900);  // CLONE_VM | CLONE_SIGHAND | CLONE_THREAD
+    a.li(A1, STACK_TOP);
+    a.li(A2, 0);
+    a.li(A3, 0);
+    a.li(A4, 0);
+    a.syscall(220);  // clone
+    size_t to_child = a.beq(A0, ZERO);
+    // Main thread: read(fds[0], buf, 4), then exit_group with its result
+    a.li(A1, FDS);
+    a.lw(A0, A1, 0);
+    a.li(A1, BUF);
+    a.li(A2, 4);
+    a.syscall(63);
+    a.syscall(94);
+    // Thread: nanosleep(1 ms), write(fds[1], "ping", 4), exit(0)
+    a.bind(to_child);
+    a.li(A0, SLEEP);
+    a.li(A1, 0);
+    a.syscall(101);
+    a.li(A1, FDS);
+    a.lw(A0, A1, 4);
+    a.li(A1, MSG);
+    a.li(A2, 4);
+    a.syscall(64);
+    a.li(A0, 0);
+    a.syscall(93);
+
+    std::vector<uint8_t> data(0x40);
+    memcpy(data.data() + (MSG - DATA), "ping", 4);
+    uint64_t sleep_ns = 1'000'000;
+    memcpy(data.data() + (SLEEP - DATA) + 8, &sleep_ns, 8);
+
+    std::vector<uint8_t> elf = make_elf(a.code, data);
+    Machine machine(elf);
+    machine.setup_linux_syscalls();
+    vfs::VirtualFS fs;
+    syscalls::install_syscalls(machine, fs);
+
+    CHECK(run(machine) == 4);
+    char got[4];
+    machine.copy_from_guest(got, BUF, 4);
+    CHECK(memcmp(got, "ping", 4) == 0);
+
+    printf("pipe_block_test: ok\n");
+    return 0;
+}
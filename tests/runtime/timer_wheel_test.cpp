@@ -0,0 +1,151 @@
+// TimerWheel (timers.hpp): expiry across level boundaries, cancelling
+// timers that have cascaded down a level, same-tick ordering, and a
+// randomized run against a sorted reference.
+
+#include "check.hpp"
+#include "timers.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+using syscalls::TimerWheel;
+
+namespace {
+
+constexpr uint64_t TICK = 1024;  // Level 0 slot width in ns
+
+// Ns at which level k of the wheel starts covering deadlines
+constexpr uint64_t level_span(int k) { return TICK << (6 * k); }
+
+std::vector<uint64_t> expire(TimerWheel& w, uint64_t now) {
+    std::vector<uint64_t> fired;
+    w.expire(now, [&](uint64_t owner) { fired.push_back(owner); });
+    return fired;
+}
+
+// Deadlines on either side of each level boundary fire exactly when due
+void level_boundaries() {
+    for (uint64_t start : {uint64_t(0), uint64_t(5) * TICK + 17, uint64_t(1) << 40}) {
+        TimerWheel w;
+        expire(w, start);
+        std::vector<uint64_t> deadlines;
+        for (int k = 1; k < 8; k++) {
+            uint64_t edge = (start / level_span(k) + 1) * level_span(k);
+            deadlines.insert(deadlines.end(), {edge - 1, edge, edge + 1, edge + TICK});
+        }
+        deadlines.push_back(UINT64_MAX - 1);
+        for (size_t i = 0; i < deadlines.size(); i++) w.add(deadlines[i], i);
+
+        for (size_t i = 0; i < deadlines.size(); i++) {
+            uint64_t d = deadlines[i];
+            CHECK(w.next_deadline() == d);
+            if (d > start) CHECK(expire(w, d - 1).empty());
+            CHECK(expire(w, d) == std::vector<uint64_t>{i});
+        }
+        CHECK(w.empty());
+        CHECK(w.next_deadline() == UINT64_MAX);
+    }
+}
+
+// A timer moved down a level by an earlier expire can still be cancelled,
+// and its slot reused
+void cancel_after_cascade() {
+    TimerWheel w;
+    uint64_t far = 3 * level_span(2) + 5 * level_span(1) + 7 * TICK + 3;
+    int a = w.add(far, 1);
+    int b = w.add(far, 2);
+    int c = w.add(far + level_span(1), 3);
+    w.add(far + 10 * level_span(2), 4);
+
+    // Walk the wheel up to the deadlines' level 1 and level 0 slots
+    CHECK(expire(w, 3 * level_span(2)).empty());
+    CHECK(expire(w, far - 2 * TICK).empty());
+    w.cancel(a);
+    CHECK(w.next_deadline() == far);
+    CHECK(expire(w, far) == std::vector<uint64_t>{2});
+
+    int d = w.add(far + 2, 5);  // Reuses a freed node
+    CHECK(d == a || d == b);
+    CHECK(w.next_deadline() == far + 2);
+    w.cancel(c);
+    CHECK(expire(w, far + 20 * level_span(2)) == (std::vector<uint64_t>{5, 4}));
+    CHECK(w.empty());
+}
+
+// Timers in one tick fire by deadline, ties in the order they were armed;
+// fire may arm more, which a later expire picks up
+void same_tick_order() {
+    TimerWheel w;
+    uint64_t base = 1000 * TICK;
+    w.add(base + 900, 1);
+    w.add(base + 100, 2);
+    w.add(base + 500, 3);
+    w.add(base + 100, 4);
+    w.add(base + 900, 5);
+    w.add(base - 5, 6);  // Already due
+    std::vector<uint64_t> fired;
+    w.expire(base + TICK - 1, [&](uint64_t owner) {
+        fired.push_back(owner);
+        if (owner == 3) w.add(base + 200, 7);
+    });
+    CHECK(fired == (std::vector<uint64_t>{6, 2, 4, 3, 1, 5}));
+    CHECK(w.next_deadline() == base + 200);
+    CHECK(expire(w, base + TICK - 1) == std::vector<uint64_t>{7});
+    CHECK(w.empty());
+}
+
+void against_reference() {
+    std::mt19937_64 rng(1);
+    TimerWheel w;
+    std::map<int, std::pair<uint64_t, uint64_t>> live;  // handle -> deadline, owner
+    uint64_t now = 1'000'000'000'000ULL, next_owner = 0;
+    for (int i = 0; i < 200000; i++) {
+        int op = rng() % 10;
+        if (op < 5) {
+            uint64_t d = now + (rng() % 4 == 0 ? rng() % (1ULL << (rng() % 60)) : rng() % 100000);
+            if (rng() % 8 == 0) d = now - rng() % 1000;
+            live[w.add(d, next_owner)] = {d, next_owner};
+            next_owner++;
+        } else if (op < 7 && !live.empty()) {
+            auto it = live.begin();
+            std::advance(it, rng() % live.size());
+            w.cancel(it->first);
+            live.erase(it);
+        } else {
+            uint64_t earliest = UINT64_MAX;
+            for (const auto& [h, t] : live) earliest = std::min(earliest, t.first);
+            CHECK(w.next_deadline() == earliest);
+            now += rng() % 3 == 0 ? rng() % (1ULL << (rng() % 40)) : rng() % 5000;
+            std::vector<std::pair<uint64_t, uint64_t>> due;
+            for (auto it = live.begin(); it != live.end();) {
+                if (it->second.first <= now) {
+                    due.push_back(it->second);
+                    it = live.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            std::sort(due.begin(), due.end());
+            std::vector<uint64_t> want;
+            for (const auto& t : due) want.push_back(t.second);
+            CHECK(expire(w, now) == want);
+            CHECK(w.empty() == live.empty());
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    level_boundaries();
+    cancel_after_cascade();
+    same_tick_order();
+    against_reference();
+    printf("timer_wheel_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,198 @@
+// Change deltas (VirtualFS::save_delta / apply_delta): hard links survive
+// a round trip as one inode, redundant removal records are dropped, virtual
+// files stay out, and malformed records are refused, as are records
+// reaching below a file or through a symlink.
+
+#include "vfs_test.hpp"
+
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+using vfs::VirtualFS;
+
+namespace {
+
+constexpr int AT_REMOVEDIR = 0x200;
+
+void put_le(std::vector<uint8_t>& out, uint64_t val, size_t n) {
+    for (size_t i = 0; i < n; i++) out.push_back(static_cast<uint8_t>(val >> (8 * i)));
+}
+
+void put_str(std::vector<uint8_t>& out, const std::string& s) {
+    put_le(out, s.size(), 4);
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+// A one-record delta making `path` an empty entry of the given mode
+std::vector<uint8_t> entry_delta(const std::string& path, uint32_t mode) {
+    std::vector<uint8_t> d = {'F', 'S', 'D', '1'};
+    put_le(d, 0, 8);
+    put_le(d, 1, 8);
+    d.push_back(VirtualFS::DELTA_ENTRY);
+    put_str(d, path);
+    put_le(d, mode, 4);
+    put_le(d, 0, 4);
+    put_le(d, 0, 4);
+    put_le(d, 0, 8);
+    put_le(d, 0, 8);
+    d.push_back(VirtualFS::DELTA_END);
+    return d;
+}
+
+void hard_links() {
+    VirtualFS src;
+    CHECK(src.mkdir("/d", 0755) == 0);
+    CHECK(src.mkdir("/e", 0755) == 0);
+    put(src, "/d/a", "shared body", O_RDWR | O_CREAT | O_TRUNC);
+    CHECK(src.link("/d/a", "/e/b") == 0);
+    CHECK(src.link("/d/a", "/z") == 0);
+    uint64_t base = src.generation();
+
+    VirtualFS dst;
+    std::vector<uint8_t> delta = src.save_delta(0);
+    CHECK(dst.apply_delta(delta.data(), delta.size()));
+    vfs::Entry a, b, z;
+    CHECK(dst.stat("/d/a", a) && dst.stat("/e/b", b) && dst.stat("/z", z));
+    CHECK(a.ino == b.ino && a.ino == z.ino);
+    CHECK(a.nlink == 3);
+    put(dst, "/e/b", "SHARED", O_WRONLY);
+    CHECK(slurp(dst, "/d/a") == "SHARED body");
+    CHECK(slurp(dst, "/z") == "SHARED body");
+
+    // A later link to an inode the other side already has
+    CHECK(src.link("/z", "/d/c") == 0);
+    delta = src.save_delta(base);
+    CHECK(dst.apply_delta(delta.data(), delta.size()));
+    vfs::Entry c;
+    CHECK(dst.stat("/d/a", a) && dst.stat("/d/c", c));
+    CHECK(a.ino == c.ino && c.nlink == 4);
+    CHECK(slurp(dst, "/d/c") == "shared body");
+}
+
+// Removal records a later change makes redundant are dropped, and what
+// is left still rebuilds the tree
+void removals() {
+    VirtualFS src;
+    CHECK(src.mkdir("/d", 0755) == 0);
+    put(src, "/d/old", "old", O_RDWR | O_CREAT | O_TRUNC);
+    put(src, "/f", "first", O_RDWR | O_CREAT | O_TRUNC);
+    CHECK(src.mkdir("/t", 0755) == 0);
+    VirtualFS dst;
+    std::vector<uint8_t> delta = src.save_delta(0);
+    CHECK(dst.apply_delta(delta.data(), delta.size()));
+    uint64_t base = src.generation();
+
+    // Scratch files under a directory that goes away cost one record
+    CHECK(src.mkdir("/t/scratch", 0755) == 0);
+    for (int i = 0; i < 100; i++) {
+        std::string path = "/t/scratch/tmp" + std::to_string(i);
+        put(src, path, "x", O_RDWR | O_CREAT | O_TRUNC);
+        CHECK(src.unlink(path) == 0);
+    }
+    CHECK(src.unlink("/t/scratch", AT_REMOVEDIR) == 0);
+    // A file written again at the same path needs no removal record
+    for (int i = 0; i < 100; i++) {
+        CHECK(src.unlink("/f") == 0);
+        put(src, "/f", "again", O_RDWR | O_CREAT | O_TRUNC);
+    }
+    // A directory made again keeps its record, or /d/old would survive
+    CHECK(src.unlink("/d/old") == 0);
+    CHECK(src.unlink("/d", AT_REMOVEDIR) == 0);
+    CHECK(src.mkdir("/d", 0755) == 0);
+    put(src, "/d/new", "new", O_RDWR | O_CREAT | O_TRUNC);
+
+    delta = src.save_delta(base);
+    CHECK(delta.size() < 256);
+    CHECK(dst.apply_delta(delta.data(), delta.size()));
+    CHECK(slurp(dst, "/f") == "again");
+    CHECK(dst.open("/d/old", 0) < 0);
+    CHECK(slurp(dst, "/d/new") == "new");
+    CHECK(dst.open("/t/scratch", 0) < 0);
+}
+
+// Files the runtime synthesizes (re-created on each open of a stats file)
+// are not guest changes; a guest write to one is
+void virtual_files() {
+    VirtualFS src;
+    uint64_t base = src.generation();
+    src.add_virtual_file("/proc/friscy/syscalls", "read 1\n");
+    src.add_virtual_file("/proc/friscy/syscalls", "read 2\n");
+    src.add_virtual_file("/etc/hosts", "127.0.0.1 localhost\n");
+    put(src, "/f", "real", O_RDWR | O_CREAT | O_TRUNC);
+
+    VirtualFS dst;
+    std::vector<uint8_t> delta = src.save_delta(base);
+    CHECK(dst.apply_delta(delta.data(), delta.size()));
+    vfs::Entry e;
+    CHECK(slurp(dst, "/f") == "real");
+    CHECK(!dst.stat("/proc", e));
+    CHECK(!dst.stat("/etc/hosts", e));
+
+    base = src.generation();
+    put(src, "/etc/hosts", "10.0.0.1 box\n", O_WRONLY | O_TRUNC);
+    delta = src.save_delta(base);
+    CHECK(dst.mkdir("/etc", 0755) == 0);
+    CHECK(dst.apply_delta(delta.data(), delta.size()));
+    CHECK(slurp(dst, "/etc/hosts") == "10.0.0.1 box\n");
+}
+
+void malformed() {
+    VirtualFS fs;
+    CHECK(fs.mkdir("/d", 0755) == 0);
+    for (const char* path : {"d/x", "/d/../x", "/..", "/d/./x", "/d//x", "/", ""}) {
+        std::vector<uint8_t> d = entry_delta(path, 0100644);
+        CHECK(!fs.apply_delta(d.data(), d.size()));
+    }
+    for (uint32_t type : {0u, 0030000u, 0050000u, 0070000u, 0110000u, 0130000u, 0150000u, 0170000u}) {
+        std::vector<uint8_t> d = entry_delta("/d/x", type | 0644);
+        CHECK(!fs.apply_delta(d.data(), d.size()));
+    }
+    CHECK(fs.open("/x", 0) < 0);
+    CHECK(fs.open("/d/x", 0) < 0);
+
+    std::vector<uint8_t> ok = entry_delta("/d/x", 0100644);
+    CHECK(fs.apply_delta(ok.data(), ok.size()));
+    CHECK(slurp(fs, "/d/x").empty());
+
+    // Links must name an existing non-directory
+    for (const char* target : {"/d", "/missing", "/d/../d/x"}) {
+        std::vector<uint8_t> d = {'F', 'S', 'D', '1'};
+        put_le(d, 0, 8);
+        put_le(d, 1, 8);
+        d.push_back(VirtualFS::DELTA_LINK);
+        put_str(d, "/d/y");
+        put_str(d, target);
+        d.push_back(VirtualFS::DELTA_END);
+        CHECK(!fs.apply_delta(d.data(), d.size()));
+    }
+    CHECK(fs.open("/d/y", 0) < 0);
+
+    // Records may not reach below a file or through a symlink
+    CHECK(fs.symlink("/d", "/s") == 0);
+    for (const char* path : {"/d/x/y", "/s/y"}) {
+        std::vector<uint8_t> d = entry_delta(path, 0100644);
+        CHECK(!fs.apply_delta(d.data(), d.size()));
+    }
+    std::vector<uint8_t> remove = {'F', 'S', 'D', '1'};
+    put_le(remove, 0, 8);
+    put_le(remove, 1, 8);
+    remove.push_back(VirtualFS::DELTA_REMOVE);
+    put_str(remove, "/s/x");
+    remove.push_back(VirtualFS::DELTA_END);
+    CHECK(!fs.apply_delta(remove.data(), remove.size()));
+    CHECK(slurp(fs, "/d/x").empty());
+    CHECK(fs.open("/s/y", 0) < 0);
+}
+
+}  // namespace
+
+int main() {
+    hard_links();
+    removals();
+    virtual_files();
+    malformed();
+    printf("vfs_delta_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,99 @@
+// File bodies (FileData) through VirtualFS: copy_file_range between two
+// ranges of one file, and holes far past EOF.
+
+#include "vfs_test.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using vfs::VirtualFS;
+
+namespace {
+
+// Copying within one file writes into the extent being read from; growing
+// that extent must not pull the source bytes out from under the copy
+void copy_within_file() {
+    VirtualFS fs;
+    std::string body(30000, '\0');
+    for (size_t i = 0; i < body.size(); i++) body[i] = char('a' + i % 26);
+    // Still open for writing, so the body is private memory, not a blob
+    int fd = fs.open("/f", O_RDWR | O_CREAT | O_TRUNC);
+    CHECK(fd >= 0);
+    CHECK(fs.write(fd, body.data(), body.size()) == (ssize_t)body.size());
+    uint64_t from = 0, to = body.size();
+    CHECK(fs.copy_range(fd, &from, fd, &to, body.size()) == (ssize_t)body.size());
+    CHECK(from == body.size() && to == 2 * body.size());
+
+    // Into another extent, past a hole
+    from = 0;
+    to = 1 << 20;
+    CHECK(fs.copy_range(fd, &from, fd, &to, body.size()) == (ssize_t)body.size());
+    fs.close(fd);
+
+    std::string all = slurp(fs, "/f");
+    CHECK(all.size() == (1 << 20) + body.size());
+    CHECK(all.compare(0, body.size(), body) == 0);
+    CHECK(all.compare(body.size(), body.size(), body) == 0);
+    CHECK(all.find_first_not_of('\0', 2 * body.size()) == size_t(1 << 20));
+    CHECK(all.compare(1 << 20, body.size(), body) == 0);
+
+    // Overlapping ranges are refused
+    fd = fs.open("/f", O_RDWR);
+    from = 0;
+    to = 100;
+    CHECK(fs.copy_range(fd, &from, fd, &to, 200) == -22);
+    fs.close(fd);
+}
+
+// A write far past EOF stores only the extents it touches; the gap is a
+// hole that reads as zeros and that SEEK_DATA/SEEK_HOLE report
+void far_hole() {
+    VirtualFS fs;
+    int fd = fs.open("/sparse", O_RDWR | O_CREAT | O_TRUNC);
+    CHECK(fd >= 0);
+    CHECK(fs.write(fd, "head", 4) == 4);
+    const uint64_t far = 1ULL << 38;
+    CHECK(fs.pwrite(fd, "tail", 4, far) == 4);
+    // Would need 2^34 extent slots if holes took memory
+    const uint64_t huge = (1ULL << 50) - 2;
+    CHECK(fs.pwrite(fd, "end", 3, huge) == 3);
+
+    char buf[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    CHECK(fs.pread(fd, buf, sizeof(buf), far - 4) == 8);
+    CHECK(memcmp(buf, "\0\0\0\0tail", 8) == 0);
+    CHECK(fs.pread(fd, buf, sizeof(buf), 1ULL << 44) == 8);
+    CHECK(memcmp(buf, "\0\0\0\0\0\0\0\0", 8) == 0);
+    CHECK(fs.pread(fd, buf, sizeof(buf), huge) == 3);
+    CHECK(memcmp(buf, "end", 3) == 0);
+
+    const uint64_t chunk = vfs::FileData::CHUNK_SIZE;
+    CHECK(fs.lseek(fd, 0, 3) == 0);                       // SEEK_DATA
+    CHECK(fs.lseek(fd, 0, 4) == (off_t)chunk);            // SEEK_HOLE
+    CHECK(fs.lseek(fd, 100, 3) == 100);
+    CHECK(fs.lseek(fd, chunk, 3) == (off_t)far);
+    CHECK(fs.lseek(fd, far + 1, 3) == (off_t)(far + 1));
+    CHECK(fs.lseek(fd, far, 4) == (off_t)(far + chunk));
+    CHECK(fs.lseek(fd, far + chunk, 3) == (off_t)(huge / chunk * chunk));
+    // Both of the last two extents are data, up to EOF
+    CHECK(fs.lseek(fd, huge - 1, 4) == (off_t)(huge + 3));
+    CHECK(fs.lseek(fd, huge + 3, 3) == -6);                // ENXIO
+
+    // Truncating drops the far extents, leaving one hole after "head"
+    CHECK(fs.ftruncate(fd, far) == 0);
+    CHECK(fs.lseek(fd, chunk, 3) == -6);
+    CHECK(fs.lseek(fd, 100, 4) == (off_t)chunk);
+    CHECK(fs.pwrite(fd, "x", 1, far - 1) == 1);
+    CHECK(fs.pread(fd, buf, 2, far - 2) == 2);
+    CHECK(memcmp(buf, "\0x", 2) == 0);
+    fs.close(fd);
+}
+
+}  // namespace
+
+int main() {
+    copy_within_file();
+    far_hole();
+    printf("vfs_file_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,29 @@
+// Helpers for the VirtualFS host tests: the guest open flags and whole-file
+// reads and writes.
+#pragma once
+
+#include "check.hpp"
+#include "vfs.hpp"
+
+#include <string>
+
+constexpr int O_WRONLY = 01, O_RDWR = 02, O_CREAT = 0100, O_TRUNC = 01000, O_APPEND = 02000;
+
+// The whole body of path, or "<errno>" if it does not open
+inline std::string slurp(vfs::VirtualFS& fs, const std::string& path) {
+    int fd = fs.open(path, 0);
+    if (fd < 0) return "<" + std::to_string(fd) + ">";
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = fs.read(fd, buf, sizeof(buf))) > 0) out.append(buf, n);
+    fs.close(fd);
+    return out;
+}
+
+inline void put(vfs::VirtualFS& fs, const std::string& path, const std::string& body, int flags) {
+    int fd = fs.open(path, flags);
+    CHECK(fd >= 0);
+    CHECK(fs.write(fd, body.data(), body.size()) == (ssize_t)body.size());
+    fs.close(fd);
+}
@@ -0,0 +1,192 @@
+// Copy-on-write views over a sealed lower VFS (VirtualFS::seal).
+//
+// Builds a lower layer from a tar whose bodies are bound lazily, as a
+// compressed rootfs is, seals it and runs several views on their own
+// threads at once: each reads the shared bodies, writes, appends and
+// removes, and must see only its own changes. A view's tar and delta
+// cover the lower layer's tree as well.
+
+#include "vfs_test.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void tar_entry(std::vector<uint8_t>& tar, const std::string& name, char type,
+               const std::string& body = "", const std::string& link = "") {
+    uint8_t h[512] = {};
+    memcpy(h, name.data(), name.size());
+    snprintf(reinterpret_cast<char*>(h + 100), 8, "%07o", type == '5' ? 0755 : 0644);
+    snprintf(reinterpret_cast<char*>(h + 108), 8, "%07o", 0);
+    snprintf(reinterpret_cast<char*>(h + 116), 8, "%07o", 0);
+    snprintf(reinterpret_cast<char*>(h + 124), 12, "%011zo", body.size());
+    snprintf(reinterpret_cast<char*>(h + 136), 12, "%011o", 0);
+    h[156] = type;
+    memcpy(h + 157, link.data(), link.size());
+    memcpy(h + 257, "ustar", 5);
+    memset(h + 148, ' ', 8);
+    unsigned sum = 0;
+    for (uint8_t b : h) sum += b;
+    snprintf(reinterpret_cast<char*>(h + 148), 8, "%06o", sum);
+    tar.insert(tar.end(), h, h + 512);
+    tar.insert(tar.end(), body.begin(), body.end());
+    tar.resize((tar.size() + 511) / 512 * 512);
+}
+
+// Archive bytes fetched on demand, counting the fetches
+class CountingSource : public vfs::ContentSource {
+public:
+    explicit CountingSource(const std::vector<uint8_t>& tar) : tar_(tar) {}
+    bool fetch(uint64_t offset, uint8_t* out, size_t len) override {
+        fetches++;
+        if (offset + len > tar_.size()) return false;
+        memcpy(out, tar_.data() + offset, len);
+        return true;
+    }
+    std::atomic<int> fetches{0};
+
+private:
+    const std::vector<uint8_t>& tar_;
+};
+
+// Binds every body lazily, like CompressedTarReader
+class LazyTarReader : public vfs::TarReader {
+public:
+    LazyTarReader(const std::vector<uint8_t>& tar, std::shared_ptr<CountingSource> source)
+        : tar_(tar), source_(std::move(source)) {}
+    bool read(uint8_t* out, size_t len) override {
+        if (pos_ + len > tar_.size()) return false;
+        memcpy(out, tar_.data() + pos_, len);
+        pos_ += len;
+        return true;
+    }
+    bool skip(uint64_t len) override {
+        if (pos_ + len > tar_.size()) return false;
+        pos_ += len;
+        return true;
+    }
+    uint64_t tell() const override { return pos_; }
+    bool bind(vfs::FileData& content, uint64_t offset, uint64_t len) override {
+        content.assign_lazy(source_, offset, len);
+        return true;
+    }
+
+private:
+    const std::vector<uint8_t>& tar_;
+    std::shared_ptr<CountingSource> source_;
+    uint64_t pos_ = 0;
+};
+
+}  // namespace
+
+int main() {
+    std::string hosts = "127.0.0.1 localhost\n";
+    std::string tool(200 * 1024, '\0');
+    for (size_t i = 0; i < tool.size(); i++) tool[i] = char('a' + i % 23);
+    std::string readme(3000, 'r');
+
+    std::vector<uint8_t> tar;
+    tar_entry(tar, "etc/", '5');
+    tar_entry(tar, "etc/hosts", '0', hosts);
+    tar_entry(tar, "bin/", '5');
+    tar_entry(tar, "bin/tool", '0', tool);
+    tar_entry(tar, "bin/alias", '1', "", "bin/tool");
+    tar_entry(tar, "readme", '0', readme);
+    tar_entry(tar, "readme.copy", '0', readme);
+    tar.resize(tar.size() + 1024);
+
+    auto source = std::make_shared<CountingSource>(tar);
+    auto fs = std::make_unique<vfs::VirtualFS>();
+    LazyTarReader reader(tar, source);
+    CHECK(fs->load_tar(reader));
+    CHECK(source->fetches == 0);
+
+    // Truncating a lazy body on open drops it without fetching it first
+    {
+        vfs::VirtualFS scratch;
+        LazyTarReader scratch_reader(tar, source);
+        CHECK(scratch.load_tar(scratch_reader));
+        put(scratch, "/bin/tool", "short", O_WRONLY | O_TRUNC);
+        CHECK(slurp(scratch, "/bin/tool") == "short");
+        CHECK(source->fetches == 0);
+    }
+
+    std::shared_ptr<const vfs::VirtualFS> lower = vfs::VirtualFS::seal(std::move(fs));
+    int fetched = source->fetches;
+    CHECK(fetched > 0);
+
+    constexpr int VIEWS = 4;
+    std::vector<std::thread> threads;
+    for (int v = 0; v < VIEWS; v++) {
+        threads.emplace_back([&, v] {
+            std::unique_ptr<vfs::VirtualFS> own = vfs::VirtualFS::view(lower);
+            CHECK(own);
+            vfs::VirtualFS& view = *own;
+            for (int round = 0; round < 50; round++) {
+                CHECK(slurp(view, "/etc/hosts") == hosts);
+                CHECK(slurp(view, "/bin/tool") == tool);
+                CHECK(slurp(view, "/readme.copy") == readme);
+            }
+
+            // Writes stay in this view; a hard link keeps naming one inode
+            std::string mine = "view " + std::to_string(v) + "\n";
+            put(view, "/bin/alias", mine, O_WRONLY);
+            std::string patched = mine + tool.substr(mine.size());
+            CHECK(slurp(view, "/bin/tool") == patched);
+            put(view, "/etc/hosts", mine, O_WRONLY | O_APPEND);
+            CHECK(slurp(view, "/etc/hosts") == hosts + mine);
+            put(view, "/etc/new", mine, O_RDWR | O_CREAT | O_TRUNC);
+            CHECK(slurp(view, "/etc/new") == mine);
+            CHECK(view.unlink("/readme") == 0);
+            CHECK(view.open("/readme", 0) < 0);
+            CHECK(slurp(view, "/readme.copy") == readme);
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    // The lower layer is untouched and was never fetched from again
+    std::unique_ptr<vfs::VirtualFS> fresh_view = vfs::VirtualFS::view(lower);
+    vfs::VirtualFS& fresh = *fresh_view;
+    CHECK(slurp(fresh, "/etc/hosts") == hosts);
+    CHECK(slurp(fresh, "/bin/tool") == tool);
+    CHECK(slurp(fresh, "/bin/alias") == tool);
+    CHECK(slurp(fresh, "/readme") == readme);
+    CHECK(fresh.open("/etc/new", 0) < 0);
+    CHECK(source->fetches == fetched);
+
+    // A view saves the whole tree, walked into or not, and its delta
+    // replays onto another view of the same lower layer
+    std::unique_ptr<vfs::VirtualFS> saver_view = vfs::VirtualFS::view(lower);
+    vfs::VirtualFS& saver = *saver_view;
+    std::vector<uint8_t> image = saver.save_tar();
+    vfs::VirtualFS loaded;
+    CHECK(loaded.load_tar(image.data(), image.size()));
+    CHECK(slurp(loaded, "/etc/hosts") == hosts);
+    CHECK(slurp(loaded, "/bin/tool") == tool);
+    CHECK(slurp(loaded, "/bin/alias") == tool);
+    CHECK(slurp(loaded, "/readme") == readme);
+    uint64_t base = saver.generation();
+    put(saver, "/bin/tool", "patched", O_WRONLY | O_TRUNC);
+    CHECK(saver.unlink("/readme") == 0);
+    std::vector<uint8_t> delta = saver.save_delta(base);
+    std::unique_ptr<vfs::VirtualFS> replay_view = vfs::VirtualFS::view(lower);
+    vfs::VirtualFS& replay = *replay_view;
+    CHECK(replay.apply_delta(delta.data(), delta.size()));
+    CHECK(slurp(replay, "/bin/tool") == "patched");
+    CHECK(slurp(replay, "/bin/alias") == "patched");
+    CHECK(replay.open("/readme", 0) < 0);
+    CHECK(slurp(replay, "/etc/hosts") == hosts);
+
+    // A view needs a sealed lower layer
+    std::shared_ptr<const vfs::VirtualFS> unsealed = std::make_shared<vfs::VirtualFS>();
+    CHECK(!vfs::VirtualFS::view(unsealed));
+
+    printf("vfs_view_test: ok\n");
+    return 0;
+}